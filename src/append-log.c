@@ -0,0 +1,260 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "append-log.h"
+
+struct _append_log {
+  char *path;
+  char *header;
+  int fd;
+  int failed;         /* a write has failed since the last check */
+  int num_lines;      /* in the file, superseded ones included */
+  char *pending;      /* lines not written out yet */
+  size_t pending_len;
+  size_t pending_size;
+};
+
+/**
+ * Hand the whole lines of the file to @read_line.
+ *
+ * @return how many bytes of the file are whole lines
+ */
+static off_t append_log_load(append_log *l, append_log_line_fn read_line,
+    void *arg)
+{
+  FILE *input = fopen(l->path, "r");
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  off_t whole = 0;
+
+  if (input == NULL)
+    return 0;
+
+  while ((len = getline(&line, &line_size, input)) != -1)
+    {
+      if (line[len - 1] != '\n')
+        break;
+      whole += len;
+      l->num_lines ++;
+      line[len - 1] = 0;
+      if (line[0] != '#' && read_line(arg, line) != 0)
+        printf("WARNING: ignoring bad line in %s.\n", l->path);
+    }
+
+  free(line);
+  fclose(input);
+  return whole;
+}
+
+static int
+append_log_write_all(int fd, const char *data, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      n = write(fd, data, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      data += n;
+      len -= n;
+    }
+  return 0;
+}
+
+static void append_log_free(append_log *l)
+{
+  if (l->fd >= 0)
+    close(l->fd);
+  free(l->pending);
+  free(l->header);
+  free(l->path);
+  free(l);
+}
+
+/**
+ * Open the log at @path, creating it with @header if need be, and pass
+ * each line it already has to @read_line.
+ *
+ * @return NULL if it cannot be written
+ */
+append_log *append_log_open(const char *path, const char *header,
+    append_log_line_fn read_line, void *arg)
+{
+  append_log *l = calloc(1, sizeof(append_log));
+  off_t whole;
+  struct stat st;
+
+  l->path = strdup(path);
+  l->header = strdup(header);
+
+  whole = append_log_load(l, read_line, arg);
+
+  /* Cut off a torn last line, or the next one would be glued to it */
+  l->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (l->fd < 0 || fstat(l->fd, &st) != 0
+      || (st.st_size != whole && ftruncate(l->fd, whole) != 0))
+    {
+      printf("WARNING: cannot write %s: %s\n", path, strerror(errno));
+      append_log_free(l);
+      return NULL;
+    }
+
+  if (l->num_lines == 0)
+    {
+      append_log_append(l, header, strlen(header));
+      append_log_end_line(l);
+    }
+  return l;
+}
+
+/**
+ * Replace the file with a header and what @write_live appends.  The lines
+ * are written to a temporary file, which then takes the place of the old
+ * one; what was still pending for the old one is dropped, as @write_live
+ * covers it.
+ */
+static int append_log_compact(append_log *l, append_log_write_fn write_live,
+    void *arg)
+{
+  char *tmp;
+  int fd = l->fd;
+  int result = 0;
+
+  if (asprintf(&tmp, "%s.tmp", l->path) < 0)
+    return -1;
+
+  l->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  l->failed = l->fd < 0;
+  l->pending_len = 0;
+  l->num_lines = 0;
+  if (l->fd >= 0)
+    {
+      append_log_append(l, l->header, strlen(l->header));
+      append_log_end_line(l);
+      write_live(arg);
+      append_log_flush(l);
+    }
+
+  if (l->failed || close(l->fd) != 0 || rename(tmp, l->path) != 0)
+    {
+      printf("WARNING: cannot rewrite %s: %s\n", l->path, strerror(errno));
+      unlink(tmp);
+      result = -1;
+    }
+  l->fd = fd;
+  l->pending_len = 0;
+  free(tmp);
+  return result;
+}
+
+/**
+ * Write out what has been appended, rewriting the file if most of its
+ * lines are superseded, and free the log.  @num_live is how many lines
+ * @write_live would append.
+ */
+void append_log_close(append_log *l, int num_live,
+    append_log_write_fn write_live, void *arg)
+{
+  if (l == NULL)
+    return;
+
+  if (l->num_lines > 2 * num_live + 1024)
+    append_log_compact(l, write_live, arg);
+  else
+    append_log_flush(l);
+  append_log_free(l);
+}
+
+/**
+ * Append the pending lines to the file.
+ *
+ * @return 0 on success
+ */
+int append_log_flush(append_log *l)
+{
+  int result = 0;
+
+  if (l == NULL || l->pending_len == 0)
+    return 0;
+
+  if (append_log_write_all(l->fd, l->pending, l->pending_len) != 0)
+    {
+      l->failed = 1;
+      result = -1;
+    }
+  l->pending_len = 0;
+  return result;
+}
+
+void append_log_append(append_log *l, const char *str, size_t len)
+{
+  if (l->pending_len + len > l->pending_size)
+    {
+      while (l->pending_len + len > l->pending_size)
+        l->pending_size = l->pending_size ? l->pending_size * 2 : 4096;
+      l->pending = realloc(l->pending, l->pending_size);
+    }
+  memcpy(l->pending + l->pending_len, str, len);
+  l->pending_len += len;
+}
+
+/**
+ * Append @str with any newline, or any of the @separators the caller's
+ * lines are split on, blanked out.
+ */
+void append_log_append_text(append_log *l, const char *str,
+    const char *separators)
+{
+  size_t start = l->pending_len;
+  size_t i;
+
+  append_log_append(l, str, strlen(str));
+  for (i = start; i < l->pending_len; i++)
+    if (l->pending[i] == '\n' || strchr(separators, l->pending[i]) != NULL)
+      l->pending[i] = ' ';
+}
+
+/**
+ * Finish the line being appended, and write out the pending ones if
+ * enough have built up.
+ */
+void append_log_end_line(append_log *l)
+{
+  append_log_append(l, "\n", 1);
+  l->num_lines ++;
+  if (l->pending_len >= APPEND_LOG_FLUSH_SIZE)
+    append_log_flush(l);
+}
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef APPEND_LOG_H__
+#define APPEND_LOG_H__
+
+#include <stddef.h>
+
+/**
+ * A file of lines that is only ever appended to, for the caches.  The
+ * last line written for a key supersedes the ones before it, and once
+ * most lines are superseded append_log_close() rewrites the file with
+ * just the live ones, by rename so that a crash leaves the old or the new
+ * file.  Lines are buffered and written out once APPEND_LOG_FLUSH_SIZE
+ * has built up, unsynced: losing the last few only costs a lookup.
+ *
+ * The file starts with a header line; it and other lines starting with
+ * '#' are not handed back when the file is read.  A crash can tear the
+ * last line, so a line without its newline is cut off when the file is
+ * opened.
+ */
+#define APPEND_LOG_FLUSH_SIZE (64 * 1024)
+
+typedef struct _append_log append_log;
+
+/* Called with each line of the file as it is read, newline stripped; it
+ * returns -1 for a line it cannot make sense of, 0 otherwise */
+typedef int (*append_log_line_fn) (void *arg, char *line);
+/* Called to append every live line when the file is rewritten */
+typedef void (*append_log_write_fn) (void *arg);
+
+extern append_log *append_log_open(const char *path, const char *header,
+    append_log_line_fn read_line, void *arg);
+extern void append_log_close(append_log *l, int num_live,
+    append_log_write_fn write_live, void *arg);
+extern int append_log_flush(append_log *l);
+
+extern void append_log_append(append_log *l, const char *str, size_t len);
+extern void append_log_append_text(append_log *l, const char *str,
+    const char *separators);
+extern void append_log_end_line(append_log *l);
+
+#endif // APPEND_LOG_H__
@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Benchmark for the durable_batch backends.
+ *
+ * Writes and commits a synthetic snapshot of small playlist files, 100 to
+ * a folder, once with plain POSIX I/O and once on io_uring, and reports
+ * the time each takes to queue the writes and to commit them.  Run it once
+ * on a disk and once on tmpfs to see what the file system costs.
+ *
+ *   make bench && ./bench-durable DIRECTORY [files]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "durable.h"
+
+#define FILES_PER_FOLDER 100
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A playlist file of 5 to 40 tracks, like most of a real snapshot */
+static size_t make_file(char *buf, size_t size, int n)
+{
+  size_t len = snprintf(buf, size, "{\"playlist_name\": \"Playlist %d\",\n"
+      "\"songs\": [\n", n);
+  int i, num_tracks = 5 + n % 36;
+
+  for (i = 0; i < num_tracks && len < size; i++)
+    len += snprintf(buf + len, size - len, "%s{\"name\": \"Track %d\", "
+        "\"artists\": [\"Artist %d\"], \"album\": \"Album %d\", "
+        "\"duration\": %d, \"link\": \"spotify:track:%022d\"}",
+        i > 0 ? ",\n" : "", i, n % 97, n % 31, 180000 + i, n * 64 + i);
+  len += snprintf(buf + len, size - len, "\n]}\n");
+  return len < size ? len : size - 1;
+}
+
+static void run(const char *label, const char *directory, int num_files,
+    int uring)
+{
+  durable_batch *batch = durable_batch_new();
+  char buf[8192];
+  char *path;
+  double start, queued, committed;
+  size_t bytes = 0;
+  int i;
+
+  if (uring && durable_batch_use_uring(batch) != 0)
+    {
+      printf("%-8s io_uring is not available\n", label);
+      durable_batch_free(batch);
+      return;
+    }
+
+  for (i = 0; i < num_files; i += FILES_PER_FOLDER)
+    {
+      asprintf(&path, "%s/%s/%04d", directory, label, i / FILES_PER_FOLDER);
+      mkdir(path, 0755);
+      free(path);
+    }
+
+  start = now();
+  for (i = 0; i < num_files; i++)
+    {
+      size_t len = make_file(buf, sizeof(buf), i);
+
+      asprintf(&path, "%s/%s/%04d/%03d--Playlist %d.json", directory, label,
+          i / FILES_PER_FOLDER, i % FILES_PER_FOLDER, i);
+      durable_batch_write(batch, path, buf, len);
+      bytes += len;
+      free(path);
+    }
+  queued = now();
+  if (durable_batch_commit(batch) != 0)
+    printf("%-8s commit failed\n", label);
+  committed = now();
+
+  printf("%-8s %6d files  %7.1f MB  write %8.1f ms  commit %8.1f ms  "
+      "%8.0f files/s\n", label, num_files, bytes / (1024.0 * 1024),
+      (queued - start) * 1000, (committed - queued) * 1000,
+      num_files / (committed - start));
+  durable_batch_free(batch);
+}
+
+int main(int argc, char **argv)
+{
+  int num_files = argc > 2 ? atoi(argv[2]) : 20000;
+  char *path;
+
+  if (argc < 2)
+    {
+      fprintf(stderr, "Usage: bench-durable DIRECTORY [files]\n");
+      return 1;
+    }
+
+  mkdir(argv[1], 0755);
+  asprintf(&path, "%s/posix", argv[1]);
+  mkdir(path, 0755);
+  free(path);
+  asprintf(&path, "%s/uring", argv[1]);
+  mkdir(path, 0755);
+  free(path);
+
+  run("posix", argv[1], num_files, 0);
+  run("uring", argv[1], num_files, 1);
+  return 0;
+}
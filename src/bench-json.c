@@ -0,0 +1,199 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Microbenchmark for the snapshot JSON emitter.
+ *
+ * Renders a synthetic playlist of 10k tracks the way save.c does, once
+ * with json.c and once with the asprintf/fprintf approach it replaced,
+ * and reports the throughput of each.
+ *
+ *   make bench && ./bench-json [iterations]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "json.h"
+
+#define NUM_TRACKS 10000
+#define MAX_ARTISTS 4
+
+typedef struct {
+  char name[64];
+  char album[64];
+  char link[64];
+  const char *artists[MAX_ARTISTS];
+  int num_artists;
+  int duration;
+} fake_track;
+
+static char artist_names[16][32];
+
+static void make_tracks(fake_track *tracks)
+{
+  int i, j;
+
+  for (i = 0; i < 16; i++)
+    snprintf(artist_names[i], sizeof(artist_names[i]), "Artist \"%d\" & Friends", i);
+
+  for (i = 0; i < NUM_TRACKS; i++)
+    {
+      fake_track *t = &tracks[i];
+      snprintf(t->name, sizeof(t->name), "Track number %d (Radio Edit)", i);
+      snprintf(t->album, sizeof(t->album), "Album\t%d: The \"Best\" of", i / 12);
+      snprintf(t->link, sizeof(t->link), "spotify:track:%022d", i);
+      t->num_artists = 1 + i % MAX_ARTISTS;
+      for (j = 0; j < t->num_artists; j++)
+        t->artists[j] = artist_names[(i + j) % 16];
+      t->duration = 180000 + i;
+    }
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t render_emitter(json_buffer *b, fake_track *tracks, FILE *output)
+{
+  int i, j;
+
+  json_buffer_reset(b);
+  json_append_raw(b, "{\"playlist_name\": ");
+  json_append_string(b, "Synthetic");
+  json_append_raw(b, ",\n\"songs\": [\n");
+
+  for (i = 0; i < NUM_TRACKS; i++)
+    {
+      if (i > 0)
+        json_append_raw(b, ",\n");
+      json_append_raw(b, "{\"name\": ");
+      json_append_string(b, tracks[i].name);
+      json_append_raw(b, ", \"artists\": [");
+      for (j = 0; j < tracks[i].num_artists; j++)
+        {
+          if (j > 0)
+            json_append_raw(b, ", ");
+          json_append_string(b, tracks[i].artists[j]);
+        }
+      json_append_raw(b, "], \"album\": ");
+      json_append_string(b, tracks[i].album);
+      json_append_raw(b, ", \"duration\": ");
+      json_append_int(b, tracks[i].duration);
+      json_append_raw(b, ", \"link\": ");
+      json_append_string(b, tracks[i].link);
+      json_append_raw(b, "}");
+    }
+  json_append_raw(b, "\n]}\n");
+
+  fwrite(b->data, 1, b->len, output);
+  return b->len;
+}
+
+/* What actually_save_playlist used to do, minus the escaping it lacked */
+static size_t render_asprintf(fake_track *tracks, FILE *output)
+{
+  int i, j;
+  long start = ftell(output);
+
+  setvbuf(output, NULL, _IONBF, 0);
+  fprintf(output, "{\"playlist_name\": \"%s\",\n\"songs\": [\n", "Synthetic");
+
+  for (i = 0; i < NUM_TRACKS; i++)
+    {
+      char *artists_str = NULL;
+
+      for (j = 0; j < tracks[i].num_artists; j++)
+        {
+          char *new_artists_str = NULL;
+          if (asprintf(&new_artists_str, "%s, \"%s\"",
+              artists_str, tracks[i].artists[j]) == -1)
+            break;
+          free(artists_str);
+          artists_str = new_artists_str;
+        }
+
+      fprintf(output, "{\"name\": \"%s\", \"artists\": [%s], \"album\": \"%s\", "
+          "\"duration\": %d, \"link\": \"%s\"},\n",
+          tracks[i].name, artists_str + 8, tracks[i].album,
+          tracks[i].duration, tracks[i].link);
+      free(artists_str);
+    }
+
+  fprintf(output, "]}\n");
+  return ftell(output) - start;
+}
+
+static void report(const char *label, double seconds, size_t bytes, int iterations)
+{
+  printf("%-10s %8.2f ms/playlist  %10.0f tracks/s  %8.1f MB/s\n", label,
+      seconds * 1000 / iterations,
+      (double) NUM_TRACKS * iterations / seconds,
+      bytes / seconds / (1024 * 1024));
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = argc > 1 ? atoi(argv[1]) : 50;
+  fake_track *tracks = calloc(NUM_TRACKS, sizeof(fake_track));
+  FILE *output;
+  json_buffer b;
+  size_t bytes;
+  double start;
+  int i;
+
+  make_tracks(tracks);
+  json_buffer_init(&b, NULL);
+
+  output = tmpfile();
+  bytes = 0;
+  start = now();
+  for (i = 0; i < iterations; i++)
+    {
+      rewind(output);
+      bytes += render_emitter(&b, tracks, output);
+    }
+  report("json.c", now() - start, bytes, iterations);
+  fclose(output);
+
+  output = tmpfile();
+  bytes = 0;
+  start = now();
+  for (i = 0; i < iterations; i++)
+    {
+      rewind(output);
+      bytes += render_asprintf(tracks, output);
+    }
+  report("asprintf", now() - start, bytes, iterations);
+  fclose(output);
+
+  json_buffer_free(&b);
+  free(tracks);
+  return 0;
+}
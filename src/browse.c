@@ -21,12 +21,76 @@
  *
  */
 
+#include <string.h>
+
 #include "git-spot.h"
 #include "cmd.h"
+#include "metadata-cache.h"
+#include "record.h"
+#include "stats.h"
 
-static sp_track *track_browse;
-static sp_playlist *playlist_browse;
-static sp_playlist_callbacks pl_callbacks;
+typedef enum {
+  BROWSE_TRACK,
+  BROWSE_PLAYLIST,
+  BROWSE_ALBUM,
+  BROWSE_ARTIST
+} browse_kind;
+
+typedef struct _browse_request browse_request;
+
+typedef void (*browse_done_fn)(browse_request *req);
+
+/**
+ * A track, playlist, album or artist being resolved.  Any number of them
+ * can be in flight at once: each one is in browse_requests until it is
+ * done, and while there are any, one metadata listener passes each update
+ * on to the ones that wait for metadata.
+ */
+struct _browse_request {
+  browse_kind kind;
+  sp_track *track;
+  sp_playlist *playlist;
+  sp_albumbrowse *album;
+  sp_artistbrowse *artist;
+  sp_error error;
+  int index;          /* in browse_requests */
+  int verbose;        /* print the progress of a playlist */
+  browse_done_fn done;
+  void *userdata;
+
+  /*
+   * The tracks of a playlist that have not loaded yet.  The set is built
+   * once the playlist has loaded and only shrinks after that, so each
+   * metadata update costs as much as there is left to load.
+   */
+  sp_track **pending;
+  int num_pending;    /* -1 until the set is built */
+  int num_tracks;
+  int percent;
+};
+
+static browse_request **browse_requests;
+static int browse_num_requests;
+static int browse_requests_size;
+
+static void browse_metadata_updated(void *unused);
+
+/**
+ * Print a track libspotify has not loaded from what the metadata cache
+ * knows of it
+ */
+static void print_cached_track(const metadata_entry *e, metadata_state state)
+{
+  int i;
+
+  printf("    Track %s [%d:%02d] by ", e->name,
+         e->duration / 60000, (e->duration / 1000) % 60);
+  for (i = 0; i < e->num_artists; i++)
+    printf("%s%s", i ? ", " : "", e->artists[i]);
+  printf(", %d%% popularity (%s from cache)\n", e->popularity,
+         state == METADATA_FRESH ? "fresh" : "stale");
+  printf("\t\t%s\n", e->uri);
+}
 
 /**
  * Print the given track title together with some trivial metadata
@@ -38,6 +102,22 @@ void print_track(sp_track *track)
   int duration = sp_track_duration(track);
   char url[256];
   sp_link *l;
+  const metadata_entry *cached;
+  metadata_state state;
+
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("track");
+    record_track(track);
+    record_end();
+    return;
+  }
+
+  if (!sp_track_is_loaded(track)
+      && (cached = metadata_cache_track(g_metadata_cache, track, &state))) {
+    print_cached_track(cached, state);
+    return;
+  }
+  metadata_cache_store_track(g_metadata_cache, track);
 
 #if WIN32
   printf(" %s ", sp_track_is_starred(g_session,track) ? "*" : " ");
@@ -72,6 +152,22 @@ static void print_albumbrowse(sp_albumbrowse *browse)
 {
   int i;
 
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("album");
+    record_album(sp_albumbrowse_album(browse));
+    record_int("tracks", sp_albumbrowse_num_tracks(browse));
+    record_list_begin("copyrights");
+    for (i = 0; i < sp_albumbrowse_num_copyrights(browse); ++i)
+      record_list_string(sp_albumbrowse_copyright(browse, i));
+    record_list_end();
+    record_string("review", sp_albumbrowse_review(browse));
+    record_end();
+
+    for (i = 0; i < sp_albumbrowse_num_tracks(browse); ++i)
+      print_track(sp_albumbrowse_track(browse, i));
+    return;
+  }
+
   printf("Album browse of \"%s\" (%d)\n", 
          sp_album_name(sp_albumbrowse_album(browse)), 
          sp_album_year(sp_albumbrowse_album(browse)));
@@ -98,6 +194,23 @@ static void print_artistbrowse(sp_artistbrowse *browse)
 {
   int i;
 
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("artist");
+    record_artist(sp_artistbrowse_artist(browse));
+    record_int("tracks", sp_artistbrowse_num_tracks(browse));
+    record_int("portraits", sp_artistbrowse_num_portraits(browse));
+    record_list_begin("similar_artists");
+    for (i = 0; i < sp_artistbrowse_num_similar_artists(browse); ++i)
+      record_list_string(sp_artist_name(sp_artistbrowse_similar_artist(browse, i)));
+    record_list_end();
+    record_string("biography", sp_artistbrowse_biography(browse));
+    record_end();
+
+    for (i = 0; i < sp_artistbrowse_num_tracks(browse); ++i)
+      print_track(sp_artistbrowse_track(browse, i));
+    return;
+  }
+
   printf("Artist browse of \"%s\"\n", sp_artist_name(sp_artistbrowse_artist(browse)));
 
   for (i = 0; i < sp_artistbrowse_num_similar_artists(browse); ++i)
@@ -116,22 +229,317 @@ static void print_artistbrowse(sp_artistbrowse *browse)
 
 
 
+
+
+static browse_request *browse_request_new(browse_kind kind,
+                                          browse_done_fn done, void *userdata)
+{
+  browse_request *req = calloc(1, sizeof(browse_request));
+
+  req->kind = kind;
+  req->error = SP_ERROR_OK;
+  req->done = done;
+  req->userdata = userdata;
+  req->num_pending = -1;
+
+  if (browse_num_requests == browse_requests_size) {
+    browse_requests_size = browse_requests_size ? browse_requests_size * 2 : 16;
+    browse_requests = realloc(browse_requests,
+                              browse_requests_size * sizeof(browse_request *));
+  }
+  if (browse_num_requests == 0)
+    metadata_listener_add(browse_metadata_updated, NULL);
+  req->index = browse_num_requests;
+  browse_requests[browse_num_requests++] = req;
+  return req;
+}
+
+static void browse_pending_reset(browse_request *req)
+{
+  int i;
+
+  for (i = 0; i < req->num_pending; i++)
+    sp_track_release(req->pending[i]);
+  free(req->pending);
+  req->pending = NULL;
+  req->num_pending = -1;
+}
+
+static sp_playlist_callbacks pl_callbacks;
+
+/**
+ * Take @req out of the table, hand it to its done function and free it.
+ */
+static void browse_request_finish(browse_request *req)
+{
+  browse_requests[req->index] = browse_requests[--browse_num_requests];
+  browse_requests[req->index]->index = req->index;
+  if (browse_num_requests == 0)
+    metadata_listener_remove(browse_metadata_updated, NULL);
+
+  req->done(req);
+
+  browse_pending_reset(req);
+  if (req->track)
+    sp_track_release(req->track);
+  if (req->playlist) {
+    sp_playlist_remove_callbacks(req->playlist, &pl_callbacks, req);
+    sp_playlist_release(req->playlist);
+  }
+  if (req->album)
+    sp_albumbrowse_release(req->album);
+  if (req->artist)
+    sp_artistbrowse_release(req->artist);
+  free(req);
+}
+
+/**
+ * The done function of the browse command: print whatever was found.
+ */
+static void browse_print(browse_request *req)
+{
+  int i, tracks;
+
+  switch (req->kind) {
+  case BROWSE_TRACK:
+    if (req->error == SP_ERROR_OK)
+      print_track(req->track);
+    else
+      fprintf(stderr, "Unable to resolve track: %s\n", sp_error_message(req->error));
+    break;
+
+  case BROWSE_PLAYLIST:
+    tracks = sp_playlist_num_tracks(req->playlist);
+    if (g_output_format == OUTPUT_NDJSON) {
+      record_begin("playlist");
+      record_playlist(req->playlist);
+      record_end();
+
+      for(i = 0; i < tracks; i++) {
+        record_begin("track");
+        record_int("position", i + 1);
+        record_track(sp_playlist_track(req->playlist, i));
+        record_end();
+      }
+      break;
+    }
+
+    printf("\tPlaylist and metadata loaded\n");
+    for(i = 0; i < tracks; i++) {
+      sp_track *t = sp_playlist_track(req->playlist, i);
+
+      printf(" %5d: ", i + 1);
+      print_track(t);
+    }
+    break;
+
+  case BROWSE_ALBUM:
+    if (req->error == SP_ERROR_OK)
+      print_albumbrowse(req->album);
+    else
+      fprintf(stderr, "Failed to browse album: %s\n", sp_error_message(req->error));
+    break;
+
+  case BROWSE_ARTIST:
+    if (req->error == SP_ERROR_OK)
+      print_artistbrowse(req->artist);
+    else
+      fprintf(stderr, "Failed to browse artist: %s\n", sp_error_message(req->error));
+    break;
+  }
+
+  cmd_done();
+}
+
+/*
+ * Speculative prefetch.  With a budget (browse --prefetch N), a finished
+ * album browse starts artist browses for the artists of the album in the
+ * background, and a finished artist browse does the same for its similar
+ * artists, on the bet that those are browsed next.  At most N prefetched
+ * artist browses are kept, in flight or done; once the budget is used up,
+ * the oldest one that is done and was never asked for makes room.
+ *
+ * An artist browse that finds its artist prefetched is a hit and is
+ * answered from the prefetch, any other artist browse is a miss.
+ */
+typedef struct {
+  sp_artist *artist;
+  sp_artistbrowse *browse;    /* NULL while in flight */
+  browse_request *waiting;    /* an artist browse asked for it meanwhile */
+} prefetch_entry;
+
+static prefetch_entry **prefetched;   /* oldest first */
+static int num_prefetched;
+static int prefetched_size;
+#define PREFETCH_BUDGET 0
+
+static int prefetch_budget = PREFETCH_BUDGET;
+static int prefetch_issued;
+static int prefetch_hits;
+static int prefetch_misses;
+static int prefetch_wasted;           /* dropped without being asked for */
+
+static void browse_prefetch_similar(sp_artistbrowse *browse);
+
+static int prefetch_find(sp_artist *artist)
+{
+  int i;
+
+  for (i = 0; i < num_prefetched; i++)
+    if (prefetched[i]->artist == artist)
+      return i;
+  return -1;
+}
+
+static void prefetch_remove(int i)
+{
+  memmove(prefetched + i, prefetched + i + 1,
+          (num_prefetched - i - 1) * sizeof(prefetch_entry *));
+  num_prefetched--;
+}
+
+/* Answer @req with the prefetched browse of @e, which is taken out already */
+static void prefetch_deliver(prefetch_entry *e, browse_request *req)
+{
+  req->artist = e->browse;
+  req->error = sp_artistbrowse_error(e->browse);
+  sp_artist_release(e->artist);
+  free(e);
+
+  if (req->error == SP_ERROR_OK)
+    browse_prefetch_similar(req->artist);
+  browse_request_finish(req);
+}
+
+static void prefetch_callback(sp_artistbrowse *browse, void *userdata)
+{
+  prefetch_entry *e = userdata;
+
+  e->browse = browse;
+  if (e->waiting != NULL) {
+    prefetch_remove(prefetch_find(e->artist));
+    prefetch_deliver(e, e->waiting);
+  }
+}
+
+static void prefetch_artist(sp_artist *artist)
+{
+  prefetch_entry *e;
+  int i;
+
+  if (artist == NULL || prefetch_find(artist) >= 0)
+    return;
+
+  if (num_prefetched >= prefetch_budget) {
+    for (i = 0; i < num_prefetched && prefetched[i]->browse == NULL; i++)
+      ;
+    if (i == num_prefetched)
+      return;   // All of the budget is still in flight
+
+    e = prefetched[i];
+    prefetch_remove(i);
+    sp_artistbrowse_release(e->browse);
+    sp_artist_release(e->artist);
+    free(e);
+    prefetch_wasted++;
+  }
+
+  if (num_prefetched == prefetched_size) {
+    prefetched_size = prefetched_size ? prefetched_size * 2 : 16;
+    prefetched = realloc(prefetched, prefetched_size * sizeof(prefetch_entry *));
+  }
+  e = calloc(1, sizeof(prefetch_entry));
+  e->artist = artist;
+  sp_artist_add_ref(artist);
+  prefetched[num_prefetched++] = e;
+  prefetch_issued++;
+  sp_artistbrowse_create(g_session, artist, prefetch_callback, e);
+}
+
+static void browse_prefetch_album(sp_albumbrowse *browse)
+{
+  int i, j;
+
+  if (prefetch_budget <= 0)
+    return;
+
+  prefetch_artist(sp_albumbrowse_artist(browse));
+  for (i = 0; i < sp_albumbrowse_num_tracks(browse); i++) {
+    sp_track *t = sp_albumbrowse_track(browse, i);
+
+    for (j = 0; j < sp_track_num_artists(t); j++)
+      prefetch_artist(sp_track_artist(t, j));
+  }
+}
+
+static void browse_prefetch_similar(sp_artistbrowse *browse)
+{
+  int i;
+
+  if (prefetch_budget <= 0)
+    return;
+
+  for (i = 0; i < sp_artistbrowse_num_similar_artists(browse); i++)
+    prefetch_artist(sp_artistbrowse_similar_artist(browse, i));
+}
+
+/**
+ * Answer the artist browse @req from a prefetch of @artist if there is
+ * one, now or once the prefetch is done.
+ *
+ * @return 1 if it will be, 0 if it has to be browsed as usual
+ */
+static int browse_prefetched(browse_request *req, sp_artist *artist)
+{
+  int i;
+
+  if (prefetch_budget <= 0)
+    return 0;
+
+  i = prefetch_find(artist);
+  if (i < 0 || prefetched[i]->waiting != NULL) {
+    prefetch_misses++;
+    return 0;
+  }
+
+  prefetch_hits++;
+  if (prefetched[i]->browse == NULL) {
+    prefetched[i]->waiting = req;
+  } else {
+    prefetch_entry *e = prefetched[i];
+
+    prefetch_remove(i);
+    prefetch_deliver(e, req);
+  }
+  return 1;
+}
+
+static void prefetch_print_stats(void)
+{
+  int lookups = prefetch_hits + prefetch_misses;
+
+  fprintf(stderr, "Prefetch: %d issued, %d hits, %d misses (%d%% hit rate), "
+                  "%d dropped unused, %d held.\n",
+          prefetch_issued, prefetch_hits, prefetch_misses,
+          lookups > 0 ? 100 * prefetch_hits / lookups : 0,
+          prefetch_wasted, num_prefetched);
+}
+
 /**
  * Callback for libspotify
  *
  * @param browse    The browse result object that is now done
- * @param userdata  The opaque pointer given to sp_albumbrowse_create()
+ * @param userdata  The request given to sp_albumbrowse_create()
  */
 static void browse_album_callback(sp_albumbrowse *browse, void *userdata)
 {
-  if (sp_albumbrowse_error(browse) == SP_ERROR_OK)
-    print_albumbrowse(browse);
-  else
-    fprintf(stderr, "Failed to browse album: %s\n",
-            sp_error_message(sp_albumbrowse_error(browse)));
+  browse_request *req = userdata;
 
-  sp_albumbrowse_release(browse);
-  cmd_done();
+  req->album = browse;
+  req->error = sp_albumbrowse_error(browse);
+  if (req->error == SP_ERROR_OK)
+    browse_prefetch_album(browse);
+  browse_request_finish(req);
 }
 
 
@@ -139,18 +547,17 @@ static void browse_album_callback(sp_albumbrowse *browse, void *userdata)
  * Callback for libspotify
  *
  * @param browse    The browse result object that is now done
- * @param userdata  The opaque pointer given to sp_artistbrowse_create()
+ * @param userdata  The request given to sp_artistbrowse_create()
  */
 static void browse_artist_callback(sp_artistbrowse *browse, void *userdata)
 {
-  if (sp_artistbrowse_error(browse) == SP_ERROR_OK)
-    print_artistbrowse(browse);
-  else
-    fprintf(stderr, "Failed to browse artist: %s\n",
-            sp_error_message(sp_artistbrowse_error(browse)));
+  browse_request *req = userdata;
 
-  sp_artistbrowse_release(browse);
-  cmd_done();
+  req->artist = browse;
+  req->error = sp_artistbrowse_error(browse);
+  if (req->error == SP_ERROR_OK)
+    browse_prefetch_similar(browse);
+  browse_request_finish(req);
 }
 
 
@@ -158,62 +565,111 @@ static void browse_artist_callback(sp_artistbrowse *browse, void *userdata)
 /**
  *
  */
-static void track_browse_try(void)
+static void track_browse_try(browse_request *req)
 {
-  switch (sp_track_error(track_browse)) {
+  switch (sp_track_error(req->track)) {
   case SP_ERROR_OK:
-    print_track(track_browse);
     break;
 
   case SP_ERROR_IS_LOADING:
     return; // Still pending
 
   default:
-    fprintf(stderr, "Unable to resolve track: %s\n", sp_error_message(sp_track_error(track_browse)));
+    req->error = sp_track_error(req->track);
     break;
   }
-  
-  metadata_updated_fn = NULL;
-  cmd_done();
-  sp_track_release(track_browse);
+
+  browse_request_finish(req);
 }
 
 
 
+static void browse_pending_build(browse_request *req)
+{
+  int i;
+
+  req->num_tracks = sp_playlist_num_tracks(req->playlist);
+  req->pending = malloc((req->num_tracks + 1) * sizeof(sp_track *));
+  req->num_pending = 0;
+  req->percent = -1;
+
+  for(i = 0; i < req->num_tracks; i++) {
+    sp_track *t = sp_playlist_track(req->playlist, i);
+    metadata_state state;
+
+    if (sp_track_is_loaded(t))
+      continue;
+
+    // Tracks the cache has fresh metadata for are printed from there
+    metadata_cache_track(g_metadata_cache, t, &state);
+    if (state != METADATA_FRESH) {
+      sp_track_add_ref(t);
+      req->pending[req->num_pending++] = t;
+    }
+  }
+}
+
 /**
- *
+ * Drop the tracks that have loaded since the last update from the set.
  */
-static void playlist_browse_try(void)
+static void browse_pending_update(browse_request *req)
 {
-  int i, tracks;
+  int i = 0;
+  int percent;
 
-  metadata_updated_fn = playlist_browse_try;
-  if(!sp_playlist_is_loaded(playlist_browse)) {
-    printf("\tPlaylist not loaded\n");
-    return;
+  while (i < req->num_pending) {
+    if (sp_track_is_loaded(req->pending[i])) {
+      sp_track_release(req->pending[i]);
+      req->pending[i] = req->pending[--req->num_pending];
+    } else {
+      i++;
+    }
   }
 
-  tracks = sp_playlist_num_tracks(playlist_browse);
-  for(i = 0; i < tracks; i++) {
-    sp_track *t = sp_playlist_track(playlist_browse, i);
-    if (!sp_track_is_loaded(t))
-      return;
+  percent = req->num_tracks > 0
+    ? 100 * (req->num_tracks - req->num_pending) / req->num_tracks : 100;
+  if (req->verbose && percent != req->percent && req->num_pending > 0)
+    printf("\tLoaded %d%% of %d tracks\n", percent, req->num_tracks);
+  req->percent = percent;
+}
+
+/**
+ *
+ */
+static void playlist_browse_try(browse_request *req)
+{
+  if(!sp_playlist_is_loaded(req->playlist)) {
+    if (req->verbose)
+      printf("\tPlaylist not loaded\n");
+    return;
   }
 
-  printf("\tPlaylist and metadata loaded\n");
+  if (req->num_pending < 0)
+    browse_pending_build(req);
+  browse_pending_update(req);
+  if (req->num_pending > 0)
+    return;
 
-  for(i = 0; i < tracks; i++) {
-    sp_track *t = sp_playlist_track(playlist_browse, i);
-    
-    printf(" %5d: ", i + 1);
-    print_track(t);
-  }
-  sp_playlist_remove_callbacks(playlist_browse, &pl_callbacks, NULL);
+  browse_request_finish(req);
+}
 
-  sp_playlist_release(playlist_browse);
-  playlist_browse = NULL;
-  metadata_updated_fn = NULL;
-  cmd_done();
+/**
+ * Pass a metadata update on to every request that waits for one.  A
+ * request that finishes swaps the last one into its slot, which has been
+ * seen already; requests started meanwhile wait for the next update.
+ */
+static void browse_metadata_updated(void *unused)
+{
+  int i;
+
+  for (i = browse_num_requests - 1; i >= 0; i--) {
+    if (i >= browse_num_requests)
+      continue;
+    if (browse_requests[i]->kind == BROWSE_TRACK)
+      track_browse_try(browse_requests[i]);
+    else if (browse_requests[i]->kind == BROWSE_PLAYLIST)
+      playlist_browse_try(browse_requests[i]);
+  }
 }
 
 /**
@@ -222,7 +678,11 @@ static void playlist_browse_try(void)
 static void pl_tracks_added(sp_playlist *pl, sp_track * const * tracks,
           int num_tracks, int position, void *userdata)
 {
-  printf("\t%d tracks added\n", num_tracks);
+  browse_request *req = userdata;
+
+  if (req->verbose)
+    printf("\t%d tracks added\n", num_tracks);
+  browse_pending_reset(req);
 }
 
 /**
@@ -231,7 +691,11 @@ static void pl_tracks_added(sp_playlist *pl, sp_track * const * tracks,
 static void pl_tracks_removed(sp_playlist *pl, const int *tracks,
             int num_tracks, void *userdata)
 {
-  printf("\t%d tracks removed\n", num_tracks);
+  browse_request *req = userdata;
+
+  if (req->verbose)
+    printf("\t%d tracks removed\n", num_tracks);
+  browse_pending_reset(req);
 }
 
 /**
@@ -240,7 +704,10 @@ static void pl_tracks_removed(sp_playlist *pl, const int *tracks,
 static void pl_tracks_moved(sp_playlist *pl, const int *tracks,
           int num_tracks, int new_position, void *userdata)
 {
-  printf("\t%d tracks moved\n", num_tracks);
+  browse_request *req = userdata;
+
+  if (req->verbose)
+    printf("\t%d tracks moved\n", num_tracks);
 }
 
 /**
@@ -248,7 +715,10 @@ static void pl_tracks_moved(sp_playlist *pl, const int *tracks,
  */
 static void pl_renamed(sp_playlist *pl, void *userdata)
 {
-  printf("\tList name: %s\n",  sp_playlist_name(pl));
+  browse_request *req = userdata;
+
+  if (req->verbose)
+    printf("\tList name: %s\n",  sp_playlist_name(pl));
 }
 
 /**
@@ -256,7 +726,7 @@ static void pl_renamed(sp_playlist *pl, void *userdata)
  */
 static void pl_state_change(sp_playlist *pl, void *userdata)
 {
-  playlist_browse_try();
+  playlist_browse_try(userdata);
 }
 
 static sp_playlist_callbacks pl_callbacks = {
@@ -268,11 +738,275 @@ static sp_playlist_callbacks pl_callbacks = {
 };
 
 
+static void browse_playlist_request(sp_playlist *pl, browse_done_fn done,
+                                    void *userdata, int verbose)
+{
+  browse_request *req = browse_request_new(BROWSE_PLAYLIST, done, userdata);
+
+  req->playlist = pl;
+  req->verbose = verbose;
+  sp_playlist_add_callbacks(pl, &pl_callbacks, req);
+  playlist_browse_try(req);
+}
+
 void browse_playlist(sp_playlist *pl)
 {
-  playlist_browse = pl;
-  sp_playlist_add_callbacks(playlist_browse, &pl_callbacks, NULL);
-  playlist_browse_try();
+  browse_playlist_request(pl, browse_print, NULL,
+                          g_output_format == OUTPUT_TEXT);
+}
+
+static void browse_revalidated(browse_request *req)
+{
+  if (req->error == SP_ERROR_OK)
+    metadata_cache_store_track(g_metadata_cache, req->track);
+}
+
+/**
+ * Load @track in the background, only to update the metadata cache.
+ */
+static void browse_revalidate(sp_track *track)
+{
+  browse_request *req = browse_request_new(BROWSE_TRACK, browse_revalidated,
+                                           NULL);
+
+  req->track = track;
+  sp_track_add_ref(track);
+  track_browse_try(req);
+}
+
+/**
+ * Start resolving @link.  @done is called with the request once it is
+ * resolved or has failed, possibly before this returns.
+ *
+ * @return 0, or -1 if @link is of a kind that cannot be browsed
+ */
+static int browse_start(sp_link *link, browse_done_fn done, void *userdata,
+                        int verbose)
+{
+  browse_request *req;
+  metadata_state state;
+
+  switch(sp_link_type(link)) {
+  default:
+    return -1;
+
+  case SP_LINKTYPE_ALBUM:
+    req = browse_request_new(BROWSE_ALBUM, done, userdata);
+    sp_albumbrowse_create(g_session, sp_link_as_album(link), browse_album_callback, req);
+    break;
+
+  case SP_LINKTYPE_ARTIST:
+    req = browse_request_new(BROWSE_ARTIST, done, userdata);
+    if (browse_prefetched(req, sp_link_as_artist(link)))
+      break;
+    sp_artistbrowse_create(g_session, sp_link_as_artist(link), browse_artist_callback, req);
+    break;
+
+  case SP_LINKTYPE_LOCALTRACK:
+  case SP_LINKTYPE_TRACK:
+    req = browse_request_new(BROWSE_TRACK, done, userdata);
+    req->track = sp_link_as_track(link);
+    sp_track_add_ref(req->track);
+    if (!sp_track_is_loaded(req->track)
+        && metadata_cache_track(g_metadata_cache, req->track, &state)) {
+      // Answer from the cache now, and refresh a stale entry behind it
+      if (state == METADATA_STALE)
+        browse_revalidate(req->track);
+      browse_request_finish(req);
+      break;
+    }
+    track_browse_try(req);
+    break;
+
+  case SP_LINKTYPE_PLAYLIST:
+    browse_playlist_request(sp_playlist_create(g_session, link), done,
+                            userdata, verbose);
+    break;
+  }
+
+  return 0;
+}
+
+/*
+ * browse --batch: resolve the URIs read from a file or stdin, one per
+ * line, with up to batch_window of them in flight at a time.  Each result
+ * is printed as one line of JSON as soon as it is in, so the output is in
+ * completion order rather than input order.
+ */
+typedef struct {
+  char *uri;
+  double started;     /* stats_now() */
+} batch_item;
+
+static FILE *batch_input;
+#define BATCH_WINDOW 16
+
+static int batch_window = BATCH_WINDOW;
+static int batch_in_flight;
+static int batch_pumping;
+static int batch_eof;
+static int batch_resolved;
+static int batch_failed;
+static double batch_started;
+
+static const char *kind_names[] = {
+  "track",
+  "playlist",
+  "album",
+  "artist"
+};
+
+static void batch_emit(browse_request *req, batch_item *item)
+{
+  record_begin(kind_names[req->kind]);
+  record_string("input", item->uri);
+  record_double("latency_ms", (stats_now() - item->started) * 1000);
+
+  if (req->error != SP_ERROR_OK) {
+    record_string("error", sp_error_message(req->error));
+    record_end();
+    return;
+  }
+
+  switch (req->kind) {
+  case BROWSE_TRACK:
+    record_track(req->track);
+    break;
+
+  case BROWSE_PLAYLIST:
+    record_playlist(req->playlist);
+    break;
+
+  case BROWSE_ALBUM:
+    record_album(sp_albumbrowse_album(req->album));
+    record_int("tracks", sp_albumbrowse_num_tracks(req->album));
+    break;
+
+  case BROWSE_ARTIST:
+    record_artist(sp_artistbrowse_artist(req->artist));
+    record_int("tracks", sp_artistbrowse_num_tracks(req->artist));
+    break;
+  }
+  record_end();
+}
+
+/* An input line that could not even be looked up */
+static void batch_emit_invalid(const char *uri, const char *error)
+{
+  record_begin("error");
+  record_string("input", uri);
+  record_string("error", error);
+  record_end();
+  batch_failed++;
+}
+
+static void batch_pump(void);
+
+static void batch_done(browse_request *req)
+{
+  batch_item *item = req->userdata;
+
+  batch_emit(req, item);
+  if (req->error == SP_ERROR_OK)
+    batch_resolved++;
+  else
+    batch_failed++;
+
+  free(item->uri);
+  free(item);
+  batch_in_flight--;
+  batch_pump();
+}
+
+static void batch_finish(void)
+{
+  double elapsed = stats_now() - batch_started;
+
+  if (batch_input != stdin)
+    fclose(batch_input);
+  batch_input = NULL;
+
+  fprintf(stderr, "Resolved %d URIs in %.1f s (%.1f per second), %d failed.\n",
+          batch_resolved, elapsed,
+          elapsed > 0 ? batch_resolved / elapsed : 0, batch_failed);
+  if (prefetch_budget > 0)
+    prefetch_print_stats();
+  cmd_done();
+}
+
+/**
+ * Read and start URIs until the window is full.  Requests that resolve
+ * straight away call back into here, so only the outermost call reads.
+ */
+static void batch_pump(void)
+{
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+
+  if (batch_pumping)
+    return;
+
+  batch_pumping = 1;
+  while (!batch_eof && (batch_window <= 0 || batch_in_flight < batch_window)) {
+    sp_link *link;
+    batch_item *item;
+
+    if ((len = getline(&line, &line_size, batch_input)) == -1) {
+      batch_eof = 1;
+      break;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'
+                       || line[len - 1] == ' ' || line[len - 1] == '\t'))
+      line[--len] = 0;
+    if (len == 0 || line[0] == '#')
+      continue;
+
+    link = sp_link_create_from_string(line);
+    if (!link) {
+      batch_emit_invalid(line, "Not a spotify link");
+      continue;
+    }
+
+    item = malloc(sizeof(batch_item));
+    item->uri = strdup(line);
+    item->started = stats_now();
+    batch_in_flight++;
+    if (browse_start(link, batch_done, item, 0) != 0) {
+      batch_in_flight--;
+      batch_emit_invalid(line, "Can not handle link");
+      free(item->uri);
+      free(item);
+    }
+    sp_link_release(link);
+  }
+  batch_pumping = 0;
+  free(line);
+
+  if (batch_eof && batch_in_flight == 0 && batch_input != NULL)
+    batch_finish();
+}
+
+static int browse_batch(const char *path)
+{
+  if (batch_input != NULL) {
+    fprintf(stderr, "A batch is running already\n");
+    return -1;
+  }
+
+  batch_input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!batch_input) {
+    fprintf(stderr, "Can not open %s\n", path);
+    return -1;
+  }
+
+  batch_eof = 0;
+  batch_in_flight = 0;
+  batch_resolved = 0;
+  batch_failed = 0;
+  batch_started = stats_now();
+  batch_pump();
+  return 0;
 }
 
 /**
@@ -280,7 +1014,9 @@ void browse_playlist(sp_playlist *pl)
  */
 static void browse_usage(void)
 {
-  fprintf(stderr, "Usage: browse <spotify-uri>\n");
+  fprintf(stderr, "Usage: browse [--prefetch N] <spotify-uri>\n"
+                  "       browse [--prefetch N] --batch FILE|- [--window N]\n"
+                  "       browse --prefetch-stats\n");
 }
 
 
@@ -290,45 +1026,51 @@ static void browse_usage(void)
 int cmd_browse(int argc, char **argv)
 {
   sp_link *link;
+  const char *batch = NULL;
+  int i;
+
+  if (argc == 2 && strcmp(argv[1], "--prefetch-stats") == 0) {
+    prefetch_print_stats();
+    return 1;
+  }
 
-  if (argc != 2) {
+  /* Options only last for one command, unless a batch still uses them */
+  if (batch_input == NULL) {
+    batch_window = BATCH_WINDOW;
+    prefetch_budget = PREFETCH_BUDGET;
+  }
+
+  for (i = 1; i < argc - 1; i++) {
+    if (strcmp(argv[i], "--batch") == 0)
+      batch = argv[++i];
+    else if (strcmp(argv[i], "--window") == 0)
+      batch_window = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--prefetch") == 0)
+      prefetch_budget = atoi(argv[++i]);
+    else
+      break;
+  }
+  if (batch != NULL && i == argc)
+    return browse_batch(batch);
+
+  if (batch != NULL || i != argc - 1) {
     browse_usage();
     return -1;
   }
 
   
-  link = sp_link_create_from_string(argv[1]);
+  link = sp_link_create_from_string(argv[i]);
   
   if (!link) {
     fprintf(stderr, "Not a spotify link\n");
     return -1;
   }
 
-  switch(sp_link_type(link)) {
-  default:
+  if (browse_start(link, browse_print, NULL,
+                   g_output_format == OUTPUT_TEXT) != 0) {
     fprintf(stderr, "Can not handle link");
     sp_link_release(link);
     return -1;
-
-  case SP_LINKTYPE_ALBUM:
-    sp_albumbrowse_create(g_session, sp_link_as_album(link), browse_album_callback, NULL);
-    break;
-
-  case SP_LINKTYPE_ARTIST:
-    sp_artistbrowse_create(g_session, sp_link_as_artist(link), browse_artist_callback, NULL);
-    break;
-
-  case SP_LINKTYPE_LOCALTRACK:
-  case SP_LINKTYPE_TRACK:
-    track_browse = sp_link_as_track(link);
-    metadata_updated_fn = track_browse_try;
-    sp_track_add_ref(track_browse);
-    track_browse_try();
-    break;
-
-  case SP_LINKTYPE_PLAYLIST:
-    browse_playlist(sp_playlist_create(g_session, link));
-    break;
   }
 
   sp_link_release(link);
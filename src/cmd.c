@@ -54,6 +54,7 @@ struct {
   { "save",       cmd_save,       "Save playlist hierarchy to filesystem" },
   { "save_social",cmd_save_social,"Save all friends' playlists to disk." },
   { "load",       cmd_load,       "Load playlist hierarchy from filesystem" },
+  { "snapshot",   cmd_snapshot,   "List a binary snapshot saved with save --binary" },
   { "playlists",  cmd_playlists,  "List playlists" },
   { "playlist",   cmd_playlist,   "List playlist contents" },
   { "set_autolink", cmd_set_autolink, "Set autolinking state" },
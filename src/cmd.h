@@ -48,6 +48,7 @@ extern int cmd_friends(int argc, char **argv);
 extern int cmd_save(int argc, char **argv);
 extern int cmd_save_social(int argc, char **argv);
 extern int cmd_load(int argc, char **argv);
+extern int cmd_snapshot(int argc, char **argv);
 
 extern int cmd_playlists(int argc, char **argv);
 extern int cmd_playlist(int argc, char **argv);
@@ -0,0 +1,259 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "manifest.h"
+
+/*
+ * Interning: the diff compares ints, not strings
+ */
+
+typedef struct {
+  const char **strings;
+  int *slots;         /* id + 1 */
+  unsigned int num_slots;
+  int num_ids;
+} id_table;
+
+static int
+intern(id_table *t, const char *str)
+{
+  unsigned int i = (unsigned int) manifest_hash(str, strlen(str)) & (t->num_slots - 1);
+
+  while (t->slots[i] != 0)
+    {
+      if (strcmp(t->strings[t->slots[i] - 1], str) == 0)
+        return t->slots[i] - 1;
+      i = (i + 1) & (t->num_slots - 1);
+    }
+  t->strings[t->num_ids] = str;
+  t->slots[i] = ++t->num_ids;
+  return t->num_ids - 1;
+}
+
+/*
+ * Linear space Myers
+ */
+
+typedef struct {
+  const int *a;
+  const int *b;
+  int *vf;            /* furthest x on each diagonal, forwards */
+  int *vb;            /* and backwards, from the ends */
+  int offset;
+  diff_result *d;
+} lcs_context;
+
+static void
+match(lcs_context *c, int x, int y)
+{
+  c->d->old_to_new[x] = y;
+  c->d->new_to_old[y] = x;
+}
+
+/**
+ * Find the middle snake of a[0..n) against b[0..m), from (*x, *y) to
+ * (*u, *v) in their coordinates.
+ */
+static void
+middle_snake(lcs_context *c, const int *a, int n, const int *b, int m,
+    int *x_out, int *y_out, int *u_out, int *v_out)
+{
+  int *vf = c->vf + c->offset;
+  int *vb = c->vb + c->offset;
+  int max = (n + m + 1) / 2;
+  int delta = n - m;
+  int odd = delta & 1;
+  int d, k, x, y, sx;
+
+  vf[1] = 0;
+  vb[1] = 0;
+  for (d = 0; d <= max; d++)
+    {
+      for (k = -d; k <= d; k += 2)
+        {
+          if (k == -d || (k != d && vf[k - 1] < vf[k + 1]))
+            x = vf[k + 1];
+          else
+            x = vf[k - 1] + 1;
+          y = x - k;
+          sx = x;
+          while (x < n && y < m && a[x] == b[y])
+            x++, y++;
+          vf[k] = x;
+          if (odd && delta - k >= -(d - 1) && delta - k <= d - 1
+              && vf[k] + vb[delta - k] >= n)
+            {
+              *x_out = sx;
+              *y_out = sx - k;
+              *u_out = x;
+              *v_out = y;
+              return;
+            }
+        }
+
+      for (k = -d; k <= d; k += 2)
+        {
+          if (k == -d || (k != d && vb[k - 1] < vb[k + 1]))
+            x = vb[k + 1];
+          else
+            x = vb[k - 1] + 1;
+          y = x - k;
+          sx = x;
+          while (x < n && y < m && a[n - x - 1] == b[m - y - 1])
+            x++, y++;
+          vb[k] = x;
+          if (!odd && delta - k >= -d && delta - k <= d
+              && vb[k] + vf[delta - k] >= n)
+            {
+              *x_out = n - x;
+              *y_out = m - y;
+              *u_out = n - sx;
+              *v_out = m - (sx - k);
+              return;
+            }
+        }
+    }
+
+  /* Not reached for n + m > 0 */
+  *x_out = *u_out = n;
+  *y_out = *v_out = m;
+}
+
+static void
+lcs(lcs_context *c, int a_lo, int a_hi, int b_lo, int b_hi)
+{
+  int x, y, u, v, i;
+
+  while (a_lo < a_hi && b_lo < b_hi && c->a[a_lo] == c->b[b_lo])
+    match(c, a_lo++, b_lo++);
+  while (a_lo < a_hi && b_lo < b_hi && c->a[a_hi - 1] == c->b[b_hi - 1])
+    match(c, --a_hi, --b_hi);
+  if (a_lo == a_hi || b_lo == b_hi)
+    return;
+
+  middle_snake(c, c->a + a_lo, a_hi - a_lo, c->b + b_lo, b_hi - b_lo,
+      &x, &y, &u, &v);
+
+  lcs(c, a_lo, a_lo + x, b_lo, b_lo + y);
+  for (i = 0; i < u - x; i++)
+    match(c, a_lo + x + i, b_lo + y + i);
+  lcs(c, a_lo + u, a_hi, b_lo + v, b_hi);
+}
+
+/**
+ * Diff the URIs @old against @new.
+ */
+diff_result *diff_tracks(const char *const *old, int num_old,
+    const char *const *new, int num_new)
+{
+  diff_result *d = calloc(1, sizeof(diff_result));
+  id_table ids;
+  lcs_context c;
+  int *a, *b, *head, *next;
+  int i, j;
+
+  d->num_old = num_old;
+  d->num_new = num_new;
+  d->old_to_new = malloc((num_old + 1) * sizeof(int));
+  d->new_to_old = malloc((num_new + 1) * sizeof(int));
+  d->moved = calloc(num_new + 1, 1);
+  for (i = 0; i < num_old; i++)
+    d->old_to_new[i] = -1;
+  for (j = 0; j < num_new; j++)
+    d->new_to_old[j] = -1;
+
+  ids.num_slots = 64;
+  while (ids.num_slots < (unsigned int) (num_old + num_new) * 2)
+    ids.num_slots <<= 1;
+  ids.slots = calloc(ids.num_slots, sizeof(int));
+  ids.strings = malloc((num_old + num_new + 1) * sizeof(char *));
+  ids.num_ids = 0;
+
+  a = malloc((num_old + 1) * sizeof(int));
+  b = malloc((num_new + 1) * sizeof(int));
+  for (i = 0; i < num_old; i++)
+    a[i] = intern(&ids, old[i]);
+  for (j = 0; j < num_new; j++)
+    b[j] = intern(&ids, new[j]);
+
+  c.a = a;
+  c.b = b;
+  c.offset = (num_old + num_new + 1) / 2 + 1;
+  c.vf = malloc((2 * c.offset + 1) * sizeof(int));
+  c.vb = malloc((2 * c.offset + 1) * sizeof(int));
+  c.d = d;
+  lcs(&c, 0, num_old, 0, num_new);
+
+  for (j = 0; j < num_new; j++)
+    if (d->new_to_old[j] != -1)
+      d->num_kept ++;
+
+  /* Pair up what is left: the first unmatched old copy of a URI moves to
+     the first unmatched new place for it */
+  head = malloc((ids.num_ids + 1) * sizeof(int));
+  next = malloc((num_old + 1) * sizeof(int));
+  for (i = 0; i < ids.num_ids; i++)
+    head[i] = -1;
+  for (i = num_old - 1; i >= 0; i--)
+    if (d->old_to_new[i] == -1)
+      {
+        next[i] = head[a[i]];
+        head[a[i]] = i;
+      }
+  for (j = 0; j < num_new; j++)
+    if (d->new_to_old[j] == -1 && (i = head[b[j]]) != -1)
+      {
+        head[b[j]] = next[i];
+        d->old_to_new[i] = j;
+        d->new_to_old[j] = i;
+        d->moved[j] = 1;
+        d->num_moved ++;
+      }
+
+  d->num_inserted = num_new - d->num_kept - d->num_moved;
+  d->num_removed = num_old - d->num_kept - d->num_moved;
+
+  free(head);
+  free(next);
+  free(c.vf);
+  free(c.vb);
+  free(a);
+  free(b);
+  free(ids.slots);
+  free(ids.strings);
+  return d;
+}
+
+void diff_result_free(diff_result *d)
+{
+  if (d == NULL)
+    return;
+  free(d->old_to_new);
+  free(d->new_to_old);
+  free(d->moved);
+  free(d);
+}
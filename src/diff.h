@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef DIFF_H__
+#define DIFF_H__
+
+/**
+ * Track list diffs.
+ *
+ * diff_tracks() matches a live track list @old against a saved one @new.
+ * A longest common subsequence of URIs (Myers' O(ND) algorithm in linear
+ * space) stays where it is.  Of the rest, an old track whose URI is still
+ * wanted somewhere else is moved there, and the others are removed; new
+ * tracks that matched nothing are inserted.
+ */
+typedef struct {
+  int num_old;
+  int num_new;
+  int *old_to_new;    /* new index of each old track, -1 if it is removed */
+  int *new_to_old;    /* old index of each new track, -1 if it is inserted */
+  char *moved;        /* per new index: it is matched, but not in the LCS */
+  int num_kept;
+  int num_moved;
+  int num_removed;
+  int num_inserted;
+} diff_result;
+
+extern diff_result *diff_tracks(const char *const *old, int num_old,
+    const char *const *new, int num_new);
+extern void diff_result_free(diff_result *d);
+
+#endif // DIFF_H__
@@ -0,0 +1,811 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "durable.h"
+#include "uring.h"
+
+/* With io_uring: how many files may be in flight, and the ring's size */
+#define DURABLE_URING_FILES 64
+#define DURABLE_URING_ENTRIES 256
+
+/* The end of every temporary file's name */
+#define TMP_SUFFIX ".git-spot-tmp"
+
+typedef struct _durable_op durable_op;
+
+struct _durable_op {
+  durable_op *next;
+  char *path;
+  char *tmp_path;     /* NULL for an unlink */
+  int failed;         /* its queued write did not make it to disk */
+  int superseded;     /* a later operation on the same path replaces it */
+  int index;          /* its place in the batch, while committing */
+};
+
+/* A write queued on the ring, with its own copy of the data */
+typedef struct {
+  durable_op *op;
+  char *data;
+  size_t len;
+  unsigned slot;
+  int pending;        /* completions still to come */
+  int error;          /* the first errno, 0 if none */
+} durable_write;
+
+struct _durable_batch {
+  durable_op *ops;
+  durable_op **tail;
+  int num_ops;
+  unsigned next_tmp;      /* keeps temporary files of one path apart */
+  pthread_mutex_t lock;   /* writes may come from several threads */
+  uring *ring;            /* NULL for plain POSIX I/O */
+  unsigned free_slots[DURABLE_URING_FILES];
+  int num_free_slots;
+  int in_flight;
+  int num_failed;         /* queued writes that failed on the ring */
+};
+
+durable_batch *durable_batch_new(void)
+{
+  durable_batch *batch = malloc(sizeof(durable_batch));
+
+  batch->ops = NULL;
+  batch->tail = &batch->ops;
+  batch->num_ops = 0;
+  batch->next_tmp = 0;
+  pthread_mutex_init(&batch->lock, NULL);
+  batch->ring = NULL;
+  batch->num_free_slots = 0;
+  batch->in_flight = 0;
+  batch->num_failed = 0;
+  return batch;
+}
+
+/**
+ * Queue the writes and the commit of @batch on an io_uring from now on,
+ * if the kernel has one.
+ *
+ * @return 0 if it does, -1 if the batch stays with POSIX I/O
+ */
+int durable_batch_use_uring(durable_batch *batch)
+{
+  int i;
+
+  if (batch->ring == NULL)
+    batch->ring = uring_new(DURABLE_URING_ENTRIES, DURABLE_URING_FILES);
+  if (batch->ring == NULL)
+    return -1;
+
+  for (i = 0; i < DURABLE_URING_FILES; i++)
+    batch->free_slots[i] = DURABLE_URING_FILES - 1 - i;
+  batch->num_free_slots = DURABLE_URING_FILES;
+  return 0;
+}
+
+int durable_batch_size(durable_batch *batch)
+{
+  return batch->num_ops;
+}
+
+static durable_op *
+durable_batch_append_locked(durable_batch *batch, char *path, char *tmp_path)
+{
+  durable_op *op = malloc(sizeof(durable_op));
+
+  op->next = NULL;
+  op->path = path;
+  op->tmp_path = tmp_path;
+  op->failed = 0;
+  op->superseded = 0;
+  *batch->tail = op;
+  batch->tail = &op->next;
+  batch->num_ops ++;
+  return op;
+}
+
+static void
+durable_batch_append(durable_batch *batch, char *path, char *tmp_path)
+{
+  pthread_mutex_lock(&batch->lock);
+  durable_batch_append_locked(batch, path, tmp_path);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+/* The directory part of @path, "." if there is none */
+static char *
+dup_dirname(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+
+  if (slash == NULL)
+    return strdup(".");
+  if (slash == path)
+    return strdup("/");
+  return strndup(path, slash - path);
+}
+
+/**
+ * A temporary file next to @path.  Each write gets a file of its own, so
+ * two writes of one path in a batch never share one.
+ */
+static char *
+temporary_path(durable_batch *batch, const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  char *tmp_path;
+  unsigned n;
+
+  pthread_mutex_lock(&batch->lock);
+  n = batch->next_tmp++;
+  pthread_mutex_unlock(&batch->lock);
+
+  if (slash == NULL)
+    asprintf(&tmp_path, ".%s.%u" TMP_SUFFIX, path, n);
+  else
+    asprintf(&tmp_path, "%.*s/.%s.%u" TMP_SUFFIX, (int) (slash - path),
+        path, slash + 1, n);
+  return tmp_path;
+}
+
+static int
+write_all(int fd, const char *data, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write(fd, data, len);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      data += n;
+      len -= n;
+    }
+  return 0;
+}
+
+/* Which request of a write's open, write, close chain completed */
+#define WRITE_STEP_MASK 3
+#define WRITE_STEP_WRITE 1
+
+static void
+durable_write_complete(durable_batch *batch, durable_write *w, int step,
+    int result)
+{
+  if (w->error == 0 && result < 0 && result != -ECANCELED)
+    w->error = -result;
+  else if (w->error == 0 && step == WRITE_STEP_WRITE && result >= 0
+      && (size_t) result != w->len)
+    w->error = EIO;
+  if (--w->pending > 0)
+    return;
+
+  if (w->error != 0)
+    {
+      printf("WARNING: writing \"%s\" failed: %s\n", w->op->tmp_path,
+          strerror(w->error));
+      unlink(w->op->tmp_path);
+      w->op->failed = 1;
+      batch->num_failed ++;
+    }
+  batch->free_slots[batch->num_free_slots++] = w->slot;
+  batch->in_flight --;
+  free(w->data);
+  free(w);
+}
+
+/**
+ * Submit what is queued on the ring, wait for at least @wait_nr
+ * completions and collect all that are there.  Call with the lock held.
+ *
+ * @return 0 on success, -1 if the ring failed
+ */
+static int
+durable_batch_reap(durable_batch *batch, unsigned wait_nr)
+{
+  uint64_t user_data;
+  int result;
+
+  if (uring_submit(batch->ring, wait_nr) != 0)
+    {
+      printf("WARNING: io_uring_enter() failed: %s\n", strerror(errno));
+      return -1;
+    }
+  while (uring_next_completion(batch->ring, &user_data, &result))
+    durable_write_complete(batch,
+        (durable_write *) (uintptr_t) (user_data & ~(uint64_t) WRITE_STEP_MASK),
+        user_data & WRITE_STEP_MASK, result);
+  return 0;
+}
+
+/**
+ * Queue the open, write and close of a temporary file for @path as one
+ * chain on the ring.  The ring is only entered once all its file slots
+ * are taken, so a run of small files costs one system call per
+ * DURABLE_URING_FILES of them.  A failed write is reported, and dropped
+ * from the batch, when its chain completes; durable_batch_foreach_failed()
+ * and durable_batch_commit() tell the caller about it.
+ *
+ * @return 0 if it was queued, -1 if the ring has failed
+ */
+static int
+durable_batch_queue_writev(durable_batch *batch, const char *path,
+    const struct iovec *iov, int iovcnt)
+{
+  durable_write *w = malloc(sizeof(durable_write));
+  char *tmp_path;
+  size_t offset = 0;
+  int i;
+
+  for (w->len = 0, i = 0; i < iovcnt; i++)
+    w->len += iov[i].iov_len;
+  w->data = malloc(w->len + 1);
+  for (i = 0; i < iovcnt; i++)
+    {
+      memcpy(w->data + offset, iov[i].iov_base, iov[i].iov_len);
+      offset += iov[i].iov_len;
+    }
+  w->pending = 3;
+  w->error = 0;
+  tmp_path = temporary_path(batch, path);
+
+  pthread_mutex_lock(&batch->lock);
+  while (batch->num_free_slots == 0 || uring_space(batch->ring) < 3)
+    if (durable_batch_reap(batch, 1) != 0)
+      {
+        pthread_mutex_unlock(&batch->lock);
+        free(tmp_path);
+        free(w->data);
+        free(w);
+        return -1;
+      }
+
+  w->slot = batch->free_slots[--batch->num_free_slots];
+  w->op = durable_batch_append_locked(batch, strdup(path), tmp_path);
+  batch->in_flight ++;
+  uring_openat(batch->ring, w->op->tmp_path, O_WRONLY | O_CREAT | O_TRUNC,
+      0644, w->slot, URING_LINK, (uintptr_t) w);
+  uring_write(batch->ring, w->slot, w->data, w->len, URING_HARDLINK,
+      (uintptr_t) w | WRITE_STEP_WRITE);
+  uring_close(batch->ring, w->slot, URING_NO_LINK, (uintptr_t) w | 2);
+  pthread_mutex_unlock(&batch->lock);
+  return 0;
+}
+
+/* Wait for every write still on the ring */
+static void
+durable_batch_drain(durable_batch *batch)
+{
+  if (batch->ring == NULL)
+    return;
+
+  pthread_mutex_lock(&batch->lock);
+  while (batch->in_flight > 0 && durable_batch_reap(batch, 1) == 0)
+    ;
+  pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Write @data to a temporary file next to @path.  @path itself is not
+ * touched until the batch is committed.  Writing a path again in the same
+ * batch replaces what was written before.
+ *
+ * @return 0 on success, -1 if the temporary file could not be written
+ */
+int durable_batch_write(durable_batch *batch, const char *path,
+    const void *data, size_t len)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void *) data;
+  iov.iov_len = len;
+  return durable_batch_writev(batch, path, &iov, 1);
+}
+
+/**
+ * durable_batch_write() of the concatenation of @iovcnt buffers, for
+ * contents that are not contiguous in memory.
+ */
+int durable_batch_writev(durable_batch *batch, const char *path,
+    const struct iovec *iov, int iovcnt)
+{
+  char *tmp_path;
+  int fd;
+  int i, failed = 0;
+
+  if (batch->ring != NULL
+      && durable_batch_queue_writev(batch, path, iov, iovcnt) == 0)
+    return 0;
+
+  tmp_path = temporary_path(batch, path);
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      printf("WARNING: open(\"%s\") failed: %s\n", tmp_path, strerror(errno));
+      free(tmp_path);
+      return -1;
+    }
+
+  for (i = 0; i < iovcnt && !failed; i++)
+    failed = write_all(fd, iov[i].iov_base, iov[i].iov_len) != 0;
+  if (close(fd) != 0)
+    failed = 1;
+
+  if (failed)
+    {
+      printf("WARNING: writing \"%s\" failed: %s\n", tmp_path, strerror(errno));
+      unlink(tmp_path);
+      free(tmp_path);
+      return -1;
+    }
+
+  durable_batch_append(batch, strdup(path), tmp_path);
+  return 0;
+}
+
+/**
+ * Call @fn with the path of every write that was queued successfully but
+ * then failed on the ring.  Waits for the writes queued so far first.
+ * durable_batch_write() itself reports the writes it could not queue.
+ */
+void durable_batch_foreach_failed(durable_batch *batch,
+    void (*fn) (const char *path, void *user_data), void *user_data)
+{
+  durable_op *op;
+  char **paths;
+  int i, n = 0;
+
+  durable_batch_drain(batch);
+
+  pthread_mutex_lock(&batch->lock);
+  if (batch->num_failed == 0)
+    {
+      pthread_mutex_unlock(&batch->lock);
+      return;
+    }
+  paths = malloc(batch->num_failed * sizeof(char *));
+  for (op = batch->ops; op != NULL; op = op->next)
+    if (op->failed)
+      paths[n++] = strdup(op->path);
+  pthread_mutex_unlock(&batch->lock);
+
+  /* Without the lock, so that @fn may queue more operations */
+  for (i = 0; i < n; i++)
+    {
+      fn(paths[i], user_data);
+      free(paths[i]);
+    }
+  free(paths);
+}
+
+/**
+ * Queue @path for removal once every write in the batch is in place.  As
+ * with writes, the last operation queued on a path is the one that counts.
+ */
+void durable_batch_unlink(durable_batch *batch, const char *path)
+{
+  durable_batch_append(batch, strdup(path), NULL);
+}
+
+static int
+op_compare(const void *a, const void *b)
+{
+  const durable_op *x = *(durable_op * const *) a;
+  const durable_op *y = *(durable_op * const *) b;
+  int c = strcmp(x->path, y->path);
+
+  return c != 0 ? c : x->index - y->index;
+}
+
+/**
+ * Mark every operation that a later one on the same path replaces, and
+ * drop the temporary files of superseded writes.
+ */
+static void
+supersede_repeated_paths(durable_batch *batch)
+{
+  durable_op **ops = malloc((batch->num_ops + 1) * sizeof(durable_op *));
+  durable_op *op;
+  int i, n = 0;
+
+  for (op = batch->ops; op != NULL; op = op->next)
+    {
+      op->index = n;
+      ops[n++] = op;
+    }
+  qsort(ops, n, sizeof(durable_op *), op_compare);
+
+  for (i = 0; i + 1 < n; i++)
+    {
+      if (strcmp(ops[i]->path, ops[i + 1]->path) != 0)
+        continue;
+      ops[i]->superseded = 1;
+      if (ops[i]->tmp_path != NULL && !ops[i]->failed)
+        unlink(ops[i]->tmp_path);
+    }
+  free(ops);
+}
+
+/**
+ * Remove the temporary files that a run which crashed before its commit
+ * left behind in the directory @dir_fd.  Those of this batch have all been
+ * renamed or removed by now.
+ */
+static void
+sweep_temporary_files(int dir_fd)
+{
+  size_t suffix_len = strlen(TMP_SUFFIX);
+  struct dirent *de;
+  DIR *dir;
+  int fd;
+
+  if ((fd = dup(dir_fd)) < 0)
+    return;
+  if ((dir = fdopendir(fd)) == NULL)
+    {
+      close(fd);
+      return;
+    }
+  while ((de = readdir(dir)) != NULL)
+    {
+      size_t len = strlen(de->d_name);
+
+      if (de->d_name[0] == '.' && len > suffix_len
+          && strcmp(de->d_name + len - suffix_len, TMP_SUFFIX) == 0)
+        unlinkat(dir_fd, de->d_name, 0);
+    }
+  closedir(dir);
+}
+
+static int
+string_compare(const void *a, const void *b)
+{
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* Sorted, de-duplicated list of the directories the batch touches */
+static char **
+batch_directories(durable_batch *batch, int *num_dirs)
+{
+  char **dirs = malloc((batch->num_ops + 1) * sizeof(char *));
+  durable_op *op;
+  int i, n = 0;
+
+  for (op = batch->ops; op != NULL; op = op->next)
+    if (!op->failed)
+      dirs[n++] = dup_dirname(op->path);
+
+  qsort(dirs, n, sizeof(char *), string_compare);
+
+  *num_dirs = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (*num_dirs > 0 && strcmp(dirs[*num_dirs - 1], dirs[i]) == 0)
+        free(dirs[i]);
+      else
+        dirs[(*num_dirs)++] = dirs[i];
+    }
+  return dirs;
+}
+
+/**
+ * Make every file in the batch durable with one flush of the file system
+ * rather than one fsync() per file.
+ *
+ * @return 0 on success, -1 if a file system could not be flushed
+ */
+static int
+flush_file_data(int *dir_fds, int num_dirs)
+{
+#ifdef __linux__
+  dev_t *synced = malloc((num_dirs + 1) * sizeof(dev_t));
+  int num_synced = 0;
+  int i, j, result = 0;
+
+  for (i = 0; i < num_dirs; i++)
+    {
+      struct stat st;
+
+      if (dir_fds[i] < 0 || fstat(dir_fds[i], &st) != 0)
+        continue;
+      for (j = 0; j < num_synced && synced[j] != st.st_dev; j++)
+        ;
+      if (j < num_synced)
+        continue;
+      synced[num_synced++] = st.st_dev;
+      if (syncfs(dir_fds[i]) != 0)
+        {
+          printf("WARNING: syncfs() failed: %s\n", strerror(errno));
+          result = -1;
+        }
+    }
+  free(synced);
+  return result;
+#else
+  sync();
+  return 0;
+#endif
+}
+
+static void
+durable_batch_clear(durable_batch *batch)
+{
+  durable_op *op = batch->ops;
+
+  while (op != NULL)
+    {
+      durable_op *next = op->next;
+      free(op->path);
+      free(op->tmp_path);
+      free(op);
+      op = next;
+    }
+  batch->ops = NULL;
+  batch->tail = &batch->ops;
+  batch->num_ops = 0;
+  batch->num_failed = 0;
+}
+
+/* What a request of uring_commit_ops() was for */
+#define COMMIT_RENAME 0
+#define COMMIT_UNLINK 1
+#define COMMIT_FSYNC 2
+
+static int
+uring_commit_result(uint64_t user_data, int result)
+{
+  durable_op *op = (durable_op *) (uintptr_t) (user_data & ~(uint64_t) 3);
+
+  if (result >= 0)
+    return 0;
+  switch (user_data & 3)
+    {
+    case COMMIT_RENAME:
+      printf("WARNING: rename(\"%s\") failed: %s\n", op->path, strerror(-result));
+      unlink(op->tmp_path);
+      return -1;
+    case COMMIT_UNLINK:
+      if (result == -ENOENT)
+        return 0;
+      printf("WARNING: unlink(\"%s\") failed: %s\n", op->path, strerror(-result));
+      return -1;
+    default:
+      return -1;
+    }
+}
+
+/**
+ * The renames, unlinks and directory syncs of durable_batch_commit() on
+ * the ring.  They run as one hard-linked chain, one ring's worth at a
+ * time, so they still happen in order and a failure does not stop the
+ * rest.
+ *
+ * @return 0 if every one succeeded, -1 otherwise
+ */
+static int
+uring_commit_ops(durable_batch *batch, int *dir_fds, int num_dirs)
+{
+  durable_op *op = batch->ops;
+  int pass = COMMIT_RENAME, dir = 0;
+  int queued, result = 0, r;
+  uint64_t user_data;
+
+  while (pass <= COMMIT_FSYNC)
+    {
+      for (queued = 0; uring_space(batch->ring) > 0 && pass <= COMMIT_FSYNC; )
+        {
+          if (pass == COMMIT_RENAME && op != NULL)
+            {
+              if (op->tmp_path != NULL && !op->failed && !op->superseded)
+                {
+                  uring_renameat(batch->ring, op->tmp_path, op->path,
+                      URING_HARDLINK, (uintptr_t) op | COMMIT_RENAME);
+                  queued ++;
+                }
+              op = op->next;
+            }
+          else if (pass == COMMIT_UNLINK && op != NULL)
+            {
+              if (op->tmp_path == NULL && !op->superseded)
+                {
+                  uring_unlinkat(batch->ring, op->path, URING_HARDLINK,
+                      (uintptr_t) op | COMMIT_UNLINK);
+                  queued ++;
+                }
+              op = op->next;
+            }
+          else if (pass == COMMIT_FSYNC && dir < num_dirs)
+            {
+              if (dir_fds[dir] >= 0)
+                {
+                  uring_fsync(batch->ring, dir_fds[dir], URING_HARDLINK,
+                      COMMIT_FSYNC);
+                  queued ++;
+                }
+              dir ++;
+            }
+          else
+            {
+              pass ++;
+              op = batch->ops;
+            }
+        }
+
+      if (queued == 0)
+        break;
+
+      /* The next ring's worth is a chain of its own */
+      uring_end_chain(batch->ring);
+      if (uring_submit(batch->ring, queued) != 0)
+        {
+          printf("WARNING: io_uring_enter() failed: %s\n", strerror(errno));
+          return -1;
+        }
+      while (queued > 0)
+        {
+          if (!uring_next_completion(batch->ring, &user_data, &r))
+            {
+              if (uring_submit(batch->ring, 1) != 0)
+                return -1;
+              continue;
+            }
+          if (uring_commit_result(user_data, r) != 0)
+            result = -1;
+          queued --;
+        }
+    }
+  return result;
+}
+
+/**
+ * The group-commit barrier.  Temporary files left over from an earlier,
+ * interrupted run are swept from every directory the batch touches.  The
+ * batch is empty afterwards and can be reused.
+ *
+ * @return 0 if every operation succeeded, -1 otherwise, including when a
+ * queued write that nothing replaced failed on the ring
+ */
+int durable_batch_commit(durable_batch *batch)
+{
+  int num_dirs, i;
+  char **dirs;
+  int *dir_fds;
+  durable_op *op;
+  int result = 0;
+
+  durable_batch_drain(batch);
+  if (batch->num_ops == 0)
+    return 0;
+
+  supersede_repeated_paths(batch);
+  for (op = batch->ops; op != NULL; op = op->next)
+    if (op->failed && !op->superseded)
+      result = -1;
+  if (result != 0)
+    printf("WARNING: not committing writes that failed, see above.\n");
+
+  dirs = batch_directories(batch, &num_dirs);
+  dir_fds = malloc((num_dirs + 1) * sizeof(int));
+  for (i = 0; i < num_dirs; i++)
+    dir_fds[i] = open(dirs[i], O_RDONLY | O_DIRECTORY);
+
+  /* Nothing may replace its target unless its contents are on disk */
+  if (flush_file_data(dir_fds, num_dirs) != 0)
+    {
+      printf("WARNING: could not flush the batch, leaving every target as it was.\n");
+      for (op = batch->ops; op != NULL; op = op->next)
+        if (op->tmp_path != NULL && !op->failed && !op->superseded)
+          unlink(op->tmp_path);
+      result = -1;
+    }
+  else if (batch->ring != NULL)
+    {
+      if (uring_commit_ops(batch, dir_fds, num_dirs) != 0)
+        result = -1;
+    }
+  else
+    {
+      for (op = batch->ops; op != NULL; op = op->next)
+        {
+          if (op->tmp_path == NULL || op->failed || op->superseded)
+            continue;
+          if (rename(op->tmp_path, op->path) != 0)
+            {
+              printf("WARNING: rename(\"%s\") failed: %s\n", op->path, strerror(errno));
+              unlink(op->tmp_path);
+              result = -1;
+            }
+        }
+
+      for (op = batch->ops; op != NULL; op = op->next)
+        {
+          if (op->tmp_path != NULL || op->superseded)
+            continue;
+          if (unlink(op->path) != 0 && errno != ENOENT)
+            {
+              printf("WARNING: unlink(\"%s\") failed: %s\n", op->path, strerror(errno));
+              result = -1;
+            }
+        }
+
+      for (i = 0; i < num_dirs; i++)
+        if (dir_fds[i] >= 0 && fsync(dir_fds[i]) != 0)
+          result = -1;
+    }
+
+  for (i = 0; i < num_dirs; i++)
+    {
+      if (dir_fds[i] < 0)
+        {
+          printf("WARNING: could not open directory \"%s\" to sync it.\n", dirs[i]);
+          result = -1;
+        }
+      else
+        {
+          sweep_temporary_files(dir_fds[i]);
+          close(dir_fds[i]);
+        }
+      free(dirs[i]);
+    }
+  free(dir_fds);
+  free(dirs);
+
+  durable_batch_clear(batch);
+  return result;
+}
+
+/**
+ * Free the batch.  Writes that were never committed are rolled back.
+ */
+void durable_batch_free(durable_batch *batch)
+{
+  durable_op *op;
+
+  if (batch == NULL)
+    return;
+
+  durable_batch_drain(batch);
+  uring_free(batch->ring);
+
+  for (op = batch->ops; op != NULL; op = op->next)
+    if (op->tmp_path != NULL)
+      unlink(op->tmp_path);
+
+  durable_batch_clear(batch);
+  pthread_mutex_destroy(&batch->lock);
+  free(batch);
+}
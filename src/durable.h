@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef DURABLE_H__
+#define DURABLE_H__
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/**
+ * Crash-consistent file replacement with group commit.
+ *
+ * durable_batch_write() writes the new contents next to the target as a
+ * hidden temporary file and nothing else.  durable_batch_commit() then,
+ * for the whole batch at once: flushes the temporary files to disk, renames
+ * every one of them over its target, performs any queued unlinks and
+ * finally syncs each touched directory once.  A crash at any point leaves
+ * each target either entirely old or entirely new, and the temporary files
+ * such a crash leaves behind are swept by the next commit that touches
+ * their directory.  If the temporary files cannot be flushed, the commit
+ * fails before it renames or unlinks anything.  Within a batch, the last
+ * write or unlink of a path wins.
+ *
+ * Writes and unlinks may be queued from several threads at once; commit
+ * and free may not overlap with them.
+ *
+ * After durable_batch_use_uring(), writes are queued on a Linux io_uring
+ * rather than made one system call at a time, and the commit's renames,
+ * unlinks and directory syncs are submitted in bulk.  A queued write can
+ * then still fail after durable_batch_write() has returned 0:
+ * durable_batch_foreach_failed() names those, and durable_batch_commit()
+ * fails if any of them was not replaced by a later write.
+ */
+typedef struct _durable_batch durable_batch;
+
+extern durable_batch *durable_batch_new(void);
+extern int durable_batch_use_uring(durable_batch *batch);
+extern int durable_batch_write(durable_batch *batch, const char *path,
+    const void *data, size_t len);
+extern int durable_batch_writev(durable_batch *batch, const char *path,
+    const struct iovec *iov, int iovcnt);
+extern void durable_batch_foreach_failed(durable_batch *batch,
+    void (*fn) (const char *path, void *user_data), void *user_data);
+extern void durable_batch_unlink(durable_batch *batch, const char *path);
+extern int durable_batch_commit(durable_batch *batch);
+extern void durable_batch_free(durable_batch *batch);
+
+extern int durable_batch_size(durable_batch *batch);
+
+#endif // DURABLE_H__
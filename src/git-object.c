@@ -0,0 +1,1677 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "git-object.h"
+#include "git-pack.h"
+#include "sha1.h"
+
+typedef struct _git_pack git_pack;
+
+struct _git_pack {
+  git_pack *next;
+  const unsigned char *idx;
+  size_t idx_len;
+  const unsigned char *pack;
+  size_t pack_len;
+  uint32_t num_objects;
+};
+
+/* Objects written during this run that are not renamed into place yet */
+typedef struct {
+  unsigned char *ids;
+  unsigned int size;
+  unsigned int count;
+} id_set;
+
+struct _git_repo {
+  char *git_dir;
+  char *common_dir;   /* git_dir, unless this is a linked worktree */
+  char *worktree;
+  git_pack *packs;
+  id_set pending;
+  git_pack_writer *pack_writer;
+};
+
+typedef struct {
+  char *name;
+  unsigned int mode;
+  unsigned char id[GIT_ID_LENGTH];
+  git_tree *subtree;
+} git_tree_entry;
+
+struct _git_tree {
+  git_tree_entry *entries;
+  int num_entries;
+  int size;
+  int dirty;
+  /* the id the tree was loaded from, the natural delta base for its new version */
+  int has_base;
+  unsigned char base_id[GIT_ID_LENGTH];
+};
+
+static const unsigned char null_id[GIT_ID_LENGTH];
+
+static const char *type_names[] = {
+  NULL, "commit", "tree", "blob", "tag"
+};
+
+const char *git_object_type_name(git_object_type type)
+{
+  if (type < GIT_OBJ_COMMIT || type > GIT_OBJ_TAG)
+    return NULL;
+  return type_names[type];
+}
+
+void git_id_to_hex(const unsigned char id[GIT_ID_LENGTH],
+    char hex[GIT_HEX_LENGTH + 1])
+{
+  static const char digits[] = "0123456789abcdef";
+  int i;
+
+  for (i = 0; i < GIT_ID_LENGTH; i++)
+    {
+      hex[i * 2] = digits[id[i] >> 4];
+      hex[i * 2 + 1] = digits[id[i] & 0xf];
+    }
+  hex[GIT_HEX_LENGTH] = 0;
+}
+
+static int
+hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * @return 0 if @hex starts with 40 hex digits, -1 otherwise
+ */
+int git_hex_to_id(const char *hex, unsigned char id[GIT_ID_LENGTH])
+{
+  int i;
+
+  for (i = 0; i < GIT_ID_LENGTH; i++)
+    {
+      int hi = hex_value(hex[i * 2]);
+      int lo = hi < 0 ? -1 : hex_value(hex[i * 2 + 1]);
+      if (lo < 0)
+        return -1;
+      id[i] = hi << 4 | lo;
+    }
+  return 0;
+}
+
+/*
+ * id_set
+ */
+
+static unsigned int
+id_hash(const unsigned char *id)
+{
+  return id[0] | id[1] << 8 | id[2] << 16 | (unsigned int) id[3] << 24;
+}
+
+static int
+id_set_contains(id_set *set, const unsigned char *id)
+{
+  unsigned int i;
+
+  if (set->size == 0)
+    return 0;
+
+  for (i = id_hash(id) & (set->size - 1); ; i = (i + 1) & (set->size - 1))
+    {
+      unsigned char *slot = set->ids + i * GIT_ID_LENGTH;
+      if (memcmp(slot, id, GIT_ID_LENGTH) == 0)
+        return 1;
+      if (memcmp(slot, null_id, GIT_ID_LENGTH) == 0)
+        return 0;
+    }
+}
+
+static void
+id_set_add(id_set *set, const unsigned char *id)
+{
+  unsigned int i;
+
+  if ((set->count + 1) * 2 > set->size)
+    {
+      id_set old = *set;
+
+      set->size = set->size ? set->size * 2 : 256;
+      set->ids = calloc(set->size, GIT_ID_LENGTH);
+      set->count = 0;
+      for (i = 0; i < old.size; i++)
+        if (memcmp(old.ids + i * GIT_ID_LENGTH, null_id, GIT_ID_LENGTH) != 0)
+          id_set_add(set, old.ids + i * GIT_ID_LENGTH);
+      free(old.ids);
+    }
+
+  if (id_set_contains(set, id))
+    return;
+
+  for (i = id_hash(id) & (set->size - 1); ; i = (i + 1) & (set->size - 1))
+    {
+      unsigned char *slot = set->ids + i * GIT_ID_LENGTH;
+      if (memcmp(slot, null_id, GIT_ID_LENGTH) == 0)
+        {
+          memcpy(slot, id, GIT_ID_LENGTH);
+          set->count ++;
+          return;
+        }
+    }
+}
+
+/*
+ * Repository discovery
+ */
+
+static int
+is_directory(const char *path)
+{
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static char *
+read_first_line(const char *path)
+{
+  FILE *input = fopen(path, "r");
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+
+  if (input == NULL)
+    return NULL;
+
+  len = getline(&line, &size, input);
+  fclose(input);
+  if (len < 0)
+    {
+      free(line);
+      return NULL;
+    }
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    line[--len] = 0;
+  return line;
+}
+
+/* Follows a "gitdir: <path>" file as used by worktrees and submodules */
+static char *
+read_gitdir_file(const char *dir, const char *path)
+{
+  FILE *input = fopen(path, "r");
+  char line[PATH_MAX + 16];
+  char *git_dir = NULL;
+  size_t len;
+
+  if (input == NULL)
+    return NULL;
+
+  if (fgets(line, sizeof(line), input) != NULL
+      && strncmp(line, "gitdir: ", 8) == 0)
+    {
+      len = strlen(line);
+      while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = 0;
+      if (line[8] == '/')
+        git_dir = strdup(line + 8);
+      else
+        asprintf(&git_dir, "%s/%s", dir, line + 8);
+    }
+  fclose(input);
+  return git_dir;
+}
+
+/*
+ * The git directory of a linked worktree only has the worktree's own HEAD
+ * and refs; its "commondir" file names the directory with the objects,
+ * the branches and the config that all worktrees share.
+ */
+static char *
+read_commondir_file(const char *git_dir)
+{
+  char *path, *line, *common_dir;
+
+  asprintf(&path, "%s/commondir", git_dir);
+  line = read_first_line(path);
+  free(path);
+
+  if (line == NULL || *line == 0)
+    {
+      free(line);
+      return strdup(git_dir);
+    }
+  if (line[0] == '/')
+    path = line;
+  else
+    {
+      asprintf(&path, "%s/%s", git_dir, line);
+      free(line);
+    }
+  common_dir = realpath(path, NULL);
+  if (common_dir == NULL)
+    return path;
+  free(path);
+  return common_dir;
+}
+
+static void
+load_packs(git_repo *repo)
+{
+  char *pack_dir;
+  DIR *dir;
+  struct dirent *de;
+
+  asprintf(&pack_dir, "%s/objects/pack", repo->common_dir);
+  dir = opendir(pack_dir);
+
+  while (dir != NULL && (de = readdir(dir)) != NULL)
+    {
+      size_t len = strlen(de->d_name);
+      char *idx_path, *pack_path;
+      int idx_fd, pack_fd;
+      struct stat idx_st, pack_st;
+      git_pack *pack;
+
+      if (len < 5 || strcmp(de->d_name + len - 4, ".idx") != 0)
+        continue;
+
+      asprintf(&idx_path, "%s/%s", pack_dir, de->d_name);
+      asprintf(&pack_path, "%s/%.*s.pack", pack_dir, (int) (len - 4), de->d_name);
+      idx_fd = open(idx_path, O_RDONLY);
+      pack_fd = open(pack_path, O_RDONLY);
+
+      if (idx_fd >= 0 && pack_fd >= 0
+          && fstat(idx_fd, &idx_st) == 0 && fstat(pack_fd, &pack_st) == 0
+          && idx_st.st_size >= 8 + 256 * 4 && pack_st.st_size >= 12)
+        {
+          pack = malloc(sizeof(git_pack));
+          pack->idx_len = idx_st.st_size;
+          pack->pack_len = pack_st.st_size;
+          pack->idx = mmap(NULL, pack->idx_len, PROT_READ, MAP_PRIVATE, idx_fd, 0);
+          pack->pack = mmap(NULL, pack->pack_len, PROT_READ, MAP_PRIVATE, pack_fd, 0);
+
+          if (pack->idx == MAP_FAILED || pack->pack == MAP_FAILED
+              || memcmp(pack->idx, "\377tOc\0\0\0\2", 8) != 0)
+            {
+              printf("WARNING: ignoring unsupported pack index %s.\n", idx_path);
+              if (pack->idx != MAP_FAILED)
+                munmap((void *) pack->idx, pack->idx_len);
+              if (pack->pack != MAP_FAILED)
+                munmap((void *) pack->pack, pack->pack_len);
+              free(pack);
+            }
+          else
+            {
+              const unsigned char *n = pack->idx + 8 + 255 * 4;
+              pack->num_objects = (uint32_t) n[0] << 24 | n[1] << 16 | n[2] << 8 | n[3];
+              pack->next = repo->packs;
+              repo->packs = pack;
+            }
+        }
+
+      if (idx_fd >= 0)
+        close(idx_fd);
+      if (pack_fd >= 0)
+        close(pack_fd);
+      free(idx_path);
+      free(pack_path);
+    }
+
+  if (dir != NULL)
+    closedir(dir);
+  free(pack_dir);
+}
+
+static void
+free_packs(git_repo *repo)
+{
+  while (repo->packs != NULL)
+    {
+      git_pack *next = repo->packs->next;
+      munmap((void *) repo->packs->idx, repo->packs->idx_len);
+      munmap((void *) repo->packs->pack, repo->packs->pack_len);
+      free(repo->packs);
+      repo->packs = next;
+    }
+}
+
+/**
+ * Re-scan objects/pack, e.g. after a pack has been added.
+ */
+void git_repo_reload_packs(git_repo *repo)
+{
+  free_packs(repo);
+  load_packs(repo);
+}
+
+/**
+ * Find the repository that @path lives in, looking in @path and then in
+ * each of its parents for a .git directory.
+ *
+ * @return the repository, or NULL if @path is not inside one
+ */
+git_repo *git_repo_discover(const char *path)
+{
+  char *dir = realpath(path, NULL);
+  git_repo *repo;
+
+  while (dir != NULL)
+    {
+      char *dot_git, *slash;
+      char *git_dir = NULL;
+
+      asprintf(&dot_git, "%s/.git", strcmp(dir, "/") == 0 ? "" : dir);
+      if (is_directory(dot_git))
+        git_dir = strdup(dot_git);
+      else
+        git_dir = read_gitdir_file(dir, dot_git);
+      free(dot_git);
+
+      if (git_dir != NULL)
+        {
+          repo = malloc(sizeof(git_repo));
+          repo->git_dir = git_dir;
+          repo->common_dir = read_commondir_file(git_dir);
+          repo->worktree = dir;
+          repo->packs = NULL;
+          memset(&repo->pending, 0, sizeof(id_set));
+          repo->pack_writer = NULL;
+          load_packs(repo);
+          return repo;
+        }
+
+      slash = strrchr(dir, '/');
+      if (slash == NULL || strcmp(dir, "/") == 0)
+        break;
+      if (slash == dir)
+        slash[1] = 0;
+      else
+        *slash = 0;
+    }
+
+  free(dir);
+  return NULL;
+}
+
+void git_repo_free(git_repo *repo)
+{
+  if (repo == NULL)
+    return;
+  free_packs(repo);
+  free(repo->pending.ids);
+  free(repo->git_dir);
+  free(repo->common_dir);
+  free(repo->worktree);
+  free(repo);
+}
+
+/**
+ * @return the directory with the repository's objects and shared refs,
+ * which for a linked worktree is not its own git directory
+ */
+const char *git_repo_dir(git_repo *repo)
+{
+  return repo->common_dir;
+}
+
+/**
+ * Send every object written from now on to @writer instead of writing it
+ * loose.  The caller still owns @writer; NULL goes back to loose objects.
+ */
+void git_repo_set_pack_writer(git_repo *repo, git_pack_writer *writer)
+{
+  repo->pack_writer = writer;
+}
+
+/**
+ * @return @path relative to the top of the work tree ("" for the top
+ * itself), or NULL if @path is outside of it
+ */
+char *git_repo_relative_path(git_repo *repo, const char *path)
+{
+  char *real = realpath(path, NULL);
+  size_t len = strlen(repo->worktree);
+  char *relative = NULL;
+
+  if (real == NULL)
+    return NULL;
+
+  if (strcmp(repo->worktree, "/") == 0)
+    relative = strdup(real + 1);
+  else if (strncmp(real, repo->worktree, len) == 0)
+    {
+      if (real[len] == 0)
+        relative = strdup("");
+      else if (real[len] == '/')
+        relative = strdup(real + len + 1);
+    }
+
+  free(real);
+  return relative;
+}
+
+/*
+ * Reading objects
+ */
+
+static char *
+loose_object_path(git_repo *repo, const unsigned char id[GIT_ID_LENGTH])
+{
+  char hex[GIT_HEX_LENGTH + 1];
+  char *path;
+
+  git_id_to_hex(id, hex);
+  asprintf(&path, "%s/objects/%.2s/%s", repo->common_dir, hex, hex + 2);
+  return path;
+}
+
+static uint32_t
+read_be32(const unsigned char *p)
+{
+  return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/**
+ * @return the offset of @id in @pack, or 0 if it is not there
+ */
+static size_t
+pack_find(git_pack *pack, const unsigned char id[GIT_ID_LENGTH])
+{
+  const unsigned char *fanout = pack->idx + 8;
+  const unsigned char *ids = fanout + 256 * 4;
+  uint32_t lo = id[0] == 0 ? 0 : read_be32(fanout + (id[0] - 1) * 4);
+  uint32_t hi = read_be32(fanout + id[0] * 4);
+
+  while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      int cmp = memcmp(ids + (size_t) mid * GIT_ID_LENGTH, id, GIT_ID_LENGTH);
+
+      if (cmp == 0)
+        {
+          const unsigned char *offsets = ids + (size_t) pack->num_objects * (GIT_ID_LENGTH + 4);
+          uint32_t offset = read_be32(offsets + (size_t) mid * 4);
+
+          if (offset & 0x80000000)
+            {
+              const unsigned char *large = offsets + (size_t) pack->num_objects * 4
+                  + (size_t) (offset & 0x7fffffff) * 8;
+              return (size_t) read_be32(large) << 32 | read_be32(large + 4);
+            }
+          return offset;
+        }
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return 0;
+}
+
+static int
+inflate_exactly(const unsigned char *in, size_t in_len,
+    unsigned char *out, size_t out_len)
+{
+  z_stream zs;
+  int status;
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK)
+    return -1;
+
+  zs.next_in = (unsigned char *) in;
+  zs.avail_in = in_len > UINT_MAX ? UINT_MAX : in_len;
+  zs.next_out = out;
+  zs.avail_out = out_len;
+  status = inflate(&zs, Z_FINISH);
+  inflateEnd(&zs);
+
+  return status == Z_STREAM_END && zs.total_out == out_len ? 0 : -1;
+}
+
+static size_t
+read_delta_size(const unsigned char **p, const unsigned char *end)
+{
+  size_t size = 0;
+  int shift = 0;
+
+  while (*p < end && shift < 64)
+    {
+      unsigned char c = *(*p)++;
+      size |= (size_t) (c & 0x7f) << shift;
+      shift += 7;
+      if (!(c & 0x80))
+        break;
+    }
+  return size;
+}
+
+/**
+ * Apply a git delta to @base.
+ *
+ * @return 0 on success, -1 if the delta is corrupt
+ */
+int git_apply_delta(const unsigned char *base, size_t base_len,
+    const unsigned char *delta, size_t delta_len,
+    unsigned char **result, size_t *result_len)
+{
+  const unsigned char *p = delta;
+  const unsigned char *end = delta + delta_len;
+  unsigned char *out, *o;
+  size_t size;
+  int corrupt = 0;
+
+  if (read_delta_size(&p, end) != base_len)
+    return -1;
+  size = read_delta_size(&p, end);
+  out = o = size < SIZE_MAX ? malloc(size + 1) : NULL;
+  if (out == NULL)
+    return -1;
+
+  while (p < end && !corrupt)
+    {
+      unsigned char op = *p++;
+
+      if (op & 0x80)
+        {
+          size_t offset = 0, len = 0;
+          int i;
+
+          /* Bits 0-3 flag the offset's bytes, bits 4-6 the length's */
+          for (i = 0; i < 7; i++)
+            {
+              if (!(op & (1 << i)))
+                continue;
+              if (p >= end)
+                break;
+              if (i < 4)
+                offset |= (size_t) *p++ << (i * 8);
+              else
+                len |= (size_t) *p++ << ((i - 4) * 8);
+            }
+          if (len == 0)
+            len = 0x10000;
+
+          corrupt = i < 7 || offset + len > base_len || len > size - (o - out);
+          if (corrupt)
+            break;
+          memcpy(o, base + offset, len);
+          o += len;
+        }
+      else if (op != 0)
+        {
+          corrupt = op > end - p || op > size - (o - out);
+          if (corrupt)
+            break;
+          memcpy(o, p, op);
+          p += op;
+          o += op;
+        }
+      else
+        corrupt = 1;
+    }
+
+  if (corrupt || p != end || (size_t) (o - out) != size)
+    {
+      free(out);
+      return -1;
+    }
+
+  *result = out;
+  *result_len = size;
+  return 0;
+}
+
+static int
+pack_read(git_repo *repo, git_pack *pack, size_t offset, int depth,
+    git_object_type *type, unsigned char **data, size_t *len);
+
+static int
+read_object(git_repo *repo, const unsigned char id[GIT_ID_LENGTH], int depth,
+    git_object_type *type, unsigned char **data, size_t *len);
+
+static int
+pack_read(git_repo *repo, git_pack *pack, size_t offset, int depth,
+    git_object_type *type, unsigned char **data, size_t *len)
+{
+  const unsigned char *p = pack->pack + offset;
+  const unsigned char *end = pack->pack + pack->pack_len - GIT_ID_LENGTH;
+  git_object_type entry_type;
+  size_t size;
+  int shift = 4;
+  unsigned char *raw;
+  unsigned char *base = NULL;
+  size_t base_len;
+  int result;
+
+  if (depth > 64 || offset < 12 || p >= end)
+    return -1;
+
+  entry_type = (*p >> 4) & 7;
+  size = *p & 0xf;
+  while ((*p++ & 0x80) && p < end)
+    {
+      size |= (size_t) (*p & 0x7f) << shift;
+      shift += 7;
+    }
+
+  if (entry_type == GIT_OBJ_OFS_DELTA)
+    {
+      size_t base_offset = *p & 0x7f;
+      while ((*p++ & 0x80) && p < end)
+        base_offset = ((base_offset + 1) << 7) | (*p & 0x7f);
+      if (base_offset > offset
+          || pack_read(repo, pack, offset - base_offset, depth + 1,
+              type, &base, &base_len) != 0)
+        return -1;
+    }
+  else if (entry_type == GIT_OBJ_REF_DELTA)
+    {
+      if (p + GIT_ID_LENGTH > end
+          || read_object(repo, p, depth + 1, type, &base, &base_len) != 0)
+        return -1;
+      p += GIT_ID_LENGTH;
+    }
+  else
+    *type = entry_type;
+
+  raw = malloc(size + 1);
+  if (inflate_exactly(p, end - p, raw, size) != 0)
+    {
+      free(raw);
+      free(base);
+      return -1;
+    }
+
+  if (base == NULL)
+    {
+      *data = raw;
+      *len = size;
+      return 0;
+    }
+
+  result = git_apply_delta(base, base_len, raw, size, data, len);
+  free(raw);
+  free(base);
+  return result;
+}
+
+static int
+read_loose_object(git_repo *repo, const unsigned char id[GIT_ID_LENGTH],
+    git_object_type *type, unsigned char **data, size_t *len)
+{
+  char *path = loose_object_path(repo, id);
+  FILE *input = fopen(path, "r");
+  unsigned char in[16384];
+  char header[64];
+  size_t header_len = 0;
+  size_t size = 0, have = 0;
+  unsigned char *out = NULL;
+  z_stream zs;
+  int status = Z_OK;
+  int i;
+
+  free(path);
+  if (input == NULL)
+    return -1;
+
+  memset(&zs, 0, sizeof(zs));
+  inflateInit(&zs);
+
+  /* Inflate the "<type> <size>\0" header first, then straight into place */
+  zs.next_out = (unsigned char *) header;
+  zs.avail_out = sizeof(header);
+
+  while (status == Z_OK)
+    {
+      if (zs.avail_in == 0)
+        {
+          zs.avail_in = fread(in, 1, sizeof(in), input);
+          zs.next_in = in;
+          if (zs.avail_in == 0)
+            break;
+        }
+
+      status = inflate(&zs, Z_NO_FLUSH);
+
+      if (out == NULL)
+        {
+          char *nul = memchr(header, 0, sizeof(header) - zs.avail_out);
+          char *space;
+
+          if (nul == NULL)
+            {
+              if (zs.avail_out == 0)
+                break;
+              continue;
+            }
+
+          space = strchr(header, ' ');
+          *type = GIT_OBJ_NONE;
+          for (i = GIT_OBJ_COMMIT; space != NULL && i <= GIT_OBJ_TAG; i++)
+            if ((size_t) (space - header) == strlen(type_names[i])
+                && strncmp(header, type_names[i], space - header) == 0)
+              *type = i;
+          if (*type == GIT_OBJ_NONE)
+            break;
+
+          size = strtoul(space + 1, NULL, 10);
+          header_len = nul + 1 - header;
+          have = sizeof(header) - zs.avail_out - header_len;
+          if (have > size)
+            break;
+          out = malloc(size + 1);
+          memcpy(out, header + header_len, have);
+          zs.next_out = out + have;
+          zs.avail_out = size - have;
+        }
+    }
+
+  inflateEnd(&zs);
+  fclose(input);
+
+  if (status != Z_STREAM_END || out == NULL || zs.total_out != header_len + size)
+    {
+      free(out);
+      return -1;
+    }
+
+  *data = out;
+  *len = size;
+  return 0;
+}
+
+static int
+read_object(git_repo *repo, const unsigned char id[GIT_ID_LENGTH], int depth,
+    git_object_type *type, unsigned char **data, size_t *len)
+{
+  git_pack *pack;
+
+  for (pack = repo->packs; pack != NULL; pack = pack->next)
+    {
+      size_t offset = pack_find(pack, id);
+      if (offset != 0)
+        return pack_read(repo, pack, offset, depth, type, data, len);
+    }
+  return read_loose_object(repo, id, type, data, len);
+}
+
+/**
+ * Read an object from the repository, loose or packed.
+ *
+ * @return 0 on success with *data malloc()ed, -1 if the object could not
+ * be found or read
+ */
+int git_repo_read_object(git_repo *repo, const unsigned char id[GIT_ID_LENGTH],
+    git_object_type *type, unsigned char **data, size_t *len)
+{
+  return read_object(repo, id, 0, type, data, len);
+}
+
+int git_repo_has_object(git_repo *repo, const unsigned char id[GIT_ID_LENGTH])
+{
+  git_pack *pack;
+  char *path;
+  int found;
+
+  if (id_set_contains(&repo->pending, id))
+    return 1;
+
+  for (pack = repo->packs; pack != NULL; pack = pack->next)
+    if (pack_find(pack, id) != 0)
+      return 1;
+
+  path = loose_object_path(repo, id);
+  found = access(path, F_OK) == 0;
+  free(path);
+  return found;
+}
+
+/*
+ * Writing objects
+ */
+
+static int
+object_header(git_object_type type, size_t len, char header[32])
+{
+  return snprintf(header, 32, "%s %zu", git_object_type_name(type), len) + 1;
+}
+
+void git_hash_object(git_object_type type, const void *data, size_t len,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  sha1_context ctx;
+  char header[32];
+
+  sha1_init(&ctx);
+  sha1_update(&ctx, header, object_header(type, len, header));
+  sha1_update(&ctx, data, len);
+  sha1_final(&ctx, id);
+}
+
+static int
+write_loose_object(git_repo *repo, durable_batch *batch,
+    git_object_type type, const void *data, size_t len,
+    const unsigned char id[GIT_ID_LENGTH])
+{
+  char header[32];
+  int header_len = object_header(type, len, header);
+  char hex[GIT_HEX_LENGTH + 1];
+  char *dir, *path;
+  unsigned char *out;
+  z_stream zs;
+  int result = -1;
+
+  memset(&zs, 0, sizeof(zs));
+  deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+  out = malloc(deflateBound(&zs, header_len + len));
+
+  zs.next_out = out;
+  zs.avail_out = deflateBound(&zs, header_len + len);
+  zs.next_in = (unsigned char *) header;
+  zs.avail_in = header_len;
+  deflate(&zs, Z_NO_FLUSH);
+  zs.next_in = (unsigned char *) data;
+  zs.avail_in = len;
+
+  git_id_to_hex(id, hex);
+  asprintf(&dir, "%s/objects/%.2s", repo->common_dir, hex);
+  asprintf(&path, "%s/%s", dir, hex + 2);
+
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+    printf("WARNING: failed to compress object %s.\n", hex);
+  else if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    printf("WARNING: mkdir(\"%s\") failed.\n", dir);
+  else if (durable_batch_write(batch, path, out, zs.total_out) == 0)
+    result = 0;
+
+  deflateEnd(&zs);
+  free(out);
+  free(dir);
+  free(path);
+  return result;
+}
+
+/**
+ * Hash an object and, unless the repository already has it, write it as a
+ * loose object through @batch, or to the repository's pack writer if it
+ * has one.  The object becomes visible when the batch is committed.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int git_repo_write_object(git_repo *repo, durable_batch *batch,
+    git_object_type type, const void *data, size_t len,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  return git_repo_write_delta_object(repo, batch, type, data, len,
+      NULL, NULL, 0, id);
+}
+
+/**
+ * git_repo_write_object() with a hint: @base_id is an earlier version of
+ * the object that a pack writer should try to store it as a delta against.
+ * @base_data may hold the contents of @base_id to save reading it back,
+ * or be NULL.  Without a pack writer the hint is ignored.
+ */
+int git_repo_write_delta_object(git_repo *repo, durable_batch *batch,
+    git_object_type type, const void *data, size_t len,
+    const unsigned char *base_id, const void *base_data, size_t base_len,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  int result;
+
+  git_hash_object(type, data, len, id);
+  if (git_repo_has_object(repo, id))
+    return 0;
+
+  if (repo->pack_writer != NULL)
+    result = git_pack_writer_add(repo->pack_writer, type, data, len, id,
+        base_id, base_data, base_len);
+  else
+    result = write_loose_object(repo, batch, type, data, len, id);
+
+  if (result == 0)
+    id_set_add(&repo->pending, id);
+  return result;
+}
+
+/*
+ * Refs
+ */
+
+/*
+ * The directory that @ref lives in: HEAD and the like belong to the
+ * worktree, branches and other refs are shared by all of them.
+ */
+static const char *
+ref_dir(git_repo *repo, const char *ref)
+{
+  if (strncmp(ref, "refs/", 5) != 0
+      || strncmp(ref, "refs/worktree/", 14) == 0
+      || strncmp(ref, "refs/bisect/", 12) == 0
+      || strncmp(ref, "refs/rewritten/", 15) == 0)
+    return repo->git_dir;
+  return repo->common_dir;
+}
+
+static int
+resolve_packed_ref(git_repo *repo, const char *ref,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  char *path;
+  FILE *input;
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int result = -1;
+
+  asprintf(&path, "%s/packed-refs", repo->common_dir);
+  input = fopen(path, "r");
+  free(path);
+  if (input == NULL)
+    return -1;
+
+  while (result != 0 && (len = getline(&line, &size, input)) != -1)
+    {
+      if (len > 0 && line[len - 1] == '\n')
+        line[--len] = 0;
+      if (len > GIT_HEX_LENGTH + 1 && line[GIT_HEX_LENGTH] == ' '
+          && strcmp(line + GIT_HEX_LENGTH + 1, ref) == 0)
+        result = git_hex_to_id(line, id);
+    }
+
+  free(line);
+  fclose(input);
+  return result;
+}
+
+/**
+ * If @ref is a symbolic ref (such as HEAD usually is), return the name of
+ * the ref it points to.
+ */
+char *git_repo_symbolic_ref(git_repo *repo, const char *ref)
+{
+  char *path, *line, *target = NULL;
+
+  asprintf(&path, "%s/%s", ref_dir(repo, ref), ref);
+  line = read_first_line(path);
+  free(path);
+
+  if (line != NULL && strncmp(line, "ref: ", 5) == 0)
+    target = strdup(line + 5);
+  free(line);
+  return target;
+}
+
+/**
+ * @return 0 and the commit @ref points to, or -1 if it does not exist
+ */
+int git_repo_resolve_ref(git_repo *repo, const char *ref,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  char *name = strdup(ref);
+  int depth;
+
+  for (depth = 0; depth < 5; depth++)
+    {
+      char *path, *line;
+      int result;
+
+      asprintf(&path, "%s/%s", ref_dir(repo, name), name);
+      line = read_first_line(path);
+      free(path);
+
+      if (line == NULL)
+        {
+          result = resolve_packed_ref(repo, name, id);
+          free(name);
+          return result;
+        }
+
+      if (strncmp(line, "ref: ", 5) != 0)
+        {
+          result = git_hex_to_id(line, id);
+          free(line);
+          free(name);
+          return result;
+        }
+
+      free(name);
+      name = strdup(line + 5);
+      free(line);
+    }
+
+  free(name);
+  return -1;
+}
+
+static int
+mkdir_parents(const char *path)
+{
+  char *copy = strdup(path);
+  char *slash;
+
+  for (slash = strchr(copy + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+      *slash = 0;
+      if (mkdir(copy, 0755) != 0 && errno != EEXIST)
+        {
+          free(copy);
+          return -1;
+        }
+      *slash = '/';
+    }
+  free(copy);
+  return 0;
+}
+
+static int
+fsync_parent_dir(const char *path)
+{
+  char *dir = strdup(path);
+  char *slash = strrchr(dir, '/');
+  int fd, result = -1;
+
+  if (slash != NULL)
+    *slash = 0;
+  fd = open(dir, O_RDONLY | O_DIRECTORY);
+  if (fd >= 0)
+    {
+      result = fsync(fd);
+      close(fd);
+    }
+  free(dir);
+  return result;
+}
+
+/*
+ * "Name <email> <seconds> <+hhmm>" for commits and reflogs, taken from the
+ * usual environment variables or the repository's [user] section.
+ */
+static char *
+config_get(git_repo *repo, const char *section, const char *key)
+{
+  char *path;
+  FILE *input;
+  char *line = NULL;
+  size_t size = 0;
+  int in_section = 0;
+  char *value = NULL;
+
+  asprintf(&path, "%s/config", repo->common_dir);
+  input = fopen(path, "r");
+  free(path);
+  if (input == NULL)
+    return NULL;
+
+  while (value == NULL && getline(&line, &size, input) != -1)
+    {
+      char *p = line + strspn(line, " \t");
+      char *end = p + strlen(p);
+
+      while (end > p && strchr(" \t\r\n", end[-1]) != NULL)
+        *--end = 0;
+
+      if (*p == '[')
+        in_section = strncasecmp(p + 1, section, strlen(section)) == 0
+            && p[1 + strlen(section)] == ']';
+      else if (in_section && strncasecmp(p, key, strlen(key)) == 0)
+        {
+          p += strlen(key);
+          p += strspn(p, " \t");
+          if (*p == '=')
+            value = strdup(p + 1 + strspn(p + 1, " \t"));
+        }
+    }
+
+  free(line);
+  fclose(input);
+  return value;
+}
+
+static char *
+identity(git_repo *repo, const char *role)
+{
+  char name_var[32], email_var[32];
+  const char *name, *email;
+  char *config_name = config_get(repo, "user", "name");
+  char *config_email = config_get(repo, "user", "email");
+  char *ident;
+  time_t now = time(NULL);
+  struct tm tm;
+  long offset;
+
+  snprintf(name_var, sizeof(name_var), "GIT_%s_NAME", role);
+  snprintf(email_var, sizeof(email_var), "GIT_%s_EMAIL", role);
+  name = getenv(name_var) ? getenv(name_var) : config_name ? config_name : "git-spot";
+  email = getenv(email_var) ? getenv(email_var) : config_email ? config_email : "git-spot@localhost";
+
+  localtime_r(&now, &tm);
+  offset = tm.tm_gmtoff / 60;
+  asprintf(&ident, "%s <%s> %ld %c%02ld%02ld", name, email, (long) now,
+      offset < 0 ? '-' : '+', labs(offset) / 60, labs(offset) % 60);
+
+  free(config_name);
+  free(config_email);
+  return ident;
+}
+
+/**
+ * Point @ref at @new_id, provided that it still points at @old_id (or
+ * does not exist yet, if @old_id is NULL).  The update is durable when
+ * this returns, and is recorded in the ref's reflog.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int git_repo_update_ref(git_repo *repo, const char *ref,
+    const unsigned char new_id[GIT_ID_LENGTH],
+    const unsigned char *old_id, const char *message)
+{
+  char *path, *lock_path, *log_path, *ident;
+  char new_hex[GIT_HEX_LENGTH + 1], old_hex[GIT_HEX_LENGTH + 1];
+  unsigned char current[GIT_ID_LENGTH];
+  int have_current;
+  FILE *log;
+  int fd, result = -1;
+
+  asprintf(&path, "%s/%s", ref_dir(repo, ref), ref);
+  asprintf(&lock_path, "%s.lock", path);
+  mkdir_parents(path);
+
+  fd = open(lock_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    {
+      printf("WARNING: could not lock %s: %s\n", ref, strerror(errno));
+      free(path);
+      free(lock_path);
+      return -1;
+    }
+
+  have_current = git_repo_resolve_ref(repo, ref, current) == 0;
+  if (have_current != (old_id != NULL)
+      || (old_id != NULL && memcmp(current, old_id, GIT_ID_LENGTH) != 0))
+    {
+      printf("WARNING: %s changed while saving, not updating it.\n", ref);
+      goto out;
+    }
+
+  git_id_to_hex(new_id, new_hex);
+  new_hex[GIT_HEX_LENGTH] = '\n';
+  if (write(fd, new_hex, GIT_HEX_LENGTH + 1) != GIT_HEX_LENGTH + 1
+      || fsync(fd) != 0)
+    goto out;
+  new_hex[GIT_HEX_LENGTH] = 0;
+
+  close(fd);
+  fd = -1;
+  if (rename(lock_path, path) != 0)
+    goto out;
+  fsync_parent_dir(path);
+  result = 0;
+
+  git_id_to_hex(old_id != NULL ? old_id : null_id, old_hex);
+
+  asprintf(&log_path, "%s/logs/%s", ref_dir(repo, ref), ref);
+  mkdir_parents(log_path);
+  ident = identity(repo, "COMMITTER");
+  log = fopen(log_path, "a");
+  if (log != NULL)
+    {
+      fprintf(log, "%s %s %s\t%s\n", old_hex, new_hex, ident, message);
+      fclose(log);
+    }
+  free(ident);
+  free(log_path);
+
+out:
+  if (fd >= 0)
+    {
+      close(fd);
+      unlink(lock_path);
+    }
+  free(path);
+  free(lock_path);
+  return result;
+}
+
+/**
+ * Write a commit object for @tree_id, with @parent_id as its only parent
+ * (or none, if NULL).
+ */
+int git_repo_write_commit(git_repo *repo, durable_batch *batch,
+    const unsigned char tree_id[GIT_ID_LENGTH],
+    const unsigned char *parent_id, const char *message,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  char tree_hex[GIT_HEX_LENGTH + 1], parent_hex[GIT_HEX_LENGTH + 1];
+  char *author = identity(repo, "AUTHOR");
+  char *committer = identity(repo, "COMMITTER");
+  char *commit;
+  int len, result;
+
+  git_id_to_hex(tree_id, tree_hex);
+  if (parent_id != NULL)
+    git_id_to_hex(parent_id, parent_hex);
+
+  len = asprintf(&commit, "tree %s\n%s%s%sauthor %s\ncommitter %s\n\n%s\n",
+      tree_hex,
+      parent_id ? "parent " : "", parent_id ? parent_hex : "",
+      parent_id ? "\n" : "",
+      author, committer, message);
+
+  result = git_repo_write_object(repo, batch, GIT_OBJ_COMMIT, commit, len, id);
+  free(commit);
+  free(author);
+  free(committer);
+  return result;
+}
+
+/**
+ * Look up the tree that the commit @commit_id records.
+ */
+int git_repo_commit_tree(git_repo *repo,
+    const unsigned char commit_id[GIT_ID_LENGTH],
+    unsigned char tree_id[GIT_ID_LENGTH])
+{
+  git_object_type type;
+  unsigned char *data;
+  size_t len;
+  int result = -1;
+
+  if (git_repo_read_object(repo, commit_id, &type, &data, &len) != 0)
+    return -1;
+
+  if (type == GIT_OBJ_COMMIT && len >= 5 + GIT_HEX_LENGTH
+      && memcmp(data, "tree ", 5) == 0)
+    result = git_hex_to_id((char *) data + 5, tree_id);
+
+  free(data);
+  return result;
+}
+
+/*
+ * In-memory trees
+ */
+
+/* git sorts tree entries as if directory names ended in '/' */
+static int
+entry_name_compare(const char *a, unsigned int a_mode,
+    const char *b, size_t b_len, unsigned int b_mode)
+{
+  size_t a_len = strlen(a);
+  size_t len = a_len < b_len ? a_len : b_len;
+  int cmp = memcmp(a, b, len);
+  unsigned char ca, cb;
+
+  if (cmp != 0)
+    return cmp;
+
+  ca = len < a_len ? a[len] : (a_mode == GIT_MODE_TREE ? '/' : 0);
+  cb = len < b_len ? b[len] : (b_mode == GIT_MODE_TREE ? '/' : 0);
+  return (int) ca - (int) cb;
+}
+
+static git_tree *
+git_tree_new(void)
+{
+  git_tree *tree = malloc(sizeof(git_tree));
+
+  tree->entries = NULL;
+  tree->num_entries = 0;
+  tree->size = 0;
+  tree->dirty = 1;
+  tree->has_base = 0;
+  return tree;
+}
+
+/**
+ * Load the tree @id, or create an empty one if @id is NULL.  Subtrees are
+ * only read when a path below them is edited.
+ *
+ * @return the tree, or NULL if @id could not be read
+ */
+git_tree *git_tree_load(git_repo *repo, const unsigned char *id)
+{
+  git_tree *tree = git_tree_new();
+  git_object_type type;
+  unsigned char *data, *p, *end;
+  size_t len;
+
+  if (id == NULL)
+    return tree;
+
+  if (git_repo_read_object(repo, id, &type, &data, &len) != 0)
+    {
+      git_tree_free(tree);
+      return NULL;
+    }
+  if (type != GIT_OBJ_TREE)
+    {
+      free(data);
+      git_tree_free(tree);
+      return NULL;
+    }
+
+  tree->dirty = 0;
+  tree->has_base = 1;
+  memcpy(tree->base_id, id, GIT_ID_LENGTH);
+  for (p = data, end = data + len; p < end; )
+    {
+      unsigned char *space = memchr(p, ' ', end - p);
+      unsigned char *nul = space ? memchr(space, 0, end - space) : NULL;
+      git_tree_entry *e;
+
+      if (nul == NULL || nul + 1 + GIT_ID_LENGTH > end)
+        break;
+
+      if (tree->num_entries == tree->size)
+        {
+          tree->size = tree->size ? tree->size * 2 : 16;
+          tree->entries = realloc(tree->entries, tree->size * sizeof(git_tree_entry));
+        }
+      e = &tree->entries[tree->num_entries++];
+      e->mode = strtoul((char *) p, NULL, 8);
+      e->name = strdup((char *) space + 1);
+      memcpy(e->id, nul + 1, GIT_ID_LENGTH);
+      e->subtree = NULL;
+      p = nul + 1 + GIT_ID_LENGTH;
+    }
+
+  free(data);
+  return tree;
+}
+
+void git_tree_free(git_tree *tree)
+{
+  int i;
+
+  if (tree == NULL)
+    return;
+
+  for (i = 0; i < tree->num_entries; i++)
+    {
+      free(tree->entries[i].name);
+      git_tree_free(tree->entries[i].subtree);
+    }
+  free(tree->entries);
+  free(tree);
+}
+
+/**
+ * Binary search for the entry called @name (@len bytes) of the given kind.
+ *
+ * @return its index, or -(insertion point) - 1 if it is not there
+ */
+static int
+tree_find(git_tree *tree, const char *name, size_t len, unsigned int mode)
+{
+  int lo = 0, hi = tree->num_entries;
+
+  while (lo < hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+      int cmp = entry_name_compare(tree->entries[mid].name,
+          tree->entries[mid].mode, name, len, mode);
+      if (cmp == 0)
+        return mid;
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return -lo - 1;
+}
+
+static git_tree_entry *
+tree_insert(git_tree *tree, int position, const char *name, size_t len,
+    unsigned int mode)
+{
+  git_tree_entry *e;
+
+  if (tree->num_entries == tree->size)
+    {
+      tree->size = tree->size ? tree->size * 2 : 16;
+      tree->entries = realloc(tree->entries, tree->size * sizeof(git_tree_entry));
+    }
+
+  memmove(tree->entries + position + 1, tree->entries + position,
+      (tree->num_entries - position) * sizeof(git_tree_entry));
+  tree->num_entries ++;
+
+  e = &tree->entries[position];
+  e->name = strndup(name, len);
+  e->mode = mode;
+  memset(e->id, 0, GIT_ID_LENGTH);
+  e->subtree = NULL;
+  return e;
+}
+
+static void
+tree_delete(git_tree *tree, int position)
+{
+  free(tree->entries[position].name);
+  git_tree_free(tree->entries[position].subtree);
+  memmove(tree->entries + position, tree->entries + position + 1,
+      (tree->num_entries - position - 1) * sizeof(git_tree_entry));
+  tree->num_entries --;
+  tree->dirty = 1;
+}
+
+static git_tree *
+entry_subtree(git_repo *repo, git_tree_entry *e)
+{
+  if (e->subtree == NULL)
+    e->subtree = git_tree_load(repo, e->id);
+  return e->subtree;
+}
+
+/**
+ * Look up the file @path (relative to @tree).
+ *
+ * @return 0 with its object in @id, -1 if there is no such file
+ */
+int git_tree_get(git_repo *repo, git_tree *tree, const char *path,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  const char *slash = strchr(path, '/');
+  int i;
+
+  if (slash == NULL)
+    {
+      i = tree_find(tree, path, strlen(path), GIT_MODE_FILE);
+      if (i < 0)
+        return -1;
+      memcpy(id, tree->entries[i].id, GIT_ID_LENGTH);
+      return 0;
+    }
+
+  if (slash == path)
+    return git_tree_get(repo, tree, slash + 1, id);
+
+  i = tree_find(tree, path, slash - path, GIT_MODE_TREE);
+  if (i < 0 || entry_subtree(repo, &tree->entries[i]) == NULL)
+    return -1;
+  return git_tree_get(repo, tree->entries[i].subtree, slash + 1, id);
+}
+
+/**
+ * Make @path (relative to @tree) a file with the given mode and object,
+ * creating directories as needed.  Setting an entry to what it already
+ * is leaves the tree clean.
+ */
+int git_tree_set(git_repo *repo, git_tree *tree, const char *path,
+    unsigned int mode, const unsigned char id[GIT_ID_LENGTH])
+{
+  const char *slash = strchr(path, '/');
+  git_tree_entry *e;
+  int i;
+
+  if (slash == NULL)
+    {
+      i = tree_find(tree, path, strlen(path), mode);
+      if (i < 0)
+        {
+          /* a directory of the same name has to make way */
+          int dir = tree_find(tree, path, strlen(path), GIT_MODE_TREE);
+          if (dir >= 0)
+            tree_delete(tree, dir);
+          i = tree_find(tree, path, strlen(path), mode);
+          e = tree_insert(tree, -i - 1, path, strlen(path), mode);
+        }
+      else
+        {
+          e = &tree->entries[i];
+          if (e->mode == mode && memcmp(e->id, id, GIT_ID_LENGTH) == 0)
+            return 0;
+          e->mode = mode;
+        }
+      memcpy(e->id, id, GIT_ID_LENGTH);
+      tree->dirty = 1;
+      return 0;
+    }
+
+  if (slash == path)
+    return git_tree_set(repo, tree, slash + 1, mode, id);
+
+  i = tree_find(tree, path, slash - path, GIT_MODE_TREE);
+  if (i < 0)
+    {
+      int file = tree_find(tree, path, slash - path, GIT_MODE_FILE);
+      if (file >= 0)
+        tree_delete(tree, file);
+      i = tree_find(tree, path, slash - path, GIT_MODE_TREE);
+      e = tree_insert(tree, -i - 1, path, slash - path, GIT_MODE_TREE);
+      e->subtree = git_tree_new();
+      tree->dirty = 1;
+    }
+  else
+    e = &tree->entries[i];
+
+  if (entry_subtree(repo, e) == NULL)
+    {
+      char hex[GIT_HEX_LENGTH + 1];
+      git_id_to_hex(e->id, hex);
+      printf("WARNING: could not read tree %s.\n", hex);
+      return -1;
+    }
+
+  if (git_tree_set(repo, e->subtree, slash + 1, mode, id) != 0)
+    return -1;
+  if (e->subtree->dirty)
+    tree->dirty = 1;
+  return 0;
+}
+
+/**
+ * Remove the file @path, and any directories that become empty.
+ */
+int git_tree_remove(git_repo *repo, git_tree *tree, const char *path)
+{
+  const char *slash = strchr(path, '/');
+  int i;
+
+  if (slash == NULL)
+    {
+      i = tree_find(tree, path, strlen(path), GIT_MODE_FILE);
+      if (i >= 0)
+        tree_delete(tree, i);
+      return 0;
+    }
+
+  if (slash == path)
+    return git_tree_remove(repo, tree, slash + 1);
+
+  i = tree_find(tree, path, slash - path, GIT_MODE_TREE);
+  if (i < 0)
+    return 0;
+  if (entry_subtree(repo, &tree->entries[i]) == NULL)
+    return -1;
+  if (git_tree_remove(repo, tree->entries[i].subtree, slash + 1) != 0)
+    return -1;
+
+  if (tree->entries[i].subtree->num_entries == 0)
+    tree_delete(tree, i);
+  else if (tree->entries[i].subtree->dirty)
+    tree->dirty = 1;
+  return 0;
+}
+
+/**
+ * Write every tree that was changed, bottom up, and return the id of the
+ * top one.
+ */
+int git_tree_write(git_repo *repo, durable_batch *batch, git_tree *tree,
+    unsigned char id[GIT_ID_LENGTH])
+{
+  char *data = NULL;
+  size_t len = 0;
+  FILE *output;
+  int i, result;
+
+  for (i = 0; i < tree->num_entries; i++)
+    {
+      git_tree_entry *e = &tree->entries[i];
+      if (e->subtree != NULL && e->subtree->dirty
+          && git_tree_write(repo, batch, e->subtree, e->id) != 0)
+        return -1;
+    }
+
+  output = open_memstream(&data, &len);
+  for (i = 0; i < tree->num_entries; i++)
+    {
+      fprintf(output, "%o %s", tree->entries[i].mode, tree->entries[i].name);
+      fputc(0, output);
+      fwrite(tree->entries[i].id, 1, GIT_ID_LENGTH, output);
+    }
+  fclose(output);
+
+  result = git_repo_write_delta_object(repo, batch, GIT_OBJ_TREE, data, len,
+      tree->has_base ? tree->base_id : NULL, NULL, 0, id);
+  if (result == 0)
+    tree->dirty = 0;
+  free(data);
+  return result;
+}
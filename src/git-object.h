@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef GIT_OBJECT_H__
+#define GIT_OBJECT_H__
+
+#include <stddef.h>
+
+#include "durable.h"
+
+/**
+ * Just enough of git's object store to commit snapshots without forking
+ * git: loose and packed objects can be read, new objects are written loose
+ * through a durable_batch (or into a pack, see git-pack.h), and a tree can
+ * be edited in memory so that only the trees along changed paths have to
+ * be rewritten.
+ */
+
+#define GIT_ID_LENGTH 20
+#define GIT_HEX_LENGTH 40
+
+/* Numbered as in pack files */
+typedef enum {
+  GIT_OBJ_NONE = 0,
+  GIT_OBJ_COMMIT = 1,
+  GIT_OBJ_TREE = 2,
+  GIT_OBJ_BLOB = 3,
+  GIT_OBJ_TAG = 4,
+  GIT_OBJ_OFS_DELTA = 6,
+  GIT_OBJ_REF_DELTA = 7
+} git_object_type;
+
+#define GIT_MODE_FILE 0100644
+#define GIT_MODE_TREE 040000
+
+typedef struct _git_repo git_repo;
+typedef struct _git_tree git_tree;
+typedef struct _git_pack_writer git_pack_writer;
+
+extern git_repo *git_repo_discover(const char *path);
+extern void git_repo_free(git_repo *repo);
+extern const char *git_repo_dir(git_repo *repo);
+extern char *git_repo_relative_path(git_repo *repo, const char *path);
+extern void git_repo_reload_packs(git_repo *repo);
+extern void git_repo_set_pack_writer(git_repo *repo, git_pack_writer *writer);
+
+extern void git_id_to_hex(const unsigned char id[GIT_ID_LENGTH],
+    char hex[GIT_HEX_LENGTH + 1]);
+extern int git_hex_to_id(const char *hex, unsigned char id[GIT_ID_LENGTH]);
+extern const char *git_object_type_name(git_object_type type);
+
+extern void git_hash_object(git_object_type type, const void *data, size_t len,
+    unsigned char id[GIT_ID_LENGTH]);
+extern int git_repo_has_object(git_repo *repo, const unsigned char id[GIT_ID_LENGTH]);
+extern int git_repo_read_object(git_repo *repo, const unsigned char id[GIT_ID_LENGTH],
+    git_object_type *type, unsigned char **data, size_t *len);
+extern int git_repo_write_object(git_repo *repo, durable_batch *batch,
+    git_object_type type, const void *data, size_t len,
+    unsigned char id[GIT_ID_LENGTH]);
+extern int git_repo_write_delta_object(git_repo *repo, durable_batch *batch,
+    git_object_type type, const void *data, size_t len,
+    const unsigned char *base_id, const void *base_data, size_t base_len,
+    unsigned char id[GIT_ID_LENGTH]);
+
+extern int git_repo_resolve_ref(git_repo *repo, const char *ref,
+    unsigned char id[GIT_ID_LENGTH]);
+extern int git_repo_update_ref(git_repo *repo, const char *ref,
+    const unsigned char new_id[GIT_ID_LENGTH],
+    const unsigned char *old_id, const char *message);
+extern char *git_repo_symbolic_ref(git_repo *repo, const char *ref);
+
+extern int git_repo_write_commit(git_repo *repo, durable_batch *batch,
+    const unsigned char tree_id[GIT_ID_LENGTH],
+    const unsigned char *parent_id, const char *message,
+    unsigned char id[GIT_ID_LENGTH]);
+extern int git_repo_commit_tree(git_repo *repo,
+    const unsigned char commit_id[GIT_ID_LENGTH],
+    unsigned char tree_id[GIT_ID_LENGTH]);
+
+extern int git_apply_delta(const unsigned char *base, size_t base_len,
+    const unsigned char *delta, size_t delta_len,
+    unsigned char **result, size_t *result_len);
+
+extern git_tree *git_tree_load(git_repo *repo, const unsigned char *id);
+extern void git_tree_free(git_tree *tree);
+extern int git_tree_get(git_repo *repo, git_tree *tree, const char *path,
+    unsigned char id[GIT_ID_LENGTH]);
+extern int git_tree_set(git_repo *repo, git_tree *tree, const char *path,
+    unsigned int mode, const unsigned char id[GIT_ID_LENGTH]);
+extern int git_tree_remove(git_repo *repo, git_tree *tree, const char *path);
+extern int git_tree_write(git_repo *repo, durable_batch *batch, git_tree *tree,
+    unsigned char id[GIT_ID_LENGTH]);
+
+#endif // GIT_OBJECT_H__
@@ -0,0 +1,883 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#include "git-pack.h"
+#include "sha1.h"
+
+/* Names the pack git-spot appends to, relative to $GIT_DIR */
+#define STATE_FILENAME "git-spot-pack"
+
+/**
+ * A pack that has grown this big is left as it is and the run starts a
+ * new one, so carrying the pack over costs a bounded amount of I/O.
+ */
+#define PACK_ROLLOVER_SIZE (8 << 20)
+
+/* Bytes per indexed block of a delta base */
+#define DELTA_BLOCK 16
+
+typedef struct {
+  unsigned char id[GIT_ID_LENGTH];
+  uint32_t crc;
+  uint64_t offset;
+  int depth;
+} pack_entry;
+
+struct _git_pack_writer {
+  git_repo *repo;
+  char *pack_dir;
+
+  /* The pack carried over from the last run, if any */
+  char *old_name;
+  const unsigned char *old_pack;
+  size_t old_pack_len;
+  const unsigned char *old_idx;
+  size_t old_idx_len;
+  uint32_t old_count;
+
+  /* Entries added by this run, and a hash table of their indices + 1 */
+  pack_entry *entries;
+  int num_entries;
+  int entries_size;
+  int *slots;
+  unsigned int num_slots;
+  int num_deltas;
+
+  /* Their pack data, which follows the old pack's entries */
+  unsigned char *data;
+  size_t len;
+  size_t size;
+};
+
+static uint32_t
+read_be32(const unsigned char *p)
+{
+  return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void
+write_be32(unsigned char *p, uint32_t value)
+{
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static const unsigned char *
+map_file(const char *path, size_t *len)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  void *map = MAP_FAILED;
+
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return NULL;
+  *len = st.st_size;
+  return map;
+}
+
+/*
+ * The old pack
+ */
+
+static size_t
+old_body_len(git_pack_writer *w)
+{
+  return w->old_pack != NULL ? w->old_pack_len - 12 - GIT_ID_LENGTH : 0;
+}
+
+static void
+old_pack_close(git_pack_writer *w)
+{
+  if (w->old_pack != NULL)
+    munmap((void *) w->old_pack, w->old_pack_len);
+  if (w->old_idx != NULL)
+    munmap((void *) w->old_idx, w->old_idx_len);
+  w->old_pack = NULL;
+  w->old_idx = NULL;
+  w->old_count = 0;
+  free(w->old_name);
+  w->old_name = NULL;
+}
+
+static void
+old_pack_open(git_pack_writer *w)
+{
+  char *state_path, *pack_path, *idx_path;
+  char name[64];
+  FILE *input;
+  size_t expected;
+
+  asprintf(&state_path, "%s/%s", git_repo_dir(w->repo), STATE_FILENAME);
+  input = fopen(state_path, "r");
+  free(state_path);
+  if (input == NULL)
+    return;
+  if (fscanf(input, "%63s", name) != 1 || strncmp(name, "pack-", 5) != 0)
+    {
+      fclose(input);
+      return;
+    }
+  fclose(input);
+
+  asprintf(&pack_path, "%s/%s.pack", w->pack_dir, name);
+  asprintf(&idx_path, "%s/%s.idx", w->pack_dir, name);
+  w->old_name = strdup(name);
+  w->old_pack = map_file(pack_path, &w->old_pack_len);
+  w->old_idx = map_file(idx_path, &w->old_idx_len);
+
+  if (w->old_pack == NULL || w->old_idx == NULL)
+    {
+      /* Most likely repacked by git gc; start a new pack */
+      old_pack_close(w);
+    }
+  else if (w->old_idx_len < 8 + 256 * 4
+      || memcmp(w->old_idx, "\377tOc\0\0\0\2", 8) != 0
+      || w->old_pack_len < 12 + GIT_ID_LENGTH
+      || memcmp(w->old_pack, "PACK\0\0\0\2", 8) != 0)
+    {
+      printf("WARNING: ignoring unsupported pack %s.\n", pack_path);
+      old_pack_close(w);
+    }
+  else if (w->old_pack_len >= PACK_ROLLOVER_SIZE)
+    {
+      /* Full: it stays where it is, for git gc to consolidate */
+      old_pack_close(w);
+    }
+  else
+    {
+      w->old_count = read_be32(w->old_idx + 8 + 255 * 4);
+      expected = 8 + 256 * 4 + (size_t) w->old_count * (GIT_ID_LENGTH + 8)
+          + 2 * GIT_ID_LENGTH;
+      if (read_be32(w->old_pack + 8) != w->old_count || w->old_idx_len < expected)
+        {
+          printf("WARNING: ignoring inconsistent pack %s.\n", pack_path);
+          old_pack_close(w);
+        }
+    }
+
+  free(pack_path);
+  free(idx_path);
+}
+
+static const unsigned char *
+old_id(git_pack_writer *w, uint32_t i)
+{
+  return w->old_idx + 8 + 256 * 4 + (size_t) i * GIT_ID_LENGTH;
+}
+
+static uint32_t
+old_crc(git_pack_writer *w, uint32_t i)
+{
+  return read_be32(old_id(w, w->old_count) + (size_t) i * 4);
+}
+
+static uint64_t
+old_offset(git_pack_writer *w, uint32_t i)
+{
+  const unsigned char *offsets = old_id(w, w->old_count) + (size_t) w->old_count * 4;
+  uint32_t offset = read_be32(offsets + (size_t) i * 4);
+
+  if (offset & 0x80000000)
+    {
+      const unsigned char *large = offsets + (size_t) w->old_count * 4
+          + (size_t) (offset & 0x7fffffff) * 8;
+      return (uint64_t) read_be32(large) << 32 | read_be32(large + 4);
+    }
+  return offset;
+}
+
+/**
+ * @return the index of @id in the old pack, or -1
+ */
+static int64_t
+old_find(git_pack_writer *w, const unsigned char id[GIT_ID_LENGTH])
+{
+  const unsigned char *fanout = w->old_idx + 8;
+  uint32_t lo, hi;
+
+  if (w->old_idx == NULL)
+    return -1;
+
+  lo = id[0] == 0 ? 0 : read_be32(fanout + (id[0] - 1) * 4);
+  hi = read_be32(fanout + id[0] * 4);
+  while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      int cmp = memcmp(old_id(w, mid), id, GIT_ID_LENGTH);
+
+      if (cmp == 0)
+        return mid;
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return -1;
+}
+
+/**
+ * Follow the OFS_DELTA chain from @offset in the old pack.
+ *
+ * @return the length of the chain, GIT_PACK_MAX_DELTA_DEPTH if it is at
+ * least that long or cannot be followed
+ */
+static int
+old_depth(git_pack_writer *w, uint64_t offset)
+{
+  const unsigned char *end = w->old_pack + w->old_pack_len - GIT_ID_LENGTH;
+  int depth;
+
+  for (depth = 0; depth < GIT_PACK_MAX_DELTA_DEPTH; depth++)
+    {
+      const unsigned char *p = w->old_pack + offset;
+      git_object_type type;
+      uint64_t distance;
+
+      if (offset < 12 || p >= end)
+        break;
+      type = (*p >> 4) & 7;
+      while ((*p++ & 0x80) && p < end)
+        ;
+      if (type != GIT_OBJ_OFS_DELTA)
+        return type == GIT_OBJ_REF_DELTA ? GIT_PACK_MAX_DELTA_DEPTH : depth;
+
+      distance = *p & 0x7f;
+      while ((*p++ & 0x80) && p < end)
+        distance = ((distance + 1) << 7) | (*p & 0x7f);
+      if (distance > offset)
+        break;
+      offset -= distance;
+    }
+  return GIT_PACK_MAX_DELTA_DEPTH;
+}
+
+/*
+ * New entries
+ */
+
+static unsigned int
+id_hash(const unsigned char *id)
+{
+  return id[0] | id[1] << 8 | id[2] << 16 | (unsigned int) id[3] << 24;
+}
+
+static pack_entry *
+new_find(git_pack_writer *w, const unsigned char id[GIT_ID_LENGTH])
+{
+  unsigned int i;
+
+  if (w->num_slots == 0)
+    return NULL;
+
+  for (i = id_hash(id) & (w->num_slots - 1); w->slots[i] != 0;
+       i = (i + 1) & (w->num_slots - 1))
+    if (memcmp(w->entries[w->slots[i] - 1].id, id, GIT_ID_LENGTH) == 0)
+      return &w->entries[w->slots[i] - 1];
+  return NULL;
+}
+
+static void
+new_index(git_pack_writer *w, int n)
+{
+  unsigned int i;
+
+  for (i = id_hash(w->entries[n].id) & (w->num_slots - 1); w->slots[i] != 0;
+       i = (i + 1) & (w->num_slots - 1))
+    ;
+  w->slots[i] = n + 1;
+}
+
+static pack_entry *
+new_entry(git_pack_writer *w, const unsigned char id[GIT_ID_LENGTH])
+{
+  pack_entry *e;
+  int n;
+
+  if (w->num_entries == w->entries_size)
+    {
+      w->entries_size = w->entries_size ? w->entries_size * 2 : 64;
+      w->entries = realloc(w->entries, w->entries_size * sizeof(pack_entry));
+    }
+
+  if ((unsigned int) (w->num_entries + 1) * 2 > w->num_slots)
+    {
+      free(w->slots);
+      w->num_slots = w->num_slots ? w->num_slots * 2 : 128;
+      w->slots = calloc(w->num_slots, sizeof(int));
+      for (n = 0; n < w->num_entries; n++)
+        new_index(w, n);
+    }
+
+  e = &w->entries[w->num_entries];
+  memcpy(e->id, id, GIT_ID_LENGTH);
+  new_index(w, w->num_entries++);
+  return e;
+}
+
+/**
+ * Append one entry: a whole object if @base_offset is 0, otherwise a delta
+ * against the entry at @base_offset.
+ */
+static int
+append_entry(git_pack_writer *w, git_object_type type,
+    const unsigned char id[GIT_ID_LENGTH], const void *payload, size_t len,
+    uint64_t base_offset, int depth)
+{
+  uint64_t offset = 12 + old_body_len(w) + w->len;
+  unsigned char header[32];
+  size_t header_len = 0;
+  size_t size = len;
+  unsigned char c;
+  z_stream zs;
+  size_t bound;
+  pack_entry *e;
+
+  c = (base_offset ? GIT_OBJ_OFS_DELTA : type) << 4 | (size & 0xf);
+  size >>= 4;
+  while (size != 0)
+    {
+      header[header_len++] = c | 0x80;
+      c = size & 0x7f;
+      size >>= 7;
+    }
+  header[header_len++] = c;
+
+  if (base_offset)
+    {
+      unsigned char distance[16];
+      uint64_t d = offset - base_offset;
+      int pos = sizeof(distance) - 1;
+
+      distance[pos] = d & 0x7f;
+      while (d >>= 7)
+        distance[--pos] = 0x80 | (--d & 0x7f);
+      memcpy(header + header_len, distance + pos, sizeof(distance) - pos);
+      header_len += sizeof(distance) - pos;
+    }
+
+  memset(&zs, 0, sizeof(zs));
+  deflateInit(&zs, Z_DEFAULT_COMPRESSION);
+  bound = header_len + deflateBound(&zs, len);
+  if (w->len + bound > w->size)
+    {
+      while (w->len + bound > w->size)
+        w->size = w->size ? w->size * 2 : 65536;
+      w->data = realloc(w->data, w->size);
+    }
+
+  memcpy(w->data + w->len, header, header_len);
+  zs.next_in = (unsigned char *) payload;
+  zs.avail_in = len;
+  zs.next_out = w->data + w->len + header_len;
+  zs.avail_out = bound - header_len;
+  if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+    {
+      deflateEnd(&zs);
+      return -1;
+    }
+
+  e = new_entry(w, id);
+  e->offset = offset;
+  e->depth = depth;
+  e->crc = crc32(0, w->data + w->len, header_len + zs.total_out);
+  w->len += header_len + zs.total_out;
+  deflateEnd(&zs);
+  return 0;
+}
+
+/*
+ * The writer
+ */
+
+/**
+ * Start a pack for @repo that carries over git-spot's previous pack, unless
+ * that one has reached PACK_ROLLOVER_SIZE.
+ */
+git_pack_writer *git_pack_writer_new(git_repo *repo)
+{
+  git_pack_writer *w = calloc(1, sizeof(git_pack_writer));
+
+  w->repo = repo;
+  asprintf(&w->pack_dir, "%s/objects/pack", git_repo_dir(repo));
+  old_pack_open(w);
+  return w;
+}
+
+/**
+ * Add an object with the given (already computed) @id.  If @base_id is
+ * given, the object is stored as a delta against it when that is small
+ * enough and the chain not too long, adding the base itself to the pack if
+ * it is not there yet.  @base_data may hold the base's contents.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int git_pack_writer_add(git_pack_writer *w, git_object_type type,
+    const void *data, size_t len, const unsigned char id[GIT_ID_LENGTH],
+    const unsigned char *base_id, const void *base_data, size_t base_len)
+{
+  unsigned char *read_data = NULL;
+  unsigned char *delta = NULL;
+  size_t delta_len = 0;
+  uint64_t base_offset = 0;
+  int base_depth = 0;
+  pack_entry *base;
+  int64_t i;
+  int result;
+
+  if (new_find(w, id) != NULL || old_find(w, id) >= 0)
+    return 0;
+  if (base_id != NULL && memcmp(base_id, id, GIT_ID_LENGTH) == 0)
+    base_id = NULL;
+
+  if (base_id != NULL)
+    {
+      if ((base = new_find(w, base_id)) != NULL)
+        {
+          base_offset = base->offset;
+          base_depth = base->depth;
+        }
+      else if ((i = old_find(w, base_id)) >= 0)
+        {
+          base_offset = old_offset(w, i);
+          base_depth = old_depth(w, base_offset);
+        }
+      if (base_depth >= GIT_PACK_MAX_DELTA_DEPTH)
+        base_id = NULL;
+    }
+
+  if (base_id != NULL && base_data == NULL)
+    {
+      git_object_type base_type;
+
+      if (git_repo_read_object(w->repo, base_id, &base_type, &read_data,
+          &base_len) != 0 || base_type != type)
+        base_id = NULL;
+      base_data = read_data;
+    }
+
+  /* A delta that saves less than half is not worth the chain */
+  if (base_id != NULL
+      && (git_delta_create(base_data, base_len, data, len, &delta, &delta_len) != 0
+          || delta_len >= len / 2))
+    base_id = NULL;
+
+  if (base_id != NULL && base_offset == 0)
+    {
+      if (git_pack_writer_add(w, type, base_data, base_len, base_id,
+          NULL, NULL, 0) != 0)
+        base_id = NULL;
+      else
+        base_offset = new_find(w, base_id)->offset;
+    }
+
+  if (base_id != NULL)
+    {
+      result = append_entry(w, type, id, delta, delta_len, base_offset,
+          base_depth + 1);
+      if (result == 0)
+        w->num_deltas ++;
+    }
+  else
+    result = append_entry(w, type, id, data, len, 0, 0);
+
+  free(read_data);
+  free(delta);
+  return result;
+}
+
+static int
+entry_compare(const void *a, const void *b)
+{
+  return memcmp(((const pack_entry *) a)->id, ((const pack_entry *) b)->id,
+      GIT_ID_LENGTH);
+}
+
+/**
+ * Build a version 2 index of the old entries followed by the new ones.
+ */
+static unsigned char *
+build_index(git_pack_writer *w, const unsigned char pack_id[GIT_ID_LENGTH],
+    size_t *len)
+{
+  uint32_t total = w->old_count + w->num_entries;
+  pack_entry *sorted = malloc((w->num_entries + 1) * sizeof(pack_entry));
+  uint32_t num_large = 0;
+  unsigned char *idx, *fanout, *ids, *crcs, *offsets, *large;
+  uint32_t i, o = 0, n = 0;
+  sha1_context sha;
+
+  memcpy(sorted, w->entries, w->num_entries * sizeof(pack_entry));
+  qsort(sorted, w->num_entries, sizeof(pack_entry), entry_compare);
+
+  for (i = 0; i < (uint32_t) w->num_entries; i++)
+    if (sorted[i].offset > 0x7fffffff)
+      num_large ++;
+  for (i = 0; i < w->old_count; i++)
+    if (old_offset(w, i) > 0x7fffffff)
+      num_large ++;
+
+  *len = 8 + 256 * 4 + (size_t) total * (GIT_ID_LENGTH + 8)
+      + (size_t) num_large * 8 + 2 * GIT_ID_LENGTH;
+  idx = malloc(*len);
+  memcpy(idx, "\377tOc\0\0\0\2", 8);
+  fanout = idx + 8;
+  ids = fanout + 256 * 4;
+  crcs = ids + (size_t) total * GIT_ID_LENGTH;
+  offsets = crcs + (size_t) total * 4;
+  large = offsets + (size_t) total * 4;
+  memset(fanout, 0, 256 * 4);
+  num_large = 0;
+
+  for (i = 0; i < total; i++)
+    {
+      const unsigned char *id;
+      uint32_t crc;
+      uint64_t offset;
+      int b;
+
+      if (n == (uint32_t) w->num_entries
+          || (o < w->old_count && memcmp(old_id(w, o), sorted[n].id, GIT_ID_LENGTH) < 0))
+        {
+          id = old_id(w, o);
+          crc = old_crc(w, o);
+          offset = old_offset(w, o);
+          o++;
+        }
+      else
+        {
+          id = sorted[n].id;
+          crc = sorted[n].crc;
+          offset = sorted[n].offset;
+          n++;
+        }
+
+      memcpy(ids + (size_t) i * GIT_ID_LENGTH, id, GIT_ID_LENGTH);
+      write_be32(crcs + (size_t) i * 4, crc);
+      if (offset > 0x7fffffff)
+        {
+          write_be32(offsets + (size_t) i * 4, 0x80000000 | num_large);
+          write_be32(large + (size_t) num_large * 8, offset >> 32);
+          write_be32(large + (size_t) num_large * 8 + 4, offset & 0xffffffff);
+          num_large ++;
+        }
+      else
+        write_be32(offsets + (size_t) i * 4, offset);
+
+      for (b = id[0]; b < 256; b++)
+        write_be32(fanout + b * 4, read_be32(fanout + b * 4) + 1);
+    }
+
+  large += (size_t) num_large * 8;
+  memcpy(large, pack_id, GIT_ID_LENGTH);
+  sha1_init(&sha);
+  sha1_update(&sha, idx, large + GIT_ID_LENGTH - idx);
+  sha1_final(&sha, large + GIT_ID_LENGTH);
+
+  free(sorted);
+  return idx;
+}
+
+/**
+ * Queue the finished pack, its index and the new state file in @batch,
+ * and the old pack's removal after them.  Does nothing if no object was
+ * added.
+ *
+ * @return 0 on success, -1 if the pack could not be written
+ */
+int git_pack_writer_finish(git_pack_writer *w, durable_batch *batch)
+{
+  unsigned char header[12];
+  unsigned char pack_id[GIT_ID_LENGTH];
+  char hex[GIT_HEX_LENGTH + 1];
+  struct iovec iov[4];
+  sha1_context sha;
+  char *path, *contents;
+  unsigned char *idx;
+  size_t idx_len;
+  int i, iovcnt = 0;
+  int result = -1;
+
+  if (w->num_entries == 0)
+    return 0;
+
+  memcpy(header, "PACK\0\0\0\2", 8);
+  write_be32(header + 8, w->old_count + w->num_entries);
+
+  iov[iovcnt].iov_base = header;
+  iov[iovcnt++].iov_len = sizeof(header);
+  if (w->old_pack != NULL)
+    {
+      iov[iovcnt].iov_base = (void *) (w->old_pack + 12);
+      iov[iovcnt++].iov_len = old_body_len(w);
+    }
+  iov[iovcnt].iov_base = w->data;
+  iov[iovcnt++].iov_len = w->len;
+
+  sha1_init(&sha);
+  for (i = 0; i < iovcnt; i++)
+    sha1_update(&sha, iov[i].iov_base, iov[i].iov_len);
+  sha1_final(&sha, pack_id);
+  iov[iovcnt].iov_base = pack_id;
+  iov[iovcnt++].iov_len = GIT_ID_LENGTH;
+  git_id_to_hex(pack_id, hex);
+
+  if (mkdir(w->pack_dir, 0755) != 0 && errno != EEXIST)
+    {
+      printf("WARNING: mkdir(\"%s\") failed.\n", w->pack_dir);
+      return -1;
+    }
+
+  /* The pack has to be in place before the index that makes it visible */
+  asprintf(&path, "%s/pack-%s.pack", w->pack_dir, hex);
+  if (durable_batch_writev(batch, path, iov, iovcnt) != 0)
+    {
+      free(path);
+      return -1;
+    }
+  free(path);
+
+  idx = build_index(w, pack_id, &idx_len);
+  asprintf(&path, "%s/pack-%s.idx", w->pack_dir, hex);
+  if (durable_batch_write(batch, path, idx, idx_len) == 0)
+    {
+      free(path);
+      asprintf(&path, "%s/%s", git_repo_dir(w->repo), STATE_FILENAME);
+      asprintf(&contents, "pack-%s\n", hex);
+      result = durable_batch_write(batch, path, contents, strlen(contents));
+      free(contents);
+    }
+  free(path);
+  free(idx);
+
+  /* Every entry of the old pack is in the new one */
+  if (result == 0 && w->old_name != NULL)
+    {
+      asprintf(&path, "%s/%s.idx", w->pack_dir, w->old_name);
+      durable_batch_unlink(batch, path);
+      free(path);
+      asprintf(&path, "%s/%s.pack", w->pack_dir, w->old_name);
+      durable_batch_unlink(batch, path);
+      free(path);
+    }
+  return result;
+}
+
+void git_pack_writer_stats(git_pack_writer *w, int *num_objects,
+    int *num_deltas, size_t *bytes)
+{
+  *num_objects = w->num_entries;
+  *num_deltas = w->num_deltas;
+  *bytes = w->len;
+}
+
+void git_pack_writer_free(git_pack_writer *w)
+{
+  if (w == NULL)
+    return;
+  old_pack_close(w);
+  free(w->pack_dir);
+  free(w->entries);
+  free(w->slots);
+  free(w->data);
+  free(w);
+}
+
+/*
+ * Delta encoding
+ */
+
+static uint32_t
+block_hash(const unsigned char *p)
+{
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i = 0; i < DELTA_BLOCK; i++)
+    h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+static void
+delta_reserve(unsigned char **out, size_t *len, size_t *size, size_t extra)
+{
+  if (*len + extra > *size)
+    {
+      while (*len + extra > *size)
+        *size *= 2;
+      *out = realloc(*out, *size);
+    }
+}
+
+static void
+delta_put_size(unsigned char *out, size_t *len, size_t size)
+{
+  do
+    {
+      out[(*len)++] = (size >= 0x80 ? 0x80 : 0) | (size & 0x7f);
+      size >>= 7;
+    }
+  while (size != 0);
+}
+
+static void
+delta_insert(unsigned char **out, size_t *len, size_t *size,
+    const unsigned char *data, size_t n)
+{
+  while (n > 0)
+    {
+      size_t chunk = n > 0x7f ? 0x7f : n;
+
+      delta_reserve(out, len, size, chunk + 1);
+      (*out)[(*len)++] = chunk;
+      memcpy(*out + *len, data, chunk);
+      *len += chunk;
+      data += chunk;
+      n -= chunk;
+    }
+}
+
+static void
+delta_copy(unsigned char **out, size_t *len, size_t *size,
+    uint64_t offset, size_t n)
+{
+  while (n > 0)
+    {
+      size_t chunk = n > 0xffffff ? 0xffffff : n;
+      unsigned char *cmd;
+      int i;
+
+      delta_reserve(out, len, size, 8);
+      cmd = *out + (*len)++;
+      *cmd = 0x80;
+      for (i = 0; i < 4; i++)
+        if ((offset >> (i * 8)) & 0xff)
+          {
+            *cmd |= 1 << i;
+            (*out)[(*len)++] = (offset >> (i * 8)) & 0xff;
+          }
+      for (i = 0; i < 3; i++)
+        if ((chunk >> (i * 8)) & 0xff)
+          {
+            *cmd |= 0x10 << i;
+            (*out)[(*len)++] = (chunk >> (i * 8)) & 0xff;
+          }
+      offset += chunk;
+      n -= chunk;
+    }
+}
+
+/**
+ * Encode @target as a git delta against @base: every DELTA_BLOCK-aligned
+ * block of @base is indexed, and matches found at any offset in @target
+ * are extended in both directions into copy instructions.
+ *
+ * @return 0 with a malloc()ed delta, -1 if @base is too big to address
+ */
+int git_delta_create(const unsigned char *base, size_t base_len,
+    const unsigned char *target, size_t target_len,
+    unsigned char **delta, size_t *delta_len)
+{
+  unsigned int num_slots = 64, mask;
+  uint32_t *slots;
+  size_t i, j, literal, len = 0, size = 256;
+  unsigned char *out;
+
+  if (base_len > 0xffffffffu)
+    return -1;
+
+  while (num_slots < base_len / DELTA_BLOCK * 2)
+    num_slots <<= 1;
+  mask = num_slots - 1;
+  slots = calloc(num_slots, sizeof(uint32_t));
+
+  /* The first occurrence of a block wins */
+  for (i = 0; i + DELTA_BLOCK <= base_len; i += DELTA_BLOCK)
+    {
+      uint32_t *slot = &slots[block_hash(base + i) & mask];
+      if (*slot == 0)
+        *slot = i + 1;
+    }
+
+  out = malloc(size);
+  delta_put_size(out, &len, base_len);
+  delta_put_size(out, &len, target_len);
+
+  for (j = literal = 0; j + DELTA_BLOCK <= target_len; )
+    {
+      uint32_t slot = slots[block_hash(target + j) & mask];
+      size_t b, t, b_end, t_end;
+
+      if (slot == 0 || memcmp(base + slot - 1, target + j, DELTA_BLOCK) != 0)
+        {
+          j++;
+          continue;
+        }
+
+      b = slot - 1;
+      t = j;
+      while (b > 0 && t > literal && base[b - 1] == target[t - 1])
+        {
+          b--;
+          t--;
+        }
+      b_end = slot - 1 + DELTA_BLOCK;
+      t_end = j + DELTA_BLOCK;
+      while (b_end < base_len && t_end < target_len && base[b_end] == target[t_end])
+        {
+          b_end++;
+          t_end++;
+        }
+
+      delta_insert(&out, &len, &size, target + literal, t - literal);
+      delta_copy(&out, &len, &size, b, t_end - t);
+      j = literal = t_end;
+    }
+  delta_insert(&out, &len, &size, target + literal, target_len - literal);
+
+  free(slots);
+  *delta = out;
+  *delta_len = len;
+  return 0;
+}
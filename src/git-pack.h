@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef GIT_PACK_H__
+#define GIT_PACK_H__
+
+#include <stddef.h>
+
+#include "durable.h"
+#include "git-object.h"
+
+/**
+ * Writes a run's objects as one pack instead of loose objects.
+ *
+ * git only resolves a delta against a base in the same pack, so git-spot
+ * keeps a pack of its own (named in $GIT_DIR/git-spot-pack).  A new writer
+ * starts by copying that pack's entries verbatim, which keeps their offsets
+ * and deltas valid, and then appends this run's objects, deltified against
+ * the previous version of the same playlist where one is given.  When the
+ * batch is committed the new pack and its index replace the old pack.
+ *
+ * Once the pack reaches a few megabytes it is no longer carried over: it is
+ * left in place and the next run starts a new pack, storing in full the
+ * first base each of its deltas needs.  A run thus copies a bounded amount
+ * of data however long the history, and git gc can consolidate the packs.
+ *
+ * git_repo_set_pack_writer() routes git_repo_write_object() here.
+ */
+
+#define GIT_PACK_MAX_DELTA_DEPTH 50
+
+extern git_pack_writer *git_pack_writer_new(git_repo *repo);
+extern int git_pack_writer_add(git_pack_writer *writer, git_object_type type,
+    const void *data, size_t len, const unsigned char id[GIT_ID_LENGTH],
+    const unsigned char *base_id, const void *base_data, size_t base_len);
+extern int git_pack_writer_finish(git_pack_writer *writer, durable_batch *batch);
+extern void git_pack_writer_free(git_pack_writer *writer);
+extern void git_pack_writer_stats(git_pack_writer *writer, int *num_objects,
+    int *num_deltas, size_t *bytes);
+
+extern int git_delta_create(const unsigned char *base, size_t base_len,
+    const unsigned char *target, size_t target_len,
+    unsigned char **delta, size_t *delta_len);
+
+#endif // GIT_PACK_H__
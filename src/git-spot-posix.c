@@ -22,6 +22,7 @@
  */
 
 #include <unistd.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <string.h>
@@ -29,6 +30,9 @@
 
 #include "git-spot.h"
 #include "cmd.h"
+#include "metadata-cache.h"
+#include "record.h"
+#include "writer.h"
 
 /// Set when libspotify want to process events
 static int notify_events;
@@ -47,6 +51,11 @@ static char *cmdline;
 
 extern int is_logged_out;
 
+static const struct option long_options[] = {
+  { "format", required_argument, NULL, 'f' },
+  { "cache-ttl", required_argument, NULL, 't' },
+  { NULL, 0, NULL, 0 }
+};
 
 
 
@@ -74,8 +83,9 @@ int main(int argc, char **argv)
   int r;
   int next_timeout = 0;
   int opt;
+  int cache_ttl = METADATA_CACHE_TTL;
 
-  while ((opt = getopt(argc, argv, "u:p:")) != EOF) {
+  while ((opt = getopt_long(argc, argv, "+u:p:f:t:", long_options, NULL)) != EOF) {
     switch (opt) {
     case 'u':
       username = optarg;
@@ -85,6 +95,17 @@ int main(int argc, char **argv)
       password = optarg;
       break;
 
+    case 'f':
+      if (output_set_format(optarg) != 0) {
+        fprintf(stderr, "Unknown output format %s, use text or ndjson\n", optarg);
+        exit(1);
+      }
+      break;
+
+    case 't':
+      cache_ttl = atoi(optarg);
+      break;
+
     default:
       exit(1);
     }
@@ -116,6 +137,10 @@ int main(int argc, char **argv)
   if ((r = git_spot_init(username, password)) != 0)
     exit(r);
 
+  // After the session, which creates the directory the cache lives in
+  if (cache_ttl > 0)
+    g_metadata_cache = metadata_cache_open(METADATA_CACHE_FILENAME, cache_ttl);
+
   pthread_mutex_lock(&notify_mutex);
 
   while(!is_logged_out) {
@@ -152,19 +177,23 @@ int main(int argc, char **argv)
       cmdargc = 0;
     }
 
-    // Process libspotify events
+    // Process libspotify events, and the writes finished meanwhile
     notify_events = 0;
     pthread_mutex_unlock(&notify_mutex);
 
+    writer_run_completions();
+
     do {
       sp_session_process_events(g_session, &next_timeout);
     } while (next_timeout == 0);
 
     pthread_mutex_lock(&notify_mutex);
   }
-  printf("Logged out\n");
+  record_flush();
+  fprintf(stderr, "Logged out\n");
   sp_session_release(g_session);
-  printf("Exiting...\n");
+  metadata_cache_close(g_metadata_cache);
+  fprintf(stderr, "Exiting...\n");
   return 0;
 }
 
@@ -173,6 +202,9 @@ int main(int argc, char **argv)
  */
 void cmd_done(void)
 {
+  record_flush();
+  metadata_cache_flush(g_metadata_cache);
+
   pthread_mutex_lock(&notify_mutex);
   pthread_cond_signal(&prompt_cond);
   pthread_mutex_unlock(&notify_mutex);
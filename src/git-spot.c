@@ -26,9 +26,18 @@
 #include <string.h>
 
 sp_session *g_session;
-void (*metadata_updated_fn)(void);
 int is_logged_out;
 
+typedef struct {
+  metadata_listener_fn fn;    /* NULL once removed */
+  void *userdata;
+} metadata_listener;
+
+static metadata_listener *listeners;
+static int num_listeners;
+static int listeners_size;
+static int dispatching;
+
 /**
  * This callback is called when the user was logged in, but the connection to
  * Spotify was dropped for some reason.
@@ -88,18 +97,65 @@ static void log_message(sp_session *session, const char *data)
 
 
 
+void metadata_listener_add(metadata_listener_fn fn, void *userdata)
+{
+  if (num_listeners == listeners_size) {
+    listeners_size = listeners_size ? listeners_size * 2 : 16;
+    listeners = realloc(listeners, listeners_size * sizeof(metadata_listener));
+  }
+  listeners[num_listeners].fn = fn;
+  listeners[num_listeners].userdata = userdata;
+  num_listeners++;
+}
+
+/**
+ * Removing only clears the slot while a dispatch is going on, so that the
+ * dispatch does not lose its place; the slots are compacted afterwards.
+ */
+void metadata_listener_remove(metadata_listener_fn fn, void *userdata)
+{
+  int i;
+
+  for (i = 0; i < num_listeners; i++) {
+    if (listeners[i].fn != fn || listeners[i].userdata != userdata)
+      continue;
+    if (dispatching) {
+      listeners[i].fn = NULL;
+    } else {
+      memmove(&listeners[i], &listeners[i + 1],
+              (num_listeners - i - 1) * sizeof(metadata_listener));
+      num_listeners--;
+    }
+    return;
+  }
+}
+
 /**
  * Callback called when libspotify has new metadata available
  *
- * Not used in this example (but available to be able to reuse the session.c file
- * for other examples.)
+ * Passes the news on to every listener.  Listeners added meanwhile wait
+ * for the next update.
  *
  * @sa sp_session_callbacks#metadata_updated
  */
 static void metadata_updated(sp_session *sess)
 {
-  if(metadata_updated_fn)
-    metadata_updated_fn();
+  int i, j, n = num_listeners;
+
+  dispatching++;
+  for (i = 0; i < n; i++) {
+    if (listeners[i].fn)
+      listeners[i].fn(listeners[i].userdata);
+  }
+  dispatching--;
+
+  if (dispatching)
+    return;
+  for (i = j = 0; i < num_listeners; i++) {
+    if (listeners[i].fn)
+      listeners[j++] = listeners[i];
+  }
+  num_listeners = j;
 }
 
 
@@ -36,7 +36,16 @@
 
 extern sp_session *g_session;
 
-extern void (*metadata_updated_fn)(void);
+/**
+ * Everything waiting for metadata registers a listener, and each
+ * metadata_updated callback from libspotify is passed on to all of them.
+ * Listeners may add and remove listeners, themselves included, while they
+ * are being called.
+ */
+typedef void (*metadata_listener_fn)(void *userdata);
+
+extern void metadata_listener_add(metadata_listener_fn fn, void *userdata);
+extern void metadata_listener_remove(metadata_listener_fn fn, void *userdata);
 
 extern int git_spot_init(const char *username, const char *password);
 
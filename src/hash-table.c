@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash-table.h"
+#include "manifest.h"
+
+static unsigned int hash_bucket(hash_table *t, const char *key)
+{
+  return (unsigned int) manifest_hash(key, strlen(key)) & (t->num_buckets - 1);
+}
+
+/**
+ * Set up an empty table with @num_buckets to start with, a power of two.
+ */
+void hash_table_init(hash_table *t, unsigned int num_buckets)
+{
+  t->num_buckets = num_buckets;
+  t->num_entries = 0;
+  t->buckets = calloc(num_buckets, sizeof(hash_entry *));
+}
+
+/**
+ * Free the buckets.  The entries are left to whoever put them in.
+ */
+void hash_table_clear(hash_table *t)
+{
+  free(t->buckets);
+  t->buckets = NULL;
+  t->num_buckets = 0;
+  t->num_entries = 0;
+}
+
+hash_entry *hash_table_find(hash_table *t, const char *key)
+{
+  hash_entry *e;
+
+  for (e = t->buckets[hash_bucket(t, key)]; e != NULL; e = e->next)
+    if (strcmp(e->key, key) == 0)
+      return e;
+  return NULL;
+}
+
+static void hash_table_grow(hash_table *t)
+{
+  hash_entry **old_buckets = t->buckets;
+  unsigned int old_num_buckets = t->num_buckets;
+  unsigned int i;
+
+  t->num_buckets *= 2;
+  t->buckets = calloc(t->num_buckets, sizeof(hash_entry *));
+
+  for (i = 0; i < old_num_buckets; i++)
+    {
+      hash_entry *e = old_buckets[i];
+      while (e != NULL)
+        {
+          hash_entry *next = e->next;
+          unsigned int b = hash_bucket(t, e->key);
+          e->next = t->buckets[b];
+          t->buckets[b] = e;
+          e = next;
+        }
+    }
+  free(old_buckets);
+}
+
+/**
+ * Add @e, whose key must not be in the table yet.
+ */
+void hash_table_insert(hash_table *t, hash_entry *e)
+{
+  unsigned int b;
+
+  if (t->num_entries >= t->num_buckets)
+    hash_table_grow(t);
+
+  b = hash_bucket(t, e->key);
+  e->next = t->buckets[b];
+  t->buckets[b] = e;
+  t->num_entries ++;
+}
+
+void hash_table_remove(hash_table *t, hash_entry *e)
+{
+  hash_entry **p = &t->buckets[hash_bucket(t, e->key)];
+
+  while (*p != e)
+    p = &(*p)->next;
+  *p = e->next;
+  t->num_entries --;
+}
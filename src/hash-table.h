@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef HASH_TABLE_H__
+#define HASH_TABLE_H__
+
+/**
+ * A table of entries keyed by string, for the caches.  The entries are
+ * the callers' own structs, which start with a hash_entry pointing at
+ * their key; the table only links them up and never frees them.  It
+ * doubles its buckets once it has as many entries, so chains stay short.
+ *
+ * To visit every entry, walk the chains of buckets[0 .. num_buckets).
+ */
+typedef struct _hash_entry hash_entry;
+
+struct _hash_entry {
+  hash_entry *next;
+  const char *key;
+};
+
+typedef struct {
+  hash_entry **buckets;
+  unsigned int num_buckets;   /* a power of two */
+  int num_entries;
+} hash_table;
+
+extern void hash_table_init(hash_table *t, unsigned int num_buckets);
+extern void hash_table_clear(hash_table *t);
+
+extern hash_entry *hash_table_find(hash_table *t, const char *key);
+extern void hash_table_insert(hash_table *t, hash_entry *e);
+extern void hash_table_remove(hash_table *t, hash_entry *e);
+
+#endif // HASH_TABLE_H__
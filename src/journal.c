@@ -0,0 +1,388 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+#include "manifest.h"
+
+#define JOURNAL_HEADER "# git-spot journal v1"
+
+typedef struct _journal_slot journal_slot;
+
+struct _journal_slot {
+  journal_slot *next;
+  journal_entry entry;
+};
+
+struct _journal {
+  char *path;
+  int fd;
+  journal_slot **buckets;
+  unsigned int num_buckets;
+  int num_entries;
+  char *pending;      /* lines not written out yet */
+  size_t pending_len;
+  size_t pending_size;
+  int num_pending;
+};
+
+static unsigned int
+journal_bucket(journal *j, const char *root, const char *uri)
+{
+  uint64_t hash = manifest_hash(root, strlen(root));
+
+  hash = (hash ^ manifest_hash(uri, strlen(uri))) * 0x100000001b3ULL;
+  return (unsigned int) hash & (j->num_buckets - 1);
+}
+
+static journal_slot *
+journal_find(journal *j, const char *root, const char *uri)
+{
+  journal_slot *s;
+
+  for (s = j->buckets[journal_bucket(j, root, uri)]; s != NULL; s = s->next)
+    if (strcmp(s->entry.uri, uri) == 0 && strcmp(s->entry.root, root) == 0)
+      return s;
+  return NULL;
+}
+
+static void journal_grow(journal *j)
+{
+  journal_slot **old_buckets = j->buckets;
+  unsigned int old_num_buckets = j->num_buckets;
+  unsigned int i;
+
+  j->num_buckets *= 2;
+  j->buckets = calloc(j->num_buckets, sizeof(journal_slot *));
+
+  for (i = 0; i < old_num_buckets; i++)
+    {
+      journal_slot *s = old_buckets[i];
+      while (s != NULL)
+        {
+          journal_slot *next = s->next;
+          unsigned int b = journal_bucket(j, s->entry.root, s->entry.uri);
+          s->next = j->buckets[b];
+          j->buckets[b] = s;
+          s = next;
+        }
+    }
+  free(old_buckets);
+}
+
+static void
+journal_set(journal *j, const char *root, const char *uri,
+    const char *filename, uint64_t revision, uint64_t hash, int num_tracks,
+    const unsigned char *blob_id)
+{
+  journal_slot *s = journal_find(j, root, uri);
+
+  if (s == NULL)
+    {
+      unsigned int b;
+
+      if (j->num_entries >= j->num_buckets)
+        journal_grow(j);
+
+      s = malloc(sizeof(journal_slot));
+      s->entry.root = strdup(root);
+      s->entry.uri = strdup(uri);
+      s->entry.filename = NULL;
+      b = journal_bucket(j, root, uri);
+      s->next = j->buckets[b];
+      j->buckets[b] = s;
+      j->num_entries ++;
+    }
+
+  free(s->entry.filename);
+  s->entry.filename = strdup(filename);
+  s->entry.revision = revision;
+  s->entry.hash = hash;
+  s->entry.num_tracks = num_tracks;
+  s->entry.has_blob_id = blob_id != NULL;
+  if (blob_id != NULL)
+    memcpy(s->entry.blob_id, blob_id, JOURNAL_BLOB_ID_LENGTH);
+}
+
+/**
+ * Read the entries of an existing journal.  A crash can tear its last
+ * line, so only lines that end in a newline count.
+ *
+ * @return how many bytes of the file are whole lines
+ */
+static off_t journal_load(journal *j)
+{
+  FILE *input = fopen(j->path, "r");
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  off_t whole = 0;
+
+  if (input == NULL)
+    return 0;
+
+  while ((len = getline(&line, &line_size, input)) != -1)
+    {
+      char *fields[7];
+      char *c = line;
+      int n;
+      unsigned char blob_id[JOURNAL_BLOB_ID_LENGTH];
+      int has_blob_id;
+
+      if (line[len - 1] != '\n')
+        break;
+      whole += len;
+      line[len - 1] = 0;
+      if (line[0] == '#')
+        continue;
+
+      for (n = 0; n < 7 && c != NULL; n++)
+        fields[n] = strsep(&c, n == 6 ? "" : "\t");
+
+      if (n != 7 || fields[6] == NULL)
+        {
+          printf("WARNING: ignoring bad line in %s.\n", j->path);
+          continue;
+        }
+
+      has_blob_id = manifest_parse_blob_id(fields[4], blob_id) == 0;
+      journal_set(j, fields[1], fields[5], fields[6],
+          strtoull(fields[0], NULL, 16), strtoull(fields[2], NULL, 16),
+          atoi(fields[3]), has_blob_id ? blob_id : NULL);
+    }
+
+  free(line);
+  fclose(input);
+  return whole;
+}
+
+static int
+journal_sync_directory(const char *path)
+{
+  char *dir = strdup(path);
+  char *slash = strrchr(dir, '/');
+  int fd, result = -1;
+
+  if (slash != NULL)
+    *slash = 0;
+  fd = open(slash != NULL ? dir : ".", O_RDONLY | O_DIRECTORY);
+  if (fd >= 0)
+    {
+      result = fsync(fd);
+      close(fd);
+    }
+  free(dir);
+  return result;
+}
+
+static int
+journal_write_all(int fd, const char *data, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      n = write(fd, data, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      data += n;
+      len -= n;
+    }
+  return 0;
+}
+
+/**
+ * Open the journal at @path for appending.  With @resume, the entries it
+ * already has are kept and can be looked up; otherwise it starts empty.
+ *
+ * @return NULL if it cannot be written
+ */
+journal *journal_open(const char *path, int resume)
+{
+  journal *j = calloc(1, sizeof(journal));
+  off_t whole = 0;
+  struct stat st;
+
+  j->path = strdup(path);
+  j->num_buckets = 256;
+  j->buckets = calloc(j->num_buckets, sizeof(journal_slot *));
+
+  if (resume)
+    whole = journal_load(j);
+
+  j->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (j->fd < 0 || fstat(j->fd, &st) != 0
+      || (st.st_size != whole && ftruncate(j->fd, whole) != 0))
+    {
+      printf("WARNING: cannot write %s: %s\n", path, strerror(errno));
+      journal_free(j);
+      return NULL;
+    }
+
+  /* A new journal must itself survive a crash before it is any use */
+  if (whole == 0
+      && (journal_write_all(j->fd, JOURNAL_HEADER "\n",
+          strlen(JOURNAL_HEADER "\n")) != 0
+        || fdatasync(j->fd) != 0 || journal_sync_directory(path) != 0))
+    {
+      printf("WARNING: cannot write %s: %s\n", path, strerror(errno));
+      journal_free(j);
+      return NULL;
+    }
+
+  return j;
+}
+
+void journal_free(journal *j)
+{
+  unsigned int i;
+
+  if (j == NULL)
+    return;
+
+  for (i = 0; i < j->num_buckets; i++)
+    {
+      journal_slot *s = j->buckets[i];
+      while (s != NULL)
+        {
+          journal_slot *next = s->next;
+          free(s->entry.root);
+          free(s->entry.uri);
+          free(s->entry.filename);
+          free(s);
+          s = next;
+        }
+    }
+  if (j->fd >= 0)
+    close(j->fd);
+  free(j->buckets);
+  free(j->pending);
+  free(j->path);
+  free(j);
+}
+
+const journal_entry *journal_lookup(journal *j, const char *root,
+    const char *uri)
+{
+  journal_slot *s = journal_find(j, root, uri);
+
+  return s != NULL ? &s->entry : NULL;
+}
+
+/**
+ * Buffer the line for a playlist of the snapshot tree @root whose file
+ * will be durable by the next journal_sync().
+ */
+void journal_add(journal *j, const char *root, const char *uri,
+    const char *filename, uint64_t revision, uint64_t hash, int num_tracks,
+    const unsigned char *blob_id)
+{
+  char blob_hex[JOURNAL_BLOB_ID_LENGTH * 2 + 1];
+  char *line;
+  int len, i;
+
+  if (blob_id != NULL)
+    for (i = 0; i < JOURNAL_BLOB_ID_LENGTH; i++)
+      sprintf(blob_hex + i * 2, "%02x", blob_id[i]);
+  else
+    strcpy(blob_hex, "-");
+
+  len = asprintf(&line, "%016" PRIx64 "\t%s\t%016" PRIx64 "\t%d\t%s\t%s\t%s\n",
+      revision, root, hash, num_tracks, blob_hex, uri, filename);
+  if (len < 0)
+    return;
+
+  if (j->pending_len + len > j->pending_size)
+    {
+      while (j->pending_len + len > j->pending_size)
+        j->pending_size = j->pending_size ? j->pending_size * 2 : 4096;
+      j->pending = realloc(j->pending, j->pending_size);
+    }
+  memcpy(j->pending + j->pending_len, line, len);
+  j->pending_len += len;
+  j->num_pending ++;
+  free(line);
+
+  journal_set(j, root, uri, filename, revision, hash, num_tracks, blob_id);
+}
+
+/**
+ * Append the buffered lines to the journal and sync it.
+ *
+ * @return 0 on success
+ */
+int journal_sync(journal *j)
+{
+  int result = 0;
+
+  if (j->num_pending == 0)
+    return 0;
+
+  if (journal_write_all(j->fd, j->pending, j->pending_len) != 0
+      || fdatasync(j->fd) != 0)
+    result = -1;
+
+  j->pending_len = 0;
+  j->num_pending = 0;
+  return result;
+}
+
+/**
+ * Forget the buffered lines, whose files did not make it to disk.
+ */
+void journal_discard(journal *j)
+{
+  j->pending_len = 0;
+  j->num_pending = 0;
+}
+
+int journal_size(journal *j)
+{
+  return j->num_entries;
+}
+
+int journal_pending(journal *j)
+{
+  return j->num_pending;
+}
+
+/**
+ * Delete the journal of a run that finished.
+ */
+int journal_remove(journal *j)
+{
+  if (unlink(j->path) != 0 && errno != ENOENT)
+    return -1;
+  return journal_sync_directory(j->path);
+}
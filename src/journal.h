@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef JOURNAL_H__
+#define JOURNAL_H__
+
+#include <stdint.h>
+
+/**
+ * The journal of a save run: one line per playlist whose file is known to
+ * be on disk, appended as the run goes.  A run that dies halfway leaves
+ * the journal behind, and "save --resume" skips what it lists instead of
+ * starting from zero.  A run that finishes removes it.
+ *
+ * journal_add() only buffers a line.  The caller must have made the
+ * playlist's file durable before journal_sync() writes the buffered lines
+ * out and syncs them.
+ */
+#define JOURNAL_FILENAME ".git-spot-journal"
+
+#define JOURNAL_BLOB_ID_LENGTH 20
+
+typedef struct _journal journal;
+
+typedef struct {
+  char *root;         /* the snapshot tree, as passed to journal_add() */
+  char *uri;
+  char *filename;     /* relative to root */
+  uint64_t revision;
+  uint64_t hash;
+  int num_tracks;
+  int has_blob_id;
+  unsigned char blob_id[JOURNAL_BLOB_ID_LENGTH];
+} journal_entry;
+
+extern journal *journal_open(const char *path, int resume);
+extern void journal_free(journal *j);
+
+extern const journal_entry *journal_lookup(journal *j, const char *root,
+    const char *uri);
+extern void journal_add(journal *j, const char *root, const char *uri,
+    const char *filename, uint64_t revision, uint64_t hash, int num_tracks,
+    const unsigned char *blob_id);
+extern int journal_sync(journal *j);
+extern void journal_discard(journal *j);
+extern int journal_size(journal *j);
+extern int journal_pending(journal *j);
+extern int journal_remove(journal *j);
+
+#endif // JOURNAL_H__
@@ -0,0 +1,425 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "json.h"
+
+void json_buffer_init(json_buffer *b, FILE *output)
+{
+  b->size = 4096;
+  b->data = malloc(b->size);
+  b->len = 0;
+  b->output = output;
+  b->flush_threshold = JSON_FLUSH_THRESHOLD;
+}
+
+void json_buffer_reset(json_buffer *b)
+{
+  b->len = 0;
+}
+
+void json_buffer_free(json_buffer *b)
+{
+  free(b->data);
+  b->data = NULL;
+  b->len = b->size = 0;
+}
+
+/**
+ * Write everything buffered so far to the attached stream.
+ *
+ * @return 0 on success, -1 if the write failed or no stream is attached
+ */
+int json_buffer_flush(json_buffer *b)
+{
+  size_t len = b->len;
+
+  if (b->output == NULL)
+    return -1;
+
+  b->len = 0;
+  if (len > 0 && fwrite(b->data, 1, len, b->output) != len)
+    return -1;
+  return 0;
+}
+
+static inline void
+json_reserve(json_buffer *b, size_t len)
+{
+  if (b->len + len <= b->size)
+    return;
+
+  if (b->output != NULL && b->len >= b->flush_threshold)
+    {
+      json_buffer_flush(b);
+      if (len <= b->size)
+        return;
+    }
+
+  while (b->size < b->len + len)
+    b->size *= 2;
+  b->data = realloc(b->data, b->size);
+}
+
+void json_append(json_buffer *b, const char *data, size_t len)
+{
+  json_reserve(b, len);
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+void json_append_raw(json_buffer *b, const char *str)
+{
+  json_append(b, str, strlen(str));
+}
+
+/**
+ * Append @str as a quoted JSON string.  Runs of characters that need no
+ * escaping are copied in one go; the input is only walked once.
+ */
+void json_append_string(json_buffer *b, const char *str)
+{
+  static const char hex[] = "0123456789abcdef";
+  const unsigned char *run = (const unsigned char *) (str ? str : "");
+  const unsigned char *c;
+
+  json_append(b, "\"", 1);
+
+  for (c = run; *c != 0; c++)
+    {
+      char escape[6];
+      size_t escape_len = 2;
+
+      if (*c >= 0x20 && *c != '"' && *c != '\\')
+        continue;
+
+      json_append(b, (const char *) run, c - run);
+      run = c + 1;
+
+      escape[0] = '\\';
+      switch (*c)
+        {
+        case '"':  escape[1] = '"'; break;
+        case '\\': escape[1] = '\\'; break;
+        case '\n': escape[1] = 'n'; break;
+        case '\r': escape[1] = 'r'; break;
+        case '\t': escape[1] = 't'; break;
+        case '\b': escape[1] = 'b'; break;
+        case '\f': escape[1] = 'f'; break;
+        default:
+          escape[1] = 'u';
+          escape[2] = '0';
+          escape[3] = '0';
+          escape[4] = hex[*c >> 4];
+          escape[5] = hex[*c & 0xf];
+          escape_len = 6;
+          break;
+        }
+      json_append(b, escape, escape_len);
+    }
+
+  json_append(b, (const char *) run, c - run);
+  json_append(b, "\"", 1);
+}
+
+void json_append_int(json_buffer *b, long long value)
+{
+  char digits[24];
+  char *p = digits + sizeof(digits);
+  unsigned long long v = value < 0 ? -(unsigned long long) value : value;
+
+  do
+    {
+      *--p = '0' + v % 10;
+      v /= 10;
+    }
+  while (v != 0);
+
+  if (value < 0)
+    *--p = '-';
+
+  json_append(b, p, digits + sizeof(digits) - p);
+}
+
+/**
+ * Append @value with three decimals, which is plenty for timings.
+ */
+void json_append_double(json_buffer *b, double value)
+{
+  char digits[64];
+  int len = snprintf(digits, sizeof(digits), "%.3f", value);
+
+  /* NaN and infinities have no JSON spelling */
+  if (value - value != 0 || len < 0 || len >= (int) sizeof(digits))
+    json_append_raw(b, "null");
+  else
+    json_append(b, digits, len);
+}
+
+/*
+ * Reading
+ */
+
+void json_reader_init(json_reader *r, FILE *input)
+{
+  r->input = input;
+  r->pos = r->len = 0;
+  r->value_size = 256;
+  r->value = malloc(r->value_size);
+  r->value_len = 0;
+  r->value[0] = 0;
+  r->depth = 0;
+}
+
+void json_reader_free(json_reader *r)
+{
+  free(r->value);
+  r->value = NULL;
+}
+
+const char *json_reader_value(json_reader *r)
+{
+  return r->value;
+}
+
+/* The next byte of input without consuming it, EOF at the end */
+static inline int
+reader_peek(json_reader *r)
+{
+  if (r->pos == r->len)
+    {
+      r->len = fread(r->chunk, 1, sizeof(r->chunk), r->input);
+      r->pos = 0;
+      if (r->len == 0)
+        return EOF;
+    }
+  return (unsigned char) r->chunk[r->pos];
+}
+
+static inline int
+reader_get(json_reader *r)
+{
+  int c = reader_peek(r);
+  if (c != EOF)
+    r->pos ++;
+  return c;
+}
+
+static inline void
+value_append(json_reader *r, char c)
+{
+  if (r->value_len + 1 >= r->value_size)
+    {
+      r->value_size *= 2;
+      r->value = realloc(r->value, r->value_size);
+    }
+  r->value[r->value_len++] = c;
+}
+
+static void
+value_append_utf8(json_reader *r, unsigned long cp)
+{
+  if (cp < 0x80)
+    value_append(r, cp);
+  else if (cp < 0x800)
+    {
+      value_append(r, 0xc0 | (cp >> 6));
+      value_append(r, 0x80 | (cp & 0x3f));
+    }
+  else if (cp < 0x10000)
+    {
+      value_append(r, 0xe0 | (cp >> 12));
+      value_append(r, 0x80 | ((cp >> 6) & 0x3f));
+      value_append(r, 0x80 | (cp & 0x3f));
+    }
+  else
+    {
+      value_append(r, 0xf0 | (cp >> 18));
+      value_append(r, 0x80 | ((cp >> 12) & 0x3f));
+      value_append(r, 0x80 | ((cp >> 6) & 0x3f));
+      value_append(r, 0x80 | (cp & 0x3f));
+    }
+}
+
+static long
+read_hex4(json_reader *r)
+{
+  long value = 0;
+  int i;
+
+  for (i = 0; i < 4; i++)
+    {
+      int c = reader_get(r);
+      if (!isxdigit(c))
+        return -1;
+      value = value * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+    }
+  return value;
+}
+
+/* Read the rest of a string whose opening quote has been consumed */
+static int
+read_string(json_reader *r)
+{
+  long high = -1;     /* a high surrogate waiting for its low half */
+  int c;
+
+  r->value_len = 0;
+  while ((c = reader_get(r)) != '"')
+    {
+      long cp;
+
+      if (c == EOF)
+        return -1;
+
+      if (c == '\\' && reader_peek(r) == 'u')
+        {
+          reader_get(r);
+          if ((cp = read_hex4(r)) < 0)
+            return -1;
+          /* A surrogate pair encodes one code point beyond the BMP */
+          if (high >= 0 && cp >= 0xdc00 && cp < 0xe000)
+            {
+              value_append_utf8(r, 0x10000 + ((high - 0xd800) << 10)
+                  + (cp - 0xdc00));
+              high = -1;
+              continue;
+            }
+          /* Half a pair is no character, but what follows it still is */
+          if (high >= 0)
+            value_append_utf8(r, 0xfffd);
+          high = cp >= 0xd800 && cp < 0xdc00 ? cp : -1;
+          if (high < 0)
+            value_append_utf8(r, cp >= 0xdc00 && cp < 0xe000 ? 0xfffd : cp);
+          continue;
+        }
+
+      if (high >= 0)
+        value_append_utf8(r, 0xfffd);
+      high = -1;
+      if (c != '\\')
+        {
+          value_append(r, c);
+          continue;
+        }
+
+      switch (c = reader_get(r))
+        {
+        case '"': case '\\': case '/': value_append(r, c); break;
+        case 'b': value_append(r, '\b'); break;
+        case 'f': value_append(r, '\f'); break;
+        case 'n': value_append(r, '\n'); break;
+        case 'r': value_append(r, '\r'); break;
+        case 't': value_append(r, '\t'); break;
+        default:
+          return -1;
+        }
+    }
+  if (high >= 0)
+    value_append_utf8(r, 0xfffd);
+  r->value[r->value_len] = 0;
+  return 0;
+}
+
+json_token json_reader_next(json_reader *r)
+{
+  int c;
+
+  for (;;)
+    {
+      c = reader_get(r);
+      if (c == EOF)
+        return r->depth == 0 ? JSON_END : JSON_ERROR;
+      if (!isspace(c) && c != ',' && c != ':')
+        break;
+    }
+
+  switch (c)
+    {
+    case '{':
+      r->depth ++;
+      return JSON_BEGIN_OBJECT;
+    case '[':
+      r->depth ++;
+      return JSON_BEGIN_ARRAY;
+    case '}':
+    case ']':
+      if (r->depth == 0)
+        return JSON_ERROR;
+      r->depth --;
+      return c == '}' ? JSON_END_OBJECT : JSON_END_ARRAY;
+    case '"':
+      if (read_string(r) != 0)
+        return JSON_ERROR;
+      /* A string followed by a colon is a key */
+      while ((c = reader_peek(r)) != EOF && isspace(c))
+        r->pos ++;
+      if (c == ':')
+        {
+          r->pos ++;
+          return JSON_KEY;
+        }
+      return JSON_STRING;
+    }
+
+  r->value_len = 0;
+  value_append(r, c);
+  while ((c = reader_peek(r)) != EOF && (isalnum(c) || c == '.' || c == '-' || c == '+'))
+    value_append(r, reader_get(r));
+  r->value[r->value_len] = 0;
+
+  if (strcmp(r->value, "true") == 0)
+    return JSON_TRUE;
+  if (strcmp(r->value, "false") == 0)
+    return JSON_FALSE;
+  if (strcmp(r->value, "null") == 0)
+    return JSON_NULL;
+  if (isdigit((unsigned char) r->value[0]) || r->value[0] == '-')
+    return JSON_NUMBER;
+  return JSON_ERROR;
+}
+
+/**
+ * Skip the rest of the value that @token, the token just read, starts.
+ * Call it after a JSON_KEY's value token to ignore that value.
+ *
+ * @return the last token consumed, JSON_ERROR if the input ended early
+ */
+json_token json_reader_skip(json_reader *r, json_token token)
+{
+  int depth = r->depth;
+
+  if (token != JSON_BEGIN_OBJECT && token != JSON_BEGIN_ARRAY)
+    return token;
+
+  while (r->depth >= depth)
+    {
+      token = json_reader_next(r);
+      if (token == JSON_ERROR || token == JSON_END)
+        return JSON_ERROR;
+    }
+  return token;
+}
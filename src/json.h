@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef JSON_H__
+#define JSON_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * A growable output buffer for emitting JSON.  The buffer is meant to be
+ * reused: json_buffer_reset() keeps the allocation, so rendering many
+ * documents costs no heap traffic once the buffer has grown to the size of
+ * the largest one.
+ *
+ * If an output stream is attached, the buffer is written out whenever it
+ * grows past the flush threshold, so arbitrarily long streams can be
+ * emitted through a bounded buffer.
+ */
+typedef struct _json_buffer json_buffer;
+
+struct _json_buffer {
+  char *data;
+  size_t len;
+  size_t size;
+  FILE *output;
+  size_t flush_threshold;
+};
+
+#define JSON_FLUSH_THRESHOLD (64 * 1024)
+
+extern void json_buffer_init(json_buffer *b, FILE *output);
+extern void json_buffer_reset(json_buffer *b);
+extern void json_buffer_free(json_buffer *b);
+extern int json_buffer_flush(json_buffer *b);
+
+extern void json_append(json_buffer *b, const char *data, size_t len);
+extern void json_append_raw(json_buffer *b, const char *str);
+extern void json_append_string(json_buffer *b, const char *str);
+extern void json_append_int(json_buffer *b, long long value);
+extern void json_append_double(json_buffer *b, double value);
+
+/**
+ * A pull reader for JSON read from a stream in fixed-size chunks, so a
+ * document never has to be in memory as a whole.  json_reader_next()
+ * returns one token at a time; the text of the last key, string or number
+ * (with escapes decoded) is in json_reader_value().
+ *
+ * The reader does not check that commas and colons are where they should
+ * be, only that the nesting is consistent.
+ */
+typedef enum {
+  JSON_ERROR = -1,
+  JSON_END = 0,
+  JSON_BEGIN_OBJECT,
+  JSON_END_OBJECT,
+  JSON_BEGIN_ARRAY,
+  JSON_END_ARRAY,
+  JSON_KEY,
+  JSON_STRING,
+  JSON_NUMBER,
+  JSON_TRUE,
+  JSON_FALSE,
+  JSON_NULL
+} json_token;
+
+#define JSON_READER_CHUNK 8192
+
+typedef struct _json_reader json_reader;
+
+struct _json_reader {
+  FILE *input;
+  char chunk[JSON_READER_CHUNK];
+  size_t pos;
+  size_t len;
+  char *value;
+  size_t value_len;
+  size_t value_size;
+  int depth;
+};
+
+extern void json_reader_init(json_reader *r, FILE *input);
+extern void json_reader_free(json_reader *r);
+extern json_token json_reader_next(json_reader *r);
+extern const char *json_reader_value(json_reader *r);
+extern json_token json_reader_skip(json_reader *r, json_token token);
+
+#endif // JSON_H__
@@ -0,0 +1,322 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "manifest.h"
+
+#define MANIFEST_HEADER "# git-spot manifest v2"
+
+struct _manifest {
+  manifest_entry **buckets;
+  unsigned int num_buckets;
+  int num_entries;
+};
+
+/**
+ * 64 bit FNV-1a.  Good enough to tell whether a rendering changed, and
+ * cheap enough to run over every playlist on every save.
+ */
+uint64_t manifest_hash(const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  while (len--)
+    {
+      hash ^= *p++;
+      hash *= 0x100000001b3ULL;
+    }
+  return hash;
+}
+
+static unsigned int
+manifest_bucket(manifest *m, const char *uri)
+{
+  return (unsigned int) manifest_hash(uri, strlen(uri)) & (m->num_buckets - 1);
+}
+
+manifest *manifest_new(void)
+{
+  manifest *m = malloc(sizeof(manifest));
+
+  m->num_buckets = 256;
+  m->num_entries = 0;
+  m->buckets = calloc(m->num_buckets, sizeof(manifest_entry *));
+  return m;
+}
+
+static void manifest_grow(manifest *m)
+{
+  manifest_entry **old_buckets = m->buckets;
+  unsigned int old_num_buckets = m->num_buckets;
+  unsigned int i;
+
+  m->num_buckets *= 2;
+  m->buckets = calloc(m->num_buckets, sizeof(manifest_entry *));
+
+  for (i = 0; i < old_num_buckets; i++)
+    {
+      manifest_entry *e = old_buckets[i];
+      while (e != NULL)
+        {
+          manifest_entry *next = e->next;
+          unsigned int b = manifest_bucket(m, e->uri);
+          e->next = m->buckets[b];
+          m->buckets[b] = e;
+          e = next;
+        }
+    }
+  free(old_buckets);
+}
+
+manifest_entry *manifest_lookup(manifest *m, const char *uri)
+{
+  manifest_entry *e;
+
+  for (e = m->buckets[manifest_bucket(m, uri)]; e != NULL; e = e->next)
+    if (strcmp(e->uri, uri) == 0)
+      return e;
+  return NULL;
+}
+
+manifest_entry *manifest_set(manifest *m, const char *uri,
+    const char *filename, uint64_t hash, int num_tracks,
+    const unsigned char *blob_id)
+{
+  manifest_entry *e = manifest_lookup(m, uri);
+
+  if (e == NULL)
+    {
+      unsigned int b;
+
+      if (m->num_entries >= m->num_buckets)
+        manifest_grow(m);
+
+      e = malloc(sizeof(manifest_entry));
+      e->uri = strdup(uri);
+      e->filename = NULL;
+      b = manifest_bucket(m, uri);
+      e->next = m->buckets[b];
+      m->buckets[b] = e;
+      m->num_entries ++;
+    }
+
+  free(e->filename);
+  e->filename = strdup(filename);
+  e->hash = hash;
+  e->num_tracks = num_tracks;
+  e->has_blob_id = blob_id != NULL;
+  if (blob_id != NULL)
+    memcpy(e->blob_id, blob_id, MANIFEST_BLOB_ID_LENGTH);
+  return e;
+}
+
+/**
+ * Forget the entry for @uri, if there is one.
+ */
+void manifest_remove(manifest *m, const char *uri)
+{
+  manifest_entry **p = &m->buckets[manifest_bucket(m, uri)];
+  manifest_entry *e;
+
+  for (; (e = *p) != NULL; p = &e->next)
+    if (strcmp(e->uri, uri) == 0)
+      {
+        *p = e->next;
+        free(e->uri);
+        free(e->filename);
+        free(e);
+        m->num_entries --;
+        return;
+      }
+}
+
+int manifest_size(manifest *m)
+{
+  return m->num_entries;
+}
+
+void manifest_foreach(manifest *m,
+    void (*fn) (manifest_entry *entry, void *user_data), void *user_data)
+{
+  unsigned int i;
+  manifest_entry *e;
+
+  for (i = 0; i < m->num_buckets; i++)
+    for (e = m->buckets[i]; e != NULL; e = e->next)
+      fn(e, user_data);
+}
+
+void manifest_free(manifest *m)
+{
+  unsigned int i;
+
+  if (m == NULL)
+    return;
+
+  for (i = 0; i < m->num_buckets; i++)
+    {
+      manifest_entry *e = m->buckets[i];
+      while (e != NULL)
+        {
+          manifest_entry *next = e->next;
+          free(e->uri);
+          free(e->filename);
+          free(e);
+          e = next;
+        }
+    }
+  free(m->buckets);
+  free(m);
+}
+
+/**
+ * Parse the hex form of a blob id, as the manifest and the journal write it.
+ *
+ * @return 0 on success, -1 if @hex is not one
+ */
+int manifest_parse_blob_id(const char *hex,
+    unsigned char blob_id[MANIFEST_BLOB_ID_LENGTH])
+{
+  int i;
+
+  if (strlen(hex) != MANIFEST_BLOB_ID_LENGTH * 2)
+    return -1;
+  for (i = 0; i < MANIFEST_BLOB_ID_LENGTH; i++)
+    {
+      unsigned int byte;
+      if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+        return -1;
+      blob_id[i] = byte;
+    }
+  return 0;
+}
+
+/**
+ * Load a manifest.  A missing file is not an error, it just means that
+ * nothing has been saved into this tree yet.
+ */
+manifest *manifest_load(const char *path)
+{
+  manifest *m = manifest_new();
+  FILE *input = fopen(path, "r");
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  int num_fields = 5;
+
+  if (input == NULL)
+    return m;
+
+  while ((len = getline(&line, &line_size, input)) != -1)
+    {
+      char *fields[5];
+      char *c = line;
+      int n;
+      unsigned char blob_id[MANIFEST_BLOB_ID_LENGTH];
+      int has_blob_id = 0;
+
+      if (line[0] == '#')
+        {
+          if (strncmp(line, "# git-spot manifest v1", 22) == 0)
+            num_fields = 4;
+          continue;
+        }
+      if (len > 0 && line[len - 1] == '\n')
+        line[len - 1] = 0;
+
+      for (n = 0; n < num_fields && c != NULL; n++)
+        fields[n] = strsep(&c, n == num_fields - 1 ? "" : "\t");
+
+      if (n != num_fields || fields[num_fields - 1] == NULL)
+        {
+          printf("WARNING: ignoring bad line in %s.\n", path);
+          continue;
+        }
+
+      if (num_fields == 5)
+        has_blob_id = manifest_parse_blob_id(fields[2], blob_id) == 0;
+
+      manifest_set(m, fields[num_fields - 2], fields[num_fields - 1],
+          strtoull(fields[0], NULL, 16), atoi(fields[1]),
+          has_blob_id ? blob_id : NULL);
+    }
+
+  free(line);
+  fclose(input);
+  return m;
+}
+
+static int
+manifest_entry_compare(const void *a, const void *b)
+{
+  const manifest_entry *ea = *(const manifest_entry **) a;
+  const manifest_entry *eb = *(const manifest_entry **) b;
+
+  return strcmp(ea->uri, eb->uri);
+}
+
+static void
+manifest_collect(manifest_entry *entry, void *user_data)
+{
+  manifest_entry ***tail = user_data;
+
+  **tail = entry;
+  (*tail) ++;
+}
+
+/**
+ * Entries are written sorted by URI, so that the manifest itself only
+ * changes where the snapshot changed.
+ */
+int manifest_write(manifest *m, FILE *output)
+{
+  manifest_entry **entries = malloc((m->num_entries + 1) * sizeof(manifest_entry *));
+  manifest_entry **tail = entries;
+  int i, j;
+
+  manifest_foreach(m, manifest_collect, &tail);
+  qsort(entries, m->num_entries, sizeof(manifest_entry *),
+      manifest_entry_compare);
+
+  fprintf(output, "%s\n", MANIFEST_HEADER);
+  for (i = 0; i < m->num_entries; i++)
+    {
+      fprintf(output, "%016" PRIx64 "\t%d\t", entries[i]->hash,
+          entries[i]->num_tracks);
+      if (entries[i]->has_blob_id)
+        for (j = 0; j < MANIFEST_BLOB_ID_LENGTH; j++)
+          fprintf(output, "%02x", entries[i]->blob_id[j]);
+      else
+        fputc('-', output);
+      fprintf(output, "\t%s\t%s\n", entries[i]->uri, entries[i]->filename);
+    }
+
+  free(entries);
+  return ferror(output) ? -1 : 0;
+}
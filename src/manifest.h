@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef MANIFEST_H__
+#define MANIFEST_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A manifest records, for every playlist in a snapshot tree, which file it
+ * was written to and a hash of the rendered contents.  It lives in the root
+ * of the snapshot tree so that the next save can tell which playlists have
+ * not changed.
+ */
+#define MANIFEST_FILENAME ".git-spot-manifest"
+
+#define MANIFEST_BLOB_ID_LENGTH 20
+
+typedef struct _manifest manifest;
+typedef struct _manifest_entry manifest_entry;
+
+struct _manifest_entry {
+  manifest_entry *next;
+  char *uri;
+  char *filename;     /* relative to the snapshot root */
+  uint64_t hash;
+  int num_tracks;
+  int has_blob_id;
+  unsigned char blob_id[MANIFEST_BLOB_ID_LENGTH];  /* git object name */
+};
+
+extern manifest *manifest_new(void);
+extern manifest *manifest_load(const char *path);
+extern int manifest_write(manifest *m, FILE *output);
+extern void manifest_free(manifest *m);
+
+extern manifest_entry *manifest_lookup(manifest *m, const char *uri);
+extern manifest_entry *manifest_set(manifest *m, const char *uri,
+    const char *filename, uint64_t hash, int num_tracks,
+    const unsigned char *blob_id);
+extern void manifest_remove(manifest *m, const char *uri);
+
+extern int manifest_size(manifest *m);
+extern void manifest_foreach(manifest *m,
+    void (*fn) (manifest_entry *entry, void *user_data), void *user_data);
+
+extern uint64_t manifest_hash(const void *data, size_t len);
+extern int manifest_parse_blob_id(const char *hex,
+    unsigned char blob_id[MANIFEST_BLOB_ID_LENGTH]);
+
+#endif // MANIFEST_H__
@@ -0,0 +1,340 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metadata-cache.h"
+#include "append-log.h"
+#include "hash-table.h"
+
+#define METADATA_CACHE_HEADER "# git-spot metadata cache v1"
+
+metadata_cache *g_metadata_cache;
+
+typedef struct {
+  hash_entry hash;          /* keyed by entry.uri */
+  metadata_entry entry;
+} metadata_slot;
+
+struct _metadata_cache {
+  int ttl;
+  time_t oldest;            /* while loading, older entries are dropped */
+  append_log *log;
+  hash_table table;
+};
+
+static metadata_slot *
+metadata_find(metadata_cache *c, const char *uri)
+{
+  return (metadata_slot *) hash_table_find(&c->table, uri);
+}
+
+static void metadata_entry_clear(metadata_entry *e)
+{
+  int i;
+
+  free(e->name);
+  free(e->album);
+  for (i = 0; i < e->num_artists; i++)
+    free(e->artists[i]);
+  free(e->artists);
+}
+
+static void
+metadata_set(metadata_cache *c, const char *uri, const char *name,
+    const char *album, const char * const *artists, int num_artists,
+    int duration, int popularity, time_t fetched)
+{
+  metadata_slot *s = metadata_find(c, uri);
+  metadata_entry *e;
+  char *new_name, *new_album, **new_artists;
+  int i;
+
+  if (s == NULL)
+    {
+      s = calloc(1, sizeof(metadata_slot));
+      s->entry.uri = strdup(uri);
+      s->hash.key = s->entry.uri;
+      hash_table_insert(&c->table, &s->hash);
+    }
+
+  /* The new values may point into the old ones, so copy them first */
+  new_name = strdup(name);
+  new_album = album != NULL ? strdup(album) : NULL;
+  new_artists = malloc((num_artists + 1) * sizeof(char *));
+  for (i = 0; i < num_artists; i++)
+    new_artists[i] = strdup(artists[i]);
+
+  e = &s->entry;
+  metadata_entry_clear(e);
+  e->name = new_name;
+  e->album = new_album;
+  e->artists = new_artists;
+  e->num_artists = num_artists;
+  e->duration = duration;
+  e->popularity = popularity;
+  e->fetched = fetched;
+}
+
+/**
+ * Take in a line of the cache file, unless it is too old to keep.
+ */
+static int metadata_load_line(void *arg, char *line)
+{
+  metadata_cache *c = arg;
+  const char *artists[64];
+  char *fields[6];
+  char *rest = line;
+  int n, num_artists = 0;
+  time_t fetched;
+
+  for (n = 0; n < 6 && rest != NULL; n++)
+    fields[n] = strsep(&rest, "\t");
+  if (n != 6)
+    return -1;
+  while (rest != NULL && num_artists < 64)
+    artists[num_artists++] = strsep(&rest, "\t");
+
+  fetched = strtoll(fields[0], NULL, 10);
+  if (fetched < c->oldest)
+    return 0;
+  metadata_set(c, fields[3], fields[4], *fields[5] ? fields[5] : NULL,
+      artists, num_artists, atoi(fields[1]), atoi(fields[2]), fetched);
+  return 0;
+}
+
+/* A field of a line, with the separators it must not contain blanked out */
+static void metadata_append_field(metadata_cache *c, const char *str)
+{
+  append_log_append(c->log, "\t", 1);
+  append_log_append_text(c->log, str, "\t");
+}
+
+static void metadata_append_entry(metadata_cache *c, const metadata_entry *e)
+{
+  char numbers[64];
+  int i;
+
+  append_log_append(c->log, numbers, snprintf(numbers, sizeof(numbers),
+      "%lld\t%d\t%d", (long long) e->fetched, e->duration, e->popularity));
+  metadata_append_field(c, e->uri);
+  metadata_append_field(c, e->name);
+  metadata_append_field(c, e->album != NULL ? e->album : "");
+  for (i = 0; i < e->num_artists; i++)
+    metadata_append_field(c, e->artists[i]);
+  append_log_end_line(c->log);
+}
+
+/* One line per live entry, for rewriting the file */
+static void metadata_append_all(void *arg)
+{
+  metadata_cache *c = arg;
+  unsigned int i;
+
+  for (i = 0; i < c->table.num_buckets; i++)
+    {
+      hash_entry *h;
+      for (h = c->table.buckets[i]; h != NULL; h = h->next)
+        metadata_append_entry(c, &((metadata_slot *) h)->entry);
+    }
+}
+
+/**
+ * Open the cache at @path, creating it if need be.  Entries are fresh for
+ * @ttl seconds.
+ *
+ * @return NULL if it cannot be written
+ */
+metadata_cache *metadata_cache_open(const char *path, int ttl)
+{
+  metadata_cache *c = calloc(1, sizeof(metadata_cache));
+
+  c->ttl = ttl;
+  c->oldest = time(NULL) - (time_t) ttl * METADATA_CACHE_KEEP;
+  hash_table_init(&c->table, 1024);
+
+  c->log = append_log_open(path, METADATA_CACHE_HEADER, metadata_load_line, c);
+  if (c->log == NULL)
+    {
+      metadata_cache_close(c);
+      return NULL;
+    }
+  return c;
+}
+
+/**
+ * Write out what has been stored, rewriting the file if most of its lines
+ * are superseded, and free the cache.
+ */
+void metadata_cache_close(metadata_cache *c)
+{
+  unsigned int i;
+
+  if (c == NULL)
+    return;
+
+  append_log_close(c->log, c->table.num_entries, metadata_append_all, c);
+
+  for (i = 0; i < c->table.num_buckets; i++)
+    {
+      hash_entry *h = c->table.buckets[i];
+      while (h != NULL)
+        {
+          metadata_slot *s = (metadata_slot *) h;
+          h = h->next;
+          free(s->entry.uri);
+          metadata_entry_clear(&s->entry);
+          free(s);
+        }
+    }
+  hash_table_clear(&c->table);
+  free(c);
+}
+
+/**
+ * Append the stored entries to the file.  They are not synced: losing the
+ * last few to a crash only costs a lookup.
+ *
+ * @return 0 on success
+ */
+int metadata_cache_flush(metadata_cache *c)
+{
+  return c != NULL ? append_log_flush(c->log) : 0;
+}
+
+int metadata_cache_size(metadata_cache *c)
+{
+  return c->table.num_entries;
+}
+
+const metadata_entry *metadata_cache_lookup(metadata_cache *c,
+    const char *uri, metadata_state *state)
+{
+  metadata_slot *s = metadata_find(c, uri);
+
+  if (s == NULL)
+    {
+      *state = METADATA_MISS;
+      return NULL;
+    }
+  *state = time(NULL) - s->entry.fetched < c->ttl
+      ? METADATA_FRESH : METADATA_STALE;
+  return &s->entry;
+}
+
+static int
+metadata_same(const metadata_entry *e, const char *name, const char *album,
+    const char * const *artists, int num_artists, int duration)
+{
+  int i;
+
+  if (strcmp(e->name, name) != 0 || e->duration != duration
+      || (e->album == NULL) != (album == NULL)
+      || (album != NULL && strcmp(e->album, album) != 0)
+      || e->num_artists != num_artists)
+    return 0;
+  for (i = 0; i < num_artists; i++)
+    if (strcmp(e->artists[i], artists[i]) != 0)
+      return 0;
+  return 1;
+}
+
+/**
+ * Remember the metadata of @uri as of now.  An unchanged entry is only
+ * written out again when it is getting on for stale, so saving the same
+ * playlists over and over does not grow the file.
+ */
+void metadata_cache_store(metadata_cache *c, const char *uri,
+    const char *name, const char *album, const char * const *artists,
+    int num_artists, int duration, int popularity)
+{
+  metadata_slot *s = metadata_find(c, uri);
+  time_t now = time(NULL);
+
+  /* A track can load before its album does; keep the album known so far */
+  if (album == NULL && s != NULL)
+    album = s->entry.album;
+
+  if (s != NULL && now - s->entry.fetched < c->ttl / 2
+      && metadata_same(&s->entry, name, album, artists, num_artists, duration))
+    return;
+
+  metadata_set(c, uri, name, album, artists, num_artists, duration,
+      popularity, now);
+  metadata_append_entry(c, &metadata_find(c, uri)->entry);
+}
+
+/**
+ * Look @track up by its URI.
+ */
+const metadata_entry *metadata_cache_track(metadata_cache *c,
+    sp_track *track, metadata_state *state)
+{
+  sp_link *link;
+  char uri[256];
+
+  *state = METADATA_MISS;
+  if (c == NULL || (link = sp_link_create_from_track(track, 0)) == NULL)
+    return NULL;
+  sp_link_as_string(link, uri, sizeof(uri));
+  sp_link_release(link);
+  return metadata_cache_lookup(c, uri, state);
+}
+
+/**
+ * Store the metadata of @track if it has loaded, artists and all.
+ */
+void metadata_cache_store_track(metadata_cache *c, sp_track *track)
+{
+  sp_album *album = sp_track_album(track);
+  const char *artists[64];
+  int num_artists = sp_track_num_artists(track);
+  sp_link *link;
+  char uri[256];
+  int i;
+
+  if (c == NULL || !sp_track_is_loaded(track) || num_artists == 0)
+    return;
+  if (num_artists > 64)
+    num_artists = 64;
+  for (i = 0; i < num_artists; i++)
+    {
+      sp_artist *artist = sp_track_artist(track, i);
+      if (!sp_artist_is_loaded(artist))
+        return;
+      artists[i] = sp_artist_name(artist);
+    }
+
+  if ((link = sp_link_create_from_track(track, 0)) == NULL)
+    return;
+  sp_link_as_string(link, uri, sizeof(uri));
+  sp_link_release(link);
+
+  metadata_cache_store(c, uri, sp_track_name(track),
+      album != NULL && sp_album_is_loaded(album) ? sp_album_name(album) : NULL,
+      artists, num_artists, sp_track_duration(track),
+      sp_track_popularity(track));
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef METADATA_CACHE_H__
+#define METADATA_CACHE_H__
+
+#include <time.h>
+#include <libspotify/api.h>
+
+/**
+ * git-spot's own cache of resolved track metadata, kept on disk between
+ * runs and keyed by track URI.  libspotify only fills in a track some time
+ * after it is asked for; with the cache, a track that has been seen before
+ * can be answered for straight away.
+ *
+ * An entry younger than the TTL is fresh and is trusted as it is.  An
+ * older one is stale: it is still better than nothing, but whoever uses it
+ * should let libspotify load the track as well, and storing what it
+ * delivers revalidates the entry.  Entries that have gone unrefreshed for
+ * METADATA_CACHE_KEEP TTLs are dropped.
+ *
+ * The file is a log: stores are appended to it, the last line for a URI
+ * wins, and metadata_cache_close() rewrites it once it is mostly
+ * superseded lines.  The cache is not thread safe.
+ */
+#define METADATA_CACHE_FILENAME "tmp/git-spot-metadata"
+#define METADATA_CACHE_TTL (24 * 60 * 60)
+#define METADATA_CACHE_KEEP 30
+
+typedef struct _metadata_cache metadata_cache;
+
+typedef enum {
+  METADATA_MISS,
+  METADATA_STALE,
+  METADATA_FRESH
+} metadata_state;
+
+typedef struct {
+  char *uri;
+  char *name;
+  char *album;        /* NULL if it had not loaded */
+  char **artists;
+  int num_artists;
+  int duration;
+  int popularity;
+  time_t fetched;
+} metadata_entry;
+
+extern metadata_cache *g_metadata_cache;
+
+extern metadata_cache *metadata_cache_open(const char *path, int ttl);
+extern void metadata_cache_close(metadata_cache *c);
+extern int metadata_cache_flush(metadata_cache *c);
+extern int metadata_cache_size(metadata_cache *c);
+
+extern const metadata_entry *metadata_cache_lookup(metadata_cache *c,
+    const char *uri, metadata_state *state);
+extern void metadata_cache_store(metadata_cache *c, const char *uri,
+    const char *name, const char *album, const char * const *artists,
+    int num_artists, int duration, int popularity);
+
+/* The same for libspotify tracks; the cache may be NULL for none */
+extern const metadata_entry *metadata_cache_track(metadata_cache *c,
+    sp_track *track, metadata_state *state);
+extern void metadata_cache_store_track(metadata_cache *c, sp_track *track);
+
+#endif // METADATA_CACHE_H__
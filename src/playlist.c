@@ -25,6 +25,7 @@
 
 #include "git-spot.h"
 #include "cmd.h"
+#include "record.h"
 
 static int subscriptions_updated;
 
@@ -52,6 +53,59 @@ int cmd_update_subscriptions(int argc, char **argv)
 
 
 
+/**
+ * The ndjson form of "playlists": one record per container entry, with
+ * its position and folder nesting level.
+ */
+static int playlists_records(sp_playlistcontainer *pc)
+{
+  int i, level = 0;
+  sp_playlist *pl;
+  char name[200];
+
+  record_begin("container");
+  record_int("entries", sp_playlistcontainer_num_playlists(pc));
+  record_end();
+
+  for (i = 0; i < sp_playlistcontainer_num_playlists(pc); ++i) {
+    switch (sp_playlistcontainer_playlist_type(pc, i)) {
+      case SP_PLAYLIST_TYPE_PLAYLIST:
+        pl = sp_playlistcontainer_playlist(pc, i);
+        record_begin("playlist");
+        record_int("position", i);
+        record_int("level", level);
+        record_playlist(pl);
+        if(subscriptions_updated)
+          record_int("subscribers", sp_playlist_num_subscribers(pl));
+        record_end();
+        break;
+      case SP_PLAYLIST_TYPE_START_FOLDER:
+        sp_playlistcontainer_playlist_folder_name(pc, i, name, sizeof(name));
+        record_begin("folder");
+        record_int("position", i);
+        record_int("level", level++);
+        record_string("name", name);
+        record_int("id", sp_playlistcontainer_playlist_folder_id(pc, i));
+        record_end();
+        break;
+      case SP_PLAYLIST_TYPE_END_FOLDER:
+        record_begin("folder_end");
+        record_int("position", i);
+        record_int("level", --level);
+        record_int("id", sp_playlistcontainer_playlist_folder_id(pc, i));
+        record_end();
+        break;
+      case SP_PLAYLIST_TYPE_PLACEHOLDER:
+        record_begin("placeholder");
+        record_int("position", i);
+        record_int("level", level);
+        record_end();
+        break;
+    }
+  }
+  return 1;
+}
+
 /**
  *
  */
@@ -62,6 +116,9 @@ int cmd_playlists(int argc, char **argv)
   sp_playlist *pl;
   char name[200];
 
+  if (g_output_format == OUTPUT_NDJSON)
+    return playlists_records(pc);
+
   printf("%d entries in the container\n", sp_playlistcontainer_num_playlists(pc));
 
   for (i = 0; i < sp_playlistcontainer_num_playlists(pc); ++i) {
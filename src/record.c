@@ -0,0 +1,254 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "git-spot.h"
+#include "json.h"
+#include "metadata-cache.h"
+#include "record.h"
+
+output_format g_output_format = OUTPUT_TEXT;
+
+static json_buffer record_buffer;
+static int record_interactive = -1;   /* stdout is a terminal, once known */
+static int record_fields;
+static int record_list_items;
+
+static const char *relation_names[] = {
+  "unknown",
+  "none",
+  "unidirectional",
+  "bidirectional"
+};
+
+/**
+ * Select the output format by name, "text" or "ndjson".
+ *
+ * @return 0 on success, -1 if the name is not known
+ */
+int output_set_format(const char *name)
+{
+  if (strcmp(name, "text") == 0)
+    g_output_format = OUTPUT_TEXT;
+  else if (strcmp(name, "ndjson") == 0)
+    g_output_format = OUTPUT_NDJSON;
+  else
+    return -1;
+  return 0;
+}
+
+static void record_key(const char *key)
+{
+  json_append_raw(&record_buffer, record_fields++ ? ", " : "{");
+  json_append_string(&record_buffer, key);
+  json_append_raw(&record_buffer, ": ");
+}
+
+static void record_link(const char *key, sp_link *link)
+{
+  char uri[256];
+
+  if (link == NULL) {
+    record_string(key, NULL);
+    return;
+  }
+  sp_link_as_string(link, uri, sizeof(uri));
+  sp_link_release(link);
+  record_string(key, uri);
+}
+
+void record_begin(const char *type)
+{
+  if (record_buffer.data == NULL)
+    json_buffer_init(&record_buffer, stdout);
+  record_fields = 0;
+  record_string("type", type);
+}
+
+/**
+ * Close the record as one line.  It is only written out straight away if
+ * someone is watching stdout; otherwise it waits for the buffer to fill
+ * up or for record_flush().
+ */
+void record_end(void)
+{
+  json_append_raw(&record_buffer, "}\n");
+
+  if (record_interactive < 0)
+    record_interactive = isatty(fileno(stdout));
+  if (record_interactive)
+    record_flush();
+}
+
+/**
+ * Write out every record buffered so far.
+ */
+void record_flush(void)
+{
+  if (record_buffer.data == NULL)
+    return;
+  json_buffer_flush(&record_buffer);
+  fflush(stdout);
+}
+
+/**
+ * Add a string field; NULL is written as null.
+ */
+void record_string(const char *key, const char *value)
+{
+  record_key(key);
+  if (value)
+    json_append_string(&record_buffer, value);
+  else
+    json_append_raw(&record_buffer, "null");
+}
+
+void record_int(const char *key, long long value)
+{
+  record_key(key);
+  json_append_int(&record_buffer, value);
+}
+
+void record_double(const char *key, double value)
+{
+  record_key(key);
+  json_append_double(&record_buffer, value);
+}
+
+void record_bool(const char *key, int value)
+{
+  record_key(key);
+  json_append_raw(&record_buffer, value ? "true" : "false");
+}
+
+void record_list_begin(const char *key)
+{
+  record_key(key);
+  json_append_raw(&record_buffer, "[");
+  record_list_items = 0;
+}
+
+void record_list_string(const char *value)
+{
+  if (record_list_items++)
+    json_append_raw(&record_buffer, ", ");
+  json_append_string(&record_buffer, value);
+}
+
+void record_list_end(void)
+{
+  json_append_raw(&record_buffer, "]");
+}
+
+/**
+ * The fields of a track known from a cache rather than from libspotify.
+ */
+void record_metadata(const metadata_entry *e)
+{
+  int i;
+
+  record_string("uri", e->uri);
+  record_string("name", e->name);
+  record_list_begin("artists");
+  for (i = 0; i < e->num_artists; i++)
+    record_list_string(e->artists[i]);
+  record_list_end();
+  record_string("album", e->album);
+  record_int("duration", e->duration);
+  record_int("popularity", e->popularity);
+}
+
+/* A track that has not loaded, from the metadata cache */
+static void record_cached_track(const metadata_entry *e, metadata_state state)
+{
+  record_metadata(e);
+  record_string("cached", state == METADATA_FRESH ? "fresh" : "stale");
+}
+
+void record_track(sp_track *track)
+{
+  sp_album *album = sp_track_album(track);
+  const metadata_entry *cached;
+  metadata_state state;
+  int i;
+
+  if (!sp_track_is_loaded(track)
+      && (cached = metadata_cache_track(g_metadata_cache, track, &state))) {
+    record_cached_track(cached, state);
+    return;
+  }
+  metadata_cache_store_track(g_metadata_cache, track);
+
+  record_link("uri", sp_link_create_from_track(track, 0));
+  record_string("name", sp_track_name(track));
+  record_list_begin("artists");
+  for (i = 0; i < sp_track_num_artists(track); i++)
+    record_list_string(sp_artist_name(sp_track_artist(track, i)));
+  record_list_end();
+  record_string("album", album ? sp_album_name(album) : NULL);
+  record_int("duration", sp_track_duration(track));
+  record_int("popularity", sp_track_popularity(track));
+  record_int("disc", sp_track_disc(track));
+  record_int("index", sp_track_index(track));
+  record_bool("starred", sp_track_is_starred(g_session, track));
+}
+
+void record_album(sp_album *album)
+{
+  sp_artist *artist = sp_album_artist(album);
+
+  record_link("uri", sp_link_create_from_album(album));
+  record_string("name", sp_album_name(album));
+  record_string("artist", artist ? sp_artist_name(artist) : NULL);
+  record_int("year", sp_album_year(album));
+}
+
+void record_artist(sp_artist *artist)
+{
+  record_link("uri", sp_link_create_from_artist(artist));
+  record_string("name", sp_artist_name(artist));
+}
+
+void record_playlist(sp_playlist *playlist)
+{
+  sp_user *owner = sp_playlist_owner(playlist);
+
+  record_link("uri", sp_link_create_from_playlist(playlist));
+  record_string("name", sp_playlist_name(playlist));
+  record_string("owner", owner ? sp_user_canonical_name(owner) : NULL);
+  record_int("tracks", sp_playlist_num_tracks(playlist));
+  record_bool("collaborative", sp_playlist_is_collaborative(playlist));
+}
+
+void record_user(sp_user *user)
+{
+  record_link("uri", sp_link_create_from_user(user));
+  record_string("name", sp_user_canonical_name(user));
+  record_string("display_name", sp_user_display_name(user));
+  record_string("full_name", sp_user_full_name(user));
+  record_string("picture", sp_user_picture(user));
+  record_string("relation",
+                relation_names[sp_user_relation_type(g_session, user)]);
+}
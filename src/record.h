@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef RECORD_H__
+#define RECORD_H__
+
+#include <libspotify/api.h>
+
+#include "metadata-cache.h"
+
+/**
+ * Machine-readable output.  With --format=ndjson every command that lists
+ * things prints one JSON object per line instead of its usual text, each
+ * with a "type" member saying what the line describes.
+ *
+ * A record is built with record_begin(), any number of field calls and
+ * record_end(), which ends the line.  All records go through one shared
+ * buffer that is reused, so once it has grown to the longest record
+ * printing costs no allocation at all.  The buffer is written out when it
+ * passes its flush threshold and by record_flush(), which cmd_done() calls
+ * at the end of every command; a terminal gets each line at once.  Only
+ * one record can be open at a time.
+ */
+typedef enum {
+  OUTPUT_TEXT,
+  OUTPUT_NDJSON
+} output_format;
+
+extern output_format g_output_format;
+
+extern int output_set_format(const char *name);
+
+extern void record_begin(const char *type);
+extern void record_end(void);
+extern void record_flush(void);
+
+extern void record_string(const char *key, const char *value);
+extern void record_int(const char *key, long long value);
+extern void record_double(const char *key, double value);
+extern void record_bool(const char *key, int value);
+
+extern void record_list_begin(const char *key);
+extern void record_list_string(const char *value);
+extern void record_list_end(void);
+
+/* The usual fields of the common objects, for use inside a record */
+extern void record_track(sp_track *track);
+extern void record_album(sp_album *album);
+extern void record_artist(sp_artist *artist);
+extern void record_playlist(sp_playlist *playlist);
+extern void record_user(sp_user *user);
+extern void record_metadata(const metadata_entry *e);
+
+#endif // RECORD_H__
@@ -28,17 +28,41 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <pthread.h>
 
 
 #include "git-spot.h"
 #include "cmd.h"
+#include "manifest.h"
+#include "json.h"
+#include "durable.h"
+#include "git-object.h"
+#include "git-pack.h"
+#include "track-table.h"
+#include "snapshot.h"
+#include "diff.h"
+#include "writer.h"
+#include "journal.h"
+#include "stats.h"
+#include "metadata-cache.h"
 
 typedef void (*sg_callback) (void *user_data);
 
+typedef struct _container_context container_context;
+
 static void container_loaded(sp_playlistcontainer *pc, void *user_data);
-static void save_playlist_async(sp_playlist *playlist, const char *directory,
+static void save_playlist_async(sp_playlist *playlist,
+    container_context *container,
+    const char *directory,
     unsigned int prefix,
+    int index,
     sg_callback cb, void *user_data);
+static void container_context_queue_playlist(container_context *ctx,
+    sp_playlist *playlist, const char *directory, unsigned int prefix);
+static void container_context_schedule(container_context *ctx);
+static void container_context_pump(container_context *ctx);
 
 static char *safe_filename (const char *str)
 {
@@ -54,111 +78,131 @@ static char *safe_filename (const char *str)
   return filename;
 }
 
-typedef struct _string_list string_list;
-
-struct _string_list {
-  string_list *next;
-  string_list *prev;
-  char *data;
-};
-
-string_list *
-string_list_first(string_list *list)
+/**
+ * The folder being walked: an open descriptor and the path of each level,
+ * so a new folder costs one mkdirat() and nothing is joined again.
+ */
+typedef struct {
+  int *fds;
+  size_t *lengths;    /* of path above each level */
+  int depth;
+  int size;
+  char *path;
+  size_t path_len;
+  size_t path_size;
+} dir_stack;
+
+static void dir_stack_append(dir_stack *stack, const char *str)
 {
-  while(list != NULL && list->prev != NULL)
-    list = list->prev;
-  return list;
+  size_t len = strlen(str);
+
+  if (stack->path_len + len + 1 > stack->path_size)
+    {
+      while (stack->path_len + len + 1 > stack->path_size)
+        stack->path_size = stack->path_size ? stack->path_size * 2 : 256;
+      stack->path = realloc(stack->path, stack->path_size);
+    }
+  memcpy(stack->path + stack->path_len, str, len + 1);
+  stack->path_len += len;
 }
 
-string_list *
-string_list_last(string_list *list)
+static void dir_stack_enter(dir_stack *stack, int fd, size_t parent_len)
 {
-  while(list != NULL && list->next != NULL)
-    list = list->next;
-  return list;
+  if (stack->depth == stack->size)
+    {
+      stack->size = stack->size ? stack->size * 2 : 8;
+      stack->fds = realloc(stack->fds, stack->size * sizeof(int));
+      stack->lengths = realloc(stack->lengths, stack->size * sizeof(size_t));
+    }
+  stack->fds[stack->depth] = fd;
+  stack->lengths[stack->depth] = parent_len;
+  stack->depth ++;
 }
 
-string_list *
-string_list_append(string_list *list, char *data)
+static void dir_stack_init(dir_stack *stack, const char *root)
 {
-  string_list *new_link = malloc(sizeof(string_list));
-  new_link->next = NULL;
-  new_link->data = data;
-
-  while (list != NULL && list->next != NULL)
-    list = list->next;
-
-  new_link->prev = list;
-
-  if(list != NULL)
-    list->next = new_link;
-
-  return new_link;
+  int fd;
+
+  memset(stack, 0, sizeof(dir_stack));
+  if(mkdir(root, 0755) != 0 && errno != EEXIST)
+    printf("WARNING: mkdir(\"%s\") failed.", root);
+  if ((fd = open(root, O_RDONLY | O_DIRECTORY)) < 0)
+    printf("WARNING: open(\"%s\") failed: %s\n", root, strerror(errno));
+  dir_stack_append(stack, root);
+  dir_stack_enter(stack, fd, 0);
 }
 
-string_list *
-string_list_copy(string_list *old_list)
+/**
+ * Create (if need be) and enter the folder @name below the current one.
+ */
+static void dir_stack_push(dir_stack *stack, const char *name)
 {
-  string_list *first_link = string_list_append(NULL, old_list->data);
-  string_list *new_link = first_link;
-  string_list *old_link = string_list_first(old_list);
+  int parent = stack->fds[stack->depth - 1];
+  size_t parent_len = stack->path_len;
+  int fd = -1;
 
-  while (old_link != NULL)
+  dir_stack_append(stack, "/");
+  dir_stack_append(stack, name);
+  if (parent >= 0)
     {
-      new_link = string_list_append(new_link, strdup(old_link->data));
-      old_link = old_link->next;
+      if (mkdirat(parent, name, 0755) != 0 && errno != EEXIST)
+        printf("WARNING: mkdir(\"%s\") failed.", stack->path);
+      else if ((fd = openat(parent, name, O_RDONLY | O_DIRECTORY)) < 0)
+        printf("WARNING: open(\"%s\") failed: %s\n", stack->path,
+            strerror(errno));
     }
-
-  return first_link;
+  dir_stack_enter(stack, fd, parent_len);
 }
 
-string_list *
-string_list_remove_tail(string_list *list)
+static void dir_stack_pop(dir_stack *stack)
 {
-  string_list *new_tail;
-  if (list == NULL)
-    return NULL;
-  list = string_list_last(list);
-  new_tail = list->prev;
-  new_tail->next = NULL;
-  free(list->data);
-  free(list);
-
-  return new_tail;
+  if (stack->depth <= 1)
+    return;
+  stack->depth --;
+  if (stack->fds[stack->depth] >= 0)
+    close(stack->fds[stack->depth]);
+  stack->path_len = stack->lengths[stack->depth];
+  stack->path[stack->path_len] = 0;
 }
 
-static void
-string_list_free(string_list *list)
+static void dir_stack_free(dir_stack *stack)
 {
-  list = string_list_first(list);
-  while(list != NULL)
-    {
-      string_list *next_list = list->next;
-      free(list->data);
-      free(list);
-      list = next_list;
-    }
+  while (stack->depth > 1)
+    dir_stack_pop(stack);
+  if (stack->depth == 1 && stack->fds[0] >= 0)
+    close(stack->fds[0]);
+  free(stack->fds);
+  free(stack->lengths);
+  free(stack->path);
 }
 
-static char *
-string_list_join(string_list *list, const char *sep)
-{
-  string_list *l;
-  char *old_string = NULL;
-  char *new_string = NULL;
+/*
+ * Every snapshot root also gets an ORDER_FILENAME, which lists its folders,
+ * by their real names, and its playlist files in container order.  It is
+ * what load rebuilds the container from.
+ */
+#define ORDER_FILENAME ".git-spot-order"
+#define ORDER_HEADER "git-spot order 1"
 
-  for (l = string_list_first(list); l != NULL; l = l->next)
-    {
-      asprintf(&new_string, "%s%s%s", old_string, sep, l->data);
-      free(old_string);
-      old_string = new_string;
-    }
-  new_string = strdup(old_string + strlen("(null)") + strlen(sep));
-  free(old_string);
-  return new_string;
-}
+typedef enum {
+  ORDER_PLAYLIST,     /* value is the playlist's URI */
+  ORDER_FOLDER,       /* value is the folder's name */
+  ORDER_END_FOLDER
+} order_kind;
 
-typedef struct _container_context container_context;
+typedef struct {
+  order_kind kind;
+  char *value;
+} order_item;
+
+/* A playlist waiting for a slot in the load window */
+typedef struct {
+  sp_playlist *playlist;
+  char *directory;
+  unsigned int prefix;
+  int index;
+  int size;
+} save_job;
 
 struct _container_context {
   sp_playlistcontainer *pc;
@@ -168,6 +212,27 @@ struct _container_context {
   int finished_calls;
   void (*finally_func) (container_context *);
   void *user_data;
+  manifest *old_manifest;
+  manifest *new_manifest;
+  int written_files;
+  int unchanged_files;
+  int deleted_files;
+  int resumed_files;
+  int placeholder_tracks;
+  int cached_tracks;
+  save_job *jobs;
+  int num_jobs;
+  int jobs_size;
+  int next_job;
+  int in_flight;
+  int pumping;
+  char *git_prefix;   /* where ctx->name is in the repository's tree */
+  snapshot_builder *snapshot;
+  order_item *order;  /* the container, for ORDER_FILENAME */
+  int num_order;
+  int order_size;
+  double requested;   /* stats_now() timestamps */
+  double loaded;
 };
 
 static container_context *container_context_new(
@@ -183,6 +248,27 @@ static container_context *container_context_new(
   ctx->started_calls = 0;
   ctx->finished_calls = 0;
   ctx->user_data = user_data;
+  ctx->old_manifest = NULL;
+  ctx->new_manifest = NULL;
+  ctx->written_files = 0;
+  ctx->unchanged_files = 0;
+  ctx->deleted_files = 0;
+  ctx->resumed_files = 0;
+  ctx->placeholder_tracks = 0;
+  ctx->cached_tracks = 0;
+  ctx->jobs = NULL;
+  ctx->num_jobs = 0;
+  ctx->jobs_size = 0;
+  ctx->next_job = 0;
+  ctx->in_flight = 0;
+  ctx->pumping = 0;
+  ctx->git_prefix = NULL;
+  ctx->snapshot = NULL;
+  ctx->order = NULL;
+  ctx->num_order = 0;
+  ctx->order_size = 0;
+  ctx->requested = stats_now();
+  ctx->loaded = 0;
   return ctx;
 }
 
@@ -199,8 +285,46 @@ static void container_context_add_finally(
     }
 }
 
+static void container_context_clear_order(container_context *ctx)
+{
+  int i;
+
+  for (i = 0; i < ctx->num_order; i++)
+    free(ctx->order[i].value);
+  ctx->num_order = 0;
+}
+
+/* Record the next entry of the container; @value may be NULL */
+static void container_context_add_order(container_context *ctx,
+    order_kind kind, const char *value)
+{
+  order_item *item;
+  char *c;
+
+  if (ctx->num_order == ctx->order_size)
+    {
+      ctx->order_size = ctx->order_size ? ctx->order_size * 2 : 64;
+      ctx->order = realloc(ctx->order, ctx->order_size * sizeof(order_item));
+    }
+  item = &ctx->order[ctx->num_order++];
+  item->kind = kind;
+  item->value = value != NULL ? strdup(value) : NULL;
+
+  /* The file has one entry per line */
+  for (c = item->value; c != NULL && *c != 0; c++)
+    if (*c == '\t' || *c == '\n' || *c == '\r')
+      *c = ' ';
+}
+
 static void container_context_free(container_context *ctx) {
   sp_playlistcontainer_remove_callbacks(ctx->pc, ctx->callbacks, ctx);
+  container_context_clear_order(ctx);
+  free(ctx->order);
+  manifest_free(ctx->old_manifest);
+  manifest_free(ctx->new_manifest);
+  free(ctx->jobs);
+  free(ctx->git_prefix);
+  snapshot_builder_free(ctx->snapshot);
   free(ctx->callbacks);
   free(ctx->name);
   free(ctx);
@@ -208,404 +332,3237 @@ static void container_context_free(container_context *ctx) {
 
 static int subscriptions_updated;
 
-static void cmd_save_finally(container_context *ctx)
+/* Only rewrite playlists whose rendering differs from the manifest */
+static int save_incremental;
+
+/* Every file of a save run is committed together at the end of the run */
+static durable_batch *save_batch;
+
+/* With --io-uring, save_batch queues its I/O on an io_uring if it can */
+static int save_uring;
+
+/* How many playlists of a container may be loading at once, 0 for all */
+static int save_window = 16;
+
+/* How many friends' published containers may be loading at once */
+static int save_social_window = 4;
+
+/* Start the biggest playlists first, so that they do not finish last */
+static int save_largest_first;
+
+/*
+ * With --track-table, playlist files only list track URIs and the
+ * metadata of every track of the run goes to one table in save_directory.
+ */
+static track_table *save_tracks;
+static char *save_directory;
+
+/* With --binary, every snapshot root also gets a SNAPSHOT_FILENAME */
+static int save_binary;
+
+/*
+ * With --commit, the run ends by committing the snapshot to save_ref in
+ * the enclosing repository.  save_tree starts out as the tree of the ref's
+ * current commit, and only the paths this run touches are edited in it.
+ */
+static char *save_ref;
+static git_repo *save_repo;
+
+/*
+ * With --pack, the run's objects go into git-spot's own pack, each
+ * playlist stored as a delta against its version in save_tree.
+ */
+static int save_pack;
+static git_pack_writer *save_pack_writer;
+static git_tree *save_tree;
+
+/*
+ * Guards save_tree and save_pack_writer: writer threads stage blobs while
+ * the main thread stages and removes those of finished containers.
+ */
+static pthread_mutex_t save_stage_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* How many writer threads render and write playlist files, 0 for none */
+static int save_threads = 4;
+
+/*
+ * How long a loaded playlist may wait for the metadata of its tracks,
+ * albums and artists before it is written with placeholders, 0 for not
+ * at all.
+ */
+static int save_metadata_timeout = 30;
+
+/*
+ * With --checkpoint N, every N playlists the batch is committed and the
+ * playlists are recorded in save_journal, so that "save --resume" can
+ * skip them after a crash.  0 for neither, which keeps the run to one
+ * commit of the batch; --resume checkpoints every SAVE_RESUME_CHECKPOINT.
+ */
+#define SAVE_RESUME_CHECKPOINT 100
+
+static journal *save_journal;
+static int save_checkpoint;
+static int save_checkpoint_failed;  /* the run may not be committed to git */
+
+/* Files whose queued write failed in a batch a checkpoint committed */
+static char **save_failed_paths;
+static int save_num_failed_paths;
+static int save_resume;
+static int save_writes_in_flight;
+
+/* With --stats FILE, the timings of the run are written to FILE at the end */
+static stats *save_stats;
+static char *save_stats_path;
+static unsigned char save_parent[GIT_ID_LENGTH];
+static int save_has_parent;
+static int save_total_written;
+static int save_total_unchanged;
+static int save_total_deleted;
+static int save_total_placeholders;
+
+static void save_repo_open(const char *path)
 {
-  cmd_save_social(0, NULL);
-  container_context_free(ctx);
+  unsigned char tree_id[GIT_ID_LENGTH];
+
+  save_repo = git_repo_discover(path);
+  if (save_repo == NULL)
+    {
+      printf("WARNING: %s is not in a git repository, not committing.\n", path);
+      free(save_ref);
+      save_ref = NULL;
+      return;
+    }
+
+  save_has_parent = git_repo_resolve_ref(save_repo, save_ref, save_parent) == 0;
+  if (save_has_parent && git_repo_commit_tree(save_repo, save_parent, tree_id) == 0)
+    save_tree = git_tree_load(save_repo, tree_id);
+  else if (!save_has_parent)
+    save_tree = git_tree_load(save_repo, NULL);
+
+  if (save_tree == NULL)
+    {
+      printf("WARNING: could not read %s, not committing.\n", save_ref);
+      git_repo_free(save_repo);
+      save_repo = NULL;
+      free(save_ref);
+      save_ref = NULL;
+      return;
+    }
+
+  if (save_pack)
+    {
+      save_pack_writer = git_pack_writer_new(save_repo);
+      git_repo_set_pack_writer(save_repo, save_pack_writer);
+    }
 }
 
-static container_context *container_context_start_call(container_context *ctx)
+static char *
+git_path(const char *git_prefix, const char *relative_filename)
 {
-  ctx->started_calls ++;
-  return ctx;
+  char *path;
+
+  asprintf(&path, "%s%s%s", git_prefix, *git_prefix ? "/" : "",
+      relative_filename);
+  return path;
 }
 
-static void container_context_finish_call(container_context *ctx)
+static char *
+container_context_git_path(container_context *ctx, const char *relative_filename)
 {
-  ctx->finished_calls ++;
-  printf("%d of %d calls finished.\n", ctx->finished_calls, ctx->started_calls);
-  if(ctx->finished_calls == ctx->started_calls)
+  return git_path(ctx->git_prefix, relative_filename);
+}
+
+/**
+ * @return the contents of @relative_filename as it is on disk, if that is
+ * the blob @id; NULL otherwise
+ */
+static char *
+read_previous_version(const char *root, const char *relative_filename,
+    const unsigned char id[GIT_ID_LENGTH], size_t *len)
+{
+  char *filename, *data = NULL;
+  unsigned char actual_id[GIT_ID_LENGTH];
+  FILE *input;
+  long size;
+
+  asprintf(&filename, "%s/%s", root, relative_filename);
+  input = fopen(filename, "r");
+  free(filename);
+  if (input == NULL)
+    return NULL;
+
+  if (fseek(input, 0, SEEK_END) == 0 && (size = ftell(input)) >= 0
+      && fseek(input, 0, SEEK_SET) == 0)
     {
-      if (ctx->finally_func != NULL)
-        ctx->finally_func(ctx);
+      data = malloc(size + 1);
+      if (fread(data, 1, size, input) != (size_t) size)
+        {
+          free(data);
+          data = NULL;
+        }
       else
-        printf("context's finally function is NULL.");
+        *len = size;
+    }
+  fclose(input);
+
+  if (data != NULL)
+    {
+      git_hash_object(GIT_OBJ_BLOB, data, *len, actual_id);
+      if (memcmp(actual_id, id, GIT_ID_LENGTH) != 0)
+        {
+          free(data);
+          data = NULL;
+        }
     }
+  return data;
 }
 
 /**
+ * Put @relative_filename, which is relative to the directory @root and
+ * thus to @git_prefix in the repository, into the tree that will be
+ * committed.  The blob is only written if @known_id is NULL or missing
+ * from the repository.  With --pack, it is deltified against the blob at
+ * @base_filename, where the previous version was saved, or at
+ * @relative_filename if that is NULL.  Writer threads and the main thread
+ * may stage at the same time; save_stage_lock keeps them apart.
  *
+ * @return 0 on success, -1 if the blob could not be written
  */
-int cmd_save(int argc, char **argv)
+static int
+stage_blob(const char *root, const char *git_prefix,
+    const char *relative_filename, const char *base_filename,
+    const void *data, size_t len,
+    const unsigned char *known_id, unsigned char id[GIT_ID_LENGTH])
 {
-  sp_playlistcontainer *pc = sp_session_playlistcontainer(g_session);
-  container_context *ctx = NULL;
-
-  if (argc < 1)
-    ctx = container_context_new(pc, ".", NULL);
+  char *path = git_path(git_prefix, relative_filename);
+  unsigned char base_id[GIT_ID_LENGTH];
+  int has_base = 0;
+  char *base_data = NULL;
+  size_t base_len = 0;
+  int result;
+
+  if (base_filename == NULL)
+    base_filename = relative_filename;
+
+  pthread_mutex_lock(&save_stage_lock);
+  if (known_id != NULL && git_repo_has_object(save_repo, known_id))
+    memcpy(id, known_id, GIT_ID_LENGTH);
   else
-    ctx = container_context_new(pc, argv[1], NULL);
+    {
+      /* The previous version is usually still on disk, which saves
+         reading it back out of its delta chain */
+      if (save_pack_writer != NULL)
+        {
+          char *base_path = git_path(git_prefix, base_filename);
+          has_base = git_tree_get(save_repo, save_tree, base_path, base_id) == 0;
+          free(base_path);
+        }
+      if (has_base)
+        base_data = read_previous_version(root, base_filename, base_id,
+            &base_len);
+
+      result = git_repo_write_delta_object(save_repo, save_batch, GIT_OBJ_BLOB,
+          data, len, has_base ? base_id : NULL, base_data, base_len, id);
+      free(base_data);
+      if (result != 0)
+        {
+          pthread_mutex_unlock(&save_stage_lock);
+          free(path);
+          return -1;
+        }
+    }
 
-  ctx->callbacks->container_loaded = container_loaded;
-  sp_playlistcontainer_add_callbacks(pc, ctx->callbacks,
-      container_context_start_call(ctx));
-  container_context_add_finally(ctx, cmd_save_finally);
-  return 1;
+  git_tree_set(save_repo, save_tree, path, GIT_MODE_FILE, id);
+  pthread_mutex_unlock(&save_stage_lock);
+  free(path);
+  return 0;
 }
 
-static void container_loaded(sp_playlistcontainer *pc, void *userdata)
+static int
+container_context_stage_blob(container_context *ctx,
+    const char *relative_filename, const char *base_filename,
+    const void *data, size_t len,
+    const unsigned char *known_id, unsigned char id[GIT_ID_LENGTH])
 {
-  container_context *ctx = userdata;
-  int i, j, level = 0;
-  unsigned int prefix = 0;
-  sp_playlist *pl;
-  char name[200];
-  string_list *path = string_list_append(NULL, strdup(ctx->name));
-
-  if(mkdir(ctx->name, 0755) != 0 && errno != EEXIST)
-    printf("WARNING: mkdir(\"%s\") failed.", ctx->name);
-
-  printf("path = %s\n", ctx->name);
-  printf("%d entries in the container\n", sp_playlistcontainer_num_playlists(pc));
+  return stage_blob(ctx->name, ctx->git_prefix, relative_filename,
+      base_filename, data, len, known_id, id);
+}
 
-  sp_session_num_friends(g_session);
+static char *
+container_context_manifest_path(container_context *ctx)
+{
+  char *path;
 
-  for (i = 0; i < sp_playlistcontainer_num_playlists(pc); ++i) {
-    char *folder_name;
-    switch (sp_playlistcontainer_playlist_type(pc, i)) {
-      case SP_PLAYLIST_TYPE_PLAYLIST:
-        printf("%d. ", i);
-        folder_name = string_list_join(path, "/");
-        if(mkdir(folder_name, 0755) != 0 && errno != EEXIST)
-          printf("WARNING: mkdir(\"%s\") failed.", folder_name);
-        prefix ++;
-        pl = sp_playlistcontainer_playlist(pc, i);
-        save_playlist_async(pl, folder_name, prefix, (sg_callback)container_context_finish_call,
-            container_context_start_call(ctx));
-        free(folder_name);
-        printf("%s", sp_playlist_name(pl));
-        if(subscriptions_updated)
-          printf(" (%d subscribers)", sp_playlist_num_subscribers(pl));
-        printf("\n");
-        break;
-      case SP_PLAYLIST_TYPE_START_FOLDER:
-        printf("%d. ", i);
-        for (j = level; j; --j) printf("\t");
-        sp_playlistcontainer_playlist_folder_name(pc, i, name, sizeof(name));
-        printf("Folder: %s with id %lu\n", name,
-             sp_playlistcontainer_playlist_folder_id(pc, i));
-        level++;
-        prefix = 0;
-        path = string_list_append(path, safe_filename(name));
+  asprintf(&path, "%s/%s", ctx->name, MANIFEST_FILENAME);
+  return path;
+}
 
-        folder_name = string_list_join(path, "/");
-        if(mkdir(folder_name, 0755) != 0 && errno != EEXIST)
-          printf("WARNING: mkdir(\"%s\") failed.", folder_name);
-        free(folder_name);
-        break;
-      case SP_PLAYLIST_TYPE_END_FOLDER:
-        path = string_list_remove_tail(path);
-        level--;
-        prefix = 0;
-         printf("%d. ", i);
-        for (j = level; j; --j) printf("\t");
-        printf("End folder with id %lu\n",  sp_playlistcontainer_playlist_folder_id(pc, i));
-        break;
-      case SP_PLAYLIST_TYPE_PLACEHOLDER:
-        printf("%d. Placeholder", i);
-        break;
-    }
-  }
+/**
+ * Carry what the old manifest has for the playlist @uri over to the new
+ * one, or leave it out of the new one if it is new.  Its new file could
+ * not be written, so the old file stays in place and must neither be
+ * deleted nor be taken for the new contents.
+ */
+static void
+container_context_keep_old_entry(container_context *ctx, const char *uri)
+{
+  manifest_entry *old_entry = manifest_lookup(ctx->old_manifest, uri);
 
-  printf("Made %d async calls.\n", ctx->started_calls -1);
-  container_context_finish_call(ctx);
-  string_list_free(path);
+  if (old_entry != NULL)
+    manifest_set(ctx->new_manifest, uri, old_entry->filename, old_entry->hash,
+        old_entry->num_tracks,
+        old_entry->has_blob_id ? old_entry->blob_id : NULL);
+  else
+    manifest_remove(ctx->new_manifest, uri);
 }
 
+/* Looks for the playlist that the new manifest saves to a file */
 typedef struct {
-  sp_playlist *playlist;
-  char *directory;
-  unsigned int prefix;
-  sg_callback cb;
-  void *user_data;
-  sp_playlist_callbacks *callbacks;
-} playlist_data;
+  const char *filename;
+  char *uri;
+} manifest_search;
 
-static playlist_data *playlist_data_new(sp_playlist *playlist,
-    const char *directory,
-    unsigned int prefix,
-    sg_callback cb,
-    void *user_data)
+static void
+find_manifest_filename(manifest_entry *entry, void *user_data)
 {
-  playlist_data *data = malloc(sizeof(playlist_data));
-
-  data->playlist = playlist;
-  data->directory = strdup(directory);
-  data->prefix = prefix;
-  data->cb = cb;
-  data->user_data = user_data;
-  data->callbacks = malloc(sizeof(sp_playlist_callbacks));
-  memset(data->callbacks, 0, sizeof(sp_playlist_callbacks));
+  manifest_search *search = user_data;
 
-  return data;
+  if (search->uri == NULL && strcmp(entry->filename, search->filename) == 0)
+    search->uri = strdup(entry->uri);
 }
 
-static void playlist_data_free(playlist_data *data)
+/**
+ * Called for each write of save_batch that failed after it was queued: if
+ * @path is the file of a playlist of @ctx, that playlist was not written
+ * after all.
+ */
+static void
+forget_failed_write(const char *path, void *user_data)
 {
-  sp_playlist_remove_callbacks(data->playlist, data->callbacks, data);
-  free(data->directory);
-  free(data->callbacks);
-  free(data);
+  container_context *ctx = user_data;
+  size_t len = strlen(ctx->name);
+  manifest_search search;
+
+  if (strncmp(path, ctx->name, len) != 0 || path[len] != '/')
+    return;
+
+  search.filename = path + len + 1;
+  search.uri = NULL;
+  manifest_foreach(ctx->new_manifest, find_manifest_filename, &search);
+  if (search.uri == NULL)
+    return;
+
+  container_context_keep_old_entry(ctx, search.uri);
+  ctx->written_files --;
+  free(search.uri);
 }
 
-static void save_playlist_finally(playlist_data *data)
+static void
+delete_stale_file(manifest_entry *old_entry, void *user_data)
 {
-  if(data->cb != NULL)
-    data->cb(data->user_data);
-  playlist_data_free(data);
-}
+  container_context *ctx = user_data;
+  manifest_entry *new_entry = manifest_lookup(ctx->new_manifest, old_entry->uri);
+  char *filename;
 
-static char *
-sg_link_dup_string(sp_link *link)
-{
-  char link_str[100];
+  if (new_entry != NULL && strcmp(new_entry->filename, old_entry->filename) == 0)
+    return;
 
-  if(!sp_link_as_string(link, link_str, 100))
-    printf("WARNING: sp_link_as_string failed.\n");
+  asprintf(&filename, "%s/%s", ctx->name, old_entry->filename);
+  if (access(filename, F_OK) == 0)
+    {
+      durable_batch_unlink(save_batch, filename);
+      ctx->deleted_files ++;
+    }
+  free(filename);
 
-  return strdup(link_str);
+  if (ctx->git_prefix != NULL)
+    {
+      char *path = container_context_git_path(ctx, old_entry->filename);
+      pthread_mutex_lock(&save_stage_lock);
+      git_tree_remove(save_repo, save_tree, path);
+      pthread_mutex_unlock(&save_stage_lock);
+      free(path);
+    }
 }
 
-/*
- * http://open.spotify.com/user/alsuren/playlist/1ruXh4qLoLj8GDWpSbYFsf
- * spotify:user:alsuren:playlist:1ruXh4qLoLj8GDWpSbYFsf
- */
-static char *
-sg_link_dup_http_string(sp_link *link)
+static void container_context_write_binary(container_context *ctx)
 {
-  char link_str[100];
-  char *c;
-
+  char *path;
+  void *data;
+  size_t len;
+  unsigned char id[GIT_ID_LENGTH];
 
-  if(!sp_link_as_string(link, link_str + strlen("http://open..com"), 100))
-    printf("WARNING: sp_link_as_string failed.\n");
+  data = snapshot_builder_render(ctx->snapshot, &len);
+  asprintf(&path, "%s/%s", ctx->name, SNAPSHOT_FILENAME);
 
-  memmove(link_str, "http://open.spotify.com", strlen("http://open.spotify.com"));
+  if (durable_batch_write(save_batch, path, data, len) != 0)
+    printf("WARNING: failed to write %s.\n", path);
+  else if (ctx->git_prefix != NULL)
+    container_context_stage_blob(ctx, SNAPSHOT_FILENAME, NULL, data, len,
+        NULL, id);
 
-  for(c = link_str + strlen("http://open.spotify.com"); *c != 0; c ++)
-    if(*c == ':')
-      *c = '/';
-  return strdup(link_str);
+  free(path);
+  free(data);
+}
+
+/**
+ * Write ORDER_FILENAME: each playlist by the file the new manifest has for
+ * it, so one that failed to save is left out.
+ */
+static void container_context_write_order(container_context *ctx)
+{
+  char *path, *contents = NULL;
+  size_t contents_len = 0;
+  FILE *output = open_memstream(&contents, &contents_len);
+  manifest_entry *entry;
+  int i;
+
+  fprintf(output, "%s\n", ORDER_HEADER);
+  for (i = 0; i < ctx->num_order; i++)
+    {
+      order_item *item = &ctx->order[i];
+
+      switch (item->kind)
+        {
+        case ORDER_PLAYLIST:
+          entry = manifest_lookup(ctx->new_manifest, item->value);
+          if (entry != NULL)
+            fprintf(output, "playlist\t%s\n", entry->filename);
+          break;
+        case ORDER_FOLDER:
+          fprintf(output, "folder\t%s\n", item->value);
+          break;
+        case ORDER_END_FOLDER:
+          fprintf(output, "end\n");
+          break;
+        }
+    }
+
+  asprintf(&path, "%s/%s", ctx->name, ORDER_FILENAME);
+  if (fclose(output) != 0
+      || durable_batch_write(save_batch, path, contents, contents_len) != 0)
+    printf("WARNING: failed to write %s.\n", path);
+  else if (ctx->git_prefix != NULL)
+    {
+      unsigned char id[GIT_ID_LENGTH];
+      container_context_stage_blob(ctx, ORDER_FILENAME, NULL, contents,
+          contents_len, NULL, id);
+    }
+  free(contents);
+  free(path);
+}
+
+/**
+ * Called once every playlist in the container has been saved: removes
+ * files for playlists that went away or were renamed, and records the new
+ * manifest and the container's order for next time.
+ */
+static void container_context_finish_snapshot(container_context *ctx)
+{
+  char *manifest_path = container_context_manifest_path(ctx);
+  char *contents = NULL;
+  size_t contents_len = 0;
+  FILE *output;
+  int failed, i;
+
+  /* With --io-uring, a write can fail after it was counted as written */
+  durable_batch_foreach_failed(save_batch, forget_failed_write, ctx);
+  for (i = 0; i < save_num_failed_paths; i++)
+    forget_failed_write(save_failed_paths[i], ctx);
+
+  if (save_incremental)
+    manifest_foreach(ctx->old_manifest, delete_stale_file, ctx);
+
+  output = open_memstream(&contents, &contents_len);
+  failed = manifest_write(ctx->new_manifest, output) != 0;
+  if (fclose(output) != 0 || failed
+      || durable_batch_write(save_batch, manifest_path, contents, contents_len) != 0)
+    printf("WARNING: failed to write %s.\n", manifest_path);
+  else if (ctx->git_prefix != NULL)
+    {
+      unsigned char id[GIT_ID_LENGTH];
+      container_context_stage_blob(ctx, MANIFEST_FILENAME, NULL, contents,
+          contents_len, NULL, id);
+    }
+  free(contents);
+  free(manifest_path);
+
+  container_context_write_order(ctx);
+  if (ctx->snapshot != NULL)
+    container_context_write_binary(ctx);
+
+  printf("%s: %d written, %d unchanged, %d deleted.\n", ctx->name,
+      ctx->written_files, ctx->unchanged_files, ctx->deleted_files);
+  save_total_written += ctx->written_files;
+  save_total_unchanged += ctx->unchanged_files;
+  save_total_deleted += ctx->deleted_files;
+  if (save_stats != NULL)
+    stats_add_container(save_stats, ctx->name, ctx->num_jobs, ctx->requested,
+        ctx->loaded, stats_now());
+  if (ctx->resumed_files > 0)
+    printf("%s: %d of those were saved by an interrupted run.\n", ctx->name,
+        ctx->resumed_files);
+  if (ctx->cached_tracks > 0)
+    printf("%s: %d tracks were saved from the metadata cache.\n", ctx->name,
+        ctx->cached_tracks);
+  if (ctx->placeholder_tracks > 0)
+    printf("%s: %d tracks were saved with placeholders.\n", ctx->name,
+        ctx->placeholder_tracks);
+  save_total_placeholders += ctx->placeholder_tracks;
+}
+
+static void cmd_save_finally(container_context *ctx)
+{
+  cmd_save_social(0, NULL);
+  container_context_free(ctx);
+}
+
+static container_context *container_context_start_call(container_context *ctx)
+{
+  ctx->started_calls ++;
+  return ctx;
+}
+
+static void container_context_finish_call(container_context *ctx)
+{
+  ctx->finished_calls ++;
+  printf("%d of %d calls finished.\n", ctx->finished_calls, ctx->started_calls);
+
+  container_context_pump(ctx);
+  if (ctx->pumping)
+    return; /* the outer container_context_pump() call will get here */
+
+  if(ctx->finished_calls == ctx->started_calls && ctx->next_job == ctx->num_jobs)
+    {
+      if (ctx->new_manifest != NULL)
+        container_context_finish_snapshot(ctx);
+      if (ctx->finally_func != NULL)
+        ctx->finally_func(ctx);
+      else
+        printf("context's finally function is NULL.");
+    }
+}
+
+/* The options of cmd_save() that take a value */
+static const char *save_value_options[] = {
+  "--window", "-w", "--threads", "--social-window", "--metadata-timeout",
+  "--checkpoint", "--stats", NULL
+};
+
+static int save_option_takes_value(const char *arg)
+{
+  int i;
+
+  for (i = 0; save_value_options[i] != NULL; i++)
+    if (strcmp(arg, save_value_options[i]) == 0)
+      return 1;
+  return 0;
+}
+
+/**
+ * Put every option of a save run back to its default, so that nothing
+ * carries over from an earlier run in the same session.
+ */
+static void save_reset_options(void)
+{
+  save_incremental = 0;
+  save_uring = 0;
+  save_window = 16;
+  save_social_window = 4;
+  save_largest_first = 0;
+  track_table_free(save_tracks);
+  save_tracks = NULL;
+  save_binary = 0;
+  free(save_ref);
+  save_ref = NULL;
+  save_pack = 0;
+  save_threads = 4;
+  save_metadata_timeout = 30;
+  save_checkpoint = 0;
+  save_checkpoint_failed = 0;
+  save_resume = 0;
+  free(save_stats_path);
+  save_stats_path = NULL;
+  save_has_parent = 0;
+  save_total_written = 0;
+  save_total_unchanged = 0;
+  save_total_deleted = 0;
+  save_total_placeholders = 0;
+}
+
+/**
+ *
+ */
+static void save_usage(void)
+{
+  fprintf(stderr, "Usage: save [--incremental] [--window N] [--largest-first]\n"
+                  "            [--commit[=REF]] [--pack] [--track-table] [--binary]\n"
+                  "            [--threads N] [--io-uring] [--social-window N]\n"
+                  "            [--metadata-timeout SECONDS] [--checkpoint N]\n"
+                  "            [--resume] [--stats FILE] [DIRECTORY]\n");
+}
+
+/**
+ *
+ */
+int cmd_save(int argc, char **argv)
+{
+  sp_playlistcontainer *pc = sp_session_playlistcontainer(g_session);
+  container_context *ctx = NULL;
+  const char *directory = NULL;
+  int i;
+
+  if (save_directory != NULL)
+    {
+      fprintf(stderr, "save: a save is already running\n");
+      return -1;
+    }
+
+  save_reset_options();
+  for (i = 1; i < argc; i++)
+    {
+      if (save_option_takes_value(argv[i]) && i + 1 == argc)
+        {
+          save_usage();
+          return -1;
+        }
+
+      if (strcmp(argv[i], "--incremental") == 0 || strcmp(argv[i], "-i") == 0)
+        save_incremental = 1;
+      else if (strcmp(argv[i], "--window") == 0 || strcmp(argv[i], "-w") == 0)
+        save_window = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--largest-first") == 0)
+        save_largest_first = 1;
+      else if (strcmp(argv[i], "--commit") == 0)
+        {
+          free(save_ref);
+          save_ref = strdup("refs/heads/git-spot");
+        }
+      else if (strncmp(argv[i], "--commit=", 9) == 0)
+        {
+          free(save_ref);
+          if (strncmp(argv[i] + 9, "refs/", 5) == 0)
+            save_ref = strdup(argv[i] + 9);
+          else
+            asprintf(&save_ref, "refs/heads/%s", argv[i] + 9);
+        }
+      else if (strcmp(argv[i], "--pack") == 0)
+        save_pack = 1;
+      else if (strcmp(argv[i], "--track-table") == 0)
+        {
+          if (save_tracks == NULL)
+            save_tracks = track_table_new();
+        }
+      else if (strcmp(argv[i], "--binary") == 0)
+        save_binary = 1;
+      else if (strcmp(argv[i], "--threads") == 0)
+        save_threads = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--io-uring") == 0)
+        save_uring = 1;
+      else if (strcmp(argv[i], "--social-window") == 0)
+        save_social_window = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--metadata-timeout") == 0)
+        save_metadata_timeout = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--checkpoint") == 0)
+        save_checkpoint = atoi(argv[++i]);
+      else if (strcmp(argv[i], "--resume") == 0)
+        save_resume = 1;
+      else if (strcmp(argv[i], "--stats") == 0)
+        {
+          free(save_stats_path);
+          save_stats_path = strdup(argv[++i]);
+        }
+      else if (argv[i][0] != '-' && directory == NULL)
+        directory = argv[i];
+      else
+        {
+          save_usage();
+          return -1;
+        }
+    }
+
+  if (directory == NULL)
+    directory = ".";
+  save_directory = strdup(directory);
+  writer_start(save_threads);
+
+  if (save_stats_path != NULL && save_stats == NULL)
+    save_stats = stats_new();
+
+  /* Only the playlist files and the manifest can be picked up again */
+  if (save_resume && (save_binary || save_tracks != NULL))
+    {
+      printf("WARNING: --resume does not work with --binary or --track-table,"
+          " saving everything.\n");
+      save_resume = 0;
+    }
+  if (save_resume && save_checkpoint == 0)
+    save_checkpoint = SAVE_RESUME_CHECKPOINT;
+
+  if (save_pack && save_ref == NULL)
+    save_ref = strdup("refs/heads/git-spot");
+
+  ctx = container_context_new(pc, directory, NULL);
+
+  container_context_start_call(ctx);
+  ctx->callbacks->container_loaded = container_loaded;
+  sp_playlistcontainer_add_callbacks(pc, ctx->callbacks, ctx);
+  container_context_add_finally(ctx, cmd_save_finally);
+
+  /* A container that loaded before, e.g. for an earlier save, says no more */
+  if (sp_playlistcontainer_is_loaded(pc))
+    container_loaded(pc, ctx);
+  return 1;
+}
+
+static void container_loaded(sp_playlistcontainer *pc, void *userdata)
+{
+  container_context *ctx = userdata;
+  int i, j, level = 0;
+  unsigned int prefix = 0;
+  sp_playlist *pl;
+  char name[200];
+  dir_stack path;
+  uint32_t *folders = NULL;   /* snapshot folder of each level */
+  char *folder_name;
+
+  dir_stack_init(&path, ctx->name);
+
+  if (save_batch == NULL)
+    {
+      save_batch = durable_batch_new();
+      if (save_uring && durable_batch_use_uring(save_batch) != 0)
+        printf("io_uring is not available, using POSIX I/O.\n");
+    }
+
+  if (save_journal == NULL && save_checkpoint > 0)
+    {
+      char *journal_path;
+
+      asprintf(&journal_path, "%s/%s",
+          save_directory != NULL ? save_directory : ctx->name, JOURNAL_FILENAME);
+      save_journal = journal_open(journal_path, save_resume);
+      if (save_journal != NULL && save_resume)
+        printf("Resuming from %d journaled playlists.\n",
+            journal_size(save_journal));
+      free(journal_path);
+    }
+
+  if (ctx->new_manifest == NULL)
+    {
+      char *manifest_path = container_context_manifest_path(ctx);
+      ctx->loaded = stats_now();
+      ctx->old_manifest = manifest_load(manifest_path);
+      ctx->new_manifest = manifest_new();
+      free(manifest_path);
+      if (save_binary)
+        ctx->snapshot = snapshot_builder_new();
+
+      if (save_ref != NULL && save_repo == NULL)
+        save_repo_open(ctx->name);
+      if (save_repo != NULL)
+        {
+          ctx->git_prefix = git_repo_relative_path(save_repo, ctx->name);
+          if (ctx->git_prefix == NULL)
+            printf("WARNING: %s is outside of %s, not committing it.\n",
+                ctx->name, git_repo_dir(save_repo));
+        }
+    }
+
+  printf("path = %s\n", ctx->name);
+  printf("%d entries in the container\n", sp_playlistcontainer_num_playlists(pc));
+  container_context_clear_order(ctx);
+
+  sp_session_num_friends(g_session);
+
+  for (i = 0; i < sp_playlistcontainer_num_playlists(pc); ++i) {
+    switch (sp_playlistcontainer_playlist_type(pc, i)) {
+      case SP_PLAYLIST_TYPE_PLAYLIST:
+        printf("%d. ", i);
+        prefix ++;
+        pl = sp_playlistcontainer_playlist(pc, i);
+        if (ctx->snapshot != NULL)
+          snapshot_builder_add_playlist(ctx->snapshot,
+              level > 0 ? folders[level - 1] : SNAPSHOT_NONE);
+        container_context_queue_playlist(ctx, pl, path.path, prefix);
+        printf("%s", sp_playlist_name(pl));
+        if(subscriptions_updated)
+          printf(" (%d subscribers)", sp_playlist_num_subscribers(pl));
+        printf("\n");
+        break;
+      case SP_PLAYLIST_TYPE_START_FOLDER:
+        printf("%d. ", i);
+        for (j = level; j; --j) printf("\t");
+        sp_playlistcontainer_playlist_folder_name(pc, i, name, sizeof(name));
+        printf("Folder: %s with id %lu\n", name,
+             sp_playlistcontainer_playlist_folder_id(pc, i));
+        if (ctx->snapshot != NULL && level >= 0)
+          {
+            folders = realloc(folders, (level + 1) * sizeof(uint32_t));
+            folders[level] = snapshot_builder_add_folder(ctx->snapshot,
+                sp_playlistcontainer_playlist_folder_id(pc, i), name,
+                level > 0 ? folders[level - 1] : SNAPSHOT_NONE);
+          }
+        container_context_add_order(ctx, ORDER_FOLDER, name);
+        level++;
+        prefix = 0;
+        folder_name = safe_filename(name);
+        dir_stack_push(&path, folder_name);
+        free(folder_name);
+        break;
+      case SP_PLAYLIST_TYPE_END_FOLDER:
+        container_context_add_order(ctx, ORDER_END_FOLDER, NULL);
+        dir_stack_pop(&path);
+        level--;
+        prefix = 0;
+         printf("%d. ", i);
+        for (j = level; j; --j) printf("\t");
+        printf("End folder with id %lu\n",  sp_playlistcontainer_playlist_folder_id(pc, i));
+        break;
+      case SP_PLAYLIST_TYPE_PLACEHOLDER:
+        printf("%d. Placeholder", i);
+        break;
+    }
+  }
+
+  printf("Queued %d playlists.\n", ctx->num_jobs);
+  container_context_schedule(ctx);
+  container_context_finish_call(ctx);
+  dir_stack_free(&path);
+  free(folders);
+}
+
+/* A track, album or artist a loaded playlist is still waiting for */
+typedef enum {
+  SAVE_PENDING_TRACK,
+  SAVE_PENDING_ALBUM,
+  SAVE_PENDING_ARTIST
+} save_pending_kind;
+
+typedef struct {
+  save_pending_kind kind;
+  void *object;
+} save_pending;
+
+typedef struct {
+  sp_playlist *playlist;
+  container_context *container;
+  char *directory;
+  unsigned int prefix;
+  int index;          /* among the container's playlists */
+  sg_callback cb;
+  void *user_data;
+  sp_playlist_callbacks *callbacks;
+  save_pending *pending;
+  int num_pending;
+  int pending_size;
+  int gate;           /* in save_gated, -1 unless waiting there */
+  struct timeval deadline;
+  double requested;   /* stats_now() timestamps */
+  double loaded;
+  double ready;
+} playlist_data;
+
+static playlist_data *playlist_data_new(sp_playlist *playlist,
+    container_context *container,
+    const char *directory,
+    unsigned int prefix,
+    int index,
+    sg_callback cb,
+    void *user_data)
+{
+  playlist_data *data = malloc(sizeof(playlist_data));
+
+  data->playlist = playlist;
+  data->container = container;
+  data->directory = strdup(directory);
+  data->prefix = prefix;
+  data->index = index;
+  data->cb = cb;
+  data->user_data = user_data;
+  data->callbacks = malloc(sizeof(sp_playlist_callbacks));
+  memset(data->callbacks, 0, sizeof(sp_playlist_callbacks));
+  data->pending = NULL;
+  data->num_pending = 0;
+  data->pending_size = 0;
+  data->gate = -1;
+  data->requested = stats_now();
+  data->loaded = 0;
+  data->ready = 0;
+
+  return data;
+}
+
+static void playlist_data_free(playlist_data *data)
+{
+  free(data->pending);
+  free(data->directory);
+  free(data->callbacks);
+  free(data);
+}
+
+static void save_playlist_finally(playlist_data *data)
+{
+  if(data->cb != NULL)
+    data->cb(data->user_data);
+  playlist_data_free(data);
+}
+
+static char *
+sg_link_dup_string(sp_link *link)
+{
+  char link_str[100];
+
+  if(!sp_link_as_string(link, link_str, 100))
+    printf("WARNING: sp_link_as_string failed.\n");
+
+  return strdup(link_str);
+}
+
+/*
+ * http://open.spotify.com/user/alsuren/playlist/1ruXh4qLoLj8GDWpSbYFsf
+ * spotify:user:alsuren:playlist:1ruXh4qLoLj8GDWpSbYFsf
+ */
+static char *
+sg_link_dup_http_string(sp_link *link)
+{
+  char link_str[100];
+  char *c;
+
+
+  if(!sp_link_as_string(link, link_str + strlen("http://open..com"), 100))
+    printf("WARNING: sp_link_as_string failed.\n");
+
+  memmove(link_str, "http://open.spotify.com", strlen("http://open.spotify.com"));
+
+  for(c = link_str + strlen("http://open.spotify.com"); *c != 0; c ++)
+    if(*c == ':')
+      *c = '/';
+  return strdup(link_str);
+}
+
+/**
+ * Returns the part of @directory below the snapshot root, which is what
+ * the manifest records.
+ */
+static const char *
+relative_directory(container_context *ctx, const char *directory)
+{
+  size_t len = strlen(ctx->name);
+
+  if (strncmp(directory, ctx->name, len) == 0)
+    {
+      if (directory[len] == 0)
+        return "";
+      if (directory[len] == '/')
+        return directory + len + 1;
+    }
+  return directory;
+}
+
+/**
+ * The file, relative to the snapshot root, that the playlist @uri called
+ * @name gets at @prefix in @directory.
+ */
+static char *
+playlist_relative_filename(container_context *ctx, const char *directory,
+    unsigned int prefix, const char *name, const char *uri)
+{
+  char *basename = safe_filename(name);
+  const char *relative_dir = relative_directory(ctx, directory);
+  char *filename;
+
+  asprintf(&filename, "%s%s%03u--%s--%s.json", relative_dir,
+      *relative_dir ? "/" : "", prefix, basename, uri);
+  free(basename);
+  return filename;
+}
+
+/*
+ * A loaded playlist is saved in two halves.  On the main thread,
+ * save_record_capture() copies what its file needs out of libspotify into
+ * a save_record.  A writer thread then renders, writes and stages it, and
+ * save_record_done() files the results back on the main thread.
+ */
+
+#define SAVE_NO_STRING ((size_t) -1)
+
+/* One track of a save_record; its strings are offsets into the record's */
+typedef struct {
+  size_t uri;
+  size_t name;
+  size_t album;       /* SAVE_NO_STRING until the album has loaded */
+  size_t artists;     /* num_artists strings, one after the other */
+  int num_artists;
+  int duration;
+  int wanted;         /* by save_tracks, when it was captured */
+} save_track;
+
+typedef struct {
+  playlist_data *data;
+  char *name;
+  char *http_link;
+  char *uri_link;
+  char *filename;
+  char *relative_filename;
+  save_track *tracks;
+  int num_tracks;
+  char *strings;
+  size_t strings_len;
+  size_t strings_size;
+
+  uint64_t revision;   /* of the track list, see playlist_revision() */
+
+  /* Set by the writer thread */
+  uint64_t hash;
+  int skipped;
+  int written;
+  size_t bytes;
+  int has_blob_id;
+  unsigned char blob_id[GIT_ID_LENGTH];
+  json_buffer records;  /* the metadata of the wanted tracks */
+  size_t *record_ends;
+} save_record;
+
+/* One per thread, reused for every playlist, so rendering does not
+   allocate per track */
+static __thread json_buffer render_buffer;
+
+static size_t save_record_add_string(save_record *r, const char *str)
+{
+  size_t len = strlen(str) + 1;
+  size_t offset = r->strings_len;
+
+  if (r->strings_len + len > r->strings_size)
+    {
+      while (r->strings_len + len > r->strings_size)
+        r->strings_size = r->strings_size ? r->strings_size * 2 : 4096;
+      r->strings = realloc(r->strings, r->strings_size);
+    }
+  memcpy(r->strings + offset, str, len);
+  r->strings_len += len;
+  return offset;
+}
+
+static void save_record_free(save_record *r)
+{
+  free(r->name);
+  free(r->http_link);
+  free(r->uri_link);
+  free(r->filename);
+  free(r->relative_filename);
+  free(r->tracks);
+  free(r->strings);
+  if (r->records.data != NULL)
+    json_buffer_free(&r->records);
+  free(r->record_ends);
+  free(r);
+}
+
+/**
+ * Append the name, artists, album and duration of @t as JSON object
+ * members.
+ *
+ * @return 1 if all of them were known, 0 if a placeholder was used
+ */
+static int render_track_metadata(save_record *r, save_track *t, json_buffer *b)
+{
+  const char *artist = r->strings + t->artists;
+  int j;
+  int complete = 1;
+
+  json_append_raw(b, "\"name\": ");
+  json_append_string(b, r->strings + t->name);
+
+  json_append_raw(b, ", \"artists\": [");
+  for(j=0; j < t->num_artists; j++, artist += strlen(artist) + 1)
+    {
+      if (j > 0)
+        json_append_raw(b, ", ");
+      json_append_string(b, artist);
+    }
+  if (j == 0)
+    {
+      json_append_string(b, "Dunno yet.");
+      complete = 0;
+    }
+
+  json_append_raw(b, "], \"album\": ");
+  if (t->album != SAVE_NO_STRING)
+    json_append_string(b, r->strings + t->album);
+  else
+    {
+      json_append_string(b, "Dunno yet.");
+      complete = 0;
+    }
+
+  json_append_raw(b, ", \"duration\": ");
+  json_append_int(b, t->duration);
+  return complete;
+}
+
+/**
+ * Render the track table record of each track save_tracks wanted.
+ */
+static void render_track_records(save_record *r)
+{
+  int i;
+
+  json_buffer_init(&r->records, NULL);
+  r->record_ends = malloc((r->num_tracks + 1) * sizeof(size_t));
+  for (i = 0; i < r->num_tracks; i++)
+    {
+      if (r->tracks[i].wanted)
+        {
+          json_append_raw(&r->records, "{");
+          render_track_metadata(r, &r->tracks[i], &r->records);
+          json_append_raw(&r->records, "}");
+        }
+      r->record_ends[i] = r->records.len;
+    }
+}
+
+static void render_playlist(save_record *r, json_buffer *b)
+{
+  int i;
+
+  json_append_raw(b, "{\"playlist_name\": ");
+  json_append_string(b, r->name);
+  json_append_raw(b, ",\n\"http_link\": ");
+  json_append_string(b, r->http_link);
+  json_append_raw(b, ",\n\"spotify_link\": ");
+  json_append_string(b, r->uri_link);
+  json_append_raw(b, save_tracks != NULL ? ",\n\"tracks\": [\n" : ",\n\"songs\": [\n");
+
+  for(i=0; i<r->num_tracks; i++)
+    {
+      save_track *t = &r->tracks[i];
+
+      if (i > 0)
+        json_append_raw(b, ",\n");
+
+      /* With a track table, the playlist is just its track URIs */
+      if (save_tracks != NULL)
+        {
+          json_append_string(b, r->strings + t->uri);
+          continue;
+        }
+
+      json_append_raw(b, "{");
+      render_track_metadata(r, t, b);
+      json_append_raw(b, ", \"link\": ");
+      json_append_string(b, r->strings + t->uri);
+      json_append_raw(b, "}");
+    }
+
+  json_append_raw(b, "\n]}\n");
+}
+
+/**
+ * Record the tracks of @r in the binary snapshot of its container.
+ */
+static void add_to_snapshot(save_record *r)
+{
+  snapshot_builder *b = r->data->container->snapshot;
+  const char **artists = NULL;
+  int artists_size = 0;
+  int i, j;
+
+  snapshot_builder_set_playlist(b, r->data->index, r->name, r->uri_link);
+
+  for(i=0; i<r->num_tracks; i++)
+    {
+      save_track *t = &r->tracks[i];
+      const char *artist = r->strings + t->artists;
+      uint16_t flags = 0;
+
+      if (t->num_artists > artists_size)
+        {
+          artists_size = t->num_artists;
+          artists = realloc(artists, artists_size * sizeof(const char *));
+        }
+      for (j = 0; j < t->num_artists; j++, artist += strlen(artist) + 1)
+        artists[j] = artist;
+
+      if (t->num_artists == 0 || t->album == SAVE_NO_STRING)
+        flags |= SNAPSHOT_TRACK_INCOMPLETE;
+
+      snapshot_builder_add_track(b, r->data->index, r->strings + t->uri,
+          r->strings + t->name,
+          t->album != SAVE_NO_STRING ? r->strings + t->album : NULL,
+          artists, t->num_artists, t->duration, flags);
+    }
+  free(artists);
+}
+
+/*
+ * libspotify has no playlist revisions, so a hash of the track URIs in
+ * order stands in for one.
+ */
+#define PLAYLIST_REVISION_INIT 0xcbf29ce484222325ULL
+
+static uint64_t playlist_revision_add(uint64_t revision, const char *uri)
+{
+  return (revision ^ manifest_hash(uri, strlen(uri))) * 0x100000001b3ULL;
+}
+
+static uint64_t playlist_revision(sp_playlist *playlist)
+{
+  uint64_t revision = PLAYLIST_REVISION_INIT;
+  char link_str[100];
+  sp_link *link;
+  int i;
+
+  for (i = 0; i < sp_playlist_num_tracks(playlist); i++)
+    {
+      link = sp_link_create_from_track(sp_playlist_track(playlist, i), 0);
+      if(!sp_link_as_string(link, link_str, 100))
+        printf("WARNING: sp_link_as_string failed.\n");
+      sp_link_release(link);
+      revision = playlist_revision_add(revision, link_str);
+    }
+  return revision;
+}
+
+/**
+ * Copy what the file of the loaded playlist @data needs out of libspotify.
+ */
+static save_record *save_record_capture(playlist_data *data)
+{
+  container_context *ctx = data->container;
+  save_record *r = calloc(1, sizeof(save_record));
+  sp_link *playlist_link = sp_link_create_from_playlist(data->playlist);
+  int i, j;
+
+  r->data = data;
+  r->name = strdup(sp_playlist_name(data->playlist));
+  r->http_link = sg_link_dup_http_string(playlist_link);
+  r->uri_link = sg_link_dup_string(playlist_link);
+  sp_link_release(playlist_link);
+
+  r->relative_filename = playlist_relative_filename(ctx, data->directory,
+      data->prefix, r->name, r->uri_link);
+  asprintf(&r->filename, "%s/%s", ctx->name, r->relative_filename);
+
+  r->num_tracks = sp_playlist_num_tracks(data->playlist);
+  r->tracks = malloc((r->num_tracks + 1) * sizeof(save_track));
+  r->revision = PLAYLIST_REVISION_INIT;
+  for(i=0; i<r->num_tracks; i++)
+    {
+      sp_track *track = sp_playlist_track(data->playlist, i);
+      sp_link *link = sp_link_create_from_track(track, 0);
+      sp_album *album = sp_track_album(track);
+      save_track *t = &r->tracks[i];
+      const metadata_entry *cached;
+      metadata_state state;
+      char link_str[100];
+
+      if(!sp_link_as_string(link, link_str, 100))
+        printf("WARNING: sp_link_as_string failed.\n");
+      sp_link_release(link);
+
+      t->uri = save_record_add_string(r, link_str);
+      r->revision = playlist_revision_add(r->revision, link_str);
+      t->wanted = save_tracks != NULL && track_table_wants(save_tracks, link_str);
+
+      /* What libspotify has not loaded yet, the cache may know */
+      if ((!sp_track_is_loaded(track) || album == NULL
+           || !sp_album_is_loaded(album) || sp_track_num_artists(track) == 0)
+          && g_metadata_cache != NULL
+          && (cached = metadata_cache_lookup(g_metadata_cache, link_str,
+                                             &state)) != NULL)
+        {
+          t->name = save_record_add_string(r, cached->name);
+          t->album = cached->album != NULL
+              ? save_record_add_string(r, cached->album) : SAVE_NO_STRING;
+          t->num_artists = cached->num_artists;
+          t->artists = r->strings_len;
+          for (j = 0; j < t->num_artists; j++)
+            save_record_add_string(r, cached->artists[j]);
+          t->duration = cached->duration;
+          ctx->cached_tracks ++;
+        }
+      else
+        {
+          t->name = save_record_add_string(r, sp_track_name(track));
+          t->album = album != NULL && sp_album_is_loaded(album)
+              ? save_record_add_string(r, sp_album_name(album)) : SAVE_NO_STRING;
+          t->num_artists = sp_track_num_artists(track);
+          t->artists = r->strings_len;
+          for (j = 0; j < t->num_artists; j++)
+            save_record_add_string(r, sp_artist_name(sp_track_artist(track, j)));
+          t->duration = sp_track_duration(track);
+          metadata_cache_store_track(g_metadata_cache, track);
+        }
+
+      if (t->album == SAVE_NO_STRING || t->num_artists == 0)
+        {
+          printf("WARNING: '%s': %s has no %s yet.\n", r->name, link_str,
+              t->num_artists > 0 ? "album"
+              : t->album != SAVE_NO_STRING ? "artists" : "album or artists");
+          ctx->placeholder_tracks ++;
+        }
+    }
+
+  return r;
+}
+
+/**
+ * Render, write and stage @arg, a save_record.  Runs on a writer thread,
+ * so it only reads what the main thread leaves alone until the run ends.
+ */
+static void save_record_write(void *arg)
+{
+  save_record *r = arg;
+  container_context *ctx = r->data->container;
+  manifest_entry *old_entry;
+  int unchanged;
+  const unsigned char *known_blob_id = NULL;
+
+  if (render_buffer.data == NULL)
+    json_buffer_init(&render_buffer, NULL);
+  json_buffer_reset(&render_buffer);
+  render_playlist(r, &render_buffer);
+  if (save_tracks != NULL)
+    render_track_records(r);
+
+  r->hash = manifest_hash(render_buffer.data, render_buffer.len);
+  old_entry = manifest_lookup(ctx->old_manifest, r->uri_link);
+
+  unchanged = old_entry != NULL && old_entry->hash == r->hash
+      && strcmp(old_entry->filename, r->relative_filename) == 0;
+
+  if (save_incremental && unchanged && access(r->filename, F_OK) == 0)
+    r->skipped = 1;
+  else if (durable_batch_write(save_batch, r->filename, render_buffer.data,
+      render_buffer.len) == 0)
+    {
+      r->written = 1;
+      r->bytes = render_buffer.len;
+    }
+
+  /* An unchanged rendering still has the blob the last save recorded */
+  if (unchanged && old_entry->has_blob_id)
+    known_blob_id = old_entry->blob_id;
+
+  /* A file that could not be written is not staged either */
+  if (ctx->git_prefix != NULL && (r->skipped || r->written))
+    {
+      /* A renamed or shifted playlist still deltifies against its
+         previous file */
+      if (container_context_stage_blob(ctx, r->relative_filename,
+          old_entry != NULL ? old_entry->filename : NULL,
+          render_buffer.data, render_buffer.len, known_blob_id, r->blob_id) == 0)
+        known_blob_id = r->blob_id;
+    }
+
+  if (known_blob_id != NULL)
+    {
+      memmove(r->blob_id, known_blob_id, GIT_ID_LENGTH);
+      r->has_blob_id = 1;
+    }
+}
+
+/* Keeps @path for container_context_finish_snapshot() */
+static void remember_failed_write(const char *path, void *unused)
+{
+  save_failed_paths = realloc(save_failed_paths,
+      (save_num_failed_paths + 1) * sizeof(char *));
+  save_failed_paths[save_num_failed_paths++] = strdup(path);
+}
+
+/**
+ * Make everything written so far durable, and then journal it.  No writer
+ * thread may be writing to save_batch meanwhile.
+ */
+static void save_checkpoint_now(void)
+{
+  int num_playlists = journal_pending(save_journal);
+
+  durable_batch_foreach_failed(save_batch, remember_failed_write, NULL);
+  if (durable_batch_commit(save_batch) != 0)
+    {
+      printf("WARNING: checkpoint failed, not journaling %d playlists.\n",
+          num_playlists);
+      journal_discard(save_journal);
+      save_checkpoint_failed = 1;
+    }
+  else if (journal_sync(save_journal) != 0)
+    printf("WARNING: failed to journal %d playlists.\n", num_playlists);
+  else
+    printf("Checkpoint: journaled %d more playlists.\n", num_playlists);
+}
+
+/**
+ * Back on the main thread: account for the written @arg and finish its
+ * playlist.
+ */
+static void save_record_done(void *arg)
+{
+  save_record *r = arg;
+  playlist_data *data = r->data;
+  container_context *ctx = data->container;
+  size_t start = 0;
+  int i;
+
+  save_writes_in_flight --;
+  if (r->skipped)
+    ctx->unchanged_files ++;
+  else if (r->written)
+    ctx->written_files ++;
+
+  if (r->skipped || r->written)
+    manifest_set(ctx->new_manifest, r->uri_link, r->relative_filename,
+        r->hash, r->num_tracks, r->has_blob_id ? r->blob_id : NULL);
+  else
+    container_context_keep_old_entry(ctx, r->uri_link);
+  if (save_journal != NULL && (r->skipped || r->written))
+    journal_add(save_journal, ctx->name, r->uri_link, r->relative_filename,
+        r->revision, r->hash, r->num_tracks,
+        r->has_blob_id ? r->blob_id : NULL);
+
+  for (i = 0; r->record_ends != NULL && i < r->num_tracks; i++)
+    {
+      save_track *t = &r->tracks[i];
+
+      if (t->wanted)
+        track_table_set(save_tracks, r->strings + t->uri,
+            r->records.data + start, r->record_ends[i] - start,
+            t->num_artists > 0 && t->album != SAVE_NO_STRING);
+      start = r->record_ends[i];
+    }
+
+  if (ctx->snapshot != NULL)
+    add_to_snapshot(r);
+
+  if (save_stats != NULL)
+    stats_add_playlist(save_stats, r->uri_link, r->name, r->num_tracks,
+        data->requested, data->loaded, data->ready, stats_now(), r->bytes);
+
+  if (save_journal != NULL && journal_pending(save_journal) >= save_checkpoint
+      && save_writes_in_flight == 0)
+    save_checkpoint_now();
+
+  save_record_free(r);
+  save_playlist_finally(data);
 }
 
 static void actually_save_playlist(playlist_data *data)
 {
+  printf("Playlist '%s' ready.\n", sp_playlist_name(data->playlist));
+  data->ready = stats_now();
+  save_writes_in_flight ++;
+  writer_submit(save_record_write, save_record_done, save_record_capture(data));
+}
+
+/*
+ * The readiness gate.  A loaded playlist is only written once the tracks,
+ * albums and artists it names have loaded too, so that a snapshot does not
+ * depend on what libspotify happened to have cached.  Each playlist keeps
+ * a list of the objects it waits for, which metadata_updated shrinks, and
+ * save_metadata_timeout bounds the wait.
+ */
+static playlist_data **save_gated;
+static int save_num_gated;
+static int save_gated_size;
+
+/* Wakes the main thread up at the earliest deadline in save_gated */
+static pthread_mutex_t save_timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t save_timer_cond = PTHREAD_COND_INITIALIZER;
+static struct timespec save_timer_at;
+static int save_timer_armed;
+static int save_timer_running;
+
+static void save_gate_expire(void *unused);
+
+static void *save_timer_thread(void *unused)
+{
+  pthread_mutex_lock(&save_timer_lock);
+  for (;;)
+    {
+      if (!save_timer_armed)
+        pthread_cond_wait(&save_timer_cond, &save_timer_lock);
+      else if (pthread_cond_timedwait(&save_timer_cond, &save_timer_lock,
+          &save_timer_at) == ETIMEDOUT)
+        {
+          save_timer_armed = 0;
+          pthread_mutex_unlock(&save_timer_lock);
+          writer_post(save_gate_expire, NULL);
+          pthread_mutex_lock(&save_timer_lock);
+        }
+    }
+  return NULL;
+}
+
+static void save_timer_arm(const struct timeval *at)
+{
+  pthread_t thread;
+
+  pthread_mutex_lock(&save_timer_lock);
+  if (!save_timer_armed || at->tv_sec < save_timer_at.tv_sec
+      || (at->tv_sec == save_timer_at.tv_sec
+          && at->tv_usec * 1000 < save_timer_at.tv_nsec))
+    {
+      TIMEVAL_TO_TIMESPEC(at, &save_timer_at);
+      save_timer_armed = 1;
+      pthread_cond_signal(&save_timer_cond);
+    }
+  pthread_mutex_unlock(&save_timer_lock);
+
+  if (!save_timer_running)
+    {
+      if (pthread_create(&thread, NULL, save_timer_thread, NULL) != 0)
+        printf("WARNING: could not start the metadata timer.\n");
+      else
+        {
+          pthread_detach(thread);
+          save_timer_running = 1;
+        }
+    }
+}
+
+static void save_gate_push(playlist_data *data, save_pending_kind kind,
+    void *object)
+{
+  if (data->num_pending == data->pending_size)
+    {
+      data->pending_size = data->pending_size ? data->pending_size * 2 : 64;
+      data->pending = realloc(data->pending,
+          data->pending_size * sizeof(save_pending));
+    }
+  data->pending[data->num_pending].kind = kind;
+  data->pending[data->num_pending].object = object;
+  data->num_pending ++;
+}
+
+/* Fresh metadata in the cache is as good as loaded */
+static int save_track_cached(sp_track *track)
+{
+  metadata_state state;
+
+  metadata_cache_track(g_metadata_cache, track, &state);
+  return state == METADATA_FRESH;
+}
+
+/* An unloaded track has no album or artists to wait for until it loads */
+static void save_gate_add_track(playlist_data *data, sp_track *track)
+{
+  sp_album *album;
+  sp_artist *artist;
+  int i, first = data->num_pending;
+
+  if (!sp_track_is_loaded(track))
+    {
+      if (!save_track_cached(track))
+        save_gate_push(data, SAVE_PENDING_TRACK, track);
+      return;
+    }
+
+  album = sp_track_album(track);
+  if (album != NULL && !sp_album_is_loaded(album))
+    save_gate_push(data, SAVE_PENDING_ALBUM, album);
+  for (i = 0; i < sp_track_num_artists(track); i++)
+    {
+      artist = sp_track_artist(track, i);
+      if (artist != NULL && !sp_artist_is_loaded(artist))
+        save_gate_push(data, SAVE_PENDING_ARTIST, artist);
+    }
+  if (data->num_pending > first && save_track_cached(track))
+    data->num_pending = first;
+}
+
+static int save_pending_loaded(save_pending *p)
+{
+  switch (p->kind)
+    {
+    case SAVE_PENDING_TRACK:
+      return sp_track_is_loaded(p->object);
+    case SAVE_PENDING_ALBUM:
+      return sp_album_is_loaded(p->object);
+    case SAVE_PENDING_ARTIST:
+      return sp_artist_is_loaded(p->object);
+    }
+  return 1;
+}
+
+/**
+ * Drop what has loaded since @data last looked from its pending list.
+ */
+static void save_gate_update(playlist_data *data)
+{
+  int i = 0;
+
+  while (i < data->num_pending)
+    {
+      save_pending p = data->pending[i];
+
+      if (!save_pending_loaded(&p))
+        {
+          i ++;
+          continue;
+        }
+      data->pending[i] = data->pending[--data->num_pending];
+      if (p.kind == SAVE_PENDING_TRACK)
+        save_gate_add_track(data, p.object);
+    }
+}
+
+static void save_metadata_updated(void *unused);
+
+/**
+ * Take @data out of save_gated and write it, whatever it is waiting for.
+ */
+static void save_gate_release(playlist_data *data)
+{
+  if (data->gate >= 0)
+    {
+      save_gated[data->gate] = save_gated[--save_num_gated];
+      save_gated[data->gate]->gate = data->gate;
+      data->gate = -1;
+      if (save_num_gated == 0)
+        metadata_listener_remove(save_metadata_updated, NULL);
+    }
+  actually_save_playlist(data);
+}
+
+/* Newly gated playlists are appended, so walking backwards skips them */
+static void save_metadata_updated(void *unused)
+{
+  int i;
+
+  for (i = save_num_gated - 1; i >= 0; i--)
+    {
+      if (i >= save_num_gated)
+        continue;
+      save_gate_update(save_gated[i]);
+      if (save_gated[i]->num_pending == 0)
+        save_gate_release(save_gated[i]);
+    }
+}
+
+static void save_gate_expire(void *unused)
+{
+  struct timeval now;
+  struct timeval *earliest = NULL;
+  playlist_data *data;
+  int i;
+
+  gettimeofday(&now, NULL);
+  for (i = save_num_gated - 1; i >= 0; i--)
+    {
+      if (i >= save_num_gated)
+        continue;
+      data = save_gated[i];
+      save_gate_update(data);
+      if (data->num_pending > 0 && timercmp(&data->deadline, &now, >))
+        continue;
+      if (data->num_pending > 0)
+        printf("WARNING: '%s' still waits for %d tracks, albums and artists"
+            " after %d s, saving it anyway.\n", sp_playlist_name(data->playlist),
+            data->num_pending, save_metadata_timeout);
+      save_gate_release(data);
+    }
+
+  for (i = 0; i < save_num_gated; i++)
+    if (earliest == NULL || timercmp(&save_gated[i]->deadline, earliest, <))
+      earliest = &save_gated[i]->deadline;
+  if (earliest != NULL)
+    save_timer_arm(earliest);
+}
+
+/**
+ * Write the loaded @data once its metadata has loaded as well, or at its
+ * deadline.
+ */
+static void save_gate_start(playlist_data *data)
+{
+  int i;
+
+  /* Whatever changes from here on is for the next save */
+  sp_playlist_remove_callbacks(data->playlist, data->callbacks, data);
+  data->loaded = stats_now();
+
+  if (save_metadata_timeout > 0)
+    for (i = 0; i < sp_playlist_num_tracks(data->playlist); i++)
+      save_gate_add_track(data, sp_playlist_track(data->playlist, i));
+
+  if (data->num_pending == 0)
+    {
+      actually_save_playlist(data);
+      return;
+    }
+
+  printf("Playlist '%s' waits for %d tracks, albums and artists.\n",
+      sp_playlist_name(data->playlist), data->num_pending);
+
+  if (save_num_gated == save_gated_size)
+    {
+      save_gated_size = save_gated_size ? save_gated_size * 2 : 16;
+      save_gated = realloc(save_gated, save_gated_size * sizeof(playlist_data *));
+    }
+  if (save_num_gated == 0)
+    metadata_listener_add(save_metadata_updated, NULL);
+  data->gate = save_num_gated;
+  save_gated[save_num_gated++] = data;
+
+  gettimeofday(&data->deadline, NULL);
+  data->deadline.tv_sec += save_metadata_timeout;
+  save_timer_arm(&data->deadline);
+}
+
+static void playlist_state_changed_cb(sp_playlist *pl, void *userdata)
+{
+  playlist_data *data = userdata;
+  if (sp_playlist_is_loaded(data->playlist))
+    save_gate_start(data);
+}
+
+static void save_playlist_async(sp_playlist *playlist,
+    container_context *container,
+    const char *directory,
+    unsigned int prefix,
+    int index,
+    sg_callback cb,
+    void *user_data)
+{
+  playlist_data *data = playlist_data_new(playlist, container, directory,
+      prefix, index, cb, user_data);
+  data->callbacks->playlist_state_changed = playlist_state_changed_cb;
+  sp_playlist_add_callbacks(data->playlist, data->callbacks, data);
+
+  playlist_state_changed_cb(data->playlist, data);
+}
+
+/**
+ * How big @playlist is likely to be: its real length if it is already
+ * loaded, otherwise whatever the last save recorded.
+ */
+static int
+estimated_playlist_size(container_context *ctx, sp_playlist *playlist)
+{
+  sp_link *link;
+  char *uri;
+  manifest_entry *entry;
+  int size = 0;
+
+  if (sp_playlist_is_loaded(playlist))
+    return sp_playlist_num_tracks(playlist);
+
+  link = sp_link_create_from_playlist(playlist);
+  if (link == NULL)
+    return 0;
+  uri = sg_link_dup_string(link);
+  entry = manifest_lookup(ctx->old_manifest, uri);
+  if (entry != NULL)
+    size = entry->num_tracks;
+  free(uri);
+  sp_link_release(link);
+  return size;
+}
+
+/**
+ * Whether @filename, where an interrupted run saved the playlist @uri, is
+ * still the file it would be saved to at @prefix in @directory.  Until the
+ * playlist has loaded its name is not known, so then only the directory,
+ * the prefix and the URI are compared.
+ */
+static int resume_filename_matches(container_context *ctx,
+    const char *filename, sp_playlist *playlist, const char *uri,
+    const char *directory, unsigned int prefix)
+{
+  char *expected;
+  size_t len = strlen(filename), head_len, tail_len;
+  int matches;
+
+  if (sp_playlist_is_loaded(playlist))
+    {
+      expected = playlist_relative_filename(ctx, directory, prefix,
+          sp_playlist_name(playlist), uri);
+      matches = strcmp(filename, expected) == 0;
+      free(expected);
+      return matches;
+    }
+
+  /* "DIR/NNN--" and "--URI.json" around a name without slashes */
+  expected = playlist_relative_filename(ctx, directory, prefix, "", uri);
+  tail_len = strlen(uri) + strlen("--.json");
+  head_len = strlen(expected) - tail_len;
+  matches = len >= head_len + tail_len
+      && strncmp(filename, expected, head_len) == 0
+      && strcmp(filename + len - tail_len, expected + head_len) == 0
+      && memchr(filename + head_len, '/', len - head_len - tail_len) == NULL;
+  free(expected);
+  return matches;
+}
+
+/**
+ * With --resume, account for @playlist without loading it if the journal
+ * says an interrupted run already saved it.  A playlist that is loaded
+ * anyway is only skipped if its tracks are still the same, and any is only
+ * skipped if it would still be saved to the journaled file.
+ *
+ * @return 1 if @playlist needs no saving
+ */
+static int container_context_resume(container_context *ctx,
+    sp_playlist *playlist, const char *directory, unsigned int prefix)
+{
+  const journal_entry *e;
+  sp_link *link;
+  char *uri, *filename, *data = NULL;
+  size_t len;
+  unsigned char id[GIT_ID_LENGTH];
+  int resumed = 0;
+
+  if (!save_resume || save_journal == NULL)
+    return 0;
+  link = sp_link_create_from_playlist(playlist);
+  if (link == NULL)
+    return 0;
+  uri = sg_link_dup_string(link);
+  sp_link_release(link);
+
+  e = journal_lookup(save_journal, ctx->name, uri);
+  if (e == NULL
+      || (sp_playlist_is_loaded(playlist) && playlist_revision(playlist) != e->revision)
+      || !resume_filename_matches(ctx, e->filename, playlist, uri, directory,
+          prefix))
+    {
+      free(uri);
+      return 0;
+    }
+
+  /* Make sure the file is still the one that was journaled */
+  if (ctx->git_prefix != NULL)
+    {
+      if (e->has_blob_id
+          && (data = read_previous_version(ctx->name, e->filename, e->blob_id,
+              &len)) != NULL)
+        {
+          const manifest_entry *old_entry =
+              manifest_lookup(ctx->old_manifest, uri);
+          resumed = container_context_stage_blob(ctx, e->filename,
+              old_entry != NULL ? old_entry->filename : NULL, data, len,
+              e->blob_id, id) == 0;
+        }
+    }
+  else
+    {
+      asprintf(&filename, "%s/%s", ctx->name, e->filename);
+      resumed = access(filename, F_OK) == 0;
+      free(filename);
+    }
+
+  if (resumed)
+    {
+      manifest_set(ctx->new_manifest, uri, e->filename, e->hash,
+          e->num_tracks, e->has_blob_id ? e->blob_id : NULL);
+      ctx->written_files ++;
+      ctx->resumed_files ++;
+    }
+
+  free(data);
+  free(uri);
+  return resumed;
+}
+
+static void container_context_queue_playlist(container_context *ctx,
+    sp_playlist *playlist, const char *directory, unsigned int prefix)
+{
+  save_job *job;
+  sp_link *link = sp_link_create_from_playlist(playlist);
+
+  if (link != NULL)
+    {
+      char *uri = sg_link_dup_string(link);
+      container_context_add_order(ctx, ORDER_PLAYLIST, uri);
+      free(uri);
+      sp_link_release(link);
+    }
+
+  if (container_context_resume(ctx, playlist, directory, prefix))
+    return;
+
+  if (ctx->num_jobs == ctx->jobs_size)
+    {
+      ctx->jobs_size = ctx->jobs_size ? ctx->jobs_size * 2 : 64;
+      ctx->jobs = realloc(ctx->jobs, ctx->jobs_size * sizeof(save_job));
+    }
+
+  job = &ctx->jobs[ctx->num_jobs];
+  job->playlist = playlist;
+  job->directory = strdup(directory);
+  job->prefix = prefix;
+  job->index = ctx->num_jobs;
+  job->size = save_largest_first ? estimated_playlist_size(ctx, playlist) : 0;
+  ctx->num_jobs ++;
+}
+
+static int
+save_job_compare_size(const void *a, const void *b)
+{
+  const save_job *ja = a;
+  const save_job *jb = b;
+
+  if (ja->size != jb->size)
+    return ja->size > jb->size ? -1 : 1;
+  return ja->index - jb->index;
+}
+
+static void container_context_job_done(container_context *ctx)
+{
+  ctx->in_flight --;
+  container_context_finish_call(ctx);
+}
+
+/**
+ * Start queued playlists until the window is full.  Playlists that are
+ * already loaded finish synchronously and call back into here, so only the
+ * outermost call does any work.
+ */
+static void container_context_pump(container_context *ctx)
+{
+  if (ctx->pumping)
+    return;
+
+  ctx->pumping = 1;
+  while (ctx->next_job < ctx->num_jobs
+      && (save_window <= 0 || ctx->in_flight < save_window))
+    {
+      save_job *job = &ctx->jobs[ctx->next_job++];
+
+      ctx->in_flight ++;
+      save_playlist_async(job->playlist, ctx, job->directory, job->prefix,
+          job->index, (sg_callback)container_context_job_done,
+          container_context_start_call(ctx));
+      free(job->directory);
+      job->directory = NULL;
+    }
+  ctx->pumping = 0;
+}
+
+static void container_context_schedule(container_context *ctx)
+{
+  if (save_largest_first)
+    qsort(ctx->jobs, ctx->num_jobs, sizeof(save_job), save_job_compare_size);
+
+  if (save_window > 0)
+    printf("Loading at most %d playlists at a time.\n", save_window);
+  container_context_pump(ctx);
+}
+
+/*
+ * The users whose published playlists a save run archives after the
+ * session's own container, loaded at most save_social_window at a time.
+ */
+typedef struct {
+  char **users;
+  int num_users;
+  int next_user;
+  int in_flight;
+  int finished_users;
+  int total_playlists;
+  int pumping;
+  struct timeval start;
+} save_social_context;
+
+/* Per user of a save_social_context */
+typedef struct {
+  save_social_context *social;
+  int index;
+  struct timeval start;
+} save_social_user;
+
+static int save_social_compare_users(const void *a, const void *b)
+{
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void save_social_add_user(save_social_context *ctx, sp_user *user)
+{
+  const char *name = user != NULL ? sp_user_canonical_name(user) : NULL;
+
+  if (name == NULL || *name == 0)
+    return;
+  ctx->users[ctx->num_users++] = strdup(name);
+}
+
+/**
+ * Collect the session's user and its friends, sorted and without
+ * duplicates.
+ */
+static save_social_context *save_social_context_new(void)
+{
+  save_social_context *ctx = malloc(sizeof(save_social_context));
+  int num_friends = sp_session_num_friends(g_session);
+  int i, j;
+
+  ctx->users = malloc((num_friends + 1) * sizeof(char *));
+  ctx->num_users = 0;
+  ctx->next_user = 0;
+  ctx->in_flight = 0;
+  ctx->finished_users = 0;
+  ctx->total_playlists = 0;
+  ctx->pumping = 0;
+  gettimeofday(&ctx->start, NULL);
+
+  save_social_add_user(ctx, sp_session_user(g_session));
+  for (i = 0; i < num_friends; i++)
+    save_social_add_user(ctx, sp_session_friend(g_session, i));
+
+  qsort(ctx->users, ctx->num_users, sizeof(char *), save_social_compare_users);
+  for (i = j = 0; i < ctx->num_users; i++)
+    {
+      if (j > 0 && strcmp(ctx->users[j - 1], ctx->users[i]) == 0)
+        free(ctx->users[i]);
+      else
+        ctx->users[j++] = ctx->users[i];
+    }
+  ctx->num_users = j;
+
+  return ctx;
+}
+
+static void
+save_social_context_free(save_social_context *ctx)
+{
+  int i;
+
+  for (i = 0; i < ctx->num_users; i++)
+    free(ctx->users[i]);
+  free(ctx->users);
+  free(ctx);
+}
+
+/**
+ * Write the trees changed by this run and a commit on top of save_ref.
+ *
+ * @return 0 if there is a commit to point save_ref at
+ */
+static int save_write_commit(char **message, unsigned char commit_id[GIT_ID_LENGTH])
+{
+  unsigned char tree_id[GIT_ID_LENGTH];
+  unsigned char parent_tree_id[GIT_ID_LENGTH];
+
+  if (git_tree_write(save_repo, save_batch, save_tree, tree_id) != 0)
+    {
+      printf("WARNING: failed to write the snapshot tree, not committing.\n");
+      return -1;
+    }
+
+  if (save_has_parent
+      && git_repo_commit_tree(save_repo, save_parent, parent_tree_id) == 0
+      && memcmp(tree_id, parent_tree_id, GIT_ID_LENGTH) == 0)
+    {
+      printf("Snapshot is unchanged, not committing.\n");
+      return -1;
+    }
+
+  asprintf(message, "git-spot snapshot\n\n"
+      "%d playlists written, %d unchanged, %d deleted.",
+      save_total_written, save_total_unchanged, save_total_deleted);
+
+  return git_repo_write_commit(save_repo, save_batch, tree_id,
+      save_has_parent ? save_parent : NULL, *message, commit_id);
+}
+
+static void save_update_ref(const char *message,
+    const unsigned char commit_id[GIT_ID_LENGTH])
+{
+  char hex[GIT_HEX_LENGTH + 1];
+  char *reflog_message, *head;
+
+  asprintf(&reflog_message, "commit: %.*s", (int) strcspn(message, "\n"), message);
+  git_id_to_hex(commit_id, hex);
+
+  if (git_repo_update_ref(save_repo, save_ref, commit_id,
+      save_has_parent ? save_parent : NULL, reflog_message) == 0)
+    {
+      printf("Committed snapshot %.12s to %s.\n", hex, save_ref);
+
+      head = git_repo_symbolic_ref(save_repo, "HEAD");
+      if (head != NULL && strcmp(head, save_ref) == 0)
+        printf("%s is checked out; run 'git reset -q' to refresh the index.\n",
+            save_ref);
+      free(head);
+    }
+
+  free(reflog_message);
+}
+
+/**
+ * Write the run's track table to the save directory, and stage it.
+ */
+static void save_write_track_table(void)
+{
+  json_buffer b;
+  char *filename, *git_prefix, *previous = NULL;
+  unsigned char id[GIT_ID_LENGTH];
+  size_t previous_len;
+
+  json_buffer_init(&b, NULL);
+  track_table_render(save_tracks, &b);
+  asprintf(&filename, "%s/%s", save_directory, TRACK_TABLE_FILENAME);
+
+  if (save_incremental)
+    {
+      git_hash_object(GIT_OBJ_BLOB, b.data, b.len, id);
+      previous = read_previous_version(save_directory, TRACK_TABLE_FILENAME,
+          id, &previous_len);
+    }
+
+  if (previous != NULL)
+    printf("Track table of %d tracks is unchanged.\n", track_table_size(save_tracks));
+  else if (durable_batch_write(save_batch, filename, b.data, b.len) == 0)
+    printf("Wrote %d tracks to %s.\n", track_table_size(save_tracks), filename);
+
+  if (save_repo != NULL
+      && (git_prefix = git_repo_relative_path(save_repo, save_directory)) != NULL)
+    {
+      if (stage_blob(save_directory, git_prefix, TRACK_TABLE_FILENAME, NULL,
+          b.data, b.len, NULL, id) != 0)
+        printf("WARNING: failed to stage %s.\n", filename);
+      free(git_prefix);
+    }
+
+  free(previous);
+  free(filename);
+  json_buffer_free(&b);
+}
+
+/**
+ * Write the timings of the run to save_stats_path.  They describe the run
+ * rather than the snapshot, so they do not go through save_batch.
+ */
+static void save_write_stats(void)
+{
+  json_buffer b;
+  FILE *output;
+
+  json_buffer_init(&b, NULL);
+  stats_render(save_stats, &b);
+  stats_print_summary(save_stats);
+
+  output = fopen(save_stats_path, "w");
+  if (output != NULL && fwrite(b.data, 1, b.len, output) != b.len)
+    {
+      fclose(output);
+      output = NULL;
+    }
+  if (output == NULL || fclose(output) != 0)
+    printf("WARNING: failed to write %s.\n", save_stats_path);
+  else
+    printf("Wrote run statistics to %s.\n", save_stats_path);
+
+  json_buffer_free(&b);
+  stats_free(save_stats);
+  save_stats = NULL;
+  free(save_stats_path);
+  save_stats_path = NULL;
+}
+
+/**
+ * The group-commit barrier for the whole run: nothing written by this run
+ * replaces anything on disk before this point.
+ */
+static void save_commit(void)
+{
+  int num_ops;
+  int have_commit = 0;
+  unsigned char commit_id[GIT_ID_LENGTH];
+  char *message = NULL;
+
+  if (save_batch == NULL)
+    return;
+
+  if (save_total_placeholders > 0)
+    printf("WARNING: %d tracks were saved with placeholders, see above.\n",
+        save_total_placeholders);
+
+  if (save_tracks != NULL)
+    save_write_track_table();
+
+  if (save_repo != NULL)
+    have_commit = save_write_commit(&message, commit_id) == 0;
+
+  if (have_commit && save_pack_writer != NULL)
+    {
+      int num_objects, num_deltas;
+      size_t bytes;
+
+      git_pack_writer_stats(save_pack_writer, &num_objects, &num_deltas, &bytes);
+      if (git_pack_writer_finish(save_pack_writer, save_batch) != 0)
+        {
+          printf("WARNING: failed to write the snapshot pack, not committing.\n");
+          have_commit = 0;
+        }
+      else
+        printf("Packed %d objects (%d deltas) in %zu bytes.\n",
+            num_objects, num_deltas, bytes);
+    }
+
+  num_ops = durable_batch_size(save_batch);
+  if (durable_batch_commit(save_batch) != 0)
+    {
+      printf("WARNING: not all changes could be committed to disk.\n");
+      have_commit = 0;
+    }
+  else
+    {
+      printf("Committed %d changes to disk.\n", num_ops);
+
+      /* The run is complete, there is nothing left to resume */
+      if (save_journal != NULL && journal_remove(save_journal) != 0)
+        printf("WARNING: failed to remove the save journal.\n");
+    }
+  journal_free(save_journal);
+  save_journal = NULL;
+
+  if (save_stats != NULL)
+    save_write_stats();
+
+  /* The objects written before a failed checkpoint may be missing */
+  if (have_commit && save_checkpoint_failed)
+    {
+      printf("WARNING: a checkpoint failed, not committing.\n");
+      have_commit = 0;
+    }
+
+  /* The ref may only move once the objects it points to are durable */
+  if (have_commit)
+    save_update_ref(message, commit_id);
+
+  free(message);
+  durable_batch_free(save_batch);
+  save_batch = NULL;
+  git_tree_free(save_tree);
+  save_tree = NULL;
+  git_repo_free(save_repo);
+  save_repo = NULL;
+  git_pack_writer_free(save_pack_writer);
+  save_pack_writer = NULL;
+  track_table_free(save_tracks);
+  save_tracks = NULL;
+  while (save_num_failed_paths > 0)
+    free(save_failed_paths[--save_num_failed_paths]);
+  free(save_failed_paths);
+  save_failed_paths = NULL;
+  free(save_directory);
+  save_directory = NULL;
+}
+
+static double seconds_since(const struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+static void save_social_finally (save_social_context *ctx)
+{
+  printf("Saved %d playlists of %d users in %.1f s.\n",
+      ctx->total_playlists, ctx->num_users, seconds_since(&ctx->start));
+  save_commit();
+  cmd_logout(0, NULL);
+  save_social_context_free(ctx);
+}
+
+static void finish_with_user (container_context *ctx);
+
+/**
+ * Start loading published containers until save_social_window of them
+ * are in flight.  Each is saved as soon as it has loaded, on its own.
+ */
+static void save_social_pump(save_social_context *social)
+{
+  if (social->pumping)
+    return; /* a container that was already loaded finished right away */
+
+  social->pumping = 1;
+  while (social->next_user < social->num_users
+      && (save_social_window <= 0 || social->in_flight < save_social_window))
+    {
+      const char *name = social->users[social->next_user];
+      sp_playlistcontainer *pc;
+      container_context *ctx;
+      save_social_user *user = malloc(sizeof(save_social_user));
+      char *directory = safe_filename(name);
+
+      user->social = social;
+      user->index = social->next_user++;
+      gettimeofday(&user->start, NULL);
+      social->in_flight ++;
+
+      printf("User %d of %d: loading playlists of %s.\n", user->index + 1,
+          social->num_users, name);
+      pc = sp_session_publishedcontainer_for_user_create(g_session, name);
+      ctx = container_context_new(pc, directory, user);
+      free(directory);
+
+      container_context_start_call(ctx);
+      ctx->callbacks->container_loaded = container_loaded;
+      sp_playlistcontainer_add_callbacks(pc, ctx->callbacks, ctx);
+
+      container_context_add_finally(ctx, finish_with_user);
+      if (sp_playlistcontainer_is_loaded(pc))
+        container_loaded(pc, ctx);
+    }
+  social->pumping = 0;
+
+  if (social->finished_users == social->num_users)
+    save_social_finally(social);
+}
+
+static void finish_with_user (container_context *ctx)
+{
+  save_social_user *user = ctx->user_data;
+  save_social_context *social = user->social;
+  sp_playlistcontainer *pc = ctx->pc;
+
+  social->finished_users ++;
+  social->in_flight --;
+  social->total_playlists += ctx->num_jobs;
+  printf("User %d of %d done: %s, %d playlists in %.1f s (%d of %d users finished).\n",
+      user->index + 1, social->num_users, social->users[user->index],
+      ctx->num_jobs, seconds_since(&user->start), social->finished_users,
+      social->num_users);
+
+  container_context_free(ctx);
+  sp_playlistcontainer_release(pc);
+  free(user);
+
+  save_social_pump(social);
+}
+
+/**
+ *
+ */
+int cmd_save_social(int argc, char **argv)
+{
+  save_social_context *social = save_social_context_new();
+
+  printf("Saving published playlists of %d users, %d at a time.\n",
+      social->num_users, save_social_window);
+
+  save_social_pump(social);
+  return 1;
+}
+
+
+static void
+print_snapshot_folder(snapshot *s, uint32_t folder, int depth)
+{
+  const snapshot_header *h = snapshot_get_header(s);
+  const snapshot_folder *f;
+
+  if (folder >= h->num_folders || depth > 64)
+    return;
+  f = &snapshot_folders(s)[folder];
+  print_snapshot_folder(s, f->parent, depth + 1);
+  printf("%s/", snapshot_string(s, f->name));
+}
+
+/**
+ * List the playlists of a binary snapshot, straight from the file.
+ */
+int cmd_snapshot(int argc, char **argv)
+{
+  const char *path = argc > 1 ? argv[1] : SNAPSHOT_FILENAME;
+  snapshot *s = snapshot_open(path);
+  const snapshot_header *h;
+  const snapshot_playlist *playlists;
+  uint32_t i;
+
+  if (s == NULL)
+    {
+      printf("%s is not a git-spot snapshot.\n", path);
+      return 1;
+    }
+
+  h = snapshot_get_header(s);
+  playlists = snapshot_playlists(s);
+  for (i = 0; i < h->num_playlists; i++)
+    {
+      printf("%3u. ", playlists[i].position);
+      print_snapshot_folder(s, playlists[i].folder, 0);
+      printf("%s (%u tracks)\n", snapshot_string(s, playlists[i].name),
+          playlists[i].num_tracks);
+    }
+  printf("%u playlists, %u folders, %u tracks.\n",
+      h->num_playlists, h->num_folders, h->num_tracks);
+
+  snapshot_close(s);
+  return 1;
+}
+
+/*
+ * load: recreate a saved snapshot tree as folders and playlists
+ */
+
+/* How many tracks go into one sp_playlist_add_tracks() call */
+#define LOAD_BATCH_SIZE 512
+
+typedef struct {
+  sp_playlistcontainer *pc;
+  sp_playlistcontainer_callbacks *callbacks;
+  char *directory;
+  int dry_run;
+  int sync;
+  int pending;        /* syncs waiting for their playlist, plus one */
+  int num_folders;
+  int num_playlists;
+  int num_tracks;
+  int num_calls;
+  int num_failed;
+  int num_edits;      /* track operations of the sync scripts */
+  int num_rewrite_edits;
+  int num_rewrite_calls;
+  struct timeval start;
+} load_context;
+
+/* One playlist being restored, created once its name is known */
+typedef struct {
+  load_context *ctx;
+  sp_playlist *playlist;
+  char *name;
+  char *uri;
+  int position;
+  int created;
+  sp_track *batch[LOAD_BATCH_SIZE];
+  int batch_len;
+  int num_tracks;
+  char **uris;        /* with --sync: the saved track list */
+  int num_uris;
+  int uris_size;
+} load_playlist;
+
+/* A saved track list waiting for its live playlist to load */
+typedef struct {
+  load_context *ctx;
+  sp_playlist *playlist;
+  sp_playlist_callbacks callbacks;
+  char *name;
+  char **uris;
+  int num_uris;
+} load_sync;
+
+static void load_playlist_create(load_playlist *lp)
+{
+  load_context *ctx = lp->ctx;
+  int last;
+
+  printf("Restoring '%s'.\n", lp->name);
+  lp->created = 1;
+  ctx->num_playlists ++;
+  if (ctx->dry_run)
+    return;
+
+  lp->playlist = sp_playlistcontainer_add_new_playlist(ctx->pc, lp->name);
+  if (lp->playlist == NULL)
+    {
+      printf("WARNING: could not create playlist '%s'.\n", lp->name);
+      ctx->num_failed ++;
+      return;
+    }
+
+  /* New playlists are appended; move it into its folder */
+  last = sp_playlistcontainer_num_playlists(ctx->pc) - 1;
+  if (last != lp->position)
+    sp_playlistcontainer_move_playlist(ctx->pc, last, lp->position, 0);
+}
+
+static void load_playlist_flush(load_playlist *lp)
+{
+  sp_error error;
   int i;
-  char *basename = safe_filename(sp_playlist_name(data->playlist));
-   FILE *output;
-  char *filename;
-  sp_link *playlist_link = sp_link_create_from_playlist(data->playlist);
-  char *playlist_http_link = sg_link_dup_http_string(playlist_link);
-  char *playlist_uri_link = sg_link_dup_string(playlist_link);
 
-  asprintf(&filename, "%s/%03u--%s--%s.json", data->directory, data->prefix, basename, playlist_uri_link);
+  if (lp->batch_len == 0)
+    return;
 
-  printf("Playlist '%s' ready.\n", sp_playlist_name(data->playlist));
+  if (lp->playlist != NULL)
+    {
+      error = sp_playlist_add_tracks(lp->playlist, lp->batch, lp->batch_len,
+          lp->num_tracks, g_session);
+      lp->ctx->num_calls ++;
+      if (error != SP_ERROR_OK)
+        printf("WARNING: adding %d tracks to '%s' failed: %s\n",
+            lp->batch_len, lp->name, sp_error_message(error));
+    }
 
-  output = fopen(filename, "w+");
-  free(basename);
-  free(filename);
+  for (i = 0; i < lp->batch_len; i++)
+    sp_track_release(lp->batch[i]);
+  lp->num_tracks += lp->batch_len;
+  lp->ctx->num_tracks += lp->batch_len;
+  lp->batch_len = 0;
+}
 
+static void load_playlist_add(load_playlist *lp, const char *uri)
+{
+  sp_link *link;
+  sp_track *track;
 
-  fprintf(output, "{\"playlist_name\": \"%s\",\n"
-      "\"http_link\": \"%s\",\n"
-      "\"spotify_link\": \"%s\",\n"
-      "\"songs\": [\n",
-      sp_playlist_name(data->playlist),
-      playlist_http_link, playlist_uri_link);
+  if (lp->ctx->sync)
+    {
+      if (lp->num_uris == lp->uris_size)
+        {
+          lp->uris_size = lp->uris_size ? lp->uris_size * 2 : 64;
+          lp->uris = realloc(lp->uris, lp->uris_size * sizeof(char *));
+        }
+      lp->uris[lp->num_uris++] = strdup(uri);
+      return;
+    }
 
-  for(i=0; i<sp_playlist_num_tracks(data->playlist); i++)
+  link = sp_link_create_from_string(uri);
+  track = link != NULL ? sp_link_as_track(link) : NULL;
+  if (track == NULL)
+    printf("WARNING: '%s' is not a track, skipping it.\n", uri);
+  else
     {
-      sp_track *track = sp_playlist_track(data->playlist, i);
-      sp_link *link = sp_link_create_from_track(track, 0);
-      int j = 0;
-      char link_str[100];
-      char *artists_str = NULL;
-      sp_album *album;
-      const char *album_str = NULL;
+      if (!lp->created)
+        load_playlist_create(lp);
+      sp_track_add_ref(track);
+      lp->batch[lp->batch_len++] = track;
+      if (lp->batch_len == LOAD_BATCH_SIZE)
+        load_playlist_flush(lp);
+    }
 
-      if(!sp_link_as_string(link, link_str, 100))
-        printf("WARNING: sp_link_as_string failed.\n");
+  if (link != NULL)
+    sp_link_release(link);
+}
+
+/**
+ * Read the track list ("songs" or, with a track table, "tracks") of a
+ * playlist file, streaming it into batches.
+ *
+ * @return 0 on success, -1 if the file is not valid JSON
+ */
+static int load_playlist_read(load_playlist *lp, json_reader *r)
+{
+  json_token token = json_reader_next(r);
+
+  if (token != JSON_BEGIN_OBJECT)
+    return -1;
 
-      for(j=0; j < sp_track_num_artists(track); j++)
+  while ((token = json_reader_next(r)) == JSON_KEY)
+    {
+      char *key = strdup(json_reader_value(r));
+
+      token = json_reader_next(r);
+      if (strcmp(key, "playlist_name") == 0 && token == JSON_STRING)
+        {
+          free(lp->name);
+          lp->name = strdup(json_reader_value(r));
+        }
+      else if (strcmp(key, "spotify_link") == 0 && token == JSON_STRING)
         {
-          char *new_artists_str = NULL;
-          sp_artist *artist = sp_track_artist(track, j);
-          if (-1 == asprintf(&new_artists_str, "%s, \"%s\"",
-              artists_str, sp_artist_name(artist)))
+          free(lp->uri);
+          lp->uri = strdup(json_reader_value(r));
+        }
+      else if ((strcmp(key, "songs") == 0 || strcmp(key, "tracks") == 0)
+          && token == JSON_BEGIN_ARRAY)
+        {
+          while ((token = json_reader_next(r)) != JSON_END_ARRAY)
             {
-              printf("WARNING: asprinf failed.\n");
-              break;
+              if (token == JSON_STRING)
+                load_playlist_add(lp, json_reader_value(r));
+              else if (token != JSON_BEGIN_OBJECT)
+                break;
+              else
+                while ((token = json_reader_next(r)) == JSON_KEY)
+                  {
+                    int is_link = strcmp(json_reader_value(r), "link") == 0;
+
+                    token = json_reader_next(r);
+                    if (is_link && token == JSON_STRING)
+                      load_playlist_add(lp, json_reader_value(r));
+                    else if (json_reader_skip(r, token) == JSON_ERROR)
+                      break;
+                  }
+              if (token == JSON_ERROR)
+                break;
             }
-          free(artists_str);
-          artists_str = new_artists_str;
         }
-      if (artists_str == NULL)
-        artists_str = "(null), \"Dunno yet.\"";
-
-      album = sp_track_album(track);
-      if(album != NULL && sp_album_is_loaded(album))
-        album_str = sp_album_name(album);
       else
-        album_str = "Dunno yet.";
+        token = json_reader_skip(r, token);
 
-      fprintf(output, "{\"name\": \"%s\", \"artists\": [%s], \"album\": \"%s\", "
-          "\"duration\": %d, \"link\": \"%s\"},\n",
-          sp_track_name(track), artists_str + 8 /* strip off "(null), "*/,
-          album_str, sp_track_duration(track), link_str);
+      free(key);
+      if (token == JSON_ERROR)
+        return -1;
     }
 
-  fprintf(output, "]}\n");
-  fclose(output);
-  save_playlist_finally(data);
+  return token == JSON_END_OBJECT ? 0 : -1;
 }
 
-static void playlist_state_changed_cb(sp_playlist *pl, void *userdata)
+/*
+ * load --sync: edit the playlists that still exist into their saved state
+ */
+
+static void load_report(load_context *ctx)
 {
-  playlist_data *data = userdata;
-  if (sp_playlist_is_loaded(data->playlist))
-    actually_save_playlist(data);
+  struct timeval end;
+  double elapsed;
+
+  gettimeofday(&end, NULL);
+  elapsed = (end.tv_sec - ctx->start.tv_sec) + (end.tv_usec - ctx->start.tv_usec) / 1e6;
+  if (ctx->sync)
+    {
+      printf("%s %d playlists with %d track operations in %d calls (%.1fs).\n",
+          ctx->dry_run ? "Would sync" : "Synced",
+          ctx->num_playlists, ctx->num_edits, ctx->num_calls, elapsed);
+      printf("Rewriting them would take %d track operations in %d calls; "
+          "%d operations saved.\n", ctx->num_rewrite_edits,
+          ctx->num_rewrite_calls, ctx->num_rewrite_edits - ctx->num_edits);
+    }
+  else
+    printf("%s %d playlists in %d folders with %d tracks in %d calls (%.1fs).\n",
+        ctx->dry_run ? "Would restore" : "Restored",
+        ctx->num_playlists, ctx->num_folders, ctx->num_tracks, ctx->num_calls,
+        elapsed);
+  if (ctx->num_failed > 0)
+    printf("WARNING: %d folders or playlists could not be %s.\n",
+        ctx->num_failed, ctx->sync ? "synced" : "created");
 }
 
-static void save_playlist_async(sp_playlist *playlist,
-    const char *directory,
-    unsigned int prefix,
-    sg_callback cb,
-    void *user_data)
+static void load_context_free(load_context *ctx)
 {
-  playlist_data *data = playlist_data_new(playlist, directory, prefix, cb, user_data);
-  data->callbacks->playlist_state_changed = playlist_state_changed_cb;
-  sp_playlist_add_callbacks(data->playlist, data->callbacks, data);
+  free(ctx->callbacks);
+  free(ctx->directory);
+  free(ctx);
+}
 
-  playlist_state_changed_cb(data->playlist, data);
+/**
+ * Drop one reference to @ctx; the last one reports and ends the command.
+ */
+static void load_release(load_context *ctx)
+{
+  if (--ctx->pending > 0)
+    return;
+
+  load_report(ctx);
+  load_context_free(ctx);
+  cmd_done();
 }
 
-typedef struct {
-  int started_calls;
-  int finished_calls;
-} save_social_context;
+static void load_sync_free(load_sync *s)
+{
+  int i;
+
+  for (i = 0; i < s->num_uris; i++)
+    free(s->uris[i]);
+  free(s->uris);
+  free(s->name);
+  free(s);
+}
 
-save_social_context *save_social_context_new()
+/**
+ * What sp_playlist_reorder_tracks() does: move the tracks at @indices
+ * (ascending) in front of the one that was at @position.  @pos, the index
+ * in @cur of each label, is kept up to date.
+ */
+static void move_block(int *cur, int num_cur, int *pos, const int *indices,
+    int n, int position)
 {
-  save_social_context *ctx = malloc(sizeof(save_social_context));
+  int *block = malloc(n * sizeof(int));
+  int lo = indices[0] < position ? indices[0] : position;
+  int hi = indices[n - 1] + 1 > position ? indices[n - 1] + 1 : position;
+  int i, j, k;
+
+  for (i = j = k = 0; i < num_cur; i++)
+    if (k < n && indices[k] == i)
+      block[k++] = cur[i];
+    else
+      cur[j++] = cur[i];
+
+  for (k = 0; k < n && indices[k] < position; k++)
+    ;
+  position -= k;
+  memmove(cur + position + n, cur + position, (j - position) * sizeof(int));
+  memcpy(cur + position, block, n * sizeof(int));
+  free(block);
+
+  /* Only the tracks between the block and its destination shift */
+  for (i = lo; i < hi && i < num_cur; i++)
+    pos[cur[i]] = i;
+}
 
-  ctx->started_calls = 0;
-  ctx->finished_calls = 0;
+/**
+ * Apply the diff @d to the live playlist: one pass of removals, then the
+ * moves, then the insertions, all batched.  Each pass leaves the playlist
+ * a subsequence of the saved one, so the positions of the next pass can be
+ * worked out from the saved order alone.
+ *
+ * If @max_calls is not 0, nothing is changed: the script is only counted,
+ * and that stops as soon as it takes more than @max_calls calls.
+ *
+ * @return the number of calls made, or with --dry-run that would be
+ */
+static int load_sync_edit(load_sync *s, diff_result *d, int max_calls)
+{
+  load_context *ctx = s->ctx;
+  int apply = !ctx->dry_run && max_calls == 0;
+  int *indices = malloc((d->num_old + 1) * sizeof(int));
+  int *cur = malloc((d->num_old + 1) * sizeof(int));
+  int *pos = malloc((d->num_new + 1) * sizeof(int));
+  sp_track *batch[LOAD_BATCH_SIZE];
+  int num_cur, num_calls = 0, num_edits = d->num_removed, skipped = 0;
+  int i, j, k, n, next, position;
+  sp_error error;
+
+  /* Removals, from the end so that the indices still to go stay valid */
+  for (i = k = 0; i < d->num_old; i++)
+    if (d->old_to_new[i] == -1)
+      indices[k++] = i;
+  for (; k > 0; k -= n)
+    {
+      n = k < LOAD_BATCH_SIZE ? k : LOAD_BATCH_SIZE;
+      num_calls ++;
+      if (apply
+          && (error = sp_playlist_remove_tracks(s->playlist, indices + k - n, n))
+          != SP_ERROR_OK)
+        printf("WARNING: removing %d tracks from '%s' failed: %s\n",
+            n, s->name, sp_error_message(error));
+    }
 
-  return ctx;
+  /* The survivors, by their index in the saved list, and where each is */
+  for (i = num_cur = 0; i < d->num_old; i++)
+    if (d->old_to_new[i] != -1)
+      {
+        pos[d->old_to_new[i]] = num_cur;
+        cur[num_cur++] = d->old_to_new[i];
+      }
+
+  /* Moves, in saved order: a block of moved tracks goes right after its
+     predecessor, which is in place by then */
+  for (j = 0; j < d->num_new && (max_calls == 0 || num_calls <= max_calls);
+       j = next)
+    {
+      next = j + 1;
+      if (d->new_to_old[j] == -1 || !d->moved[j])
+        continue;
+
+      k = 0;
+      indices[k++] = pos[j];
+      for (; next < d->num_new && k < LOAD_BATCH_SIZE; next++)
+        {
+          if (d->new_to_old[next] == -1)
+            continue;
+          if (!d->moved[next] || pos[next] < indices[k - 1])
+            break;
+          indices[k++] = pos[next];
+        }
+
+      for (i = j - 1; i >= 0 && d->new_to_old[i] == -1; i--)
+        ;
+      position = i < 0 ? 0 : pos[i] + 1;
+      if (indices[0] == position && indices[k - 1] == position + k - 1)
+        continue;
+
+      num_calls ++;
+      num_edits += k;
+      if (apply
+          && (error = sp_playlist_reorder_tracks(s->playlist, indices, k, position))
+          != SP_ERROR_OK)
+        printf("WARNING: moving %d tracks in '%s' failed: %s\n",
+            k, s->name, sp_error_message(error));
+      move_block(cur, num_cur, pos, indices, k, position);
+    }
+
+  /* Insertions, in saved order, so everything before them is in place */
+  for (j = 0; j < d->num_new && (max_calls == 0 || num_calls <= max_calls);
+       j = next)
+    {
+      next = j + 1;
+      if (d->new_to_old[j] != -1)
+        continue;
+
+      if (max_calls != 0)
+        {
+          /* Counting: a batch of links that are not tracks is rare */
+          for (next = j; next < d->num_new && d->new_to_old[next] == -1
+              && next - j < LOAD_BATCH_SIZE; next++)
+            ;
+          num_calls ++;
+          continue;
+        }
+
+      position = j - skipped;
+      for (n = 0, next = j; next < d->num_new && d->new_to_old[next] == -1
+          && n < LOAD_BATCH_SIZE; next++)
+        {
+          sp_link *link = sp_link_create_from_string(s->uris[next]);
+          sp_track *track = link != NULL ? sp_link_as_track(link) : NULL;
+
+          if (track == NULL)
+            {
+              printf("WARNING: '%s' is not a track, skipping it.\n", s->uris[next]);
+              skipped ++;
+            }
+          else
+            {
+              sp_track_add_ref(track);
+              batch[n++] = track;
+            }
+          if (link != NULL)
+            sp_link_release(link);
+        }
+      if (n == 0)
+        continue;
+
+      num_calls ++;
+      num_edits += n;
+      if (apply
+          && (error = sp_playlist_add_tracks(s->playlist, batch, n, position,
+              g_session)) != SP_ERROR_OK)
+        printf("WARNING: adding %d tracks to '%s' failed: %s\n",
+            n, s->name, sp_error_message(error));
+      for (i = 0; i < n; i++)
+        sp_track_release(batch[i]);
+    }
+
+  if (max_calls == 0)
+    ctx->num_edits += num_edits;
+  free(indices);
+  free(cur);
+  free(pos);
+  return num_calls;
 }
 
-static void
-save_social_context_free(save_social_context *ctx)
+/**
+ * Replace the @num_old tracks of the live playlist with the saved ones
+ * wholesale, for when the edit script would take more calls.
+ *
+ * @return the number of calls made, or with --dry-run that would be
+ */
+static int load_sync_rewrite(load_sync *s, int num_old)
 {
-  free(ctx);
+  load_context *ctx = s->ctx;
+  int indices[LOAD_BATCH_SIZE];
+  sp_track *batch[LOAD_BATCH_SIZE];
+  int num_calls = 0;
+  int i, n, position = 0;
+  sp_error error;
+
+  for (; num_old > 0; num_old -= n)
+    {
+      n = num_old < LOAD_BATCH_SIZE ? num_old : LOAD_BATCH_SIZE;
+      for (i = 0; i < n; i++)
+        indices[i] = num_old - n + i;
+      num_calls ++;
+      ctx->num_edits += n;
+      if (!ctx->dry_run
+          && (error = sp_playlist_remove_tracks(s->playlist, indices, n))
+          != SP_ERROR_OK)
+        printf("WARNING: removing %d tracks from '%s' failed: %s\n",
+            n, s->name, sp_error_message(error));
+    }
+
+  for (i = 0; i < s->num_uris; )
+    {
+      for (n = 0; i < s->num_uris && n < LOAD_BATCH_SIZE; i++)
+        {
+          sp_link *link = sp_link_create_from_string(s->uris[i]);
+          sp_track *track = link != NULL ? sp_link_as_track(link) : NULL;
+
+          if (track == NULL)
+            printf("WARNING: '%s' is not a track, skipping it.\n", s->uris[i]);
+          else
+            {
+              sp_track_add_ref(track);
+              batch[n++] = track;
+            }
+          if (link != NULL)
+            sp_link_release(link);
+        }
+      if (n == 0)
+        continue;
+
+      num_calls ++;
+      ctx->num_edits += n;
+      if (!ctx->dry_run
+          && (error = sp_playlist_add_tracks(s->playlist, batch, n, position,
+              g_session)) != SP_ERROR_OK)
+        printf("WARNING: adding %d tracks to '%s' failed: %s\n",
+            n, s->name, sp_error_message(error));
+      position += n;
+      while (n > 0)
+        sp_track_release(batch[--n]);
+    }
+  return num_calls;
 }
 
-static void save_social_finally (save_social_context *ctx)
+static void load_sync_apply(load_sync *s)
 {
-  char *argv[2];
-  argv[0] = "";
-  argv[1] = "veemcgee";
-  // cmd_published_playlists(2, &argv);
-  cmd_logout(0, NULL);
-  save_social_context_free(ctx);
+  load_context *ctx = s->ctx;
+  int num_old = sp_playlist_num_tracks(s->playlist);
+  char **old = malloc((num_old + 1) * sizeof(char *));
+  int rewrite_calls = (num_old + LOAD_BATCH_SIZE - 1) / LOAD_BATCH_SIZE
+    + (s->num_uris + LOAD_BATCH_SIZE - 1) / LOAD_BATCH_SIZE;
+  diff_result *d;
+  int num_calls, i;
+
+  for (i = 0; i < num_old; i++)
+    {
+      sp_track *track = sp_playlist_track(s->playlist, i);
+      sp_link *link = track != NULL ? sp_link_create_from_track(track, 0) : NULL;
+
+      /* a track without a link matches nothing, so it goes */
+      old[i] = link != NULL ? sg_link_dup_string(link) : strdup("");
+      if (link != NULL)
+        sp_link_release(link);
+    }
+
+  d = diff_tracks((const char *const *) old, num_old,
+      (const char *const *) s->uris, s->num_uris);
+
+  /* A reversed or shuffled playlist moves one track per call */
+  if (rewrite_calls > 0 && load_sync_edit(s, d, rewrite_calls) > rewrite_calls)
+    {
+      num_calls = load_sync_rewrite(s, num_old);
+      printf("Rewrote '%s': %d removed, %d added in %d calls.\n",
+          s->name, num_old, s->num_uris, num_calls);
+    }
+  else
+    {
+      num_calls = load_sync_edit(s, d, 0);
+      printf("Synced '%s': %d kept, %d moved, %d removed, %d added in %d calls.\n",
+          s->name, d->num_kept, d->num_moved, d->num_removed, d->num_inserted,
+          num_calls);
+    }
+
+  ctx->num_playlists ++;
+  ctx->num_tracks += s->num_uris;
+  ctx->num_calls += num_calls;
+  ctx->num_rewrite_edits += num_old + s->num_uris;
+  ctx->num_rewrite_calls += rewrite_calls;
+
+  diff_result_free(d);
+  for (i = 0; i < num_old; i++)
+    free(old[i]);
+  free(old);
 }
 
-static save_social_context *save_social_context_start_call(
-    save_social_context *ctx)
+static void load_sync_state_changed(sp_playlist *pl, void *userdata)
 {
-  ctx->started_calls ++;
-  return ctx;
+  load_sync *s = userdata;
+  load_context *ctx = s->ctx;
+
+  if (!sp_playlist_is_loaded(pl))
+    return;
+
+  sp_playlist_remove_callbacks(pl, &s->callbacks, s);
+  load_sync_apply(s);
+  sp_playlist_release(pl);
+  load_sync_free(s);
+  load_release(ctx);
 }
 
-static void finish_with_user (container_context *ctx)
+/**
+ * Sync the live playlist @lp->uri to the track list read into @lp, once
+ * it has loaded.
+ */
+static void load_sync_start(load_playlist *lp)
 {
-  save_social_context *save_ctx = ctx->user_data;
+  load_context *ctx = lp->ctx;
+  sp_link *link = lp->uri != NULL ? sp_link_create_from_string(lp->uri) : NULL;
+  sp_playlist *playlist = link != NULL ? sp_playlist_create(g_session, link) : NULL;
+  load_sync *s;
+
+  if (link != NULL)
+    sp_link_release(link);
+  if (playlist == NULL)
+    {
+      printf("WARNING: '%s' has no playlist to sync, skipping it.\n", lp->name);
+      ctx->num_failed ++;
+      return;
+    }
 
-  save_ctx->finished_calls ++;
-  if(save_ctx->started_calls == save_ctx->finished_calls)
-    save_social_finally(save_ctx);
+  s = calloc(1, sizeof(load_sync));
+  s->ctx = ctx;
+  s->playlist = playlist;
+  s->name = strdup(lp->name);
+  s->uris = lp->uris;
+  s->num_uris = lp->num_uris;
+  s->callbacks.playlist_state_changed = load_sync_state_changed;
+  lp->uris = NULL;
+  lp->num_uris = 0;
+
+  ctx->pending ++;
+  sp_playlist_add_callbacks(playlist, &s->callbacks, s);
+  load_sync_state_changed(playlist, s);
 }
+
 /**
+ * Restore the playlist file @path at @position.
  *
+ * @return the position after it
  */
-int cmd_save_social(int argc, char **argv)
+static int load_playlist_file(load_context *ctx, const char *path,
+    const char *filename, int position)
 {
-  int i;
-  int num_friends;
-  save_social_context *save_ctx = save_social_context_new();
-
-
-  num_friends = sp_session_num_friends(g_session);
-  printf("saving playlists for %d friends.\n", num_friends);
-  for(i = -1; i < num_friends; i++) {
-    // sp_user *user = sp_session_friend(g_session, i);
-    const char *name = "vmcgee"; // sp_user_canonical_name(user);
-    sp_playlistcontainer *pc = sp_session_publishedcontainer_for_user_create(
-        g_session, name);
-    container_context *ctx = container_context_new(pc, name,
-        save_social_context_start_call(save_ctx));
-    printf("saving playlists for %s.\n", name);
-
-    container_context_start_call(ctx);
-    ctx->callbacks->container_loaded = container_loaded;
-    sp_playlistcontainer_add_callbacks(pc, ctx->callbacks, ctx);
-
-    container_context_add_finally(ctx, finish_with_user);
-  }
+  FILE *input = fopen(path, "r");
+  json_reader r;
+  load_playlist lp;
+  int failed, i;
 
-  if (save_ctx->started_calls == 0)
-    save_social_finally(save_ctx);
+  if (input == NULL)
+    {
+      printf("WARNING: could not open %s.\n", path);
+      return position;
+    }
 
-  return 1;
+  memset(&lp, 0, sizeof(lp));
+  lp.ctx = ctx;
+  lp.position = position;
+  /* for files without a playlist_name before their tracks */
+  lp.name = strndup(filename, strlen(filename) - strlen(".json"));
+  json_reader_init(&r, input);
+  failed = load_playlist_read(&lp, &r) != 0;
+  json_reader_free(&r);
+  fclose(input);
+
+  if (failed)
+    printf("WARNING: %s is not a saved playlist.\n", path);
+  else if (ctx->sync)
+    load_sync_start(&lp);
+  else if (!lp.created)
+    load_playlist_create(&lp);
+
+  load_playlist_flush(&lp);
+  for (i = 0; i < lp.num_uris; i++)
+    free(lp.uris[i]);
+  free(lp.uris);
+  free(lp.uri);
+  free(lp.name);
+  return lp.playlist != NULL || (lp.created && ctx->dry_run) ? position + 1 : position;
+}
+
+static int load_filter(const struct dirent *de)
+{
+  return de->d_name[0] != '.';
 }
 
+/* By the NNN-- prefix save gave a playlist file, then by name */
+static int load_compare(const struct dirent **a, const struct dirent **b)
+{
+  const char *x = (*a)->d_name, *y = (*b)->d_name;
+  char *x_end, *y_end;
+  unsigned long x_prefix = strtoul(x, &x_end, 10);
+  unsigned long y_prefix = strtoul(y, &y_end, 10);
+
+  if (x_end != x && y_end != y && x_prefix != y_prefix)
+    return x_prefix < y_prefix ? -1 : 1;
+  return strcmp(x, y);
+}
 
 /**
+ * Restore the container that save recorded in the ORDER_FILENAME of
+ * @path, starting at @position in the container.  Folders get their
+ * original names back, and playlists and folders come in their original
+ * order.
  *
+ * @return 0 if @path has one, -1 if it has to be restored from its files
  */
-int cmd_load(int argc, char **argv)
+static int load_order(load_context *ctx, const char *path, int position)
 {
-  int index, i;
-  sp_track *track;
-  sp_playlist *playlist;
-  sp_playlistcontainer *pc = sp_session_playlistcontainer(g_session);
+  char *order_path, *line = NULL, *child;
+  size_t line_size = 0;
+  ssize_t len;
+  FILE *input;
+  int *created = NULL;    /* for each open folder, whether it was */
+  int depth = 0;
+
+  asprintf(&order_path, "%s/%s", path, ORDER_FILENAME);
+  input = fopen(order_path, "r");
+  free(order_path);
+  if (input == NULL)
+    return -1;
+
+  if ((len = getline(&line, &line_size, input)) <= 0
+      || strncmp(line, ORDER_HEADER, strlen(ORDER_HEADER)) != 0)
+    {
+      printf("WARNING: ignoring unknown %s in %s.\n", ORDER_FILENAME, path);
+      free(line);
+      fclose(input);
+      return -1;
+    }
 
-  if (argc < 1) {
-    printf("playlist [playlist index]\n");
-    return 0;
-  }
+  while ((len = getline(&line, &line_size, input)) > 0)
+    {
+      if (line[len - 1] == '\n')
+        line[--len] = 0;
 
-  index = atoi(argv[1]);
-  if (index < 0 || index > sp_playlistcontainer_num_playlists(pc)) {
-    printf("invalid index\n");
-    return 0;
-  }
-  playlist = sp_playlistcontainer_playlist(pc, index);
-  printf("Playlist %s by %s%s%s\n",
-       sp_playlist_name(playlist),
-       sp_user_display_name(sp_playlist_owner(playlist)),
-       sp_playlist_is_collaborative(playlist) ? " (collaborative)" : "",
-       sp_playlist_has_pending_changes(playlist) ? " with pending changes" : ""
-       );
-  for (i = 0; i < sp_playlist_num_tracks(playlist); ++i) {
-    track = sp_playlist_track(playlist, i);
-    printf("%d. %c %s%s %s\n", i,
-         sp_track_is_starred(g_session, track) ? '*' : ' ',
-         sp_track_is_local(g_session, track) ? "local" : "     ",
-         sp_track_is_autolinked(g_session, track) ? "autolinked" : "          ",
-         sp_track_name(track));
-  }
-  return 1;
+      if (strncmp(line, "playlist\t", 9) == 0)
+        {
+          const char *filename = line + 9;
+          const char *slash = strrchr(filename, '/');
+
+          asprintf(&child, "%s/%s", path, filename);
+          position = load_playlist_file(ctx, child,
+              slash != NULL ? slash + 1 : filename, position);
+          free(child);
+        }
+      else if (strncmp(line, "folder\t", 7) == 0 && !ctx->sync)
+        {
+          const char *name = line + 7;
+
+          created = realloc(created, (depth + 1) * sizeof(int));
+          printf("Restoring folder '%s'.\n", name);
+          ctx->num_folders ++;
+          created[depth] = ctx->dry_run
+              || sp_playlistcontainer_add_folder(ctx->pc, position, name)
+                  == SP_ERROR_OK;
+          if (created[depth])
+            position ++;
+          else
+            {
+              /* Its playlists still come back, outside of it */
+              printf("WARNING: could not create folder '%s'.\n", name);
+              ctx->num_failed ++;
+            }
+          depth ++;
+        }
+      else if (strcmp(line, "end") == 0 && !ctx->sync && depth > 0)
+        {
+          /* Past the folder's end marker */
+          if (created[--depth])
+            position ++;
+        }
+    }
+
+  free(created);
+  free(line);
+  fclose(input);
+  return 0;
+}
+
+/**
+ * Restore the playlists of @path, in the order of their NNN-- prefixes,
+ * and then each of its directories as a folder, starting at @position in
+ * the container.  This is for trees without an ORDER_FILENAME, where how
+ * playlists and folders were interleaved is lost.
+ *
+ * @return the position after the last thing restored
+ */
+static int load_directory(load_context *ctx, const char *path, int position)
+{
+  struct dirent **entries;
+  int n = scandir(path, &entries, load_filter, load_compare);
+  int pass, i;
+
+  if (n < 0)
+    {
+      printf("WARNING: could not read %s.\n", path);
+      return position;
+    }
+
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < n; i++)
+      {
+        const char *name = entries[i]->d_name;
+        size_t len = strlen(name);
+        char *child;
+        struct stat st;
+
+        asprintf(&child, "%s/%s", path, name);
+        if (stat(child, &st) != 0)
+          ;
+        else if (pass == 0 && S_ISREG(st.st_mode) && len > 5
+            && strcmp(name + len - 5, ".json") == 0)
+          position = load_playlist_file(ctx, child, name, position);
+        else if (pass == 1 && S_ISDIR(st.st_mode) && ctx->sync)
+          load_directory(ctx, child, position);
+        else if (pass == 1 && S_ISDIR(st.st_mode))
+          {
+            printf("Restoring folder '%s'.\n", name);
+            ctx->num_folders ++;
+            if (ctx->dry_run)
+              position = load_directory(ctx, child, position + 1) + 1;
+            else if (sp_playlistcontainer_add_folder(ctx->pc, position, name)
+                != SP_ERROR_OK)
+              {
+                printf("WARNING: could not create folder '%s'.\n", name);
+                ctx->num_failed ++;
+              }
+            else
+              position = load_directory(ctx, child, position + 1) + 1;
+          }
+        free(child);
+      }
+
+  for (i = 0; i < n; i++)
+    free(entries[i]);
+  free(entries);
+  return position;
+}
+
+static void load_run(load_context *ctx)
+{
+  /* held by the walk, so syncs that finish straight away don't end it */
+  ctx->pending = 1;
+  if (load_order(ctx, ctx->directory,
+      sp_playlistcontainer_num_playlists(ctx->pc)) != 0)
+    load_directory(ctx, ctx->directory,
+        sp_playlistcontainer_num_playlists(ctx->pc));
+  load_release(ctx);
+}
+
+static void load_container_loaded(sp_playlistcontainer *pc, void *userdata)
+{
+  load_context *ctx = userdata;
+
+  sp_playlistcontainer_remove_callbacks(pc, ctx->callbacks, ctx);
+  load_run(ctx);
 }
 
+/**
+ * load [-n|--dry-run] [--sync] DIRECTORY
+ *
+ * Append the snapshot saved in DIRECTORY to the playlist container:
+ * every playlist file becomes a new playlist and every folder save
+ * recorded in the tree's ORDER_FILENAME a folder, in their saved order.
+ * With --sync, edit the playlists the files were saved from back into
+ * their saved track order instead, with as few changes as a diff finds.
+ */
+int cmd_load(int argc, char **argv)
+{
+  load_context *ctx;
+  const char *directory = NULL;
+  int dry_run = 0;
+  int sync = 0;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+      if (strcmp(argv[i], "--dry-run") == 0 || strcmp(argv[i], "-n") == 0)
+        dry_run = 1;
+      else if (strcmp(argv[i], "--sync") == 0)
+        sync = 1;
+      else
+        directory = argv[i];
+    }
+
+  if (directory == NULL)
+    {
+      printf("load [-n|--dry-run] [--sync] [directory]\n");
+      return 1;
+    }
+
+  ctx = calloc(1, sizeof(load_context));
+  ctx->pc = sp_session_playlistcontainer(g_session);
+  ctx->directory = strdup(directory);
+  ctx->dry_run = dry_run;
+  ctx->sync = sync;
+  gettimeofday(&ctx->start, NULL);
+
+  if (sp_playlistcontainer_is_loaded(ctx->pc))
+    {
+      load_run(ctx);
+      return 0;
+    }
+
+  printf("Waiting for the playlist container to load.\n");
+  ctx->callbacks = calloc(1, sizeof(sp_playlistcontainer_callbacks));
+  ctx->callbacks->container_loaded = load_container_loaded;
+  sp_playlistcontainer_add_callbacks(ctx->pc, ctx->callbacks, ctx);
+  return 0;
+}
@@ -0,0 +1,454 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "search-cache.h"
+#include "append-log.h"
+#include "hash-table.h"
+
+#define SEARCH_CACHE_HEADER "# git-spot search cache v2"
+
+/* Separate the tracks of an entry and the fields of a track */
+#define SEARCH_TRACK_SEPARATOR '\036'
+#define SEARCH_FIELD_SEPARATOR '\037'
+
+/* What the text of a line must not contain */
+static const char search_separators[] = {
+  '\t', SEARCH_TRACK_SEPARATOR, SEARCH_FIELD_SEPARATOR, 0
+};
+
+typedef struct _search_slot search_slot;
+
+struct _search_slot {
+  hash_entry hash;            /* keyed by result.key */
+  search_slot *older;         /* in the LRU list */
+  search_slot *newer;
+  search_result result;
+};
+
+struct _search_cache {
+  int capacity;
+  append_log *log;
+  hash_table table;
+  search_slot *oldest;
+  search_slot *newest;
+};
+
+/* @return the length of the operator word at @c, or 0 if there is none */
+static size_t search_key_operator(const unsigned char *c)
+{
+  static const char *operators[] = { "AND", "OR", "NOT" };
+  size_t i, n;
+
+  for (i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+      n = strlen(operators[i]);
+      if (strncmp((const char *) c, operators[i], n) == 0
+          && (c[n] == 0 || isspace(c[n])))
+        return n;
+    }
+  return 0;
+}
+
+/**
+ * Write the normalized form of @query to @key: ASCII letters lowercased,
+ * other ASCII punctuation and white space turned into single spaces
+ * between words.  Bytes of multibyte characters are kept as they are.
+ *
+ * What Spotify reads as search syntax is kept, so that queries only share
+ * a key when they ask for the same thing: double quotes, a '-' starting a
+ * word, a ':' inside a word along with the rest of that word, as in
+ * "year:1990-2000", and the operators AND, OR and NOT in capitals.
+ *
+ * @return the length of the key, which is cut short if @size is too small
+ */
+size_t search_cache_key(const char *query, char *key, size_t size)
+{
+  const unsigned char *c;
+  size_t len = 0, n;
+  int space = 0;      /* words have been separated since the last byte */
+  int start = 1;      /* nothing of the current word has been kept yet */
+  int field = 0;      /* in the value of a field, which is kept whole */
+
+  if (size == 0)
+    return 0;
+
+  for (c = (const unsigned char *) query; *c != 0 && len + 2 < size; c++)
+    {
+      if (isspace(*c))
+        {
+          space = len > 0;
+          start = 1;
+          field = 0;
+          continue;
+        }
+      if (start && (n = search_key_operator(c)) > 0)
+        {
+          if (len + n + 2 >= size)
+            break;
+          if (space)
+            key[len++] = ' ';
+          memcpy(key + len, c, n);
+          len += n;
+          c += n - 1;
+          space = start = 0;
+          continue;
+        }
+      if (*c < 0x80 && !isalnum(*c) && !field && *c != '"'
+          && !(*c == ':' && c[1] != 0 && !isspace(c[1]))
+          && !(*c == '-' && start && c[1] != 0 && !isspace(c[1])))
+        {
+          space = len > 0;
+          continue;
+        }
+      if (space)
+        key[len++] = ' ';
+      space = start = 0;
+      if (*c == ':')
+        field = 1;
+      key[len++] = *c < 0x80 ? tolower(*c) : *c;
+    }
+  key[len] = 0;
+  return len;
+}
+
+static search_slot *
+search_find(search_cache *c, const char *key)
+{
+  return (search_slot *) hash_table_find(&c->table, key);
+}
+
+static void search_lru_unlink(search_cache *c, search_slot *s)
+{
+  if (s->older != NULL)
+    s->older->newer = s->newer;
+  else
+    c->oldest = s->newer;
+  if (s->newer != NULL)
+    s->newer->older = s->older;
+  else
+    c->newest = s->older;
+  s->older = s->newer = NULL;
+}
+
+static void search_lru_push(search_cache *c, search_slot *s)
+{
+  s->older = c->newest;
+  s->newer = NULL;
+  if (c->newest != NULL)
+    c->newest->newer = s;
+  else
+    c->oldest = s;
+  c->newest = s;
+}
+
+static void search_result_clear(search_result *r)
+{
+  int i, j;
+
+  for (i = 0; i < r->num_tracks; i++)
+    {
+      metadata_entry *t = &r->tracks[i];
+
+      free(t->uri);
+      free(t->name);
+      free(t->album);
+      for (j = 0; j < t->num_artists; j++)
+        free(t->artists[j]);
+      free(t->artists);
+    }
+  free(r->tracks);
+  r->tracks = NULL;
+  r->num_tracks = 0;
+}
+
+static void search_evict(search_cache *c)
+{
+  search_slot *s = c->oldest;
+
+  hash_table_remove(&c->table, &s->hash);
+  search_lru_unlink(c, s);
+  search_result_clear(&s->result);
+  free(s->result.key);
+  free(s);
+}
+
+/**
+ * The entry for @key, emptied if it was there already and now the newest.
+ */
+static search_result *search_set(search_cache *c, const char *key)
+{
+  search_slot *s = search_find(c, key);
+
+  if (s == NULL)
+    {
+      s = calloc(1, sizeof(search_slot));
+      s->result.key = strdup(key);
+      s->hash.key = s->result.key;
+      hash_table_insert(&c->table, &s->hash);
+    }
+  else
+    {
+      search_lru_unlink(c, s);
+      search_result_clear(&s->result);
+    }
+  search_lru_push(c, s);
+
+  while (c->table.num_entries > c->capacity)
+    search_evict(c);
+  return &s->result;
+}
+
+/* Parse the tracks of a line, separated by SEARCH_TRACK_SEPARATOR */
+static void search_parse_tracks(search_result *r, char *tracks)
+{
+  char track_separator[2] = { SEARCH_TRACK_SEPARATOR, 0 };
+  char field_separator[2] = { SEARCH_FIELD_SEPARATOR, 0 };
+  char *track;
+  int size = 0;
+
+  while ((track = strsep(&tracks, track_separator)) != NULL)
+    {
+      metadata_entry *t;
+      char *fields[5];
+      int n;
+
+      for (n = 0; n < 5 && track != NULL; n++)
+        fields[n] = strsep(&track, field_separator);
+      if (n != 5)
+        continue;
+
+      if (r->num_tracks == size)
+        {
+          size = size ? size * 2 : 16;
+          r->tracks = realloc(r->tracks, size * sizeof(metadata_entry));
+        }
+      t = &r->tracks[r->num_tracks++];
+      memset(t, 0, sizeof(metadata_entry));
+      t->uri = strdup(fields[0]);
+      t->name = strdup(fields[1]);
+      t->album = *fields[2] ? strdup(fields[2]) : NULL;
+      t->duration = atoi(fields[3]);
+      t->popularity = atoi(fields[4]);
+      t->artists = malloc(sizeof(char *));
+      while (track != NULL)
+        {
+          t->artists = realloc(t->artists,
+              (t->num_artists + 1) * sizeof(char *));
+          t->artists[t->num_artists++] = strdup(strsep(&track, field_separator));
+        }
+      t->fetched = r->fetched;
+    }
+}
+
+/**
+ * Take in a line of the cache file.
+ */
+static int search_load_line(void *arg, char *line)
+{
+  search_cache *c = arg;
+  char *fields[5];
+  char *rest = line;
+  search_result *r;
+  int n;
+
+  for (n = 0; n < 5 && rest != NULL; n++)
+    fields[n] = strsep(&rest, n == 4 ? "" : "\t");
+  if (n != 5 || fields[4] == NULL)
+    return -1;
+
+  r = search_set(c, fields[3]);
+  r->fetched = strtoll(fields[0], NULL, 10);
+  r->total_tracks = atoi(fields[1]);
+  r->limit = atoi(fields[2]);
+  search_parse_tracks(r, fields[4]);
+  return 0;
+}
+
+static void search_append_field(search_cache *c, const char *str)
+{
+  char separator = SEARCH_FIELD_SEPARATOR;
+
+  append_log_append(c->log, &separator, 1);
+  append_log_append_text(c->log, str, search_separators);
+}
+
+static void search_append_result(search_cache *c, const search_result *r)
+{
+  char numbers[64];
+  char separator = SEARCH_TRACK_SEPARATOR;
+  int i, j;
+
+  append_log_append(c->log, numbers, snprintf(numbers, sizeof(numbers),
+      "%lld\t%d\t%d\t", (long long) r->fetched, r->total_tracks, r->limit));
+  append_log_append(c->log, r->key, strlen(r->key));
+  append_log_append(c->log, "\t", 1);
+  for (i = 0; i < r->num_tracks; i++)
+    {
+      const metadata_entry *t = &r->tracks[i];
+
+      if (i > 0)
+        append_log_append(c->log, &separator, 1);
+      append_log_append_text(c->log, t->uri, search_separators);
+      search_append_field(c, t->name);
+      search_append_field(c, t->album != NULL ? t->album : "");
+      snprintf(numbers, sizeof(numbers), "%d", t->duration);
+      search_append_field(c, numbers);
+      snprintf(numbers, sizeof(numbers), "%d", t->popularity);
+      search_append_field(c, numbers);
+      for (j = 0; j < t->num_artists; j++)
+        search_append_field(c, t->artists[j]);
+    }
+  append_log_end_line(c->log);
+}
+
+/* One line per entry, oldest first, for rewriting the file */
+static void search_append_all(void *arg)
+{
+  search_cache *c = arg;
+  search_slot *s;
+
+  for (s = c->oldest; s != NULL; s = s->newer)
+    search_append_result(c, &s->result);
+}
+
+/**
+ * Open the cache at @path, creating it if need be, keeping at most
+ * @capacity queries.
+ *
+ * @return NULL if it cannot be written
+ */
+search_cache *search_cache_open(const char *path, int capacity)
+{
+  search_cache *c = calloc(1, sizeof(search_cache));
+
+  c->capacity = capacity > 0 ? capacity : 1;
+  hash_table_init(&c->table, 1024);
+
+  c->log = append_log_open(path, SEARCH_CACHE_HEADER, search_load_line, c);
+  if (c->log == NULL)
+    {
+      search_cache_close(c);
+      return NULL;
+    }
+  return c;
+}
+
+/**
+ * Write out what has been stored, rewriting the file if most of its lines
+ * are superseded or evicted, and free the cache.
+ */
+void search_cache_close(search_cache *c)
+{
+  if (c == NULL)
+    return;
+
+  append_log_close(c->log, c->table.num_entries, search_append_all, c);
+
+  while (c->oldest != NULL)
+    search_evict(c);
+  hash_table_clear(&c->table);
+  free(c);
+}
+
+/**
+ * Append the stored entries to the file, unsynced.
+ *
+ * @return 0 on success
+ */
+int search_cache_flush(search_cache *c)
+{
+  return c != NULL ? append_log_flush(c->log) : 0;
+}
+
+int search_cache_size(search_cache *c)
+{
+  return c->table.num_entries;
+}
+
+/**
+ * @return the results for the normalized query @key, which are now the
+ * most recently used, or NULL if there are none or they stop short of
+ * the first @limit results
+ */
+const search_result *search_cache_lookup(search_cache *c, const char *key,
+    int limit)
+{
+  search_slot *s = search_find(c, key);
+
+  if (s == NULL
+      || (limit > s->result.limit
+          && s->result.total_tracks > s->result.num_tracks))
+    return NULL;
+  search_lru_unlink(c, s);
+  search_lru_push(c, s);
+  return &s->result;
+}
+
+/**
+ * Remember the track results of the finished @search, which asked for
+ * @limit of them, under @key.
+ */
+const search_result *search_cache_store(search_cache *c, const char *key,
+    int limit, sp_search *search)
+{
+  search_result *r = search_set(c, key);
+  int i, j;
+
+  r->fetched = time(NULL);
+  r->limit = limit;
+  r->total_tracks = sp_search_total_tracks(search);
+  r->num_tracks = sp_search_num_tracks(search);
+  r->tracks = calloc(r->num_tracks + 1, sizeof(metadata_entry));
+
+  for (i = 0; i < r->num_tracks; i++)
+    {
+      sp_track *track = sp_search_track(search, i);
+      sp_album *album = sp_track_album(track);
+      sp_link *link = sp_link_create_from_track(track, 0);
+      metadata_entry *t = &r->tracks[i];
+      char uri[256];
+
+      sp_link_as_string(link, uri, sizeof(uri));
+      sp_link_release(link);
+      t->uri = strdup(uri);
+      t->name = strdup(sp_track_name(track));
+      t->album = album != NULL && sp_album_is_loaded(album)
+          ? strdup(sp_album_name(album)) : NULL;
+      t->duration = sp_track_duration(track);
+      t->popularity = sp_track_popularity(track);
+      t->fetched = r->fetched;
+      t->num_artists = sp_track_num_artists(track);
+      t->artists = malloc((t->num_artists + 1) * sizeof(char *));
+      for (j = 0; j < t->num_artists; j++)
+        t->artists[j] = strdup(sp_artist_name(sp_track_artist(track, j)));
+    }
+
+  search_append_result(c, r);
+  return r;
+}
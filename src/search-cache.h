@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SEARCH_CACHE_H__
+#define SEARCH_CACHE_H__
+
+#include <stddef.h>
+#include <time.h>
+
+#include "metadata-cache.h"
+
+/**
+ * The results of searches run before, keyed by the normalized query, so
+ * that a query seen in this or an earlier run is answered without asking
+ * Spotify again.  search_cache_key() lowercases a query and reduces
+ * punctuation and runs of white space to single spaces, so "Artist -
+ * Title" and "artist title" share an entry, but keeps search syntax, so
+ * "beatles -live" and "beatles live" do not.  An entry also records how
+ * many results were asked for, so that it does not answer a query for
+ * more of them.
+ *
+ * At most the given number of queries are kept; the least recently used
+ * one goes first.  Like the metadata cache the file is a log that is
+ * rewritten by search_cache_close() once it is mostly superseded lines,
+ * oldest entry first so that reading it back restores the order.
+ */
+#define SEARCH_CACHE_FILENAME "tmp/git-spot-searches"
+#define SEARCH_CACHE_CAPACITY 100000
+
+typedef struct _search_cache search_cache;
+
+typedef struct {
+  char *key;
+  int total_tracks;
+  int limit;                /* how many results were asked for */
+  metadata_entry *tracks;   /* the first results, in order */
+  int num_tracks;
+  time_t fetched;
+} search_result;
+
+extern size_t search_cache_key(const char *query, char *key, size_t size);
+
+extern search_cache *search_cache_open(const char *path, int capacity);
+extern void search_cache_close(search_cache *c);
+extern int search_cache_flush(search_cache *c);
+extern int search_cache_size(search_cache *c);
+
+extern const search_result *search_cache_lookup(search_cache *c,
+    const char *key, int limit);
+extern const search_result *search_cache_store(search_cache *c,
+    const char *key, int limit, sp_search *search);
+
+#endif // SEARCH_CACHE_H__
@@ -22,9 +22,15 @@
  */
 
 #include <string.h>
+#include <stdint.h>
 
 #include "git-spot.h"
 #include "cmd.h"
+#include "manifest.h"
+#include "metadata-cache.h"
+#include "record.h"
+#include "search-cache.h"
+#include "stats.h"
 
 
 /**
@@ -34,6 +40,13 @@
  */
 static void print_album(sp_album *album)
 {
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("album");
+    record_album(album);
+    record_end();
+    return;
+  }
+
   printf("  Album \"%s\" (%d)\n",
          sp_album_name(album),
          sp_album_year(album));
@@ -46,6 +59,13 @@ static void print_album(sp_album *album)
  */
 static void print_artist(sp_artist *artist)
 {
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("artist");
+    record_artist(artist);
+    record_end();
+    return;
+  }
+
   printf("  Artist \"%s\"\n", sp_artist_name(artist));
 }
 
@@ -58,6 +78,24 @@ static void print_search(sp_search *search)
 {
   int i;
 
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("search");
+    record_string("query", sp_search_query(search));
+    record_string("did_you_mean", sp_search_did_you_mean(search));
+    record_int("total_tracks", sp_search_total_tracks(search));
+    record_int("total_albums", sp_search_total_albums(search));
+    record_int("total_artists", sp_search_total_artists(search));
+    record_end();
+
+    for (i = 0; i < sp_search_num_tracks(search); ++i)
+      print_track(sp_search_track(search, i));
+    for (i = 0; i < sp_search_num_albums(search); ++i)
+      print_album(sp_search_album(search, i));
+    for (i = 0; i < sp_search_num_artists(search); ++i)
+      print_artist(sp_search_artist(search, i));
+    return;
+  }
+
   printf("Query          : %s\n", sp_search_query(search));
   printf("Did you mean   : %s\n", sp_search_did_you_mean(search));
   printf("Tracks in total: %d\n", sp_search_total_tracks(search));
@@ -99,12 +137,429 @@ static void search_complete(sp_search *search, void *userdata)
 
 
 
+/*
+ * search --all: walk every page of the track results instead of the first
+ * hundred.  Up to search_window pages are in flight at once; before the
+ * first one is in, the total is not known, so the first window is asked
+ * for on spec.  Tracks are printed as their page lands, so the output is
+ * in completion order, and results shifting between pages can make the
+ * same track turn up twice, which is why tracks are deduped by URI.
+ */
+#define SEARCH_PAGE_SIZE 100
+
+typedef struct {
+  char *query;
+  int next_offset;    /* of the next page to ask for */
+  int total;          /* of tracks, -1 until a page is in */
+  int in_flight;
+  int failed;
+  int pages;
+  int printed;
+  int duplicates;
+  double started;     /* stats_now() */
+
+  /* Hashes of the URIs printed so far, 0 for an empty slot */
+  uint64_t *seen;
+  size_t seen_size;
+  size_t num_seen;
+} search_all_context;
+
+typedef struct {
+  search_all_context *ctx;
+  int offset;
+} search_page;
+
+#define SEARCH_WINDOW 4
+
+static int search_window = SEARCH_WINDOW;
+
+/**
+ * @return 1 if @uri had not been seen yet
+ */
+static int search_all_add(search_all_context *ctx, const char *uri)
+{
+  uint64_t hash = manifest_hash(uri, strlen(uri));
+  size_t i;
+
+  if (hash == 0)
+    hash = 1;
+
+  if (2 * (ctx->num_seen + 1) > ctx->seen_size) {
+    uint64_t *old = ctx->seen;
+    size_t old_size = ctx->seen_size;
+
+    ctx->seen_size = old_size ? old_size * 2 : 1024;
+    ctx->seen = calloc(ctx->seen_size, sizeof(uint64_t));
+    for (i = 0; i < old_size; i++) {
+      size_t j = old[i] & (ctx->seen_size - 1);
+
+      if (old[i] == 0)
+        continue;
+      while (ctx->seen[j] != 0)
+        j = (j + 1) & (ctx->seen_size - 1);
+      ctx->seen[j] = old[i];
+    }
+    free(old);
+  }
+
+  for (i = hash & (ctx->seen_size - 1); ctx->seen[i] != 0;
+       i = (i + 1) & (ctx->seen_size - 1)) {
+    if (ctx->seen[i] == hash)
+      return 0;
+  }
+  ctx->seen[i] = hash;
+  ctx->num_seen++;
+  return 1;
+}
+
+static void search_all_pump(search_all_context *ctx);
+
+static void search_all_finish(search_all_context *ctx)
+{
+  double elapsed = stats_now() - ctx->started;
+
+  fprintf(stderr, "%d of %d tracks in %d pages, %d duplicates dropped, "
+                  "in %.1f s.\n",
+          ctx->printed, ctx->total < 0 ? 0 : ctx->total, ctx->pages,
+          ctx->duplicates, elapsed);
+  free(ctx->seen);
+  free(ctx->query);
+  free(ctx);
+  cmd_done();
+}
+
+static void search_all_page(sp_search *search, void *userdata)
+{
+  search_page *page = userdata;
+  search_all_context *ctx = page->ctx;
+  int i;
+
+  ctx->in_flight--;
+  ctx->pages++;
+
+  if (sp_search_error(search) != SP_ERROR_OK) {
+    fprintf(stderr, "Failed to search at offset %d: %s\n", page->offset,
+            sp_error_message(sp_search_error(search)));
+    ctx->failed = 1;
+  } else {
+    if (ctx->total < 0) {
+      ctx->total = sp_search_total_tracks(search);
+      if (g_output_format == OUTPUT_NDJSON) {
+        record_begin("search");
+        record_string("query", sp_search_query(search));
+        record_string("did_you_mean", sp_search_did_you_mean(search));
+        record_int("total_tracks", ctx->total);
+        record_end();
+      } else {
+        printf("Query          : %s\n", sp_search_query(search));
+        printf("Tracks in total: %d\n", ctx->total);
+        puts("");
+      }
+    }
+
+    // A short page means the results ran out before the total said
+    if (sp_search_num_tracks(search) < SEARCH_PAGE_SIZE
+        && page->offset + sp_search_num_tracks(search) < ctx->total)
+      ctx->total = page->offset + sp_search_num_tracks(search);
+
+    for (i = 0; i < sp_search_num_tracks(search); i++) {
+      sp_track *track = sp_search_track(search, i);
+      sp_link *link = sp_link_create_from_track(track, 0);
+      char uri[256];
+
+      sp_link_as_string(link, uri, sizeof(uri));
+      sp_link_release(link);
+      if (!search_all_add(ctx, uri)) {
+        ctx->duplicates++;
+        continue;
+      }
+
+      ctx->printed++;
+      if (g_output_format == OUTPUT_NDJSON) {
+        record_begin("track");
+        record_int("position", page->offset + i + 1);
+        record_track(track);
+        record_end();
+      } else {
+        printf(" %5d: ", page->offset + i + 1);
+        print_track(track);
+      }
+    }
+  }
+
+  sp_search_release(search);
+  free(page);
+  search_all_pump(ctx);
+}
+
+/**
+ * Ask for pages until the window is full or the results are all asked for.
+ */
+static void search_all_pump(search_all_context *ctx)
+{
+  while (!ctx->failed && ctx->in_flight < search_window) {
+    search_page *page;
+    int limit = ctx->total >= 0 ? ctx->total
+                                : search_window * SEARCH_PAGE_SIZE;
+
+    if (ctx->next_offset >= limit)
+      break;
+
+    page = malloc(sizeof(search_page));
+    page->ctx = ctx;
+    page->offset = ctx->next_offset;
+    ctx->next_offset += SEARCH_PAGE_SIZE;
+    ctx->in_flight++;
+    sp_search_create(g_session, ctx->query, page->offset, SEARCH_PAGE_SIZE,
+                     0, 0, 0, 0, &search_all_page, page);
+  }
+
+  if (ctx->in_flight == 0)
+    search_all_finish(ctx);
+}
+
+static void search_all(const char *query)
+{
+  search_all_context *ctx = calloc(1, sizeof(search_all_context));
+
+  ctx->query = strdup(query);
+  ctx->total = -1;
+  ctx->started = stats_now();
+  search_all_pump(ctx);
+}
+
+/*
+ * search --batch: run the queries read from a file or stdin, one per line,
+ * with up to search_window searches in flight.  Queries are normalized
+ * with search_cache_key() and answered from the search cache when they
+ * have been run before for at least search_limit results.  One that
+ * matches a search still in flight waits for that instead of starting
+ * another.  The key is only for matching: Spotify is sent the query as
+ * written, search syntax and all.
+ *
+ * Each query gives a "search" record followed by a "track" record per
+ * result, always as ndjson and in completion order.
+ */
+typedef struct _search_batch_item search_batch_item;
+
+struct _search_batch_item {
+  char *input;
+  char *key;
+  double started;                 /* stats_now() */
+  search_batch_item *next;        /* in flight, or waiting for the same key */
+  search_batch_item *waiting;
+};
+
+static FILE *search_batch_input;
+static search_cache *search_results;
+static search_batch_item *search_batch_flight;
+#define SEARCH_LIMIT 10
+
+static int search_limit = SEARCH_LIMIT;
+static int search_batch_in_flight;
+static int search_batch_pumping;
+static int search_batch_eof;
+static int search_batch_queries;
+static int search_batch_cached;
+static int search_batch_coalesced;
+static int search_batch_failed;
+static double search_batch_started;
+
+static void search_batch_emit(search_batch_item *item,
+                              const search_result *r, const char *source,
+                              const char *error)
+{
+  int i, num_tracks;
+
+  record_begin("search");
+  record_string("input", item->input);
+  record_string("key", item->key);
+  record_string("source", source);
+  record_double("latency_ms", (stats_now() - item->started) * 1000);
+  if (error != NULL) {
+    record_string("error", error);
+    record_end();
+    search_batch_failed++;
+    return;
+  }
+  /* A cached entry may hold more results than this batch asks for */
+  num_tracks = r->num_tracks < search_limit ? r->num_tracks : search_limit;
+  record_int("total_tracks", r->total_tracks);
+  record_int("results", num_tracks);
+  record_end();
+
+  for (i = 0; i < num_tracks; i++) {
+    record_begin("track");
+    record_string("input", item->input);
+    record_int("rank", i + 1);
+    record_metadata(&r->tracks[i]);
+    record_end();
+  }
+}
+
+static void search_batch_item_free(search_batch_item *item)
+{
+  free(item->input);
+  free(item->key);
+  free(item);
+}
+
+static void search_batch_pump(void);
+
+static void search_batch_complete(sp_search *search, void *userdata)
+{
+  search_batch_item *item = userdata;
+  search_batch_item **p, *waiter;
+  const search_result *r = NULL;
+  const char *error = NULL;
+  int i;
+
+  for (p = &search_batch_flight; *p != item; p = &(*p)->next)
+    ;
+  *p = item->next;
+  search_batch_in_flight--;
+
+  if (sp_search_error(search) == SP_ERROR_OK) {
+    r = search_cache_store(search_results, item->key, search_limit, search);
+    for (i = 0; i < sp_search_num_tracks(search); i++)
+      metadata_cache_store_track(g_metadata_cache, sp_search_track(search, i));
+  } else {
+    error = sp_error_message(sp_search_error(search));
+  }
+
+  search_batch_emit(item, r, "search", error);
+  while ((waiter = item->waiting) != NULL) {
+    item->waiting = waiter->next;
+    search_batch_emit(waiter, r, "coalesced", error);
+    search_batch_item_free(waiter);
+  }
+  search_batch_item_free(item);
+  sp_search_release(search);
+  search_batch_pump();
+}
+
+static void search_batch_finish(void)
+{
+  double elapsed = stats_now() - search_batch_started;
+
+  if (search_batch_input != stdin)
+    fclose(search_batch_input);
+  search_batch_input = NULL;
+  search_cache_close(search_results);
+  search_results = NULL;
+
+  fprintf(stderr, "%d queries in %.1f s (%.1f per second): %d from the "
+                  "cache, %d coalesced, %d failed.\n",
+          search_batch_queries, elapsed,
+          elapsed > 0 ? search_batch_queries / elapsed : 0,
+          search_batch_cached, search_batch_coalesced, search_batch_failed);
+  cmd_done();
+}
+
+/**
+ * Read queries until the window is full.  Cached and coalesced queries
+ * take no room in it, so they are answered as they are read.
+ */
+static void search_batch_pump(void)
+{
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+
+  if (search_batch_pumping)
+    return;
+
+  search_batch_pumping = 1;
+  while (!search_batch_eof && search_batch_in_flight < search_window) {
+    search_batch_item *item, *flight;
+    const search_result *r;
+    char key[1024];
+
+    if ((len = getline(&line, &line_size, search_batch_input)) == -1) {
+      search_batch_eof = 1;
+      break;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = 0;
+    if (line[0] == '#' || search_cache_key(line, key, sizeof(key)) == 0)
+      continue;
+
+    search_batch_queries++;
+    item = calloc(1, sizeof(search_batch_item));
+    item->input = strdup(line);
+    item->key = strdup(key);
+    item->started = stats_now();
+
+    if ((r = search_cache_lookup(search_results, key, search_limit)) != NULL) {
+      search_batch_cached++;
+      search_batch_emit(item, r, "cache", NULL);
+      search_batch_item_free(item);
+      continue;
+    }
+
+    for (flight = search_batch_flight; flight != NULL; flight = flight->next)
+      if (strcmp(flight->key, key) == 0)
+        break;
+    if (flight != NULL) {
+      search_batch_coalesced++;
+      item->next = flight->waiting;
+      flight->waiting = item;
+      continue;
+    }
+
+    item->next = search_batch_flight;
+    search_batch_flight = item;
+    search_batch_in_flight++;
+    /* The key is only for matching, Spotify gets the query as written */
+    sp_search_create(g_session, item->input, 0, search_limit, 0, 0, 0, 0,
+                     &search_batch_complete, item);
+  }
+  search_batch_pumping = 0;
+  free(line);
+
+  if (search_batch_eof && search_batch_in_flight == 0
+      && search_batch_input != NULL)
+    search_batch_finish();
+}
+
+static int search_batch(const char *path)
+{
+  if (search_batch_input != NULL) {
+    fprintf(stderr, "A batch is running already\n");
+    return -1;
+  }
+
+  search_results = search_cache_open(SEARCH_CACHE_FILENAME,
+                                     SEARCH_CACHE_CAPACITY);
+  if (search_results == NULL)
+    return -1;
+
+  search_batch_input = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!search_batch_input) {
+    fprintf(stderr, "Can not open %s\n", path);
+    search_cache_close(search_results);
+    search_results = NULL;
+    return -1;
+  }
+
+  search_batch_eof = 0;
+  search_batch_queries = 0;
+  search_batch_cached = 0;
+  search_batch_coalesced = 0;
+  search_batch_failed = 0;
+  search_batch_started = stats_now();
+  search_batch_pump();
+  return 0;
+}
+
 /**
  *
  */
 static void search_usage(void)
 {
-  fprintf(stderr, "Usage: search <query>\n");
+  fprintf(stderr, "Usage: search <query>\n"
+                  "       search --all [--window N] <query>\n"
+                  "       search --batch FILE|- [--window N] [--limit N]\n");
 }
 
 
@@ -114,17 +569,47 @@ static void search_usage(void)
 int cmd_search(int argc, char **argv)
 {
   char query[1024];
-  int i;
+  const char *batch = NULL;
+  int i, first, all = 0;
+
+  /* Options only last for one command, unless a batch still uses them */
+  if (search_batch_input == NULL) {
+    search_window = SEARCH_WINDOW;
+    search_limit = SEARCH_LIMIT;
+  }
 
-  if (argc < 2) {
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--all") == 0)
+      all = 1;
+    else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+      search_window = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+      batch = argv[++i];
+    else if (strcmp(argv[i], "--limit") == 0 && i + 1 < argc)
+      search_limit = atoi(argv[++i]);
+    else
+      break;
+  }
+  first = i;
+
+  if (batch != NULL && first == argc && search_window >= 1
+      && search_limit >= 1)
+    return search_batch(batch);
+
+  if (batch != NULL || first >= argc || search_window < 1) {
     search_usage();
     return -1;
   }
 
   query[0] = 0;
-  for(i = 1; i < argc; i++)
+  for(i = first; i < argc; i++)
     snprintf(query + strlen(query), sizeof(query) - strlen(query), "%s%s",
-       i == 1 ? "" : " ", argv[i]);
+       i == first ? "" : " ", argv[i]);
+
+  if (all) {
+    search_all(query);
+    return 0;
+  }
 
   sp_search_create(g_session, query, 0, 100, 0, 100, 0, 100, &search_complete, NULL);
   return 0;
@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * Plain FIPS 180-1 SHA-1, which is all git needs for object names.
+ */
+
+#include <string.h>
+
+#include "sha1.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1_transform(uint32_t state[5], const unsigned char block[64])
+{
+  uint32_t w[80];
+  uint32_t a, b, c, d, e;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16
+        | (uint32_t) block[i * 4 + 2] << 8 | (uint32_t) block[i * 4 + 3];
+  for (i = 16; i < 80; i++)
+    w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+
+  for (i = 0; i < 80; i++)
+    {
+      uint32_t f, k, t;
+
+      if (i < 20)
+        {
+          f = (b & c) | (~b & d);
+          k = 0x5a827999;
+        }
+      else if (i < 40)
+        {
+          f = b ^ c ^ d;
+          k = 0x6ed9eba1;
+        }
+      else if (i < 60)
+        {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8f1bbcdc;
+        }
+      else
+        {
+          f = b ^ c ^ d;
+          k = 0xca62c1d6;
+        }
+
+      t = ROL(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = ROL(b, 30);
+      b = a;
+      a = t;
+    }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void sha1_init(sha1_context *ctx)
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xc3d2e1f0;
+  ctx->length = 0;
+  ctx->block_len = 0;
+}
+
+void sha1_update(sha1_context *ctx, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  ctx->length += len;
+
+  if (ctx->block_len > 0)
+    {
+      size_t n = 64 - ctx->block_len;
+      if (n > len)
+        n = len;
+      memcpy(ctx->block + ctx->block_len, p, n);
+      ctx->block_len += n;
+      p += n;
+      len -= n;
+      if (ctx->block_len < 64)
+        return;
+      sha1_transform(ctx->state, ctx->block);
+      ctx->block_len = 0;
+    }
+
+  while (len >= 64)
+    {
+      sha1_transform(ctx->state, p);
+      p += 64;
+      len -= 64;
+    }
+
+  memcpy(ctx->block, p, len);
+  ctx->block_len = len;
+}
+
+void sha1_final(sha1_context *ctx, unsigned char digest[SHA1_DIGEST_LENGTH])
+{
+  uint64_t bits = ctx->length * 8;
+  unsigned char length[8];
+  int i;
+
+  for (i = 0; i < 8; i++)
+    length[i] = bits >> (56 - i * 8);
+
+  sha1_update(ctx, "\x80", 1);
+  while (ctx->block_len != 56)
+    sha1_update(ctx, "", 1);
+  sha1_update(ctx, length, 8);
+
+  for (i = 0; i < 5; i++)
+    {
+      digest[i * 4] = ctx->state[i] >> 24;
+      digest[i * 4 + 1] = ctx->state[i] >> 16;
+      digest[i * 4 + 2] = ctx->state[i] >> 8;
+      digest[i * 4 + 3] = ctx->state[i];
+    }
+}
@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SHA1_H__
+#define SHA1_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_DIGEST_LENGTH 20
+
+typedef struct {
+  uint32_t state[5];
+  uint64_t length;
+  unsigned char block[64];
+  size_t block_len;
+} sha1_context;
+
+extern void sha1_init(sha1_context *ctx);
+extern void sha1_update(sha1_context *ctx, const void *data, size_t len);
+extern void sha1_final(sha1_context *ctx, unsigned char digest[SHA1_DIGEST_LENGTH]);
+
+#endif // SHA1_H__
@@ -0,0 +1,496 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "snapshot.h"
+#include "manifest.h"
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+/*
+ * Reading
+ */
+
+struct _snapshot {
+  const unsigned char *data;
+  size_t len;
+  const snapshot_header *header;
+};
+
+static int
+section_fits(snapshot *s, uint64_t offset, uint64_t count, size_t record_size)
+{
+  return offset % 8 == 0 && offset <= s->len
+      && count <= (s->len - offset) / record_size;
+}
+
+/**
+ * Map the snapshot at @path and check that its sections are where the
+ * header says.
+ *
+ * @return the snapshot, or NULL if it cannot be read or is not one
+ */
+snapshot *snapshot_open(const char *path)
+{
+  snapshot *s;
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  void *map;
+  const snapshot_header *h;
+
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snapshot_header))
+    {
+      close(fd);
+      return NULL;
+    }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  s = malloc(sizeof(snapshot));
+  s->data = map;
+  s->len = st.st_size;
+  s->header = h = map;
+
+  if (memcmp(h->magic, SNAPSHOT_MAGIC, 8) != 0
+      || h->version != SNAPSHOT_VERSION
+      || h->byte_order != SNAPSHOT_BYTE_ORDER
+      || !section_fits(s, h->folders_offset, h->num_folders, sizeof(snapshot_folder))
+      || !section_fits(s, h->playlists_offset, h->num_playlists, sizeof(snapshot_playlist))
+      || !section_fits(s, h->tracks_offset, h->num_tracks, sizeof(snapshot_track))
+      || !section_fits(s, h->strings_offset, h->strings_size, 1)
+      || h->strings_size == 0
+      || s->data[h->strings_offset + h->strings_size - 1] != 0)
+    {
+      snapshot_close(s);
+      return NULL;
+    }
+  return s;
+}
+
+void snapshot_close(snapshot *s)
+{
+  if (s == NULL)
+    return;
+  munmap((void *) s->data, s->len);
+  free(s);
+}
+
+const snapshot_header *snapshot_get_header(snapshot *s)
+{
+  return s->header;
+}
+
+const snapshot_folder *snapshot_folders(snapshot *s)
+{
+  return (const snapshot_folder *) (s->data + s->header->folders_offset);
+}
+
+const snapshot_playlist *snapshot_playlists(snapshot *s)
+{
+  return (const snapshot_playlist *) (s->data + s->header->playlists_offset);
+}
+
+/**
+ * @return the first of @playlist's tracks, or NULL if its range is corrupt
+ */
+const snapshot_track *snapshot_playlist_tracks(snapshot *s,
+    const snapshot_playlist *playlist)
+{
+  if (playlist->first_track > s->header->num_tracks
+      || playlist->num_tracks > s->header->num_tracks - playlist->first_track)
+    return NULL;
+  return (const snapshot_track *) (s->data + s->header->tracks_offset)
+      + playlist->first_track;
+}
+
+const char *snapshot_string(snapshot *s, uint32_t offset)
+{
+  if (offset >= s->header->strings_size)
+    return "";
+  return (const char *) s->data + s->header->strings_offset + offset;
+}
+
+/**
+ * @return the string after @str in the pool, e.g. a track's next artist
+ */
+const char *snapshot_next_string(snapshot *s, const char *str)
+{
+  const char *end = (const char *) s->data + s->header->strings_offset
+      + s->header->strings_size;
+  const char *next = str + strlen(str) + 1;
+
+  return next < end ? next : "";
+}
+
+/*
+ * Writing
+ */
+
+typedef struct {
+  uint32_t offset;
+  uint32_t len;           /* including the final NUL, 0 for a free slot */
+} pool_slot;
+
+/* NUL-terminated strings, each stored once, and a hash table of them */
+typedef struct {
+  char *strings;
+  size_t len;
+  size_t size;
+  pool_slot *slots;
+  uint32_t num_slots;
+  uint32_t num_strings;
+} string_pool;
+
+typedef struct {
+  snapshot_playlist record;
+  snapshot_track *tracks;
+  uint32_t tracks_size;
+} builder_playlist;
+
+struct _snapshot_builder {
+  snapshot_folder *folders;
+  uint32_t num_folders;
+  uint32_t folders_size;
+
+  builder_playlist *playlists;
+  uint32_t num_playlists;
+  uint32_t playlists_size;
+
+  /* Strings in the order they were added, which is completion order */
+  string_pool pool;
+};
+
+static void
+pool_init(string_pool *pool)
+{
+  pool->size = 65536;
+  pool->strings = malloc(pool->size);
+  pool->strings[0] = 0;   /* offset 0 is the empty string */
+  pool->len = 1;
+  pool->num_slots = 4096;
+  pool->slots = calloc(pool->num_slots, sizeof(pool_slot));
+  pool->num_strings = 0;
+}
+
+static void
+pool_free(string_pool *pool)
+{
+  free(pool->strings);
+  free(pool->slots);
+}
+
+snapshot_builder *snapshot_builder_new(void)
+{
+  snapshot_builder *b = calloc(1, sizeof(snapshot_builder));
+
+  pool_init(&b->pool);
+  return b;
+}
+
+void snapshot_builder_free(snapshot_builder *b)
+{
+  uint32_t i;
+
+  if (b == NULL)
+    return;
+  for (i = 0; i < b->num_playlists; i++)
+    free(b->playlists[i].tracks);
+  free(b->playlists);
+  free(b->folders);
+  pool_free(&b->pool);
+  free(b);
+}
+
+static uint32_t
+slot_for(string_pool *pool, const char *data, size_t len)
+{
+  uint32_t i = (uint32_t) manifest_hash(data, len) & (pool->num_slots - 1);
+
+  while (pool->slots[i].len != 0
+      && (pool->slots[i].len != len
+          || memcmp(pool->strings + pool->slots[i].offset, data, len) != 0))
+    i = (i + 1) & (pool->num_slots - 1);
+  return i;
+}
+
+/**
+ * Put @len bytes, ending in a NUL, into @pool unless they are in it.
+ * An artist list is several strings interned as one.
+ *
+ * @return their offset
+ */
+static uint32_t
+intern(string_pool *pool, const char *data, size_t len)
+{
+  uint32_t i;
+  pool_slot *slot;
+
+  if (len <= 1)
+    return 0;
+
+  i = slot_for(pool, data, len);
+  if (pool->slots[i].len != 0)
+    return pool->slots[i].offset;
+
+  if (pool->len + len > pool->size)
+    {
+      while (pool->len + len > pool->size)
+        pool->size *= 2;
+      pool->strings = realloc(pool->strings, pool->size);
+    }
+  slot = &pool->slots[i];
+  slot->offset = pool->len;
+  slot->len = len;
+  memcpy(pool->strings + slot->offset, data, len);
+  pool->len += len;
+  pool->num_strings ++;
+
+  if (pool->num_strings * 2 > pool->num_slots)
+    {
+      pool_slot *old_slots = pool->slots;
+      uint32_t old_num_slots = pool->num_slots;
+      uint32_t offset = slot->offset;
+
+      pool->num_slots *= 2;
+      pool->slots = calloc(pool->num_slots, sizeof(pool_slot));
+      for (i = 0; i < old_num_slots; i++)
+        if (old_slots[i].len != 0)
+          pool->slots[slot_for(pool, pool->strings + old_slots[i].offset,
+              old_slots[i].len)] = old_slots[i];
+      free(old_slots);
+      return offset;
+    }
+  return slot->offset;
+}
+
+static uint32_t
+intern_string(snapshot_builder *b, const char *str)
+{
+  return str != NULL ? intern(&b->pool, str, strlen(str) + 1) : 0;
+}
+
+/**
+ * Move the string at @offset in the builder's pool, or the list of @count
+ * strings there, to @ordered.
+ *
+ * @return its offset in @ordered
+ */
+static uint32_t
+reintern(snapshot_builder *b, string_pool *ordered, uint32_t offset,
+    int count)
+{
+  const char *data = b->pool.strings + offset;
+  size_t len = 0;
+
+  while (count-- > 0)
+    len += strlen(data + len) + 1;
+  return intern(ordered, data, len);
+}
+
+/**
+ * Add a folder below @parent (SNAPSHOT_NONE for the top).
+ *
+ * @return its index
+ */
+uint32_t snapshot_builder_add_folder(snapshot_builder *b, uint64_t id,
+    const char *name, uint32_t parent)
+{
+  snapshot_folder *f;
+
+  if (b->num_folders == b->folders_size)
+    {
+      b->folders_size = b->folders_size ? b->folders_size * 2 : 16;
+      b->folders = realloc(b->folders, b->folders_size * sizeof(snapshot_folder));
+    }
+  f = &b->folders[b->num_folders];
+  f->id = id;
+  f->name = intern_string(b, name);
+  f->parent = parent;
+  return b->num_folders++;
+}
+
+/**
+ * Reserve the next playlist of the container, in @folder.  Its name and
+ * tracks can be filled in later, in any order relative to other playlists.
+ *
+ * @return its index
+ */
+uint32_t snapshot_builder_add_playlist(snapshot_builder *b, uint32_t folder)
+{
+  builder_playlist *p;
+
+  if (b->num_playlists == b->playlists_size)
+    {
+      b->playlists_size = b->playlists_size ? b->playlists_size * 2 : 64;
+      b->playlists = realloc(b->playlists,
+          b->playlists_size * sizeof(builder_playlist));
+    }
+  p = &b->playlists[b->num_playlists];
+  memset(p, 0, sizeof(builder_playlist));
+  p->record.folder = folder;
+  p->record.position = b->num_playlists;
+  return b->num_playlists++;
+}
+
+void snapshot_builder_set_playlist(snapshot_builder *b,
+    uint32_t playlist, const char *name, const char *uri)
+{
+  builder_playlist *p = &b->playlists[playlist];
+
+  p->record.name = intern_string(b, name);
+  p->record.uri = intern_string(b, uri);
+  p->record.num_tracks = 0;
+}
+
+void snapshot_builder_add_track(snapshot_builder *b, uint32_t playlist,
+    const char *uri, const char *name, const char *album,
+    const char **artists, int num_artists, uint32_t duration, uint16_t flags)
+{
+  builder_playlist *p = &b->playlists[playlist];
+  snapshot_track *t;
+  char stack_list[512];
+  char *list = stack_list;
+  size_t list_len = 0, needed = 0;
+  int i;
+
+  if (p->record.num_tracks == p->tracks_size)
+    {
+      p->tracks_size = p->tracks_size ? p->tracks_size * 2 : 64;
+      p->tracks = realloc(p->tracks, p->tracks_size * sizeof(snapshot_track));
+    }
+
+  for (i = 0; i < num_artists; i++)
+    needed += strlen(artists[i]) + 1;
+  if (needed > sizeof(stack_list))
+    list = malloc(needed);
+  for (i = 0; i < num_artists; i++)
+    {
+      size_t len = strlen(artists[i]) + 1;
+      memcpy(list + list_len, artists[i], len);
+      list_len += len;
+    }
+
+  t = &p->tracks[p->record.num_tracks++];
+  t->uri = intern_string(b, uri);
+  t->name = intern_string(b, name);
+  t->album = intern_string(b, album);
+  t->artists = intern(&b->pool, list, list_len);
+  t->duration = duration;
+  t->num_artists = num_artists;
+  t->flags = flags;
+
+  if (list != stack_list)
+    free(list);
+}
+
+/**
+ * Lay the snapshot out in one malloc()ed buffer, ready to be written.
+ * Strings are pooled anew in container order, so the same library always
+ * renders the same bytes however its playlists completed.
+ */
+void *snapshot_builder_render(snapshot_builder *b, size_t *len)
+{
+  snapshot_header *h;
+  unsigned char *data;
+  snapshot_folder *folders;
+  snapshot_playlist *playlists;
+  snapshot_track *tracks;
+  string_pool ordered;
+  uint32_t i, j, num_tracks = 0;
+
+  for (i = 0; i < b->num_playlists; i++)
+    num_tracks += b->playlists[i].record.num_tracks;
+
+  *len = ALIGN8(sizeof(snapshot_header));
+  data = calloc(1, *len + ALIGN8(b->num_folders * sizeof(snapshot_folder))
+      + ALIGN8(b->num_playlists * sizeof(snapshot_playlist))
+      + ALIGN8(num_tracks * sizeof(snapshot_track)) + b->pool.len);
+  h = (snapshot_header *) data;
+
+  memcpy(h->magic, SNAPSHOT_MAGIC, 8);
+  h->version = SNAPSHOT_VERSION;
+  h->byte_order = SNAPSHOT_BYTE_ORDER;
+  h->num_folders = b->num_folders;
+  h->num_playlists = b->num_playlists;
+  h->num_tracks = num_tracks;
+
+  pool_init(&ordered);
+
+  h->folders_offset = *len;
+  folders = (snapshot_folder *) (data + *len);
+  for (i = 0; i < b->num_folders; i++)
+    {
+      folders[i] = b->folders[i];
+      folders[i].name = reintern(b, &ordered, b->folders[i].name, 1);
+    }
+  *len += ALIGN8(b->num_folders * sizeof(snapshot_folder));
+
+  h->playlists_offset = *len;
+  playlists = (snapshot_playlist *) (data + *len);
+  *len += ALIGN8(b->num_playlists * sizeof(snapshot_playlist));
+
+  h->tracks_offset = *len;
+  tracks = (snapshot_track *) (data + *len);
+  *len += ALIGN8(num_tracks * sizeof(snapshot_track));
+
+  for (num_tracks = 0, i = 0; i < b->num_playlists; i++)
+    {
+      builder_playlist *p = &b->playlists[i];
+
+      playlists[i] = p->record;
+      playlists[i].name = reintern(b, &ordered, p->record.name, 1);
+      playlists[i].uri = reintern(b, &ordered, p->record.uri, 1);
+      playlists[i].first_track = num_tracks;
+      for (j = 0; j < p->record.num_tracks; j++)
+        {
+          snapshot_track *t = &tracks[num_tracks++];
+
+          *t = p->tracks[j];
+          t->uri = reintern(b, &ordered, t->uri, 1);
+          t->name = reintern(b, &ordered, t->name, 1);
+          t->album = reintern(b, &ordered, t->album, 1);
+          t->artists = reintern(b, &ordered, t->artists, t->num_artists);
+        }
+    }
+
+  /* Strings of a playlist that was set twice may have dropped out */
+  h->strings_size = ordered.len;
+  h->strings_offset = *len;
+  memcpy(data + *len, ordered.strings, ordered.len);
+  *len += ordered.len;
+  pool_free(&ordered);
+  return data;
+}
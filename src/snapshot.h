@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SNAPSHOT_H__
+#define SNAPSHOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A binary copy of a snapshot tree, laid out to be mmap()ed and read in
+ * place.
+ *
+ * The file is a header followed by four sections, each 8-byte aligned:
+ * the folder tree, one record per playlist in container order, the
+ * fixed-width track records of all playlists back to back, and a pool of
+ * NUL-terminated strings that every record refers to by offset.  A
+ * playlist's tracks are num_tracks records starting at first_track.
+ * Strings are interned, so an album or artist name is stored once however
+ * many tracks share it, and pooled in the order of the records that first
+ * refer to them.
+ *
+ * Integers are in the byte order of the host that wrote the file;
+ * snapshot_open() refuses files from a host of the other byte order.
+ */
+#define SNAPSHOT_FILENAME ".git-spot-snapshot"
+
+#define SNAPSHOT_MAGIC "GITSPOT\0"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+/* No folder, i.e. the top of the container */
+#define SNAPSHOT_NONE 0xffffffffu
+
+/* Set on tracks whose artists or album were not loaded yet */
+#define SNAPSHOT_TRACK_INCOMPLETE 0x0001
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t num_folders;
+  uint32_t num_playlists;
+  uint32_t num_tracks;
+  uint32_t strings_size;
+  uint64_t folders_offset;
+  uint64_t playlists_offset;
+  uint64_t tracks_offset;
+  uint64_t strings_offset;
+} snapshot_header;
+
+typedef struct {
+  uint64_t id;
+  uint32_t name;
+  uint32_t parent;        /* folder index or SNAPSHOT_NONE */
+} snapshot_folder;
+
+typedef struct {
+  uint32_t name;
+  uint32_t uri;
+  uint32_t folder;        /* folder index or SNAPSHOT_NONE */
+  uint32_t position;      /* ordinal among the container's playlists */
+  uint32_t first_track;
+  uint32_t num_tracks;
+} snapshot_playlist;
+
+typedef struct {
+  uint32_t uri;
+  uint32_t name;
+  uint32_t album;
+  uint32_t artists;       /* num_artists consecutive strings */
+  uint32_t duration;      /* milliseconds */
+  uint16_t num_artists;
+  uint16_t flags;
+} snapshot_track;
+
+/*
+ * Reading
+ */
+typedef struct _snapshot snapshot;
+
+extern snapshot *snapshot_open(const char *path);
+extern void snapshot_close(snapshot *s);
+
+extern const snapshot_header *snapshot_get_header(snapshot *s);
+extern const snapshot_folder *snapshot_folders(snapshot *s);
+extern const snapshot_playlist *snapshot_playlists(snapshot *s);
+extern const snapshot_track *snapshot_playlist_tracks(snapshot *s,
+    const snapshot_playlist *playlist);
+extern const char *snapshot_string(snapshot *s, uint32_t offset);
+extern const char *snapshot_next_string(snapshot *s, const char *str);
+
+/*
+ * Writing
+ */
+typedef struct _snapshot_builder snapshot_builder;
+
+extern snapshot_builder *snapshot_builder_new(void);
+extern void snapshot_builder_free(snapshot_builder *b);
+
+extern uint32_t snapshot_builder_add_folder(snapshot_builder *b, uint64_t id,
+    const char *name, uint32_t parent);
+extern uint32_t snapshot_builder_add_playlist(snapshot_builder *b,
+    uint32_t folder);
+extern void snapshot_builder_set_playlist(snapshot_builder *b,
+    uint32_t playlist, const char *name, const char *uri);
+extern void snapshot_builder_add_track(snapshot_builder *b, uint32_t playlist,
+    const char *uri, const char *name, const char *album,
+    const char **artists, int num_artists, uint32_t duration, uint16_t flags);
+extern void *snapshot_builder_render(snapshot_builder *b, size_t *len);
+
+#endif // SNAPSHOT_H__
@@ -23,6 +23,7 @@
 
 #include "git-spot.h"
 #include "cmd.h"
+#include "record.h"
 
 static const char *relationtypes[] = {
   "Unknown",
@@ -43,6 +44,13 @@ int cmd_friends(int argc, char **argv)
     sp_user *u = sp_session_friend(g_session, i);
     sp_relation_type rt = sp_user_relation_type(g_session, u);
 
+    if (g_output_format == OUTPUT_NDJSON) {
+      record_begin("user");
+      record_user(u);
+      record_end();
+      continue;
+    }
+
     printf("  %-20s [%s]\n", sp_user_canonical_name(u), relationtypes[rt]);
     printf("\tSpotify displayname: %s\n", sp_user_display_name(u));
     printf("\t           Realname: %s\n", sp_user_full_name(u));
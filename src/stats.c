@@ -0,0 +1,342 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+typedef struct {
+  char *uri;
+  char *name;
+  int num_tracks;
+  double requested;
+  double loaded;
+  double ready;
+  double written;
+  size_t bytes;
+} stats_playlist;
+
+typedef struct {
+  char *name;
+  int num_playlists;
+  double requested;
+  double loaded;
+  double finished;
+} stats_container;
+
+struct _stats {
+  double start;
+  stats_playlist *playlists;
+  int num_playlists;
+  int playlists_size;
+  stats_container *containers;
+  int num_containers;
+  int containers_size;
+  size_t bytes;
+  int files_written;
+};
+
+/* The stages of a playlist, each from one timestamp to the next */
+typedef enum {
+  STATS_LOAD,
+  STATS_METADATA,
+  STATS_WRITE,
+  STATS_TOTAL,
+  STATS_NUM_STAGES
+} stats_stage;
+
+static const char *stage_names[STATS_NUM_STAGES] = {
+  "load",
+  "metadata",
+  "write",
+  "total"
+};
+
+double stats_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+stats *stats_new(void)
+{
+  stats *s = calloc(1, sizeof(stats));
+
+  s->start = stats_now();
+  return s;
+}
+
+void stats_free(stats *s)
+{
+  int i;
+
+  if (s == NULL)
+    return;
+  for (i = 0; i < s->num_playlists; i++)
+    {
+      free(s->playlists[i].uri);
+      free(s->playlists[i].name);
+    }
+  for (i = 0; i < s->num_containers; i++)
+    free(s->containers[i].name);
+  free(s->playlists);
+  free(s->containers);
+  free(s);
+}
+
+void stats_add_playlist(stats *s, const char *uri, const char *name,
+    int num_tracks, double requested, double loaded, double ready,
+    double written, size_t bytes)
+{
+  stats_playlist *p;
+
+  if (s->num_playlists == s->playlists_size)
+    {
+      s->playlists_size = s->playlists_size ? s->playlists_size * 2 : 256;
+      s->playlists = realloc(s->playlists,
+          s->playlists_size * sizeof(stats_playlist));
+    }
+  p = &s->playlists[s->num_playlists++];
+  p->uri = strdup(uri);
+  p->name = strdup(name);
+  p->num_tracks = num_tracks;
+  p->requested = requested;
+  p->loaded = loaded;
+  p->ready = ready;
+  p->written = written;
+  p->bytes = bytes;
+
+  s->bytes += bytes;
+  if (bytes > 0)
+    s->files_written ++;
+}
+
+void stats_add_container(stats *s, const char *name,
+    int num_playlists, double requested, double loaded, double finished)
+{
+  stats_container *c;
+
+  if (s->num_containers == s->containers_size)
+    {
+      s->containers_size = s->containers_size ? s->containers_size * 2 : 8;
+      s->containers = realloc(s->containers,
+          s->containers_size * sizeof(stats_container));
+    }
+  c = &s->containers[s->num_containers++];
+  c->name = strdup(name);
+  c->num_playlists = num_playlists;
+  c->requested = requested;
+  c->loaded = loaded;
+  c->finished = finished;
+}
+
+static double stage_seconds(const stats_playlist *p, stats_stage stage)
+{
+  switch (stage)
+    {
+    case STATS_LOAD:
+      return p->loaded - p->requested;
+    case STATS_METADATA:
+      return p->ready - p->loaded;
+    case STATS_WRITE:
+      return p->written - p->ready;
+    default:
+      return p->written - p->requested;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+
+  return da < db ? -1 : da > db;
+}
+
+/* Nearest rank, over @n sorted values */
+static double percentile(const double *sorted, int n, int p)
+{
+  int rank = (n * p + 99) / 100;
+
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void render_stage(stats *s, stats_stage stage, double *values,
+    json_buffer *b)
+{
+  double sum = 0;
+  int i, n = s->num_playlists;
+
+  for (i = 0; i < n; i++)
+    {
+      values[i] = stage_seconds(&s->playlists[i], stage) * 1000;
+      sum += values[i];
+    }
+  qsort(values, n, sizeof(double), compare_doubles);
+
+  json_append_string(b, stage_names[stage]);
+  json_append_raw(b, ": {\"count\": ");
+  json_append_int(b, n);
+  if (n > 0)
+    {
+      json_append_raw(b, ", \"mean_ms\": ");
+      json_append_double(b, sum / n);
+      json_append_raw(b, ", \"p50_ms\": ");
+      json_append_double(b, percentile(values, n, 50));
+      json_append_raw(b, ", \"p95_ms\": ");
+      json_append_double(b, percentile(values, n, 95));
+      json_append_raw(b, ", \"p99_ms\": ");
+      json_append_double(b, percentile(values, n, 99));
+      json_append_raw(b, ", \"max_ms\": ");
+      json_append_double(b, values[n - 1]);
+    }
+  json_append_raw(b, "}");
+}
+
+static int compare_total(const void *a, const void *b)
+{
+  double ta = stage_seconds(*(stats_playlist * const *) a, STATS_TOTAL);
+  double tb = stage_seconds(*(stats_playlist * const *) b, STATS_TOTAL);
+
+  return ta > tb ? -1 : ta < tb;
+}
+
+static void render_slowest(stats *s, json_buffer *b)
+{
+  stats_playlist **sorted = malloc((s->num_playlists + 1) * sizeof(stats_playlist *));
+  stats_stage stage;
+  int i;
+
+  for (i = 0; i < s->num_playlists; i++)
+    sorted[i] = &s->playlists[i];
+  qsort(sorted, s->num_playlists, sizeof(stats_playlist *), compare_total);
+
+  json_append_raw(b, "\"slowest\": [");
+  for (i = 0; i < s->num_playlists && i < STATS_SLOWEST; i++)
+    {
+      json_append_raw(b, i > 0 ? ",\n  {\"uri\": " : "\n  {\"uri\": ");
+      json_append_string(b, sorted[i]->uri);
+      json_append_raw(b, ", \"name\": ");
+      json_append_string(b, sorted[i]->name);
+      json_append_raw(b, ", \"tracks\": ");
+      json_append_int(b, sorted[i]->num_tracks);
+      json_append_raw(b, ", \"bytes\": ");
+      json_append_int(b, sorted[i]->bytes);
+      for (stage = 0; stage < STATS_NUM_STAGES; stage++)
+        {
+          json_append_raw(b, ", \"");
+          json_append_raw(b, stage_names[stage]);
+          json_append_raw(b, "_ms\": ");
+          json_append_double(b, stage_seconds(sorted[i], stage) * 1000);
+        }
+      json_append_raw(b, "}");
+    }
+  json_append_raw(b, "]");
+  free(sorted);
+}
+
+static void render_containers(stats *s, json_buffer *b)
+{
+  int i;
+
+  json_append_raw(b, "\"containers\": [");
+  for (i = 0; i < s->num_containers; i++)
+    {
+      stats_container *c = &s->containers[i];
+
+      json_append_raw(b, i > 0 ? ",\n  {\"name\": " : "\n  {\"name\": ");
+      json_append_string(b, c->name);
+      json_append_raw(b, ", \"playlists\": ");
+      json_append_int(b, c->num_playlists);
+      json_append_raw(b, ", \"load_ms\": ");
+      json_append_double(b, (c->loaded - c->requested) * 1000);
+      json_append_raw(b, ", \"total_ms\": ");
+      json_append_double(b, (c->finished - c->requested) * 1000);
+      json_append_raw(b, "}");
+    }
+  json_append_raw(b, "]");
+}
+
+/**
+ * Render everything recorded since stats_new() as a JSON document.
+ */
+void stats_render(stats *s, json_buffer *b)
+{
+  double elapsed = stats_now() - s->start;
+  double *values = malloc((s->num_playlists + 1) * sizeof(double));
+  stats_stage stage;
+
+  json_append_raw(b, "{\"seconds\": ");
+  json_append_double(b, elapsed);
+  json_append_raw(b, ",\n\"playlists\": ");
+  json_append_int(b, s->num_playlists);
+  json_append_raw(b, ",\n\"playlists_per_second\": ");
+  json_append_double(b, elapsed > 0 ? s->num_playlists / elapsed : 0);
+  json_append_raw(b, ",\n\"files_written\": ");
+  json_append_int(b, s->files_written);
+  json_append_raw(b, ",\n\"bytes_written\": ");
+  json_append_int(b, s->bytes);
+  json_append_raw(b, ",\n\"bytes_per_second\": ");
+  json_append_double(b, elapsed > 0 ? s->bytes / elapsed : 0);
+
+  json_append_raw(b, ",\n\"latency\": {");
+  for (stage = 0; stage < STATS_NUM_STAGES; stage++)
+    {
+      json_append_raw(b, stage > 0 ? ",\n  " : "\n  ");
+      render_stage(s, stage, values, b);
+    }
+  json_append_raw(b, "},\n");
+
+  render_containers(s, b);
+  json_append_raw(b, ",\n");
+  render_slowest(s, b);
+  json_append_raw(b, "}\n");
+  free(values);
+}
+
+void stats_print_summary(stats *s)
+{
+  double elapsed = stats_now() - s->start;
+  double *totals = malloc((s->num_playlists + 1) * sizeof(double));
+  int i;
+
+  for (i = 0; i < s->num_playlists; i++)
+    totals[i] = stage_seconds(&s->playlists[i], STATS_TOTAL);
+  qsort(totals, s->num_playlists, sizeof(double), compare_doubles);
+
+  printf("Saved %d playlists in %.1f s, %.1f per second, %zu bytes written.\n",
+      s->num_playlists, elapsed,
+      elapsed > 0 ? s->num_playlists / elapsed : 0, s->bytes);
+  if (s->num_playlists > 0)
+    printf("Playlist latency: p50 %.0f ms, p95 %.0f ms, p99 %.0f ms.\n",
+        percentile(totals, s->num_playlists, 50) * 1000,
+        percentile(totals, s->num_playlists, 95) * 1000,
+        percentile(totals, s->num_playlists, 99) * 1000);
+  free(totals);
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef STATS_H__
+#define STATS_H__
+
+#include <stddef.h>
+
+#include "json.h"
+
+/**
+ * Where the time of a save run goes.  Each playlist records when it was
+ * requested, when it had loaded, when its metadata was ready and when its
+ * file was written; each container when it was requested, loaded and
+ * finished.  stats_render() turns that into latency percentiles for every
+ * stage, throughput figures and the slowest playlists, which is what the
+ * concurrency settings of "save" are tuned with.
+ *
+ * Times are seconds on a monotonic clock, from stats_now().
+ */
+#define STATS_SLOWEST 10
+
+typedef struct _stats stats;
+
+extern stats *stats_new(void);
+extern void stats_free(stats *s);
+extern double stats_now(void);
+
+extern void stats_add_playlist(stats *s, const char *uri, const char *name,
+    int num_tracks, double requested, double loaded, double ready,
+    double written, size_t bytes);
+extern void stats_add_container(stats *s, const char *name,
+    int num_playlists, double requested, double loaded, double finished);
+
+extern void stats_render(stats *s, json_buffer *b);
+extern void stats_print_summary(stats *s);
+
+#endif // STATS_H__
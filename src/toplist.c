@@ -25,12 +25,21 @@
 
 #include "git-spot.h"
 #include "cmd.h"
+#include "record.h"
 
 /**
  *
  */
 static void print_album(int index, sp_album *album)
 {
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("album");
+    record_int("rank", index);
+    record_album(album);
+    record_end();
+    return;
+  }
+
   printf("  Album %3d: \"%s\" by \"%s\"\n", index, sp_album_name(album), 
          sp_artist_name(sp_album_artist(album)));
 }
@@ -40,6 +49,14 @@ static void print_album(int index, sp_album *album)
  */
 static void print_artist(int index, sp_artist *artist)
 {
+  if (g_output_format == OUTPUT_NDJSON) {
+    record_begin("artist");
+    record_int("rank", index);
+    record_artist(artist);
+    record_end();
+    return;
+  }
+
   printf("  Artist %3d: \"%s\"\n", index, sp_artist_name(artist));
 }
 
@@ -63,6 +80,13 @@ static void got_toplist(sp_toplistbrowse *result, void *userdata)
     print_album(i + 1, sp_toplistbrowse_album(result, i));
 
   for(i = 0; i < sp_toplistbrowse_num_tracks(result); i++) {
+    if (g_output_format == OUTPUT_NDJSON) {
+      record_begin("track");
+      record_int("rank", i + 1);
+      record_track(sp_toplistbrowse_track(result, i));
+      record_end();
+      continue;
+    }
     printf("%3d: ", i + 1);
     print_track(sp_toplistbrowse_track(result, i));
   }
@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "track-table.h"
+#include "manifest.h"
+
+typedef struct _track_table_entry track_table_entry;
+
+struct _track_table_entry {
+  track_table_entry *next;
+  char *uri;
+  char *record;       /* a rendered JSON object */
+  size_t len;
+  int complete;       /* no metadata was missing when it was rendered */
+};
+
+struct _track_table {
+  track_table_entry **buckets;
+  unsigned int num_buckets;
+  int num_entries;
+};
+
+static unsigned int
+track_table_bucket(track_table *t, const char *uri)
+{
+  return (unsigned int) manifest_hash(uri, strlen(uri)) & (t->num_buckets - 1);
+}
+
+track_table *track_table_new(void)
+{
+  track_table *t = malloc(sizeof(track_table));
+
+  t->num_buckets = 1024;
+  t->num_entries = 0;
+  t->buckets = calloc(t->num_buckets, sizeof(track_table_entry *));
+  return t;
+}
+
+void track_table_free(track_table *t)
+{
+  unsigned int i;
+
+  if (t == NULL)
+    return;
+
+  for (i = 0; i < t->num_buckets; i++)
+    {
+      track_table_entry *e = t->buckets[i];
+      while (e != NULL)
+        {
+          track_table_entry *next = e->next;
+          free(e->uri);
+          free(e->record);
+          free(e);
+          e = next;
+        }
+    }
+  free(t->buckets);
+  free(t);
+}
+
+static void track_table_grow(track_table *t)
+{
+  track_table_entry **old_buckets = t->buckets;
+  unsigned int old_num_buckets = t->num_buckets;
+  unsigned int i;
+
+  t->num_buckets *= 2;
+  t->buckets = calloc(t->num_buckets, sizeof(track_table_entry *));
+
+  for (i = 0; i < old_num_buckets; i++)
+    {
+      track_table_entry *e = old_buckets[i];
+      while (e != NULL)
+        {
+          track_table_entry *next = e->next;
+          unsigned int b = track_table_bucket(t, e->uri);
+          e->next = t->buckets[b];
+          t->buckets[b] = e;
+          e = next;
+        }
+    }
+  free(old_buckets);
+}
+
+static track_table_entry *
+track_table_lookup(track_table *t, const char *uri)
+{
+  track_table_entry *e;
+
+  for (e = t->buckets[track_table_bucket(t, uri)]; e != NULL; e = e->next)
+    if (strcmp(e->uri, uri) == 0)
+      return e;
+  return NULL;
+}
+
+/**
+ * @return whether a record for @uri would be kept, i.e. there is none yet
+ * or the one there is was rendered with metadata missing.  Lets the caller
+ * skip rendering tracks that are already in the table.
+ */
+int track_table_wants(track_table *t, const char *uri)
+{
+  track_table_entry *e = track_table_lookup(t, uri);
+
+  return e == NULL || !e->complete;
+}
+
+/**
+ * Record the rendered metadata of @uri.  A complete record replaces an
+ * incomplete one; otherwise the first record wins.
+ */
+void track_table_set(track_table *t, const char *uri,
+    const char *record, size_t len, int complete)
+{
+  track_table_entry *e = track_table_lookup(t, uri);
+
+  if (e != NULL && (e->complete || !complete))
+    return;
+
+  if (e == NULL)
+    {
+      unsigned int b;
+
+      if (t->num_entries >= t->num_buckets)
+        track_table_grow(t);
+
+      e = malloc(sizeof(track_table_entry));
+      e->uri = strdup(uri);
+      e->record = NULL;
+      b = track_table_bucket(t, uri);
+      e->next = t->buckets[b];
+      t->buckets[b] = e;
+      t->num_entries ++;
+    }
+
+  free(e->record);
+  e->record = strndup(record, len);
+  e->len = len;
+  e->complete = complete;
+}
+
+int track_table_size(track_table *t)
+{
+  return t->num_entries;
+}
+
+static int
+entry_compare(const void *a, const void *b)
+{
+  return strcmp((*(track_table_entry * const *) a)->uri,
+      (*(track_table_entry * const *) b)->uri);
+}
+
+/**
+ * Render the table as one JSON object mapping URIs to records, one track
+ * per line, sorted by URI.
+ */
+void track_table_render(track_table *t, json_buffer *b)
+{
+  track_table_entry **sorted = malloc((t->num_entries + 1) * sizeof(track_table_entry *));
+  track_table_entry *e;
+  unsigned int i;
+  int n = 0;
+
+  for (i = 0; i < t->num_buckets; i++)
+    for (e = t->buckets[i]; e != NULL; e = e->next)
+      sorted[n++] = e;
+  qsort(sorted, n, sizeof(track_table_entry *), entry_compare);
+
+  json_append_raw(b, "{\"tracks\": {\n");
+  for (i = 0; i < (unsigned int) n; i++)
+    {
+      if (i > 0)
+        json_append_raw(b, ",\n");
+      json_append_string(b, sorted[i]->uri);
+      json_append_raw(b, ": ");
+      json_append(b, sorted[i]->record, sorted[i]->len);
+    }
+  json_append_raw(b, "\n}}\n");
+
+  free(sorted);
+}
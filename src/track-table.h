@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef TRACK_TABLE_H__
+#define TRACK_TABLE_H__
+
+#include <stddef.h>
+
+#include "json.h"
+
+/**
+ * The metadata of every track a save run has seen, each track once.
+ *
+ * With a track table, playlist files list only the URIs of their tracks
+ * and the names, artists, albums and durations are written once per run
+ * to TRACK_TABLE_FILENAME in the save directory.  The table is rendered
+ * sorted by URI, so the same set of tracks always gives the same bytes.
+ */
+#define TRACK_TABLE_FILENAME ".git-spot-tracks.json"
+
+typedef struct _track_table track_table;
+
+extern track_table *track_table_new(void);
+extern void track_table_free(track_table *t);
+
+extern int track_table_wants(track_table *t, const char *uri);
+extern void track_table_set(track_table *t, const char *uri,
+    const char *record, size_t len, int complete);
+extern int track_table_size(track_table *t);
+extern void track_table_render(track_table *t, json_buffer *b);
+
+#endif // TRACK_TABLE_H__
@@ -0,0 +1,368 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct _uring {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sqe_tail;      /* queued here, not yet handed to the kernel */
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+      NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg,
+    unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static struct io_uring_sqe *uring_get_sqe(uring *u, int opcode, int link,
+    uint64_t user_data)
+{
+  struct io_uring_sqe *sqe;
+  unsigned index = u->sqe_tail & u->sq_mask;
+
+  sqe = &u->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->user_data = user_data;
+  if (link == URING_LINK)
+    sqe->flags |= IOSQE_IO_LINK;
+  else if (link == URING_HARDLINK)
+    sqe->flags |= IOSQE_IO_HARDLINK;
+  u->sq_array[index] = index;
+  u->sqe_tail ++;
+  return sqe;
+}
+
+/* The requests uring_new() makes sure the kernel has */
+static const int uring_needed_ops[] = {
+  IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE,
+  IORING_OP_RENAMEAT, IORING_OP_UNLINKAT, IORING_OP_FSYNC,
+};
+
+/**
+ * Check that the kernel can do what durable.c asks of it: the requests
+ * above, and writing to a file opened into a fixed slot by the same chain.
+ */
+static int uring_probe(uring *u)
+{
+  size_t size = sizeof(struct io_uring_probe)
+      + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  uint64_t user_data;
+  int i, result, ok = 1;
+
+  if (sys_io_uring_register(u->fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    ok = 0;
+  for (i = 0; ok && i < sizeof(uring_needed_ops) / sizeof(int); i++)
+    ok = uring_needed_ops[i] <= probe->last_op
+        && (probe->ops[uring_needed_ops[i]].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  if (!ok)
+    return -1;
+
+  /* Older kernels look fixed files up before the open has filled them */
+  uring_openat(u, "/dev/null", O_WRONLY, 0, 0, URING_LINK, 0);
+  uring_write(u, 0, "", 1, URING_HARDLINK, 0);
+  uring_close(u, 0, URING_NO_LINK, 0);
+  if (uring_submit(u, 3) < 0)
+    return -1;
+  for (i = 0; i < 3; i++)
+    if (uring_next_completion(u, &user_data, &result) != 1 || result < 0)
+      ok = 0;
+  return ok ? 0 : -1;
+}
+
+/**
+ * Set up a ring of @entries requests and @num_slots fixed file slots.
+ *
+ * @return NULL if io_uring is not available
+ */
+uring *uring_new(unsigned entries, unsigned num_slots)
+{
+  struct io_uring_params p;
+  uring *u = calloc(1, sizeof(uring));
+  int *files;
+  unsigned i;
+
+  memset(&p, 0, sizeof(p));
+  u->fd = sys_io_uring_setup(entries, &p);
+  if (u->fd < 0)
+    {
+      free(u);
+      return NULL;
+    }
+
+  u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if (u->cq_ring_size > u->sq_ring_size)
+        u->sq_ring_size = u->cq_ring_size;
+      u->cq_ring_size = 0;
+    }
+  u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  u->cq_ring = u->cq_ring_size == 0 ? u->sq_ring
+    : mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED
+      || u->sqes == MAP_FAILED)
+    {
+      if (u->sqes == MAP_FAILED)
+        u->sqes = NULL;
+      if (u->cq_ring == MAP_FAILED)
+        u->cq_ring = NULL;
+      if (u->sq_ring == MAP_FAILED)
+        u->sq_ring = NULL;
+      uring_free(u);
+      return NULL;
+    }
+
+  u->sq_head = (unsigned *) ((char *) u->sq_ring + p.sq_off.head);
+  u->sq_tail = (unsigned *) ((char *) u->sq_ring + p.sq_off.tail);
+  u->sq_array = (unsigned *) ((char *) u->sq_ring + p.sq_off.array);
+  u->sq_mask = *(unsigned *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+  u->sq_entries = p.sq_entries;
+  u->sqe_tail = *u->sq_tail;
+  u->cq_head = (unsigned *) ((char *) u->cq_ring + p.cq_off.head);
+  u->cq_tail = (unsigned *) ((char *) u->cq_ring + p.cq_off.tail);
+  u->cq_mask = *(unsigned *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring + p.cq_off.cqes);
+
+  /* An empty table: -1 leaves a slot sparse */
+  files = malloc(num_slots * sizeof(int));
+  for (i = 0; i < num_slots; i++)
+    files[i] = -1;
+  if (sys_io_uring_register(u->fd, IORING_REGISTER_FILES, files, num_slots) < 0
+      || uring_probe(u) != 0)
+    {
+      free(files);
+      uring_free(u);
+      return NULL;
+    }
+  free(files);
+  return u;
+}
+
+void uring_free(uring *u)
+{
+  if (u == NULL)
+    return;
+  if (u->sqes != NULL)
+    munmap(u->sqes, u->sqes_size);
+  if (u->cq_ring != NULL && u->cq_ring != u->sq_ring)
+    munmap(u->cq_ring, u->cq_ring_size);
+  if (u->sq_ring != NULL)
+    munmap(u->sq_ring, u->sq_ring_size);
+  close(u->fd);
+  free(u);
+}
+
+/**
+ * How many more requests can be queued before uring_submit().
+ */
+unsigned uring_space(uring *u)
+{
+  return u->sq_entries
+    - (u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE));
+}
+
+void uring_openat(uring *u, const char *path, int flags, mode_t mode,
+    unsigned slot, int link, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(u, IORING_OP_OPENAT, link, user_data);
+
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t) path;
+  sqe->len = mode;
+  sqe->open_flags = flags;
+  sqe->file_index = slot + 1;
+}
+
+void uring_write(uring *u, unsigned slot, const void *data, size_t len,
+    int link, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(u, IORING_OP_WRITE, link, user_data);
+
+  sqe->fd = slot;
+  sqe->flags |= IOSQE_FIXED_FILE;
+  sqe->addr = (uintptr_t) data;
+  sqe->len = len;
+  sqe->off = 0;
+}
+
+void uring_close(uring *u, unsigned slot, int link, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(u, IORING_OP_CLOSE, link, user_data);
+
+  sqe->file_index = slot + 1;
+}
+
+void uring_renameat(uring *u, const char *from, const char *to, int link,
+    uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(u, IORING_OP_RENAMEAT, link, user_data);
+
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t) from;
+  sqe->len = AT_FDCWD;
+  sqe->off = (uintptr_t) to;
+}
+
+void uring_unlinkat(uring *u, const char *path, int link, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(u, IORING_OP_UNLINKAT, link, user_data);
+
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t) path;
+}
+
+void uring_fsync(uring *u, int fd, int link, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(u, IORING_OP_FSYNC, link, user_data);
+
+  sqe->fd = fd;
+}
+
+/**
+ * Unlink the last request queued from whatever is queued after it.
+ */
+void uring_end_chain(uring *u)
+{
+  struct io_uring_sqe *sqe = &u->sqes[(u->sqe_tail - 1) & u->sq_mask];
+
+  sqe->flags &= ~(IOSQE_IO_LINK | IOSQE_IO_HARDLINK);
+}
+
+/**
+ * Hand everything queued to the kernel, and wait until at least @wait_nr
+ * completions are there to be collected.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int uring_submit(uring *u, unsigned wait_nr)
+{
+  unsigned to_submit;
+  int n;
+
+  __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+  to_submit = u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+  if (to_submit == 0 && wait_nr == 0)
+    return 0;
+
+  do
+    n = sys_io_uring_enter(u->fd, to_submit, wait_nr,
+        wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+  while (n < 0 && errno == EINTR);
+  return n < 0 ? -1 : 0;
+}
+
+/**
+ * Collect one completion, if there is one.
+ *
+ * @return 1 if there was one, 0 if not
+ */
+int uring_next_completion(uring *u, uint64_t *user_data, int *result)
+{
+  unsigned head = *u->cq_head;
+  struct io_uring_cqe *cqe;
+
+  if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    return 0;
+
+  cqe = &u->cqes[head & u->cq_mask];
+  *user_data = cqe->user_data;
+  *result = cqe->res;
+  __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+#else /* !__linux__ */
+
+uring *uring_new(unsigned entries, unsigned num_slots)
+{
+  return NULL;
+}
+
+void uring_free(uring *u)
+{
+}
+
+/* Never called without a ring */
+unsigned uring_space(uring *u) { return 0; }
+void uring_openat(uring *u, const char *path, int flags, mode_t mode,
+    unsigned slot, int link, uint64_t user_data) { }
+void uring_write(uring *u, unsigned slot, const void *data, size_t len,
+    int link, uint64_t user_data) { }
+void uring_close(uring *u, unsigned slot, int link, uint64_t user_data) { }
+void uring_renameat(uring *u, const char *from, const char *to, int link,
+    uint64_t user_data) { }
+void uring_unlinkat(uring *u, const char *path, int link, uint64_t user_data) { }
+void uring_fsync(uring *u, int fd, int link, uint64_t user_data) { }
+void uring_end_chain(uring *u) { }
+int uring_submit(uring *u, unsigned wait_nr) { return -1; }
+int uring_next_completion(uring *u, uint64_t *user_data, int *result) { return 0; }
+
+#endif
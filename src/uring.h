@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef URING_H__
+#define URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Just enough of Linux io_uring for durable.c, on top of the raw system
+ * calls.
+ *
+ * Files are opened into a table of fixed slots, so that an open, a write
+ * and a close can be queued together as one linked chain.  Each queued
+ * request completes with its @user_data and a result, the return value of
+ * the matching system call or -errno.  Callers check uring_space() before
+ * queuing a chain.
+ */
+typedef struct _uring uring;
+
+/* How a request is linked to the one queued after it */
+#define URING_NO_LINK   0
+#define URING_LINK      1   /* the next runs after this one, if it succeeds */
+#define URING_HARDLINK  2   /* the next runs after this one, whatever happens */
+
+extern uring *uring_new(unsigned entries, unsigned num_slots);
+extern void uring_free(uring *u);
+extern unsigned uring_space(uring *u);
+
+extern void uring_openat(uring *u, const char *path, int flags, mode_t mode,
+    unsigned slot, int link, uint64_t user_data);
+extern void uring_write(uring *u, unsigned slot, const void *data, size_t len,
+    int link, uint64_t user_data);
+extern void uring_close(uring *u, unsigned slot, int link, uint64_t user_data);
+extern void uring_renameat(uring *u, const char *from, const char *to,
+    int link, uint64_t user_data);
+extern void uring_unlinkat(uring *u, const char *path, int link,
+    uint64_t user_data);
+extern void uring_fsync(uring *u, int fd, int link, uint64_t user_data);
+extern void uring_end_chain(uring *u);
+
+extern int uring_submit(uring *u, unsigned wait_nr);
+extern int uring_next_completion(uring *u, uint64_t *user_data, int *result);
+
+#endif // URING_H__
@@ -0,0 +1,173 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "git-spot.h"
+#include "writer.h"
+
+typedef struct _writer_job writer_job;
+
+struct _writer_job {
+  writer_job *next;
+  writer_fn work;
+  writer_fn done;
+  void *arg;
+};
+
+/* Jobs waiting for a worker, and jobs waiting for the main thread */
+typedef struct {
+  writer_job *head;
+  writer_job **tail;
+} writer_queue;
+
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static writer_queue writer_todo = { NULL, &writer_todo.head };
+static writer_queue writer_done = { NULL, &writer_done.head };
+static int writer_threads;
+
+static void writer_queue_push(writer_queue *q, writer_job *job)
+{
+  job->next = NULL;
+  *q->tail = job;
+  q->tail = &job->next;
+}
+
+static writer_job *writer_queue_take_all(writer_queue *q)
+{
+  writer_job *jobs = q->head;
+
+  q->head = NULL;
+  q->tail = &q->head;
+  return jobs;
+}
+
+static void *writer_thread(void *unused)
+{
+  writer_job *job;
+
+  for (;;)
+    {
+      pthread_mutex_lock(&writer_mutex);
+      while (writer_todo.head == NULL)
+        pthread_cond_wait(&writer_cond, &writer_mutex);
+      job = writer_todo.head;
+      writer_todo.head = job->next;
+      if (writer_todo.head == NULL)
+        writer_todo.tail = &writer_todo.head;
+      pthread_mutex_unlock(&writer_mutex);
+
+      job->work(job->arg);
+
+      pthread_mutex_lock(&writer_mutex);
+      writer_queue_push(&writer_done, job);
+      pthread_mutex_unlock(&writer_mutex);
+      notify_main_thread(g_session);
+    }
+  return NULL;
+}
+
+/**
+ * Start @num_threads workers, unless some are running already.
+ */
+void writer_start(int num_threads)
+{
+  pthread_t thread;
+  int i;
+
+  for (i = writer_threads; i < num_threads; i++)
+    {
+      if (pthread_create(&thread, NULL, writer_thread, NULL) != 0)
+        {
+          printf("WARNING: could not start a writer thread.\n");
+          break;
+        }
+      pthread_detach(thread);
+      writer_threads ++;
+    }
+}
+
+void writer_submit(writer_fn work, writer_fn done, void *arg)
+{
+  writer_job *job;
+
+  if (writer_threads == 0)
+    {
+      work(arg);
+      done(arg);
+      return;
+    }
+
+  job = malloc(sizeof(writer_job));
+  job->work = work;
+  job->done = done;
+  job->arg = arg;
+  pthread_mutex_lock(&writer_mutex);
+  writer_queue_push(&writer_todo, job);
+  pthread_cond_signal(&writer_cond);
+  pthread_mutex_unlock(&writer_mutex);
+}
+
+/**
+ * Have writer_run_completions() call @done with @arg, without any work
+ * first.  Unlike writer_submit(), this may be called from any thread.
+ */
+void writer_post(writer_fn done, void *arg)
+{
+  writer_job *job = malloc(sizeof(writer_job));
+
+  job->work = NULL;
+  job->done = done;
+  job->arg = arg;
+  pthread_mutex_lock(&writer_mutex);
+  writer_queue_push(&writer_done, job);
+  pthread_mutex_unlock(&writer_mutex);
+  notify_main_thread(g_session);
+}
+
+/**
+ * Run the done functions of the jobs the workers have finished.  Only
+ * call this from the main thread.
+ *
+ * @return how many were run
+ */
+int writer_run_completions(void)
+{
+  writer_job *job, *next;
+  int n = 0;
+
+  pthread_mutex_lock(&writer_mutex);
+  job = writer_queue_take_all(&writer_done);
+  pthread_mutex_unlock(&writer_mutex);
+
+  for (; job != NULL; job = next)
+    {
+      next = job->next;
+      job->done(job->arg);
+      free(job);
+      n ++;
+    }
+  return n;
+}
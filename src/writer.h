@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2006-2010 Spotify Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef WRITER_H__
+#define WRITER_H__
+
+/**
+ * A pool of threads for the parts of a save that do not touch libspotify:
+ * formatting and disk I/O.
+ *
+ * A job's work function runs on a worker thread.  Its done function runs
+ * afterwards on the main thread, from writer_run_completions(), which the
+ * main loop calls whenever it is woken up.  Until writer_start() has been
+ * called with some threads, writer_submit() runs both straight away.
+ */
+typedef void (*writer_fn) (void *arg);
+
+extern void writer_start(int num_threads);
+extern void writer_submit(writer_fn work, writer_fn done, void *arg);
+extern void writer_post(writer_fn done, void *arg);
+extern int writer_run_completions(void);
+
+#endif // WRITER_H__